@@ -0,0 +1,133 @@
+#include "aggregate_cube.hpp"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+static const char kCubeMagic[8] = { 'Q', '1', 'C', 'U', 'B', 'E', '0', '2' };
+
+AggregateCube::Cell
+AggregateCube::Range(int32_t from_day, int32_t to_day, size_t group) const
+{
+	assert(group < NumGroups());
+	const int32_t last_day = first_day + (int32_t)num_days - 1;
+	from_day = std::max(from_day, first_day);
+	to_day = std::min(to_day, last_day);
+
+	Cell c {};
+	if (from_day > to_day) {
+		return c;
+	}
+	c = prefix[(to_day - first_day + 1) * NumGroups() + group];
+	c -= prefix[(from_day - first_day) * NumGroups() + group];
+	return c;
+}
+
+void
+AggregateCube::Range(int32_t from_day, int32_t to_day, AggrHashTable* table) const
+{
+	for (size_t g=0; g<NumGroups(); g++) {
+		const Cell c = Range(from_day, to_day, g);
+		if (!c.count) {
+			continue;
+		}
+		auto& t = table[group_keys[g]];
+		t.sum_quantity += (int64_t)c.sum_quantity;
+		t.sum_base_price += (int64_t)c.sum_base_price;
+		t.sum_disc += (int64_t)c.sum_disc;
+		t.sum_disc_price += c.sum_disc_price;
+		t.sum_charge += c.sum_charge;
+		t.count += (int64_t)c.count;
+	}
+}
+
+void
+AggregateCube::Write(const std::string& filename, uint64_t data_version) const
+{
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (!f) {
+		throw std::runtime_error("Failed opening file " + filename);
+	}
+
+	const uint64_t header[] = { data_version, cardinality, (uint64_t)(int64_t)first_day, num_days, group_keys.size() };
+	bool ok = fwrite(kCubeMagic, sizeof(kCubeMagic), 1, f) == 1;
+	ok &= fwrite(header, sizeof(header), 1, f) == 1;
+	ok &= fwrite(group_keys.data(), sizeof(group_keys[0]), group_keys.size(), f) == group_keys.size();
+	ok &= fwrite(prefix.data(), sizeof(prefix[0]), prefix.size(), f) == prefix.size();
+	ok &= fclose(f) == 0;
+	if (!ok) {
+		throw std::runtime_error("Failed writing the aggregate cube to " + filename);
+	}
+}
+
+bool
+AggregateCube::Read(const std::string& filename, uint64_t data_version, AggregateCube& cube)
+{
+	FILE* f = fopen(filename.c_str(), "rb");
+	if (!f) {
+		return false;
+	}
+
+	bool ok = fseek(f, 0, SEEK_END) == 0;
+	const long file_size = ok ? ftell(f) : -1;
+	ok = ok && file_size >= 0 && fseek(f, 0, SEEK_SET) == 0;
+
+	char magic[sizeof(kCubeMagic)];
+	uint64_t header[5] = {};
+	ok = ok && fread(magic, sizeof(magic), 1, f) == 1 && !memcmp(magic, kCubeMagic, sizeof(magic));
+	ok = ok && fread(header, sizeof(header), 1, f) == 1 && header[0] == data_version;
+
+	/* A truncated or corrupt file mustn't make us allocate whatever its header says */
+	const uint64_t num_days = header[3], num_groups = header[4];
+	ok = ok && num_groups <= MAX_GROUPS && num_days < (uint64_t)file_size / sizeof(Cell) &&
+		(uint64_t)file_size == sizeof(kCubeMagic) + sizeof(header) + num_groups * sizeof(uint32_t) +
+			(num_days + 1) * num_groups * sizeof(Cell);
+	if (ok) {
+		cube.cardinality = header[1];
+		cube.first_day = (int32_t)(int64_t)header[2];
+		cube.num_days = header[3];
+		cube.group_keys.resize(header[4]);
+		cube.prefix.resize((cube.num_days + 1) * cube.NumGroups());
+		ok = fread(cube.group_keys.data(), sizeof(cube.group_keys[0]), cube.group_keys.size(), f) == cube.group_keys.size();
+		ok = ok && fread(cube.prefix.data(), sizeof(cube.prefix[0]), cube.prefix.size(), f) == cube.prefix.size();
+	}
+	fclose(f);
+	return ok;
+}
+
+AggregateCube
+AggregateCube::FromCompact(const lineitem& li, size_t num_threads)
+{
+	auto& d = *ComprData::Get(li, 0);
+	d.DecodeFlags();
+	const size_t cardinality = li.l_extendedprice.cardinality;
+
+	/* Find the ship date range and the groups present */
+	int32_t min_day = std::numeric_limits<int16_t>::max();
+	int32_t max_day = std::numeric_limits<int16_t>::min();
+	std::vector<int32_t> dense_group(MAX_GROUPS + 1, -1);
+	std::vector<uint32_t> group_keys;
+	for (size_t i=0; i<cardinality; i++) {
+		/* NULL ship dates are beyond all days (see ComprData::kNullShipDate), and never qualify */
+		if (!li.l_shipdate.IsValid(i)) {
+			continue;
+		}
+		min_day = std::min<int32_t>(min_day, d.l_shipdate[i]);
+		max_day = std::max<int32_t>(max_day, d.l_shipdate[i]);
+		const uint16_t key = (uint16_t)(d.l_returnflag[i] << 8) | (uint8_t)d.l_linestatus[i];
+		if (dense_group[key] < 0) {
+			dense_group[key] = group_keys.size();
+			group_keys.push_back(key);
+		}
+	}
+
+	return Build(cardinality, group_keys, min_day, max_day, [&] (size_t i) {
+		if (!li.l_shipdate.IsValid(i)) {
+			return Row { 0, kNoGroup, 0, 0, 0, 0 };
+		}
+		const uint16_t key = (uint16_t)(d.l_returnflag[i] << 8) | (uint8_t)d.l_linestatus[i];
+		return Row { d.l_shipdate[i], (uint32_t)dense_group[key],
+			d.l_quantity[i], d.l_extendedprice[i], d.l_discount[i], d.l_tax[i] };
+	}, num_threads);
+}
@@ -0,0 +1,151 @@
+#ifndef H_AGGREGATE_CUBE
+#define H_AGGREGATE_CUBE
+
+#include "common.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Q1's aggregates, per group, for all ship dates up to each day of the ship date
+ * domain. Answers Q1 for any DELTA - and any ship date range, as the difference
+ * of two prefixes - in O(groups), i.e. without scanning. Sums are kept in 128 bits,
+ * hence are exact regardless of the column widths they were built from. */
+struct AggregateCube {
+	struct Cell {
+		int128_t sum_quantity;
+		int128_t sum_base_price;
+		int128_t sum_disc;
+		int128_t sum_disc_price;
+		int128_t sum_charge;
+		int128_t count;
+
+		Cell& operator+=(const Cell& o) {
+			sum_quantity += o.sum_quantity;
+			sum_base_price += o.sum_base_price;
+			sum_disc += o.sum_disc;
+			sum_disc_price += o.sum_disc_price;
+			sum_charge += o.sum_charge;
+			count += o.count;
+			return *this;
+		}
+
+		Cell& operator-=(const Cell& o) {
+			sum_quantity -= o.sum_quantity;
+			sum_base_price -= o.sum_base_price;
+			sum_disc -= o.sum_disc;
+			sum_disc_price -= o.sum_disc_price;
+			sum_charge -= o.sum_charge;
+			count -= o.count;
+			return *this;
+		}
+	};
+
+	/* One tuple, as seen by Build(); group is the dense group index */
+	struct Row {
+		int32_t day;
+		uint32_t group;
+		int64_t quantity;
+		int64_t price;
+		int64_t disc;
+		int64_t tax;
+	};
+
+	size_t cardinality = 0; /* of the table the cube was built from */
+	int32_t first_day = 0; /* in the encoding of the ship date column the cube was built from */
+	size_t num_days = 0;
+	std::vector<uint32_t> group_keys; /* dense group index => the caller's group key */
+
+	/* (num_days + 1) x groups; prefix[d * groups + g] holds the aggregates of days [first_day, first_day + d) */
+	std::vector<Cell> prefix;
+
+	size_t NumGroups() const { return group_keys.size(); }
+
+	/* Aggregates of a group's tuples with from_day <= ship date <= to_day */
+	Cell Range(int32_t from_day, int32_t to_day, size_t group) const;
+
+	/* Adds the aggregates of each group with from_day <= ship date <= to_day to table[group key] */
+	void Range(int32_t from_day, int32_t to_day, AggrHashTable* table) const;
+
+	void UpTo(int32_t day, AggrHashTable* table) const {
+		Range(first_day, day, table);
+	}
+
+	/* Throws on I/O errors. data_version identifies the data the cube was built from -
+	 * e.g. by the table file's size and modification time - so that reading it back
+	 * tells a cube of a regenerated table from a current one. */
+	void Write(const std::string& filename, uint64_t data_version) const;
+
+	/* Returns false if there's no usable cube in the file, including one built from
+	 * another version of the data than data_version */
+	static bool Read(const std::string& filename, uint64_t data_version, AggregateCube& cube);
+
+	/* Cube over a core's compact columns (see ComprData); group keys are AggrHashTable indices */
+	static AggregateCube FromCompact(const lineitem& li, size_t num_threads = 0);
+
+	/* The group of rows which don't count, e.g. those with a NULL ship date */
+	static constexpr uint32_t kNoGroup = std::numeric_limits<uint32_t>::max();
+
+	/* Builds the cube in parallel; get_row(i) must return the Row of tuple i,
+	 * with first_day <= day <= last_day and group < group_keys.size() - or kNoGroup */
+	template<typename GET_ROW>
+	static AggregateCube Build(size_t cardinality, std::vector<uint32_t> group_keys,
+			int32_t first_day, int32_t last_day, GET_ROW&& get_row, size_t num_threads = 0) {
+		AggregateCube cube;
+		cube.cardinality = cardinality;
+		cube.first_day = first_day;
+		cube.num_days = last_day >= first_day ? last_day - first_day + 1 : 0;
+		cube.group_keys = std::move(group_keys);
+
+		const size_t num_groups = cube.NumGroups();
+		const size_t num_cells = cube.num_days * num_groups;
+		const int64_t one = Decimal64::ToValue(1, 0);
+
+		if (!num_threads) {
+			num_threads = CpuTopology::Get().NumUsable();
+		}
+		num_threads = std::max<size_t>(1, std::min(num_threads, cardinality / (64*1024) + 1));
+
+		/* per-thread (day, group) cells, merged afterwards */
+		std::vector<std::vector<Cell>> partial(num_threads);
+		std::vector<std::thread> threads;
+		for (size_t t=0; t<num_threads; t++) {
+			threads.emplace_back([&, t] () {
+				auto& cells = partial[t];
+				cells.assign(num_cells, Cell {});
+				const size_t begin = cardinality * t / num_threads;
+				const size_t end = cardinality * (t+1) / num_threads;
+				for (size_t i=begin; i<end; i++) {
+					const Row r = get_row(i);
+					if (r.group == kNoGroup) {
+						continue;
+					}
+					auto& c = cells[(r.day - first_day) * num_groups + r.group];
+					const int64_t disc_price = (one - r.disc) * r.price;
+					c.sum_quantity += r.quantity;
+					c.sum_base_price += r.price;
+					c.sum_disc += r.disc;
+					c.sum_disc_price += disc_price;
+					c.sum_charge += (int128_t)disc_price * (one + r.tax);
+					c.count++;
+				}
+			});
+		}
+		for (auto& t : threads) {
+			t.join();
+		}
+
+		cube.prefix.assign((cube.num_days + 1) * num_groups, Cell {});
+		for (size_t d=0; d<cube.num_days; d++) {
+			for (size_t g=0; g<num_groups; g++) {
+				Cell c = cube.prefix[d * num_groups + g];
+				for (auto& cells : partial) {
+					c += cells[d * num_groups + g];
+				}
+				cube.prefix[(d+1) * num_groups + g] = c;
+			}
+		}
+		return cube;
+	}
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "arena.hpp"
+#include "topology.hpp"
+
+#include <algorithm>
+#include <new>
+#include <numa.h>
+#include <numaif.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+static constexpr size_t kCacheLine = 64;
+static constexpr size_t kPage = 4*1024;
+
+bool Arena::huge_pages = false;
+
+Arena::Arena()
+ : node(CpuTopology::NumaNodeOf(std::max(0, sched_getcpu()))), huge(huge_pages)
+{
+}
+
+Arena::Arena(int node)
+ : node(node), huge(huge_pages)
+{
+}
+
+Arena::~Arena()
+{
+	for (auto& r : regions) {
+		munmap(r.base, r.size);
+	}
+}
+
+/* Preferred rather than bound: a full node shouldn't fail the kernel */
+static void
+bind(char* p, size_t size, int node)
+{
+	static const bool have_numa = numa_available() != -1;
+	if (!have_numa || size == 0) {
+		return;
+	}
+	if (node == Arena::kInterleave) {
+		mbind(p, size, MPOL_INTERLEAVE, numa_all_nodes_ptr->maskp, numa_all_nodes_ptr->size + 1, 0);
+		return;
+	}
+	unsigned long nodemask[16] = {};
+	if (node >= 0 && (size_t)node < sizeof(nodemask) * 8) {
+		nodemask[node / (8 * sizeof(nodemask[0]))] |= 1ul << (node % (8 * sizeof(nodemask[0])));
+		mbind(p, size, MPOL_PREFERRED, nodemask, sizeof(nodemask) * 8, 0);
+	}
+}
+
+/* A region of at least size bytes, on our node - and, for huge pages, aligned to them */
+char*
+Arena::Map(size_t size)
+{
+	const size_t align = huge ? kChunkSize : kPage;
+	size = (size + align - 1) / align * align;
+
+	const size_t mapped = size + align - kPage;
+	char* base = (char*)mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		throw std::bad_alloc();
+	}
+	/* trim the excess mapped for alignment */
+	char* aligned = (char*)(((uintptr_t)base + align - 1) / align * align);
+	if (aligned > base) {
+		munmap(base, aligned - base);
+	}
+	if (base + mapped > aligned + size) {
+		munmap(aligned + size, base + mapped - (aligned + size));
+	}
+
+	if (huge) {
+		madvise(aligned, size, MADV_HUGEPAGE);
+	}
+	bind(aligned, size, node);
+
+	regions.push_back(Region { aligned, size });
+	reserved += size;
+	return aligned;
+}
+
+void*
+Arena::Allocate(size_t bytes)
+{
+	bytes = (std::max<size_t>(bytes, 1) + kCacheLine - 1) / kCacheLine * kCacheLine;
+	if (bytes > kMaxPacked) {
+		return Map(bytes);
+	}
+
+	if (bytes > (size_t)(end - next)) {
+		next = Map(kChunkSize);
+		end = next + kChunkSize;
+	}
+	char* r = next;
+	next += bytes;
+	/* Arrays of whole pages, e.g. most vectors, start a cache line apart modulo the page
+	 * size, so that the same positions in them don't contend for the same L1 set */
+	if (bytes % kPage == 0 && next < end) {
+		next += kCacheLine;
+	}
+	return r;
+}
+
+void
+Arena::Prefer(void* p, size_t bytes, int node)
+{
+	char* begin = (char*)(((uintptr_t)p + kPage - 1) / kPage * kPage);
+	char* end = (char*)(((uintptr_t)p + bytes + kPage - 1) / kPage * kPage);
+	if (end > begin) {
+		bind(begin, end - begin, node);
+	}
+}
+
+void*
+CacheLineAligned::operator new(size_t bytes)
+{
+	void* p;
+	if (posix_memalign(&p, kCacheLine, bytes) != 0) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void
+CacheLineAligned::operator delete(void* p) noexcept
+{
+	free(p);
+}
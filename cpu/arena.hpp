@@ -0,0 +1,74 @@
+#ifndef H_arena
+#define H_arena
+
+#include <stddef.h>
+#include <vector>
+
+/* The memory of one kernel's arrays - its vectors, group tables and buffers - carved out
+ * of a few regions mapped for it, and unmapped with it. The regions are bound to the
+ * NUMA node of the thread creating the arena, e.g. the worker whose state the kernel is,
+ * and, optionally, backed by transparent huge pages. Small arrays are packed one after
+ * the other, cache line aligned, in chunks shared with the kernel's other small arrays;
+ * large ones get regions of their own. Memory is never reused before the arena goes,
+ * so all of it comes zeroed, from the OS, and is only committed when first touched. */
+struct Arena {
+	/* Of the chunks small arrays are packed into: one huge page */
+	static constexpr size_t kChunkSize = 2*1024*1024;
+
+	/* Arrays larger than this get a region of their own */
+	static constexpr size_t kMaxPacked = kChunkSize / 4;
+
+	/* For the node argument: spread the pages round-robin over all nodes, like
+	 * numa_alloc_interleaved() */
+	static constexpr int kInterleave = -1;
+
+	Arena();
+	explicit Arena(int node); /* on another node than the calling thread's, or kInterleave */
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	/* bytes of zeroes, 64-byte aligned */
+	void* Allocate(size_t bytes);
+
+	/* Bytes mapped, whether or not touched yet */
+	size_t Reserved() const { return reserved; }
+
+	int numa_node() const { return node; }
+
+	/* Has the pages starting in [p, p+bytes), if not yet touched, come from node, e.g.
+	 * to give each node its slice of a column. Adjacent ranges get adjacent pages. */
+	static void Prefer(void* p, size_t bytes, int node);
+
+	/* Whether arenas created from now on ask for transparent huge pages; false by default */
+	static bool huge_pages;
+
+private:
+	struct Region {
+		void* base;
+		size_t size;
+	};
+	std::vector<Region> regions;
+	size_t reserved = 0;
+
+	/* of the current chunk */
+	char* next = nullptr;
+	char* end = nullptr;
+
+	const int node;
+	const bool huge;
+
+	char* Map(size_t size);
+};
+
+/* Base of the types with members on cache lines of their own - alignas(64) - which
+ * C++14's new doesn't align beyond 16 bytes: allocates them, and whatever derives from
+ * them, cache line aligned. Those held by value in others need the outer type to derive
+ * from it as well. */
+struct CacheLineAligned {
+	static void* operator new(size_t bytes);
+	static void operator delete(void* p) noexcept;
+};
+
+#endif
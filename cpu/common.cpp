@@ -1,10 +1,11 @@
 #include "common.hpp"
 #include <cassert>
+#include "../src/util/bit_sliced_column.hpp"
 
 static const monetdb::date_t threshold_ship_date = monetdb::date_t::from_raw_days(729999); // September 2nd, 1998
 
-#define clear(x) memset(x, 0, sizeof(x[0]) * MAX_GROUPS)
-#define clear_avx(x) memset(x, 0, sizeof(x[0]) * AVX_GROUPS)
+#define clear(x) memset(x + groups.begin, 0, sizeof(x[0]) * groups.Size())
+#define clear_avx(x) memset(x + groups.begin * 8, 0, sizeof(x[0]) * groups.Size() * 8)
 
 extern "C" __attribute__((noinline)) void
 handle_overflow()
@@ -58,91 +59,401 @@ BaseKernel::Profile(size_t total_tuples)
 
 }
 
-BaseKernel::BaseKernel(const lineitem& li)
+GroupDomain
+GroupDomain::Of(const lineitem& li)
+{
+	const auto& rf = li.l_returnflag.minmax;
+	const auto& ls = li.l_linestatus.minmax;
+	GroupDomain domain;
+	if (rf.min <= rf.max && ls.min <= ls.max && rf.min >= 0 && ls.min >= 0) {
+		domain.begin = rf.min << 8 | ls.min;
+		domain.end = (rf.max << 8 | ls.max) + 1;
+	}
+	return domain;
+}
+
+BaseKernel::BaseKernel(const lineitem& li, const GroupDomain& groups)
  : cmp(threshold_ship_date),
-	li(li), sum_aggr_time(0), sum_magic_time(0)
+	li(li), sum_aggr_time(0), sum_magic_time(0), groups(groups)
 {
-	aggrs0 = new_array<AggrHashTable>(MAX_GROUPS);
+	aggrs0 = new_group_array<AggrHashTable>();
+
+	aggr_dsm0_sum_quantity = new_group_array<int64_t>();
+	aggr_dsm0_count = new_group_array<int64_t>();
+	aggr_dsm0_sum_base_price = new_group_array<int64_t>();
+	aggr_dsm0_sum_disc_price = new_group_array<int128_t>();
+	aggr_dsm0_sum_charge = new_group_array<int128_t>();
+	aggr_dsm0_sum_disc = new_group_array<int64_t>();
+
+	aggr_avx0_count = new_group_array<int64_t>(8);
+	aggr_avx0_sum_quantity = new_group_array<int64_t>(8);
+	aggr_avx0_sum_base_price = new_group_array<int64_t>(8);
+	aggr_avx0_sum_disc_price_lo = new_group_array<int64_t>(8);
+	aggr_avx0_sum_disc_price_hi = new_group_array<int64_t>(8);
+	aggr_avx0_sum_charge_lo = new_group_array<int64_t>(8);
+	aggr_avx0_sum_charge_hi = new_group_array<int64_t>(8);
+	aggr_avx0_sum_disc = new_group_array<int64_t>(8);
+
+	touched_groups = new_array<uint16_t>(groups.Size());
+	touched_generation = new_group_array<uint32_t>();
+}
 
-	aggr_dsm0_sum_quantity = new_array<int64_t>(MAX_GROUPS);
-	aggr_dsm0_count = new_array<int64_t>(MAX_GROUPS);
-	aggr_dsm0_sum_base_price = new_array<int64_t>(MAX_GROUPS);
-	aggr_dsm0_sum_disc_price = new_array<int128_t>(MAX_GROUPS);
-	aggr_dsm0_sum_charge = new_array<int128_t>(MAX_GROUPS);
-	aggr_dsm0_sum_disc = new_array<int64_t>(MAX_GROUPS);
+void
+BaseKernel::Clear()
+{
+	ClearGroups();
+}
 
-	aggr_avx0_count = new_array<int64_t>(AVX_GROUPS);
-	aggr_avx0_sum_quantity = new_array<int64_t>(AVX_GROUPS);
-	aggr_avx0_sum_base_price = new_array<int64_t>(AVX_GROUPS);
-	aggr_avx0_sum_disc_price_lo = new_array<int64_t>(AVX_GROUPS);
-	aggr_avx0_sum_disc_price_hi = new_array<int64_t>(AVX_GROUPS);
-	aggr_avx0_sum_charge_lo = new_array<int64_t>(AVX_GROUPS);
-	aggr_avx0_sum_charge_hi = new_array<int64_t>(AVX_GROUPS);
-	aggr_avx0_sum_disc = new_array<int64_t>(AVX_GROUPS);
+void
+BaseKernel::AddGroups(const BaseKernel& other)
+{
+	auto add = [&] (size_t g) {
+		const AggrHashTable& a = other.aggrs0[g];
+		if (a.count == 0) {
+			return;
+		}
+		assert(groups.Contains(g));
+		AggrHashTable& r = aggrs0[g];
+		r.sum_quantity += a.sum_quantity;
+		r.count += a.count;
+		r.sum_base_price += a.sum_base_price;
+		r.sum_disc += a.sum_disc;
+		r.sum_disc_price += a.sum_disc_price;
+		r.sum_charge += a.sum_charge;
+		Touch(g);
+	};
+
+	if (other.tracks_groups) {
+		for (size_t i=0; i<other.num_touched_groups; i++) {
+			add(other.touched_groups[i]);
+		}
+	} else {
+		for (size_t g=other.groups.begin; g<other.groups.end; g++) {
+			add(g);
+		}
+	}
 }
 
 void
-BaseKernel::Clear()
+BaseKernel::ClearGroups()
 {
-	clear(aggrs0);
+	if (!tracks_groups) {
+		clear(aggrs0);
+
+		clear(aggr_dsm0_sum_quantity);
+		clear(aggr_dsm0_count);
+		clear(aggr_dsm0_sum_base_price);
+		clear(aggr_dsm0_sum_disc_price);
+		clear(aggr_dsm0_sum_charge);
+		clear(aggr_dsm0_sum_disc);
+
+		clear_avx(aggr_avx0_count);
+		clear_avx(aggr_avx0_sum_quantity);
+		clear_avx(aggr_avx0_sum_base_price);
+		clear_avx(aggr_avx0_sum_disc_price_lo);
+		clear_avx(aggr_avx0_sum_charge_lo);
+		clear_avx(aggr_avx0_sum_disc_price_hi);
+		clear_avx(aggr_avx0_sum_charge_hi);
+		clear_avx(aggr_avx0_sum_disc);
+	}
+
+	for (size_t i=0; i<num_touched_groups; i++) {
+		const size_t g = touched_groups[i];
+		aggrs0[g] = AggrHashTable();
+
+		aggr_dsm0_sum_quantity[g] = 0;
+		aggr_dsm0_count[g] = 0;
+		aggr_dsm0_sum_base_price[g] = 0;
+		aggr_dsm0_sum_disc_price[g] = 0;
+		aggr_dsm0_sum_charge[g] = 0;
+		aggr_dsm0_sum_disc[g] = 0;
+
+		for (size_t k=g*8; k<(g+1)*8; k++) {
+			aggr_avx0_count[k] = 0;
+			aggr_avx0_sum_quantity[k] = 0;
+			aggr_avx0_sum_base_price[k] = 0;
+			aggr_avx0_sum_disc_price_lo[k] = 0;
+			aggr_avx0_sum_charge_lo[k] = 0;
+			aggr_avx0_sum_disc_price_hi[k] = 0;
+			aggr_avx0_sum_charge_hi[k] = 0;
+			aggr_avx0_sum_disc[k] = 0;
+		}
+	}
+	num_touched_groups = 0;
 
-	clear(aggr_dsm0_sum_quantity);
-	clear(aggr_dsm0_count);
-	clear(aggr_dsm0_sum_base_price);
-	clear(aggr_dsm0_sum_disc_price);
-	clear(aggr_dsm0_sum_charge);
-	clear(aggr_dsm0_sum_disc);
+	/* The stamps only need resetting when the generations wrap around */
+	if (!++generation) {
+		clear(touched_generation);
+		generation = 1;
+	}
+}
 
-	clear_avx(aggr_avx0_count);
-	clear_avx(aggr_avx0_sum_quantity);
-	clear_avx(aggr_avx0_sum_base_price);
-	clear_avx(aggr_avx0_sum_disc_price_lo);
-	clear_avx(aggr_avx0_sum_charge_lo);
-	clear_avx(aggr_avx0_sum_disc_price_hi);
-	clear_avx(aggr_avx0_sum_charge_hi);
-	clear_avx(aggr_avx0_sum_disc);
+monetdb::date_t
+BaseKernel::ThresholdForDelta(int delta)
+{
+	monetdb::date_t threshold(1998, 12, 1);
+	threshold.add_days(-delta);
+	return threshold;
 }
 
-IKernel::~IKernel()
+int16_t
+BaseKernel::CompactThreshold() const
 {
-	if (m_clean && false) {
-		for (auto p : m_alloced) {
-			free(p);
-		}	
-	}
+#ifdef GPU
+	return (int32_t)cmp.dte_val - (int32_t)727563;
+#else
+	return cmp.dte_val;
+#endif
 }
 
-ComprData::ComprData(const lineitem& li) : BaseKernel(li)
+ComprData::ComprData(const lineitem& li, int arena_node) : BaseKernel(li), data(arena_node)
 {
 	size_t cardinality = li.l_extendedprice.cardinality;
-    l_shipdate = new_array<int16_t>(cardinality); 
-    l_returnflag = new_array<int8_t>(cardinality);
-    l_linestatus = new_array<int8_t>(cardinality);
-    l_discount = new_array<int8_t>(cardinality);
-    l_tax = new_array<int8_t>(cardinality);
-    l_extendedprice = new_array<int32_t>(cardinality);
-    l_quantity = new_array<int16_t>(cardinality);
-    for (size_t i=0; i<cardinality; i++) {
+#define alloc_compact_column(col) \
+	l_##col = (decltype(l_##col))data.Allocate(cardinality * sizeof(l_##col[0]));
+
+	alloc_compact_column(shipdate);
+	alloc_compact_column(discount);
+	alloc_compact_column(tax);
+	alloc_compact_column(extendedprice);
+	alloc_compact_column(quantity);
+#undef alloc_compact_column
+
+	/* only if the data doesn't fit their prediction (see Build()), or once decoded */
+	l_returnflag = nullptr;
+	l_linestatus = nullptr;
+
+	const size_t num_zones = (cardinality + kZoneRows - 1) / kZoneRows;
+#define alloc_zones(col) \
+	l_##col##_zones = (decltype(l_##col##_zones))data.Allocate(num_zones * sizeof(l_##col##_zones[0]));
+
+	alloc_zones(discount);
+	alloc_zones(tax);
+	alloc_zones(extendedprice);
+	alloc_zones(quantity);
+#undef alloc_zones
+
+    auto copy_validity = [&] (const auto& column) -> uint32_t* {
+        if (!column.Validity()) {
+            return nullptr;
+        }
+        auto validity = new_array<uint32_t>(column.validity.size());
+        memcpy(validity, column.Validity(), column.validity.size() * sizeof(uint32_t));
+        return validity;
+    };
+    l_shipdate_validity = copy_validity(li.l_shipdate);
+    l_extendedprice_validity = copy_validity(li.l_extendedprice);
+}
+
+/* Rows [first, end), by the thread which is to own their pages - the first to touch them */
+void
+ComprData::Convert(const lineitem& li, size_t first, size_t end)
+{
+    for (size_t i=first; i<end; i++) {
 #ifndef GPU
         kernel_compact_init_magic(shipdate);
 #else
         l_shipdate[i] = li.l_shipdate.get()[i] - 727563;
         assert(l_shipdate[i] == li.l_shipdate.get()[i] - 727563);
 #endif
-        l_returnflag[i] = li.l_returnflag.get()[i]; /* Too lazy for this column */
-        l_linestatus[i] = li.l_linestatus.get()[i]; /* Too lazy for this column */
         kernel_compact_init_magic(discount);
         kernel_compact_init_magic(tax);
         kernel_compact_init_magic(extendedprice);
         kernel_compact_init_magic(quantity);
     }
+
+    if (l_shipdate_validity) {
+        for (size_t i=first; i<end; i++) {
+            if (!li.l_shipdate.IsValid(i)) {
+                l_shipdate[i] = kNullShipDate;
+            }
+        }
+    }
+
+    /* The builders' shares start at zone boundaries, hence each zone has one builder */
+    assert(first % kZoneRows == 0);
+    for (size_t zone = first / kZoneRows; zone * kZoneRows < end; zone++) {
+        const size_t from = zone * kZoneRows;
+        const size_t to = std::min(end, from + kZoneRows);
+#define zone_bounds(col) do { \
+            auto& z = l_##col##_zones[zone]; \
+            z.min = z.max = l_##col[from]; \
+            for (size_t i=from+1; i<to; i++) { \
+                z.min = std::min(z.min, l_##col[i]); \
+                z.max = std::max(z.max, l_##col[i]); \
+            } \
+        } while (false)
+
+        zone_bounds(discount);
+        zone_bounds(tax);
+        zone_bounds(extendedprice);
+        zone_bounds(quantity);
+#undef zone_bounds
+    }
+}
+
+/* The flag columns as they are, for data which doesn't fit the prediction; like Convert() */
+void
+ComprData::ConvertFlags(const lineitem& li, size_t first, size_t end)
+{
+    for (size_t i=first; i<end; i++) {
+        l_returnflag[i] = li.l_returnflag.get()[i];
+        l_linestatus[i] = li.l_linestatus.get()[i];
+    }
+}
+
+/* The flags as predicted from the converted ship dates, if the data fits */
+void
+ComprData::DeriveFlags(const lineitem& li)
+{
+	const size_t cardinality = li.l_extendedprice.cardinality;
+	const char* returnflag = li.l_returnflag.get();
+	const char* linestatus = li.l_linestatus.get();
+
+	flags_predicted = cardinality > 0 && cardinality <= std::numeric_limits<uint32_t>::max();
+	if (!flags_predicted) {
+		return;
+	}
+
+	/* CURRENTDATE is the last ship date of a final item */
+	last_final_day = std::numeric_limits<int16_t>::min();
+	for (size_t i=0; i<cardinality; i++) {
+		if (linestatus[i] == 'F' && li.l_shipdate.IsValid(i)) {
+			last_final_day = std::max(last_final_day, l_shipdate[i]);
+		}
+	}
+
+	const size_t max_exceptions = cardinality / kMaxFlagExceptionsFraction;
+	std::vector<uint64_t> returned((cardinality + 63) / 64, 0);
+	std::vector<FlagException> exceptions;
+	for (size_t i=0; i<cardinality && flags_predicted; i++) {
+		const int8_t rf = returnflag[i];
+		const int8_t ls = linestatus[i];
+		bool predicted;
+		if (l_shipdate[i] <= last_final_day) {
+			predicted = ls == 'F' && (rf == 'A' || rf == 'R');
+			returned[i / 64] |= (uint64_t)(predicted && rf == 'R') << (i % 64);
+		} else {
+			predicted = ls == 'O' && rf == 'N';
+		}
+		if (!predicted) {
+			exceptions.push_back(FlagException { (uint32_t)i, rf, ls });
+			flags_predicted = exceptions.size() <= max_exceptions;
+		}
+	}
+	if (!flags_predicted) {
+		return;
+	}
+
+	l_returned = (uint64_t*)data.Allocate(returned.size() * sizeof(uint64_t));
+	memcpy(l_returned, returned.data(), returned.size() * sizeof(uint64_t));
+	num_flag_exceptions = exceptions.size();
+	flag_exceptions = (FlagException*)data.Allocate(std::max<size_t>(1, num_flag_exceptions) * sizeof(FlagException));
+	std::copy(exceptions.begin(), exceptions.end(), flag_exceptions);
+}
+
+/* Another replica's prediction, into our arena */
+void
+ComprData::CopyFlagsFrom(const ComprData& other)
+{
+	flags_predicted = other.flags_predicted;
+	if (!flags_predicted) {
+		return;
+	}
+	const size_t returned_bytes = (li.l_extendedprice.cardinality + 63) / 64 * sizeof(uint64_t);
+	const size_t exceptions_bytes = std::max<size_t>(1, other.num_flag_exceptions) * sizeof(FlagException);
+	last_final_day = other.last_final_day;
+	l_returned = (uint64_t*)data.Allocate(returned_bytes);
+	memcpy(l_returned, other.l_returned, returned_bytes);
+	num_flag_exceptions = other.num_flag_exceptions;
+	flag_exceptions = (FlagException*)data.Allocate(exceptions_bytes);
+	memcpy(flag_exceptions, other.flag_exceptions, exceptions_bytes);
+}
+
+/* The flag columns, with kPartition each node's slice on its node */
+void
+ComprData::AllocateFlags()
+{
+	const size_t cardinality = li.l_extendedprice.cardinality;
+	l_returnflag = (int8_t*)data.Allocate(cardinality * sizeof(l_returnflag[0]));
+	l_linestatus = (int8_t*)data.Allocate(cardinality * sizeof(l_linestatus[0]));
+	if (layout == kPartition) {
+		for (size_t n=0; n+1<slice_begin.size(); n++) {
+			const size_t first = slice_begin[n], num = slice_begin[n+1] - first;
+			if (num) {
+				Arena::Prefer(l_returnflag + first, num * sizeof(l_returnflag[0]), n);
+				Arena::Prefer(l_linestatus + first, num * sizeof(l_linestatus[0]), n);
+			}
+		}
+	}
+}
+
+void
+ComprData::DecodeFlags()
+{
+	std::call_once(flags_decoded, [this] () {
+		if (!flags_predicted) {
+			return; /* stored */
+		}
+		AllocateFlags();
+		const size_t cardinality = li.l_extendedprice.cardinality;
+		for (size_t i=0; i<cardinality; i++) {
+			const bool final = l_shipdate[i] <= last_final_day;
+			const bool returned = (l_returned[i / 64] >> (i % 64)) & 1;
+			l_returnflag[i] = final ? (returned ? 'R' : 'A') : 'N';
+			l_linestatus[i] = final ? 'F' : 'O';
+		}
+		for (size_t e=0; e<num_flag_exceptions; e++) {
+			l_returnflag[flag_exceptions[e].row] = flag_exceptions[e].returnflag;
+			l_linestatus[flag_exceptions[e].row] = flag_exceptions[e].linestatus;
+		}
+	});
+}
+
+void
+ComprData::Slice(size_t numa_node, size_t& first, size_t& end) const
+{
+	if (layout == kPartition) {
+		first = slice_begin[numa_node];
+		end = slice_begin[numa_node + 1];
+	} else {
+		first = 0;
+		end = li.l_extendedprice.cardinality;
+	}
 }
 
 #include <numa.h>
 #include <mutex>
+#include <thread>
+#include <chrono>
 
 std::mutex numa_data_mutex;
 ComprData** numa_data;
+static std::string numa_data_description = "not built yet";
+
+DataPlacement ComprData::placement = kReplicate;
+
+static const char* const data_placement_names[kNumDataPlacements] = {
+	"replicate", "interleave", "partition"
+};
+
+const char*
+ComprData::placement_name(DataPlacement placement)
+{
+	return data_placement_names[placement];
+}
+
+bool
+ComprData::placement_by_name(const std::string& name, DataPlacement& placement)
+{
+	for (int i=0; i<kNumDataPlacements; i++) {
+		if (name == data_placement_names[i]) {
+			placement = (DataPlacement)i;
+			return true;
+		}
+	}
+	return false;
+}
 
 size_t
 ComprData::GetNumaNodes()
@@ -152,27 +463,371 @@ ComprData::GetNumaNodes()
 	return numa_num_configured_nodes();
 }
 
+/* Under numa_data_mutex */
+void
+ComprData::Build(const lineitem& li)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const size_t numa_nodes = GetNumaNodes();
+	const size_t cardinality = li.l_extendedprice.cardinality;
+
+	/* One builder per core the workers would get; nodes without any get no copy or
+	 * slice, as none of the workers would scan it */
+	const auto builders = Placement::Make(kPinCores);
+	std::vector<std::vector<size_t>> node_builders(numa_nodes);
+	std::vector<size_t> nodes;
+	for (size_t b=0; b<builders.cpus.size(); b++) {
+		node_builders[GetNumaNode(builders.cpus[b])].push_back(b);
+	}
+	for (size_t n=0; n<numa_nodes; n++) {
+		if (!node_builders[n].empty()) {
+			nodes.push_back(n);
+		}
+	}
+	assert(!nodes.empty());
+
+	numa_data = new ComprData*[numa_nodes]();
+	switch (placement) {
+	case kReplicate:
+		for (size_t n : nodes) {
+			numa_data[n] = new ComprData(li, n);
+		}
+		break;
+	case kInterleave:
+		numa_data[nodes.front()] = new ComprData(li, Arena::kInterleave);
+		break;
+	case kPartition: {
+		auto d = new ComprData(li, nodes.front());
+		const size_t chunks = (cardinality + kSliceRows - 1) / kSliceRows;
+		d->slice_begin.resize(numa_nodes + 1);
+		size_t rank = 0;
+		for (size_t n=0; n<numa_nodes; n++) {
+			d->slice_begin[n] = std::min(cardinality, kSliceRows * (chunks * rank / nodes.size()));
+			rank += !node_builders[n].empty();
+		}
+		d->slice_begin[numa_nodes] = cardinality;
+		for (size_t n : nodes) {
+			const size_t first = d->slice_begin[n], num = d->slice_begin[n+1] - first;
+#define prefer_compact_column(col) \
+			Arena::Prefer(d->l_##col + first, num * sizeof(d->l_##col[0]), n);
+
+			prefer_compact_column(shipdate);
+			prefer_compact_column(discount);
+			prefer_compact_column(tax);
+			prefer_compact_column(extendedprice);
+			prefer_compact_column(quantity);
+#undef prefer_compact_column
+		}
+		numa_data[nodes.front()] = d;
+		break;
+	}
+	default:
+		assert(false);
+	}
+	for (size_t n : nodes) {
+		numa_data[n]->layout = placement;
+	}
+	for (size_t n=0; n<numa_nodes; n++) {
+		if (!numa_data[n]) {
+			numa_data[n] = numa_data[nodes.front()];
+		}
+	}
+
+	/* Each node's builders convert equal shares of its copy, or slice - or, interleaved,
+	 * all builders of the one copy - touching, hence placing, their pages first */
+	using Step = void (ComprData::*)(const lineitem&, size_t, size_t);
+	auto convert_all = [&] (Step step) {
+		std::vector<std::thread> threads;
+		auto convert = [&] (ComprData* d, const std::vector<size_t>& team, size_t first, size_t end) {
+			const size_t chunks = (end - first + kSliceRows - 1) / kSliceRows;
+			for (size_t k=0; k<team.size(); k++) {
+				const size_t b = team[k];
+				const size_t from = std::min(end, first + kSliceRows * (chunks * k / team.size()));
+				const size_t to = std::min(end, first + kSliceRows * (chunks * (k+1) / team.size()));
+				threads.emplace_back([&builders, &li, d, b, from, to, step] {
+					builders.Pin(b);
+					(d->*step)(li, from, to);
+				});
+			}
+		};
+		if (placement == kInterleave) {
+			std::vector<size_t> all(builders.cpus.size());
+			for (size_t b=0; b<all.size(); b++) {
+				all[b] = b;
+			}
+			convert(numa_data[nodes.front()], all, 0, cardinality);
+		} else {
+			for (size_t n : nodes) {
+				size_t first, end;
+				numa_data[n]->Slice(n, first, end);
+				convert(numa_data[n], node_builders[n], first, end);
+			}
+		}
+		for (auto& t : threads) {
+			t.join();
+		}
+	};
+	convert_all(&ComprData::Convert);
+
+	/* The flags are predicted from the ship dates of one copy, and the prediction given
+	 * to the others; only if the data doesn't fit are they stored after all */
+	ComprData* first_copy = numa_data[nodes.front()];
+	first_copy->DeriveFlags(li);
+	for (size_t n : nodes) {
+		if (numa_data[n] != first_copy) {
+			numa_data[n]->CopyFlagsFrom(*first_copy);
+		}
+	}
+	if (!first_copy->flags_predicted) {
+		for (size_t n : nodes) {
+			if (placement == kReplicate || n == nodes.front()) {
+				numa_data[n]->AllocateFlags();
+			}
+		}
+		convert_all(&ComprData::ConvertFlags);
+	}
+
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	size_t bytes = 0;
+	for (size_t n : nodes) {
+		if (placement == kReplicate || n == nodes.front()) {
+			bytes += numa_data[n]->data.Reserved();
+		}
+	}
+	const size_t copies = placement == kReplicate ? nodes.size() : 1;
+	char buf[256];
+	char flags[64] = "flags stored";
+	if (first_copy->flags_predicted) {
+		snprintf(flags, sizeof(flags), "flags predicted, %.2f%% exceptions",
+			100.0 * first_copy->num_flag_exceptions / cardinality);
+	}
+	snprintf(buf, sizeof(buf), "%s: %zu cop%s, %s %zu of %zu nodes, %.1f MB, %s, built in %.1f ms by %zu thread%s",
+		placement_name(placement), copies, copies == 1 ? "y" : "ies",
+		placement == kReplicate ? "on" : placement == kInterleave ? "interleaved over" : "sliced over",
+		placement == kInterleave ? numa_nodes : nodes.size(), numa_nodes,
+		bytes / (1024.0 * 1024.0), flags, ms, builders.cpus.size(), builders.cpus.size() == 1 ? "" : "s");
+	numa_data_description = buf;
+}
+
 ComprData*
 ComprData::Get(const lineitem& li, size_t numa_node)
 {
-	size_t numa_nodes = GetNumaNodes();
+	assert(numa_node < GetNumaNodes());
 
-	assert(numa_node < numa_nodes);
+	std::unique_lock<std::mutex> lock(numa_data_mutex);
+
+	if (!numa_data) {
+		Build(li);
+	}
+
+	return numa_data[numa_node];
+}
+
+std::string
+ComprData::Describe()
+{
+	std::unique_lock<std::mutex> lock(numa_data_mutex);
+
+	return numa_data_description;
+}
+
+ComprData::ComprData(const lineitem& li, const shared_column_store& store) : BaseKernel(li)
+{
+	size_t cardinality = li.l_extendedprice.cardinality;
+#define attach_compact_column(col) \
+	l_##col = (decltype(l_##col))store.find("compact_l_" #col, cardinality * sizeof(l_##col[0])); \
+	assert(l_##col);
+
+	attach_compact_column(shipdate);
+	attach_compact_column(discount);
+	attach_compact_column(tax);
+	attach_compact_column(extendedprice);
+	attach_compact_column(quantity);
+
+	/* The flags as predicted, as Build() left them; or stored */
+	auto last_final = (const int16_t*)store.find("compact_l_last_final_day", sizeof(last_final_day));
+	flags_predicted = last_final != nullptr;
+	if (flags_predicted) {
+		last_final_day = *last_final;
+		l_returned = (uint64_t*)store.find("compact_l_returned", (cardinality + 63) / 64 * sizeof(uint64_t));
+		num_flag_exceptions = store.size_of("compact_l_flag_exceptions") / sizeof(FlagException);
+		flag_exceptions = (FlagException*)store.find("compact_l_flag_exceptions", num_flag_exceptions * sizeof(FlagException));
+		assert(l_returned && flag_exceptions);
+		l_returnflag = nullptr;
+		l_linestatus = nullptr;
+	} else {
+		attach_compact_column(returnflag);
+		attach_compact_column(linestatus);
+	}
+#undef attach_compact_column
+
+	/* Only published for columns with NULLs */
+	l_shipdate_validity = (uint32_t*)store.find("compact_l_shipdate_validity", li.l_shipdate.validity.size() * sizeof(uint32_t));
+	l_extendedprice_validity = (uint32_t*)store.find("compact_l_extendedprice_validity", li.l_extendedprice.validity.size() * sizeof(uint32_t));
+
+	/* Absent from stores published before there were zones; ArithFor() checks then */
+	const size_t num_zones = (cardinality + kZoneRows - 1) / kZoneRows;
+#define attach_zones(col) \
+	l_##col##_zones = (decltype(l_##col##_zones))store.find("compact_l_" #col "_zones", num_zones * sizeof(l_##col##_zones[0]));
+
+	attach_zones(discount);
+	attach_zones(tax);
+	attach_zones(extendedprice);
+	attach_zones(quantity);
+#undef attach_zones
+}
+
+void
+ComprData::AddSharedColumns(const lineitem& li, std::vector<shared_column_store::column>& columns)
+{
+	size_t cardinality = li.l_extendedprice.cardinality;
+	auto& d = *Get(li, 0);
+#define add_shared_column(col) \
+	columns.push_back({ "l_" #col, li.l_##col.get(), cardinality * sizeof(li.l_##col.get()[0]) }); \
+	columns.push_back({ "l_" #col "_minmax", &li.l_##col.minmax, sizeof(li.l_##col.minmax) }); \
+	columns.push_back({ "compact_l_" #col, d.l_##col, cardinality * sizeof(d.l_##col[0]) });
+#define add_shared_flag_column(col) \
+	columns.push_back({ "l_" #col, li.l_##col.get(), cardinality * sizeof(li.l_##col.get()[0]) }); \
+	columns.push_back({ "l_" #col "_minmax", &li.l_##col.minmax, sizeof(li.l_##col.minmax) });
+
+	add_shared_column(shipdate);
+	add_shared_flag_column(returnflag);
+	add_shared_flag_column(linestatus);
+	add_shared_column(discount);
+	add_shared_column(tax);
+	add_shared_column(extendedprice);
+	add_shared_column(quantity);
+#undef add_shared_flag_column
+#undef add_shared_column
+
+	/* The flags' prediction if the data fits it, else the stored flags */
+	if (d.flags_predicted) {
+		columns.push_back({ "compact_l_last_final_day", &d.last_final_day, sizeof(d.last_final_day) });
+		columns.push_back({ "compact_l_returned", d.l_returned, (cardinality + 63) / 64 * sizeof(uint64_t) });
+		columns.push_back({ "compact_l_flag_exceptions", d.flag_exceptions, d.num_flag_exceptions * sizeof(FlagException) });
+	} else {
+		columns.push_back({ "compact_l_returnflag", d.l_returnflag, cardinality * sizeof(d.l_returnflag[0]) });
+		columns.push_back({ "compact_l_linestatus", d.l_linestatus, cardinality * sizeof(d.l_linestatus[0]) });
+	}
+
+#define add_shared_validity(col) \
+	if (d.l_##col##_validity) { \
+		columns.push_back({ "compact_l_" #col "_validity", d.l_##col##_validity, li.l_##col.validity.size() * sizeof(uint32_t) }); \
+	}
+
+	add_shared_validity(shipdate);
+	add_shared_validity(extendedprice);
+#undef add_shared_validity
+
+	const size_t num_zones = (cardinality + kZoneRows - 1) / kZoneRows;
+#define add_shared_zones(col) \
+	if (d.l_##col##_zones) { \
+		columns.push_back({ "compact_l_" #col "_zones", d.l_##col##_zones, num_zones * sizeof(d.l_##col##_zones[0]) }); \
+	}
+
+	add_shared_zones(discount);
+	add_shared_zones(tax);
+	add_shared_zones(extendedprice);
+	add_shared_zones(quantity);
+#undef add_shared_zones
+}
+
+bool
+ComprData::AttachShared(lineitem& li, const shared_column_store& store,
+	std::vector<std::function<void()>>& unplug)
+{
+	size_t cardinality = store.size_of("l_extendedprice") / sizeof(li.l_extendedprice.get()[0]);
+	bool complete = cardinality > 0;
+#define check_shared_column(col) \
+	complete &= store.find("l_" #col, cardinality * sizeof(li.l_##col.get()[0])) != nullptr; \
+	complete &= store.find("l_" #col "_minmax", sizeof(li.l_##col.minmax)) != nullptr; \
+	complete &= store.find("compact_l_" #col, cardinality * sizeof(l_##col[0])) != nullptr;
+#define check_shared_flag_column(col) \
+	complete &= store.find("l_" #col, cardinality * sizeof(li.l_##col.get()[0])) != nullptr; \
+	complete &= store.find("l_" #col "_minmax", sizeof(li.l_##col.minmax)) != nullptr;
+
+	check_shared_column(shipdate);
+	check_shared_flag_column(returnflag);
+	check_shared_flag_column(linestatus);
+	check_shared_column(discount);
+	check_shared_column(tax);
+	check_shared_column(extendedprice);
+	check_shared_column(quantity);
+#undef check_shared_flag_column
+#undef check_shared_column
+
+	/* The flags, predicted or stored */
+	const bool predicted = store.find("compact_l_last_final_day", sizeof(last_final_day)) != nullptr &&
+		store.find("compact_l_returned", (cardinality + 63) / 64 * sizeof(uint64_t)) != nullptr &&
+		store.size_of("compact_l_flag_exceptions") % sizeof(FlagException) == 0 &&
+		store.find("compact_l_flag_exceptions", store.size_of("compact_l_flag_exceptions")) != nullptr;
+	const bool stored = store.find("compact_l_returnflag", cardinality * sizeof(l_returnflag[0])) != nullptr &&
+		store.find("compact_l_linestatus", cardinality * sizeof(l_linestatus[0])) != nullptr;
+	complete &= predicted || stored;
+	if (!complete) {
+		return false;
+	}
+
+	/* Validity bitmaps are small, hence copied rather than adopted; only published for columns with NULLs */
+	auto copy_validity = [&] (auto& column, const char* name) {
+		const size_t num_containers = (cardinality + 31) / 32;
+		auto validity = (const uint32_t*)store.find(name, num_containers * sizeof(uint32_t));
+		if (validity) {
+			column.validity.assign(validity, validity + num_containers);
+		} else {
+			column.validity = std::vector<uint32_t>();
+		}
+	};
+	copy_validity(li.l_shipdate, "compact_l_shipdate_validity");
+	copy_validity(li.l_extendedprice, "compact_l_extendedprice_validity");
+
+	/* The minmax is published along, rather than found by scanning the column again */
+	auto adopt = [&] (auto& column, const char* name) {
+		using T = typename std::remove_reference<decltype(column.get()[0])>::type;
+		::free(column.m_ptr);
+		column.m_ptr = (T*)store.find(name, cardinality * sizeof(T));
+		column.m_capacity = cardinality;
+		column.cardinality = cardinality;
+		memcpy(&column.minmax, store.find(std::string(name) + "_minmax", sizeof(column.minmax)), sizeof(column.minmax));
+		/* the store's memory is not ours to free */
+		unplug.emplace_back([&column] () { column.m_ptr = nullptr; });
+	};
+	adopt(li.l_shipdate, "l_shipdate");
+	adopt(li.l_returnflag, "l_returnflag");
+	adopt(li.l_linestatus, "l_linestatus");
+	adopt(li.l_discount, "l_discount");
+	adopt(li.l_tax, "l_tax");
+	adopt(li.l_extendedprice, "l_extendedprice");
+	adopt(li.l_quantity, "l_quantity");
+
+	/* The shared columns are read-only, hence a single replica serves all NUMA nodes */
+	size_t numa_nodes = GetNumaNodes();
+	auto shared = new ComprData(li, store);
 
 	std::unique_lock<std::mutex> lock(numa_data_mutex);
 
 	if (!numa_data) {
 		numa_data = new ComprData*[numa_nodes];
-		for (size_t i=0; i<numa_nodes; i++) {
-			numa_data[i] = nullptr;
-		}
 	}
+	for (size_t i=0; i<numa_nodes; i++) {
+		numa_data[i] = shared;
+	}
+	numa_data_description = "shared: 1 copy, in a shared column store";
+	return true;
+}
 
-	if (!numa_data[numa_node]) {
-		numa_data[numa_node] = new ComprData(li);
+const bit_sliced_column<uint16_t>&
+ComprData::GetShipDateBitSliced()
+{
+	std::unique_lock<std::mutex> lock(numa_data_mutex);
+
+	if (!l_shipdate_bit_sliced) {
+		/* Dates are non-negative, with or without the GPU's frame of reference */
+		l_shipdate_bit_sliced = new bit_sliced_column<uint16_t>((uint16_t*)l_shipdate,
+			li.l_extendedprice.cardinality);
 	}
 
-	return numa_data[numa_node];
+	return *l_shipdate_bit_sliced;
 }
 
 void
@@ -7,7 +7,14 @@
 
 #include <sstream>
 #include <vector>
+#include <functional>
+#include <algorithm>
+#include <mutex>
 #include "../src/monetdb_tpch_kit/tpch_kit.hpp"
+#include "../src/util/shared_column_store.hpp"
+#include "topology.hpp"
+#include "arena.hpp"
+#include "value_range.hpp"
 #include <limits>
 #include <cinttypes>
 
@@ -43,14 +50,11 @@ typedef sel_t idx_t;
 
 #define MAX_ACTIVE_GROUPS 64
 static constexpr size_t MAX_GROUPS = std::numeric_limits<unsigned short>::max();
-static constexpr size_t AVX_GROUPS = MAX_GROUPS * 8;
 
 static constexpr size_t MAX_VSIZE = 1024;
 static constexpr size_t GROUP_BUF_SIZE = MAX_ACTIVE_GROUPS * MAX_VSIZE;
 
 
-static constexpr size_t kGroupDomain = std::numeric_limits<uint16_t>::max();
-static constexpr size_t kGrpPosSize = kGroupDomain * 2;
 static constexpr size_t kSelBufSize = 2 * GROUP_BUF_SIZE;
 
 
@@ -164,6 +168,28 @@ struct AggrHashTable {
 	int128_t sum_charge;
 };
 
+/* The group ids a kernel's rows may map to, [begin, end): the range which its tables
+ * indexed by group id - aggrs0 and the like - cover, rather than all MAX_GROUPS. The
+ * kernels' ids are (l_returnflag << 8) | l_linestatus unless they say otherwise (see
+ * BaseKernel::GroupsOf()); for TPC-H's flags, that's 4362 ids. */
+struct GroupDomain {
+	size_t begin = 0;
+	size_t end = MAX_GROUPS;
+
+	size_t Size() const { return end - begin; }
+	bool Contains(size_t group) const { return group >= begin && group < end; }
+
+	GroupDomain& Include(size_t group) {
+		begin = std::min(begin, group);
+		end = std::max(end, group + 1);
+		return *this;
+	}
+
+	/* Of the combinations of li's flags within their columns' minmax; all ids if those
+	 * aren't known, e.g. of columns filled in place rather than by Push() */
+	static GroupDomain Of(const lineitem& li);
+};
+
 #define kernel_prologue() \
 	auto shipdate = li.l_shipdate.get(); \
 	auto returnflag = li.l_returnflag.get(); \
@@ -183,39 +209,43 @@ struct AggrHashTable {
 	int8_t* RESTRICT l_discount; \
 	int8_t* RESTRICT l_tax; \
 	int32_t* RESTRICT l_extendedprice; \
-	int16_t* RESTRICT l_quantity;
+	int16_t* RESTRICT l_quantity; \
+	uint32_t* RESTRICT l_shipdate_validity; /* see Column::validity; nullptr without NULLs */ \
+	uint32_t* RESTRICT l_extendedprice_validity;
 
 #define kernel_compact_init_magic(col) l_##col[i] = li.l_##col.get()[i];
 
-struct IKernel {
+/* Cache line aligned when allocated with new - e.g. the wrappers, such as Morsel, whose
+ * state shared by their workers is on cache lines of its own */
+struct IKernel : CacheLineAligned {
 private:
-	bool m_clean;
-	std::vector<void*> m_alloced;
+	Arena m_arena; /* of all new_array()s, local to the thread constructing the kernel */
 
 public:
-	IKernel(bool clean = true) : m_clean(clean) {}
+	/* Zeroed, and freed with the kernel */
 	template<typename T>
 	inline T* new_array(size_t num)
 	{
-		T* r = static_cast<T*>(aligned_alloc(4*1024, sizeof(T) * num));
-		assert(r);
+		T* r = static_cast<T*>(m_arena.Allocate(sizeof(T) * num));
 		assert((size_t) r % 64 == 0);
-		memset(r, 0, sizeof(T) * num);
-		m_alloced.push_back(r);
 		return r;
 	}
 
-	virtual ~IKernel();
+	virtual ~IKernel() {}
 };
 
 struct BaseKernel : IKernel {
-	const monetdb::date_t cmp;
+	monetdb::date_t cmp;
 	const lineitem& li;
 
 	int64_t sum_aggr_time;
 	int64_t sum_magic_time;
 
 
+	/* The ids aggrs0 and the DSM and AVX tables cover; those point at the table entry
+	 * of id 0, i.e. before their allocation if the domain doesn't start at 0 */
+	GroupDomain groups;
+
 	AggrHashTable* aggrs0;
 
 	int64_t* aggr_dsm0_sum_quantity;
@@ -235,34 +265,225 @@ struct BaseKernel : IKernel {
 	int64_t* aggr_avx0_sum_disc;
 
 
-	BaseKernel(const lineitem& li);
+	/* The groups of aggrs0 which rows may have been aggregated into since the last Clear(),
+	 * each listed once - provided the kernel records them with Touch(), as tracks_groups
+	 * says - so that merging its partial result, and clearing it, needn't visit any other
+	 * group. A group counts as touched if its stamp is the current generation: clearing
+	 * the set is starting the next one. */
+	bool tracks_groups = false;
+
+	/* Whether the kernel leaves out the rows whose l_shipdate_validity bit is clear,
+	 * rather than relying on NULL ship dates being stored as ComprData::kNullShipDate */
+	static constexpr bool kHonoursValidity = false;
+	uint16_t* touched_groups;
+	size_t num_touched_groups = 0;
+	uint32_t* touched_generation; /* per group */
+	uint32_t generation = 1;
+
+	void Touch(size_t group) {
+		DBG_ASSERT(groups.Contains(group));
+		uint32_t& stamp = touched_generation[group];
+		if (stamp != generation) {
+			stamp = generation;
+			touched_groups[num_touched_groups++] = group;
+		}
+	}
+
+	BaseKernel(const lineitem& li) : BaseKernel(li, GroupsOf(li)) {}
+	BaseKernel(const lineitem& li, const GroupDomain& groups);
+
+	/* The ids the kernel maps li's rows to; kernels numbering their groups otherwise
+	 * hide this, for wrappers such as Morsel to size their tables alike */
+	static GroupDomain GroupsOf(const lineitem& li) { return GroupDomain::Of(li); }
+
+	/* Zeroes the aggregates - only the groups touched since the last time, if the kernel
+	 * tracks them, otherwise all of its domain */
 	virtual void Clear();
 
+	/* Adds the groups of other's aggrs0 to ours, exactly - only those it touched, if it
+	 * tracks them - and touches them. Our domain must cover the groups it aggregated. */
+	void AddGroups(const BaseKernel& other);
+
+	/* BaseKernel's Clear(), for kernels whose own Clear() does more, or less */
+	void ClearGroups();
+
+	/* Q1 filters on l_shipdate <= date '1998-12-01' - interval 'DELTA' day */
+	static monetdb::date_t ThresholdForDelta(int delta);
+	virtual void SetThreshold(const monetdb::date_t& threshold) { cmp.dte_val = threshold.dte_val; }
+
+	/* cmp, encoded like the compact l_shipdate column */
+	int16_t CompactThreshold() const;
+
+protected:
+	/* An array of per_group elements per group of the domain, pointed at those of id 0 */
+	template<typename T>
+	T* new_group_array(size_t per_group = 1) {
+		return new_array<T>(groups.Size() * per_group) - groups.begin * per_group;
+	}
 
 public:
 	virtual void Profile(size_t total_tuples);
+
+	/* Which CPUs the kernel's own threads run on; empty if it runs on the caller's */
+	virtual std::string DescribePlacement() const { return std::string(); }
+};
+
+template <typename T> class bit_sliced_column;
+
+/* How the compact columns are laid out over the NUMA nodes (see ComprData::Get()) */
+enum DataPlacement {
+	kReplicate, /* a copy per node with workers, each built by threads on its node */
+	kInterleave, /* one copy, its pages spread round-robin over all nodes */
+	kPartition, /* one copy, each node with workers holding a contiguous slice of the rows */
+	kNumDataPlacements
 };
 
 struct ComprData : BaseKernel {
 	kernel_compact_declare
 
+	/* Stands in for a NULL l_shipdate: later than any threshold, so that NULLs never
+	 * qualify even for kernels which ignore the validity bitmaps. (NULL prices are
+	 * stored as 0, which doesn't contribute to any sum.) */
+	static constexpr int16_t kNullShipDate = std::numeric_limits<int16_t>::max();
+
+	/* Slices are whole multiples of this many rows, hence of pages in every column */
+	static constexpr size_t kSliceRows = 4096;
+
+	/* The least and greatest value of a column in each zone of kZoneRows rows, as stored -
+	 * NULL prices as 0 - for proving the ranges of expressions over them (see ValueRange) */
+	template<typename T>
+	struct ZoneBounds {
+		T min;
+		T max;
+	};
+	static constexpr size_t kZoneRows = kSliceRows;
+
+	ZoneBounds<int8_t>* l_discount_zones = nullptr;
+	ZoneBounds<int8_t>* l_tax_zones = nullptr;
+	ZoneBounds<int32_t>* l_extendedprice_zones = nullptr;
+	ZoneBounds<int16_t>* l_quantity_zones = nullptr;
+
+	bool HasZones() const {
+		return l_discount_zones && l_tax_zones && l_extendedprice_zones && l_quantity_zones;
+	}
+
+	/* Of a column's values in rows [first, end), by its zones; all values of T without them */
+	template<typename T>
+	static ValueRange RangeOf(const ZoneBounds<T>* zones, size_t first, size_t end) {
+		if (!zones) {
+			return ValueRange::Of<T>();
+		}
+		ValueRange range = ValueRange::None();
+		for (size_t zone = first / kZoneRows; zone * kZoneRows < end; zone++) {
+			range = range.Union(ValueRange(zones[zone].min, zones[zone].max));
+		}
+		return range;
+	}
+
+	/* l_linestatus and l_returnflag, as predicted from l_shipdate plus exceptions. The
+	 * TPC-H generator makes a line item 'O'pen iff it shipped after its CURRENTDATE, and
+	 * 'N'ot returned iff it was received after that date - a few days after shipping.
+	 * So only whether an item predicted to be final was 'R'eturned or 'A'ccepted is
+	 * stored, a bit per row; items which don't fit the prediction - e.g. those shipped
+	 * shortly before CURRENTDATE but received after it - are listed as exceptions.
+	 * The encoding is derived, and validated, when the columns are built. If the data
+	 * fits, the flag columns aren't stored: l_returnflag and l_linestatus are nullptr
+	 * until DecodeFlags(). Otherwise flags_predicted is false, and they are stored. */
+	struct FlagException {
+		uint32_t row;
+		int8_t returnflag;
+		int8_t linestatus;
+	};
+
+	/* Exceptions beyond this fraction of the rows mean the data doesn't fit */
+	static constexpr size_t kMaxFlagExceptionsFraction = 64;
+
+	bool flags_predicted = false;
+	int16_t last_final_day = 0; /* items shipped on or before it are predicted to be final */
+	uint64_t* l_returned = nullptr; /* per row: 'R' (1) or 'A' (0), for the rows predicted final */
+	FlagException* flag_exceptions = nullptr; /* by row */
+	size_t num_flag_exceptions = 0;
+
+	const FlagException* FirstFlagExceptionFrom(size_t row) const {
+		return std::lower_bound(flag_exceptions, flag_exceptions + num_flag_exceptions, row,
+			[] (const FlagException& e, size_t r) { return e.row < r; });
+	}
+
+	/* Makes l_returnflag and l_linestatus available - decoding them the first time, if
+	 * they aren't stored - for the kernels which scan them */
+	void DecodeFlags();
+
 private:
-	ComprData(const lineitem& li);
+	bit_sliced_column<uint16_t>* l_shipdate_bit_sliced = nullptr;
+	std::once_flag flags_decoded;
+
+	/* Of the columns, placed as the policy has them; the validity bitmaps, which are
+	 * small, are the kernel's own */
+	Arena data;
+	DataPlacement layout = kReplicate;
+	std::vector<size_t> slice_begin; /* kPartition: node n owns [slice_begin[n], slice_begin[n+1]) */
+
+	ComprData(const lineitem& li, int arena_node);
+	ComprData(const lineitem& li, const shared_column_store& store);
+
+	void Convert(const lineitem& li, size_t first, size_t end);
+	void ConvertFlags(const lineitem& li, size_t first, size_t end);
+	void DeriveFlags(const lineitem& li);
+	void CopyFlagsFrom(const ComprData& other);
+	void AllocateFlags();
+	static void Build(const lineitem& li);
 
 public:
+	/* Vertically bit-sliced copy of l_shipdate, built on first use */
+	const bit_sliced_column<uint16_t>& GetShipDateBitSliced();
+
 	static size_t GetNumaNodes();
+
+	/* The compact columns numa_node's workers scan. The first call builds those of all
+	 * nodes, as placement has them, in parallel by threads on their nodes. */
 	static ComprData* Get(const lineitem& li, size_t numa_node);
-	static ComprData* GetCore(const lineitem& l, size_t coreid) {
-		return Get(l,
-			// on bricks16
-			coreid % ComprData::GetNumaNodes());
+
+	DataPlacement Layout() const { return layout; }
+
+	/* The rows numa_node holds, with kPartition; all rows otherwise */
+	void Slice(size_t numa_node, size_t& first, size_t& end) const;
+
+	/* Of the columns built from now on; kReplicate by default */
+	static DataPlacement placement;
+
+	/* e.g. "replicate: 2 copies, on 2 of 2 nodes, 481.9 MB, flags predicted, 0.00% exceptions, built in 212.4 ms by 16 threads" */
+	static std::string Describe();
+
+	static const char* placement_name(DataPlacement placement);
+	static bool placement_by_name(const std::string& name, DataPlacement& placement);
+
+	/* Lists li's columns and the compact ones, for publishing in a shared column store */
+	static void AddSharedColumns(const lineitem& li, std::vector<shared_column_store::column>& columns);
+
+	/* Makes li, and the compact columns of all NUMA nodes, use the columns of a shared
+	 * column store in place. Adds the functions which unplug li's columns to @p unplug;
+	 * they must be called before li is destroyed. Returns false, changing nothing, if
+	 * the store lacks any of the columns. */
+	static bool AttachShared(lineitem& li, const shared_column_store& store,
+		std::vector<std::function<void()>>& unplug);
+	/* Of any CPU; nodes are numbered densely on all but exotic machines */
+	static size_t GetNumaNode(size_t cpu) {
+		return CpuTopology::NumaNodeOf(cpu) % ComprData::GetNumaNodes();
+	}
+	static ComprData* GetCore(const lineitem& l, size_t cpu) {
+		return Get(l, GetNumaNode(cpu));
 	}
 };
 
 #define kernel_compact_init(NUMA) do { \
 		auto p = ComprData::GetCore(li, NUMA); \
 		assert(p); \
-		auto& d = *p; \
+		p->DecodeFlags(); \
+		kernel_compact_init_from(*p); \
+    } while (false)
+
+#define kernel_compact_init_from(SRC) do { \
+		auto& d = (SRC); \
 		l_shipdate = d.l_shipdate; \
 		l_returnflag = d.l_returnflag; \
 		l_linestatus = d.l_linestatus; \
@@ -270,6 +491,8 @@ public:
 		l_tax = d.l_tax; \
 		l_extendedprice = d.l_extendedprice; \
 		l_quantity = d.l_quantity; \
+		l_shipdate_validity = d.l_shipdate_validity; \
+		l_extendedprice_validity = d.l_extendedprice_validity; \
     } while (false)
 
 
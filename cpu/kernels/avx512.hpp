@@ -18,6 +18,7 @@ struct AVX512 : public BaseKernel {
 		kernel_prologue();
 
 		const size_t num_tuples = 16;
+		const uint32_t* shipdate_validity = li.l_shipdate.Validity();
 		const __m512i v_cmp = _mm512_set1_epi32(cmp.dte_val);
 		const __m512i v_dec1 = _mm512_set1_epi64(Decimal64::ToValue(1, 0));
 		const __m512i v_card = _mm512_set1_epi64(cardinality);
@@ -42,6 +43,10 @@ struct AVX512 : public BaseKernel {
 
 			{
 				mask = _mm512_cmple_epi32_mask(v_shipdate, v_cmp);
+				if (shipdate_validity) {
+					/* NULL ship dates are stored as date_nil, which is below any threshold */
+					mask &= (__mmask16)(shipdate_validity[offset / 32] >> (offset % 32));
+				}
 				int ilo = mask;
 				int ihi = mask >> 8;
 
@@ -0,0 +1,121 @@
+#ifndef H_KERNEL_CORRELATED
+#define H_KERNEL_CORRELATED
+
+#include "../common.hpp"
+#include <algorithm>
+
+/* Derives the group of each tuple from its ship date and returned bit, patches in
+ * the exceptions, and aggregates a vector at a time. The l_returnflag and l_linestatus
+ * columns are not read at all, unless the data doesn't fit their prediction (see
+ * ComprData::flags_predicted), in which case it aggregates using them directly. */
+struct KernelCorrelatedFlags : BaseKernel {
+	static constexpr size_t kVectorsize = MAX_VSIZE;
+	static constexpr uint16_t kKeyAF = ('A' << 8) | 'F';
+	static constexpr uint16_t kKeyRF = ('R' << 8) | 'F';
+	static constexpr uint16_t kKeyNO = ('N' << 8) | 'O';
+
+	/* the flags' prediction; nullptr over columns which have the flags explicitly */
+	const ComprData* flags;
+	uint16_t* RESTRICT keys;
+
+	kernel_compact_declare
+
+	KernelCorrelatedFlags(const lineitem& li, size_t core) : BaseKernel(li, GroupsOf(li)), flags(ComprData::GetCore(li, core)) {
+		tracks_groups = true;
+		/* not kernel_compact_init(), which would decode the flags */
+		kernel_compact_init_from(*flags);
+
+		keys = new_array<uint16_t>(kVectorsize);
+	}
+
+	/* The predicted groups are touched whether or not the table has them */
+	static GroupDomain GroupsOf(const lineitem& li) {
+		return GroupDomain::Of(li).Include(kKeyAF).Include(kKeyRF).Include(kKeyNO);
+	}
+
+	template<typename COLUMNS>
+	void UseColumns(const COLUMNS& columns) {
+		kernel_compact_init_from(columns);
+		flags = nullptr;
+	}
+
+	NOINL void operator()() {
+		task(0, li.l_extendedprice.cardinality);
+	}
+
+	NOINL void task(size_t offset, size_t morsel_num) {
+		if (flags && flags->flags_predicted) {
+			task_correlated(offset, morsel_num);
+		} else {
+			task_explicit(offset, morsel_num);
+		}
+	}
+
+private:
+	void task_correlated(size_t offset, size_t morsel_num) {
+		const int16_t date = CompactThreshold();
+		const int16_t last_final_day = flags->last_final_day;
+		const uint64_t* RESTRICT returned = flags->l_returned;
+		const auto end_of_exceptions = flags->flag_exceptions + flags->num_flag_exceptions;
+		auto exception = flags->FirstFlagExceptionFrom(offset);
+
+		/* the predicted groups, whether or not any row qualifies */
+		Touch(kKeyAF);
+		Touch(kKeyRF);
+		Touch(kKeyNO);
+
+		for (size_t base=offset; base<offset+morsel_num; base+=kVectorsize) {
+			const size_t n = min(kVectorsize, offset + morsel_num - base);
+
+			for (size_t j=0; j<n; j++) {
+				const size_t i = base + j;
+				const uint16_t final_key = (returned[i / 64] >> (i % 64)) & 1 ? kKeyRF : kKeyAF;
+				keys[j] = l_shipdate[i] > last_final_day ? kKeyNO : final_key;
+			}
+			for (; exception != end_of_exceptions && exception->row < base + n; exception++) {
+				keys[exception->row - base] = (uint16_t)(exception->returnflag << 8) | (uint8_t)exception->linestatus;
+				Touch(keys[exception->row - base]);
+			}
+
+			aggregate(base, n, date);
+		}
+	}
+
+	void aggregate(size_t base, size_t n, int16_t date) {
+		const int64_t one = Decimal64::ToValue(1, 0);
+
+		for (size_t j=0; j<n; j++) {
+			const size_t i = base + j;
+			if (l_shipdate[i] <= date) {
+				const int64_t disc = l_discount[i];
+				const int64_t price = l_extendedprice[i];
+				const int64_t disc_price = (one - disc) * price;
+				auto& a = aggrs0[keys[j]];
+				a.sum_quantity += l_quantity[i];
+				a.sum_base_price += price;
+				a.sum_disc += disc;
+				a.sum_disc_price += disc_price;
+				a.sum_charge += (int128_t)disc_price * (one + l_tax[i]);
+				a.count++;
+			}
+		}
+	}
+
+	void task_explicit(size_t offset, size_t morsel_num) {
+		const int16_t date = CompactThreshold();
+
+		for (size_t base=offset; base<offset+morsel_num; base+=kVectorsize) {
+			const size_t n = min(kVectorsize, offset + morsel_num - base);
+
+			for (size_t j=0; j<n; j++) {
+				const size_t i = base + j;
+				keys[j] = (uint16_t)(l_returnflag[i] << 8) | (uint8_t)l_linestatus[i];
+				Touch(keys[j]);
+			}
+
+			aggregate(base, n, date);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef H_KERNEL_CRACKED
+#define H_KERNEL_CRACKED
+
+#include "../common.hpp"
+#include <map>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+
+/* Adaptive index ("database cracking") on l_shipdate, over a private copy of the
+ * compact columns. Each query threshold partitions only the piece of the copy
+ * containing it, moving all qualifying rows into a prefix [0, pos) and recording
+ * that position. Repeated queries hence partition ever smaller pieces, without
+ * ever sorting upfront. */
+struct CrackedData : IKernel {
+	kernel_compact_declare
+
+	const size_t cardinality;
+	size_t last_crack_touched = 0; /* rows partitioned by the last Crack() */
+
+	/* Number of rows with l_shipdate <= threshold (compact encoding); these are
+	 * rows [0, result) of the cracked columns */
+	size_t Crack(int16_t threshold) {
+		std::unique_lock<std::mutex> guard(lock);
+
+		auto it = index.find(threshold);
+		if (it != index.end()) {
+			last_crack_touched = 0;
+			return it->second;
+		}
+
+		auto upper = index.upper_bound(threshold);
+		const size_t hi = upper == index.end() ? cardinality : upper->second;
+		const size_t lo = upper == index.begin() ? 0 : std::prev(upper)->second;
+
+		const size_t pos = Partition(lo, hi, threshold);
+		last_crack_touched = hi - lo;
+		index[threshold] = pos;
+		return pos;
+	}
+
+	size_t NumPieces() const {
+		return index.size() + 1;
+	}
+
+	static CrackedData* Get(const lineitem& li) {
+		static std::mutex get_lock;
+		static CrackedData* data = nullptr;
+
+		std::unique_lock<std::mutex> guard(get_lock);
+		if (!data) {
+			data = new CrackedData(li);
+		}
+		return data;
+	}
+
+private:
+	/* key t => rows [0, pos) have l_shipdate <= t, rows [pos, cardinality) have l_shipdate > t */
+	std::map<int16_t, size_t> index;
+	std::mutex lock;
+
+	CrackedData(const lineitem& li) : cardinality(li.l_extendedprice.cardinality) {
+		auto& d = *ComprData::Get(li, 0);
+		d.DecodeFlags();
+
+		#define copy_column(name) \
+			l_##name = new_array<std::remove_reference<decltype(*l_##name)>::type>(cardinality); \
+			memcpy(l_##name, d.l_##name, sizeof(*l_##name) * cardinality);
+
+		copy_column(shipdate);
+		copy_column(returnflag);
+		copy_column(linestatus);
+		copy_column(discount);
+		copy_column(tax);
+		copy_column(extendedprice);
+		copy_column(quantity);
+
+		#undef copy_column
+
+		#define copy_validity(name) \
+			l_##name##_validity = d.l_##name##_validity ? new_array<uint32_t>(li.l_##name.validity.size()) : nullptr; \
+			if (l_##name##_validity) { \
+				memcpy(l_##name##_validity, d.l_##name##_validity, sizeof(uint32_t) * li.l_##name.validity.size()); \
+			}
+
+		copy_validity(shipdate);
+		copy_validity(extendedprice);
+
+		#undef copy_validity
+	}
+
+	static void SwapBits(uint32_t* RESTRICT bits, size_t i, size_t j) {
+		if (bits) {
+			const uint32_t bi = (bits[i / 32] >> (i % 32)) & 1;
+			const uint32_t bj = (bits[j / 32] >> (j % 32)) & 1;
+			bits[i / 32] ^= (bi ^ bj) << (i % 32);
+			bits[j / 32] ^= (bi ^ bj) << (j % 32);
+		}
+	}
+
+	/* Moves rows of [lo, hi) with l_shipdate <= threshold to the front; all columns in tandem */
+	size_t Partition(size_t lo, size_t hi, int16_t threshold) {
+		size_t i = lo;
+		size_t j = hi;
+
+		while (true) {
+			while (i < j && l_shipdate[i] <= threshold) {
+				i++;
+			}
+			while (i < j && l_shipdate[j-1] > threshold) {
+				j--;
+			}
+			if (i >= j) {
+				break;
+			}
+
+			j--;
+			std::swap(l_shipdate[i], l_shipdate[j]);
+			std::swap(l_returnflag[i], l_returnflag[j]);
+			std::swap(l_linestatus[i], l_linestatus[j]);
+			std::swap(l_discount[i], l_discount[j]);
+			std::swap(l_tax[i], l_tax[j]);
+			std::swap(l_extendedprice[i], l_extendedprice[j]);
+			std::swap(l_quantity[i], l_quantity[j]);
+			SwapBits(l_shipdate_validity, i, j);
+			SwapBits(l_extendedprice_validity, i, j);
+			i++;
+		}
+
+		return i;
+	}
+};
+
+/* Runs KERNEL (e.g. KernelX100 or a Morsel thereof) on the cracked columns, for a
+ * given DELTA, over the qualifying-row range only */
+template<typename KERNEL>
+struct KernelCracked : BaseKernel {
+	KERNEL kernel;
+	CrackedData& cracked;
+
+	template<typename... Args>
+	KernelCracked(const lineitem& li, int delta, Args&&... args)
+	 : BaseKernel(li, KERNEL::GroupsOf(li)), kernel(li, args...), cracked(*CrackedData::Get(li)) {
+		kernel.UseColumns(cracked);
+		kernel.SetThreshold(ThresholdForDelta(delta));
+		SetThreshold(ThresholdForDelta(delta));
+
+		aggrs0 = kernel.aggrs0;
+	}
+
+	NOINL void operator()() {
+		const size_t num = cracked.Crack(CompactThreshold());
+		if (num > 0) {
+			kernel.task(0, num);
+		}
+	}
+
+	void Clear() override {
+		kernel.Clear();
+	}
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef H_KERNEL_CUBE
+#define H_KERNEL_CUBE
+
+#include "../common.hpp"
+#include "../aggregate_cube.hpp"
+
+/* Answers Q1 from the prefix-sum aggregate cube, without scanning; the cube is
+ * loaded from filename if one of data_version is there, otherwise built (and
+ * written there) */
+struct KernelAggregateCube : BaseKernel {
+	AggregateCube cube;
+
+	KernelAggregateCube(const lineitem& li, const std::string& filename = "", uint64_t data_version = 0)
+	 : BaseKernel(li) {
+		if (filename.empty() || !AggregateCube::Read(filename, data_version, cube) ||
+				cube.cardinality != li.l_extendedprice.cardinality || !Covers(cube)) {
+			cube = AggregateCube::FromCompact(li);
+			if (!filename.empty()) {
+				cube.Write(filename, data_version);
+			}
+		}
+	}
+
+	NOINL void operator()() {
+		cube.UpTo(CompactThreshold(), aggrs0);
+	}
+
+private:
+	/* Whether aggrs0 has the groups of a cube read from a file - one built from li has */
+	bool Covers(const AggregateCube& cube) const {
+		return std::all_of(cube.group_keys.begin(), cube.group_keys.end(),
+			[&] (uint32_t key) { return groups.Contains(key); });
+	}
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef H_KERNEL_FACTORISED
+#define H_KERNEL_FACTORISED
+
+#include "../common.hpp"
+#include <mutex>
+
+/* Value domains of the columns KernelFactorised aggregates by; computed once per table */
+struct FactorisedDomain {
+	static constexpr size_t kMaxGroups = 8;
+	static constexpr size_t kMaxDiscounts = 16;
+	static constexpr size_t kMaxTaxes = 16;
+	static constexpr uint8_t kNoCode = 0xFF;
+
+	/* dense codes of the l_returnflag and l_linestatus values present */
+	uint8_t rf_code[256];
+	uint8_t ls_code[256];
+	size_t num_rf = 0;
+	size_t num_ls = 0;
+
+	int8_t min_disc, max_disc;
+	int8_t min_tax, max_tax;
+
+	size_t NumDiscounts() const { return max_disc - min_disc + 1; }
+	size_t NumTaxes() const { return max_tax - min_tax + 1; }
+	size_t NumGroups() const { return num_rf * num_ls; }
+	size_t NumCells() const { return NumGroups() * NumDiscounts() * NumTaxes(); }
+
+	/* Are the domains small enough to factorise the aggregation over? */
+	bool fits;
+
+	static const FactorisedDomain& Get(const lineitem& li) {
+		static std::mutex lock;
+		static FactorisedDomain* domain = nullptr;
+
+		std::unique_lock<std::mutex> guard(lock);
+		if (!domain) {
+			domain = new FactorisedDomain(li);
+		}
+		return *domain;
+	}
+
+private:
+	FactorisedDomain(const lineitem& li) {
+		auto& d = *ComprData::Get(li, 0);
+		d.DecodeFlags();
+		const size_t cardinality = li.l_extendedprice.cardinality;
+
+		memset(rf_code, kNoCode, sizeof(rf_code));
+		memset(ls_code, kNoCode, sizeof(ls_code));
+		min_disc = min_tax = std::numeric_limits<int8_t>::max();
+		max_disc = max_tax = std::numeric_limits<int8_t>::min();
+
+		for (size_t i=0; i<cardinality; i++) {
+			auto& rf = rf_code[(uint8_t)d.l_returnflag[i]];
+			auto& ls = ls_code[(uint8_t)d.l_linestatus[i]];
+			if (rf == kNoCode) {
+				rf = num_rf++;
+			}
+			if (ls == kNoCode) {
+				ls = num_ls++;
+			}
+			min_disc = std::min(min_disc, d.l_discount[i]);
+			max_disc = std::max(max_disc, d.l_discount[i]);
+			min_tax = std::min(min_tax, d.l_tax[i]);
+			max_tax = std::max(max_tax, d.l_tax[i]);
+		}
+
+		fits = cardinality > 0 && NumGroups() <= kMaxGroups &&
+			NumDiscounts() <= kMaxDiscounts && NumTaxes() <= kMaxTaxes;
+	}
+};
+
+/* Factorised aggregation: as l_discount and l_tax have tiny domains, only sum(price),
+ * sum(quantity) and count are accumulated, per (group, discount, tax) cell. The
+ * discounted price and charge sums are reconstructed exactly from the cells - whose
+ * discount and tax factors are constant - when flushing them, at the end of each task.
+ * Falls back to computing every tuple's products if the domains are too large. */
+struct KernelFactorised : BaseKernel {
+	struct Cell {
+		int64_t sum_price;
+		int64_t sum_quantity;
+		int64_t count;
+	};
+
+	const FactorisedDomain& domain;
+	Cell* RESTRICT cells;
+	uint8_t rf_of_group[FactorisedDomain::kMaxGroups];
+	uint8_t ls_of_group[FactorisedDomain::kMaxGroups];
+
+	kernel_compact_declare
+
+	KernelFactorised(const lineitem& li, size_t core) : BaseKernel(li), domain(FactorisedDomain::Get(li)) {
+		tracks_groups = true;
+		kernel_compact_init(core);
+
+		cells = new_array<Cell>(domain.fits ? domain.NumCells() : 1);
+		for (size_t rf=0; rf<256; rf++) {
+			for (size_t ls=0; ls<256; ls++) {
+				if (domain.rf_code[rf] != FactorisedDomain::kNoCode && domain.ls_code[ls] != FactorisedDomain::kNoCode) {
+					const size_t g = domain.rf_code[rf] * domain.num_ls + domain.ls_code[ls];
+					rf_of_group[g] = rf;
+					ls_of_group[g] = ls;
+				}
+			}
+		}
+	}
+
+	template<typename COLUMNS>
+	void UseColumns(const COLUMNS& columns) {
+		kernel_compact_init_from(columns);
+	}
+
+	NOINL void operator()() {
+		task(0, li.l_extendedprice.cardinality);
+	}
+
+	NOINL void task(size_t offset, size_t morsel_num) {
+		if (domain.fits) {
+			task_factorised(offset, morsel_num);
+		} else {
+			task_direct(offset, morsel_num);
+		}
+	}
+
+private:
+	void task_factorised(size_t offset, size_t morsel_num) {
+		const int16_t date = CompactThreshold();
+		const size_t num_taxes = domain.NumTaxes();
+		const size_t num_discounts = domain.NumDiscounts();
+		const size_t num_ls = domain.num_ls;
+		const int8_t min_disc = domain.min_disc;
+		const int8_t min_tax = domain.min_tax;
+		const uint8_t* RESTRICT rf_code = domain.rf_code;
+		const uint8_t* RESTRICT ls_code = domain.ls_code;
+
+		auto o_sd = l_shipdate + offset;
+		auto o_rf = l_returnflag + offset;
+		auto o_ls = l_linestatus + offset;
+		auto o_disc = l_discount + offset;
+		auto o_tax = l_tax + offset;
+		auto o_eprice = l_extendedprice + offset;
+		auto o_quantity = l_quantity + offset;
+
+		for (size_t i=0; i<morsel_num; i++) {
+			/* branch-free: disqualified tuples add zeros */
+			const int64_t pass = o_sd[i] <= date;
+			const size_t group = rf_code[(uint8_t)o_rf[i]] * num_ls + ls_code[(uint8_t)o_ls[i]];
+			const size_t cell = (group * num_discounts + (o_disc[i] - min_disc)) * num_taxes + (o_tax[i] - min_tax);
+
+			cells[cell].sum_price += o_eprice[i] & -pass;
+			cells[cell].sum_quantity += o_quantity[i] & -pass;
+			cells[cell].count += pass;
+		}
+
+		flush();
+	}
+
+	/* Reconstructs the group aggregates from the cells, and clears the latter */
+	void flush() {
+		const int64_t one = Decimal64::ToValue(1, 0);
+		const size_t num_taxes = domain.NumTaxes();
+		const size_t num_discounts = domain.NumDiscounts();
+
+		for (size_t g=0; g<domain.NumGroups(); g++) {
+			const uint16_t idx = (uint16_t)(rf_of_group[g] << 8) | ls_of_group[g];
+			auto& a = aggrs0[idx];
+
+			for (size_t d=0; d<num_discounts; d++) {
+				const int64_t disc = domain.min_disc + (int64_t)d;
+				for (size_t t=0; t<num_taxes; t++) {
+					const int64_t tax = domain.min_tax + (int64_t)t;
+					Cell& c = cells[(g * num_discounts + d) * num_taxes + t];
+					if (!c.count) {
+						continue;
+					}
+
+					Touch(idx);
+					const int128_t disc_price = (int128_t)c.sum_price * (one - disc);
+					a.sum_quantity += c.sum_quantity;
+					a.sum_base_price += c.sum_price;
+					a.sum_disc += disc * c.count;
+					a.sum_disc_price += disc_price;
+					a.sum_charge += disc_price * (one + tax);
+					a.count += c.count;
+
+					c = Cell {};
+				}
+			}
+		}
+	}
+
+	void task_direct(size_t offset, size_t morsel_num) {
+		const int16_t date = CompactThreshold();
+		const int64_t one = Decimal64::ToValue(1, 0);
+
+		for (size_t i=offset; i<offset+morsel_num; i++) {
+			if (l_shipdate[i] <= date) {
+				const int64_t disc = l_discount[i];
+				const int64_t price = l_extendedprice[i];
+				const int64_t disc_price = (one - disc) * price;
+				const uint16_t idx = (uint16_t)(l_returnflag[i] << 8) | (uint8_t)l_linestatus[i];
+				auto& a = aggrs0[idx];
+				Touch(idx);
+				a.sum_quantity += l_quantity[i];
+				a.sum_base_price += price;
+				a.sum_disc += disc;
+				a.sum_disc_price += disc_price;
+				a.sum_charge += (int128_t)disc_price * (one + l_tax[i]);
+				a.count++;
+			}
+		}
+	}
+};
+
+#endif
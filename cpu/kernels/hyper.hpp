@@ -15,9 +15,10 @@ struct KernelHyPer : BaseKernel {
 		int64_t disc_price;
 		int64_t charge;
 
+		/* NULL ship dates are stored as date_nil, which is below any threshold */
 		if (!use_flag) {
 			for (size_t i=0; i<cardinality; i++) {
-				if (shipdate[i] <= cmp.dte_val) {
+				if (shipdate[i] <= cmp.dte_val && li.l_shipdate.IsValid(i)) {
 					const auto disc = discount[i];
 					const auto price = extendedprice[i];
 					
@@ -65,7 +66,7 @@ struct KernelHyPer : BaseKernel {
 		} else {
 			bool flag = false;
 			for (size_t i=0; i<cardinality; i++) {
-				if (shipdate[i] <= cmp.dte_val) {
+				if (shipdate[i] <= cmp.dte_val && li.l_shipdate.IsValid(i)) {
 					const auto disc = discount[i];
 					const auto price = extendedprice[i];
 
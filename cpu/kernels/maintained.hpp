@@ -0,0 +1,190 @@
+#ifndef H_KERNEL_MAINTAINED
+#define H_KERNEL_MAINTAINED
+
+#include "../common.hpp"
+#include "../aggregate_cube.hpp"
+#include "x100.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
+
+/* Q1 over the LiveTable as a maintained result rather than a scan: SUM and COUNT
+ * decompose, and whether a row qualifies depends on its own ship date only. So each
+ * refresh aggregates just the rows appended since the previous one into deltas per
+ * (ship date, group), and subtracts those deleted meanwhile, from the older snapshot
+ * which still has them. A threshold's (i.e. DELTA's) result is the prefix sum of the
+ * deltas over the days up to it; the prefix sums are kept, and only recomputed from
+ * the earliest day changed since. So a query costs O(changes), plus O(groups) per day
+ * up to the threshold after that day, whatever the threshold. The rows are grouped
+ * and their aggregates computed as X100 does, on the compact ship dates, so they
+ * count exactly as in a scan. */
+struct KernelMaintainedQ1 : BaseKernel {
+	using Cell = AggregateCube::Cell;
+	using Scan = KernelX100<kMagic, true>; /* whose group ids the result has */
+	using Snapshot = LiveTable::Snapshot;
+	using SegmentVersion = LiveTable::SegmentVersion;
+
+	static constexpr size_t kVectorsize = MAX_VSIZE;
+
+	LiveTable& table;
+	std::shared_ptr<const Snapshot> last; /* as of which the deltas are up to date */
+
+	/* The groups met so far, by their order of appearance: days[g][d] is the delta of
+	 * day first_day + d, prefix[g][d] the sum of those of the days before it, which is
+	 * up to date for d <= prefix_valid */
+	std::vector<size_t> group_ids;
+	std::vector<int32_t> dense_group; /* per group of the domain; -1 if not met */
+	std::vector<std::vector<Cell>> days;
+	std::vector<std::vector<Cell>> prefix;
+	int32_t first_day = 0;
+	size_t num_days = 0;
+	size_t prefix_valid = 0;
+
+	idx_t* RESTRICT v_idx;
+
+	/* of the last refresh */
+	uint64_t epoch = 0;
+	size_t cardinality = 0;
+	size_t rows_added = 0;
+	size_t rows_subtracted = 0;
+
+	KernelMaintainedQ1(const lineitem& li)
+	 : BaseKernel(li, Scan::GroupsOf(li)), table(LiveTable::Get(li)), last(std::make_shared<Snapshot>()),
+		dense_group(groups.Size(), -1) {
+		v_idx = new_array<idx_t>(kVectorsize);
+	}
+
+	/* Brings the deltas up to date with the table, and answers for the current threshold */
+	NOINL void operator()() {
+		const auto now = table.GetSnapshot();
+		epoch = now->epoch;
+		cardinality = now->cardinality - now->num_deleted;
+		rows_added = rows_subtracted = 0;
+
+		/* Rows appended since; those deleted again already aren't selectable */
+		for (size_t s=0; s<now->segments.size(); s++) {
+			const auto& version = now->segments[s];
+			const size_t first = s < last->segments.size() ? last->segments[s].rows : 0;
+			if (version.segment && version.rows > first) {
+				const SegmentVersion::Columns columns(version);
+				Aggregate(columns, first, version.rows, columns.l_shipdate_validity, 1);
+				rows_added += version.rows - first;
+			}
+		}
+
+		/* Rows which had been aggregated, and were deleted since */
+		LiveTable::Bitmap gone(LiveTable::kContainers);
+		for (size_t s=0; s<last->segments.size(); s++) {
+			const auto& before = last->segments[s];
+			const auto& after = now->segments[s];
+			if (!before.segment || (after.segment && after.num_deleted == before.num_deleted)) {
+				continue;
+			}
+			for (size_t c=0; c<LiveTable::kContainers; c++) {
+				const uint32_t deleted_after = after.segment ? Bits(after.deleted, c, 0) : ~0u;
+				gone[c] = deleted_after & ~Bits(before.deleted, c, 0) & Bits(before.selectable, c, ~0u);
+			}
+			Aggregate(SegmentVersion::Columns(before), 0, before.rows, gone.data(), -1);
+			rows_subtracted += after.num_deleted - before.num_deleted;
+		}
+
+		last = now;
+		Answer(CompactThreshold());
+	}
+
+private:
+	static uint32_t Bits(const std::shared_ptr<const LiveTable::Bitmap>& bits, size_t c, uint32_t none) {
+		return bits ? (*bits)[c] : none;
+	}
+
+	static bool IsSet(const uint32_t* bits, size_t i) {
+		return !bits || Primitives::is_valid(bits, i);
+	}
+
+	/* Adds (or subtracts) rows [first, end) of a segment whose bits are set to the deltas */
+	void Aggregate(const SegmentVersion::Columns& columns, size_t first, size_t end, const uint32_t* rows, int sign) {
+		const int64_t one = Decimal64::ToValue(1, 0);
+
+		for (size_t offset=first; offset<end; offset+=kVectorsize) {
+			const size_t n = min(kVectorsize, end - offset);
+			Primitives::map_gid2_dom_restrict(v_idx, nullptr, n,
+				columns.l_returnflag + offset, li.l_returnflag.minmax.min, li.l_returnflag.minmax.max,
+				columns.l_linestatus + offset, li.l_linestatus.minmax.min, li.l_linestatus.minmax.max);
+
+			for (size_t i=0; i<n; i++) {
+				const size_t r = offset + i;
+				if (!IsSet(rows, r)) {
+					continue;
+				}
+				/* as X100's aggregate_wide(), NULL prices as 0 */
+				const int64_t price = IsSet(columns.l_extendedprice_validity, r) ? columns.l_extendedprice[r] : 0;
+				const int64_t disc_1 = one - columns.l_discount[r];
+				const int64_t disc_price = disc_1 * price;
+				const int128_t charge = (int128_t)disc_price * (one + columns.l_tax[r]);
+
+				Cell& c = CellOf(columns.l_shipdate[r], v_idx[i]);
+				c.sum_quantity += sign * columns.l_quantity[r];
+				c.sum_base_price += sign * price;
+				c.sum_disc += sign * disc_1;
+				c.sum_disc_price += sign * disc_price;
+				c.sum_charge += sign * charge;
+				c.count += sign;
+			}
+		}
+	}
+
+	Cell& CellOf(int32_t day, size_t group) {
+		DBG_ASSERT(groups.Contains(group));
+		int32_t& g = dense_group[group - groups.begin];
+		if (g < 0) {
+			g = group_ids.size();
+			group_ids.push_back(group);
+			days.emplace_back(num_days, Cell {});
+			prefix.emplace_back(num_days + 1, Cell {});
+		}
+		if (!num_days || day < first_day || day >= first_day + (int32_t)num_days) {
+			Cover(day);
+		}
+		const size_t d = day - first_day;
+		prefix_valid = std::min(prefix_valid, d);
+		return days[g][d];
+	}
+
+	/* Extends the days to include day; the prefix sums are recomputed */
+	void Cover(int32_t day) {
+		const int32_t begin = num_days ? std::min(first_day, day) : day;
+		const int32_t end = num_days ? std::max(first_day + (int32_t)num_days, day + 1) : day + 1;
+		const size_t shift = num_days ? first_day - begin : 0;
+		for (size_t g=0; g<group_ids.size(); g++) {
+			days[g].insert(days[g].begin(), shift, Cell {});
+			days[g].resize(end - begin, Cell {});
+			prefix[g].assign(end - begin + 1, Cell {});
+		}
+		first_day = begin;
+		num_days = end - begin;
+		prefix_valid = 0;
+	}
+
+	/* aggrs0 := the sums of the days up to threshold */
+	void Answer(int32_t threshold) {
+		const size_t k = threshold < first_day ? 0 : std::min<size_t>(num_days, threshold - first_day + 1);
+		for (; prefix_valid < k; prefix_valid++) {
+			for (size_t g=0; g<group_ids.size(); g++) {
+				prefix[g][prefix_valid + 1] = prefix[g][prefix_valid];
+				prefix[g][prefix_valid + 1] += days[g][prefix_valid];
+			}
+		}
+
+		for (size_t g=0; g<group_ids.size(); g++) {
+			const Cell& c = prefix[g][k];
+			auto& t = aggrs0[group_ids[g]];
+			t.sum_quantity = (int64_t)c.sum_quantity;
+			t.sum_base_price = (int64_t)c.sum_base_price;
+			t.sum_disc = (int64_t)c.sum_disc;
+			t.sum_disc_price = c.sum_disc_price;
+			t.sum_charge = c.sum_charge;
+			t.count = (int64_t)c.count;
+		}
+	}
+};
+
+#endif
@@ -9,8 +9,9 @@ struct KernelNaive : BaseKernel {
 	__attribute__((noinline)) void operator()() noexcept {
 		kernel_prologue();
 
+		/* NULL ship dates are stored as date_nil, which is below any threshold */
 		for (size_t i=0; i<cardinality; i++) {
-			if (shipdate[i] <= cmp.dte_val) {
+			if (shipdate[i] <= cmp.dte_val && li.l_shipdate.IsValid(i)) {
 				const auto disc = discount[i];
 				const auto price = extendedprice[i];
 				const auto disc_1 = Decimal64::ToValue(1, 0) - disc;
@@ -0,0 +1,356 @@
+#ifndef H_KERNEL_PIPELINE
+#define H_KERNEL_PIPELINE
+
+#include "../common.hpp"
+#include <tuple>
+#include <type_traits>
+
+/* Kernels generated from a list of steps - selects, maps, grouping and aggregation - at
+ * compile time, in the manner of relaxed operator fusion: within a vector, the steps
+ * between two Materialize boundaries are fused into one loop over its tuples, keeping
+ * their values in registers; at a boundary, the tuples qualifying so far become a
+ * selection vector, and the values which later steps use are written to vectors, to be
+ * loaded again by the next loop. Hence without boundaries the kernel is HyPer-like,
+ * tuple at a time; with one after every step, it is X100-like, a primitive per step.
+ *
+ * A step is a struct with
+ *	type     the type of the value it computes - its attribute, named by the step
+ *	         itself - or void, for selects and aggregates
+ *	Inputs   a StepList of the steps whose values it uses
+ *	Run(kernel, values, row)   which computes the step for a row and returns whether the
+ *	         tuple qualifies; maps store their value with values.template get<Step>()
+ */
+
+template<typename... Steps>
+struct StepList {};
+
+/* Is T one of a StepList? */
+template<typename T, typename LIST>
+struct StepListContains;
+
+template<typename T>
+struct StepListContains<T, StepList<>> : std::false_type {};
+
+template<typename T, typename FIRST, typename... REST>
+struct StepListContains<T, StepList<FIRST, REST...>> : std::integral_constant<bool,
+	std::is_same<T, FIRST>::value || StepListContains<T, StepList<REST...>>::value> {};
+
+/* Of T in a StepList */
+template<typename T, typename LIST>
+struct StepListIndex;
+
+template<typename T, typename... REST>
+struct StepListIndex<T, StepList<T, REST...>> : std::integral_constant<size_t, 0> {};
+
+template<typename T, typename FIRST, typename... REST>
+struct StepListIndex<T, StepList<FIRST, REST...>> : std::integral_constant<size_t,
+	1 + StepListIndex<T, StepList<REST...>>::value> {};
+
+/* The steps which compute values, in order */
+template<typename... Steps>
+struct StepAttributes {
+	using type = StepList<>;
+};
+
+template<typename FIRST, typename... REST>
+struct StepAttributes<FIRST, REST...> {
+	template<typename LIST> struct Prepend;
+	template<typename... Ts> struct Prepend<StepList<Ts...>> {
+		using type = typename std::conditional<std::is_void<typename FIRST::type>::value,
+			StepList<Ts...>, StepList<FIRST, Ts...>>::type;
+	};
+	using type = typename Prepend<typename StepAttributes<REST...>::type>::type;
+};
+
+/* Per attribute, a value of it (the registers of a fused loop), or a pointer to a vector */
+template<typename LIST, template<typename> class HOLDER>
+struct StepValues;
+
+template<typename... Attrs, template<typename> class HOLDER>
+struct StepValues<StepList<Attrs...>, HOLDER> {
+	std::tuple<typename HOLDER<Attrs>::type...> values;
+
+	template<typename A>
+	typename HOLDER<A>::type& get() {
+		return std::get<StepListIndex<A, StepList<Attrs...>>::value>(values);
+	}
+};
+
+template<typename A> struct StepValueOf { using type = typename A::type; };
+template<typename A> struct StepVectorOf { using type = typename A::type*; };
+
+/* The boundary between two fused loops */
+struct Materialize {
+	using type = void;
+	using Inputs = StepList<>;
+
+	template<typename K, typename V>
+	static bool Run(K&, V&, size_t) {
+		return true;
+	}
+};
+
+/* Runs the steps of stage S, in order, while the tuple qualifies */
+template<typename KERNEL, size_t S, size_t K, typename... Steps>
+struct StepStage {
+	template<typename V>
+	static bool Run(KERNEL&, V&, size_t) {
+		return true;
+	}
+};
+
+template<typename KERNEL, size_t S, size_t K, typename FIRST, typename... REST>
+struct StepStage<KERNEL, S, K, FIRST, REST...> {
+	template<typename V>
+	static bool Run(KERNEL& k, V& values, size_t i) {
+		constexpr bool here = KERNEL::StageOf(K) == S && !std::is_same<FIRST, Materialize>::value;
+		return (!here || FIRST::Run(k, values, i)) && StepStage<KERNEL, S, K+1, REST...>::Run(k, values, i);
+	}
+};
+
+template<typename... Steps>
+struct KernelPipeline : BaseKernel {
+	static constexpr size_t kVectorsize = MAX_VSIZE;
+	static constexpr size_t kNumSteps = sizeof...(Steps);
+
+	using Attributes = typename StepAttributes<Steps...>::type;
+	using Values = StepValues<Attributes, StepValueOf>;
+
+	kernel_compact_declare
+
+	/* For the steps: the ship date threshold, compact as the columns are */
+	int16_t date;
+
+	/* The tuples qualifying at each boundary; consecutive ones alternate */
+	sel_t* RESTRICT sel[2];
+
+	/* Of each attribute, by the tuple's position in the vector; only those a later
+	 * loop uses are ever written */
+	StepValues<Attributes, StepVectorOf> vectors;
+
+	KernelPipeline(const lineitem& li, size_t core) : BaseKernel(li) {
+		tracks_groups = true;
+		kernel_compact_init(core);
+
+		sel[0] = new_array<sel_t>(kVectorsize);
+		sel[1] = new_array<sel_t>(kVectorsize);
+		AllocateVectors(Attributes());
+	}
+
+	template<typename COLUMNS>
+	void UseColumns(const COLUMNS& columns) {
+		kernel_compact_init_from(columns);
+	}
+
+	/* Of step k: the number of boundaries before it */
+	static constexpr size_t StageOf(size_t k) {
+		const bool boundary[] = { std::is_same<Steps, Materialize>::value..., false };
+		size_t stage = 0;
+		for (size_t s=0; s<k; s++) {
+			stage += boundary[s];
+		}
+		return stage;
+	}
+
+	static constexpr size_t kNumStages = StageOf(kNumSteps) + 1;
+
+	/* Of the step computing attribute A */
+	template<typename A>
+	static constexpr size_t Producer() {
+		const bool produces[] = { std::is_same<Steps, A>::value..., false };
+		size_t k = 0;
+		while (k < kNumSteps && !produces[k]) {
+			k++;
+		}
+		return k;
+	}
+
+	/* Does any of steps [first_step, last_step] of stages [first, last] use attribute A? */
+	template<typename A>
+	static constexpr bool Consumed(size_t first, size_t last, size_t first_step = 0, size_t last_step = kNumSteps) {
+		const bool consumes[] = { StepListContains<A, typename Steps::Inputs>::value..., false };
+		for (size_t k=first_step; k<=last_step && k<kNumSteps; k++) {
+			if (consumes[k] && StageOf(k) >= first && StageOf(k) <= last) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	NOINL void operator()() {
+		task(0, li.l_extendedprice.cardinality);
+	}
+
+	NOINL void task(size_t offset, size_t morsel_num) {
+		date = CompactThreshold();
+
+		for (size_t base=offset; base<offset+morsel_num; base+=kVectorsize) {
+			const size_t n = std::min(kVectorsize, offset + morsel_num - base);
+			stage(std::integral_constant<size_t, 0>(), base, nullptr, n);
+		}
+	}
+
+private:
+	template<typename... Attrs>
+	void AllocateVectors(StepList<Attrs...>) {
+		vectors.values = std::make_tuple(new_array<typename Attrs::type>(kVectorsize)...);
+	}
+
+	/* The values of earlier stages which stage S uses */
+	template<size_t S, typename... Attrs>
+	void Load(StepList<Attrs...>, Values& values, size_t j) {
+		int expand[] = { 0, (Load<S, Attrs>(values, j), 0)... };
+		(void)expand;
+	}
+
+	template<size_t S, typename A>
+	void Load(Values& values, size_t j) {
+		static_assert(!Consumed<A>(0, kNumStages, 0, Producer<A>()), "A step uses an attribute computed by a later step");
+		constexpr bool load = StageOf(Producer<A>()) < S && Consumed<A>(S, S);
+		if (load) {
+			values.template get<A>() = vectors.template get<A>()[j];
+		}
+	}
+
+	/* The values of stage S which later stages use */
+	template<size_t S, typename... Attrs>
+	void Store(StepList<Attrs...>, Values& values, size_t j) {
+		int expand[] = { 0, (Store<S, Attrs>(values, j), 0)... };
+		(void)expand;
+	}
+
+	template<size_t S, typename A>
+	void Store(Values& values, size_t j) {
+		constexpr bool store = StageOf(Producer<A>()) == S && Consumed<A>(S + 1, kNumStages);
+		if (store) {
+			vectors.template get<A>()[j] = values.template get<A>();
+		}
+	}
+
+	/* One fused loop: over the whole vector, for the first stage, and over the tuples the
+	 * previous one selected for the others */
+	template<size_t S>
+	void stage(std::integral_constant<size_t, S>, size_t base, const sel_t* RESTRICT in, size_t num) {
+		constexpr bool last = S + 1 == kNumStages;
+		sel_t* RESTRICT out = sel[S % 2];
+		size_t selected = 0;
+
+		for (size_t p=0; p<num; p++) {
+			const size_t j = S == 0 ? p : in[p];
+			Values values {};
+			Load<S>(Attributes(), values, j);
+			const bool qualifies = StepStage<KernelPipeline, S, 0, Steps...>::Run(*this, values, base + j);
+			if (!last) {
+				Store<S>(Attributes(), values, j);
+				out[selected] = j;
+				selected += qualifies;
+			}
+		}
+
+		if (!last && selected > 0) {
+			stage(std::integral_constant<size_t, last ? S : S + 1>(), base, out, selected);
+		}
+	}
+};
+
+/* bound to std::min()'s references, hence defined (C++14) */
+template<typename... Steps>
+constexpr size_t KernelPipeline<Steps...>::kVectorsize;
+
+/* Q1's steps, over the compact columns (see ComprData), as KernelNaiveCompact computes them */
+
+/* Ship dates up to the threshold; NULL ones never qualify (see ComprData::kNullShipDate) */
+struct Q1Select {
+	using type = void;
+	using Inputs = StepList<>;
+
+	template<typename K, typename V>
+	static bool Run(K& k, V&, size_t i) {
+		return k.l_shipdate[i] <= k.date;
+	}
+};
+
+struct Q1Disc1 {
+	using type = int8_t;
+	using Inputs = StepList<>;
+
+	template<typename K, typename V>
+	static bool Run(K& k, V& values, size_t i) {
+		values.template get<Q1Disc1>() = (int8_t)Decimal64::ToValue(1, 0) - k.l_discount[i];
+		return true;
+	}
+};
+
+struct Q1Tax1 {
+	using type = int8_t;
+	using Inputs = StepList<>;
+
+	template<typename K, typename V>
+	static bool Run(K& k, V& values, size_t i) {
+		values.template get<Q1Tax1>() = (int8_t)Decimal64::ToValue(1, 0) + k.l_tax[i];
+		return true;
+	}
+};
+
+/* NULL prices are stored as 0 (see ComprData), hence count for nothing */
+struct Q1DiscPrice {
+	using type = int32_t;
+	using Inputs = StepList<Q1Disc1>;
+
+	template<typename K, typename V>
+	static bool Run(K& k, V& values, size_t i) {
+		values.template get<Q1DiscPrice>() = values.template get<Q1Disc1>() * k.l_extendedprice[i];
+		return true;
+	}
+};
+
+struct Q1Charge {
+	using type = int64_t;
+	using Inputs = StepList<Q1DiscPrice, Q1Tax1>;
+
+	template<typename K, typename V>
+	static bool Run(K&, V& values, size_t) {
+		values.template get<Q1Charge>() = (int64_t)values.template get<Q1DiscPrice>() * values.template get<Q1Tax1>();
+		return true;
+	}
+};
+
+/* The AggrHashTable index: (l_returnflag << 8) | l_linestatus */
+struct Q1Group {
+	using type = uint16_t;
+	using Inputs = StepList<>;
+
+	template<typename K, typename V>
+	static bool Run(K& k, V& values, size_t i) {
+		const uint16_t g = (uint16_t)(k.l_returnflag[i] << 8) | (uint8_t)k.l_linestatus[i];
+		k.Touch(g);
+		values.template get<Q1Group>() = g;
+		return true;
+	}
+};
+
+struct Q1Aggregate {
+	using type = void;
+	using Inputs = StepList<Q1Group, Q1DiscPrice, Q1Charge>;
+
+	template<typename K, typename V>
+	static bool Run(K& k, V& values, size_t i) {
+		auto& a = k.aggrs0[values.template get<Q1Group>()];
+		a.sum_quantity += k.l_quantity[i];
+		a.sum_base_price += k.l_extendedprice[i];
+		a.sum_disc_price = int128_add64(a.sum_disc_price, values.template get<Q1DiscPrice>());
+		a.sum_charge = int128_add64(a.sum_charge, values.template get<Q1Charge>());
+		a.sum_disc += k.l_discount[i];
+		a.count++;
+		return true;
+	}
+};
+
+/* Q1 at the fusion points worth comparing: none, after the select, and also after the maps */
+using KernelPipelineFused = KernelPipeline<Q1Select, Q1Disc1, Q1Tax1, Q1DiscPrice, Q1Charge, Q1Group, Q1Aggregate>;
+using KernelPipelineSelect = KernelPipeline<Q1Select, Materialize,
+	Q1Disc1, Q1Tax1, Q1DiscPrice, Q1Charge, Q1Group, Q1Aggregate>;
+using KernelPipelineSelectMaps = KernelPipeline<Q1Select, Materialize,
+	Q1Disc1, Q1Tax1, Q1DiscPrice, Q1Charge, Q1Group, Materialize, Q1Aggregate>;
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef H_KERNEL_SNAPSHOT
+#define H_KERNEL_SNAPSHOT
+
+#include "../common.hpp"
+#include "../worker_pool.hpp"
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstring>
+
+/* The compact columns as a table which keeps changing while it's queried: rows are
+ * appended to fixed-size column segments, and deleted by position. Every change
+ * publishes a new immutable snapshot - the cardinality, and each segment's rows and
+ * bitmaps as of that epoch - and a query runs on the snapshot which is current when it
+ * starts, however long it takes. Writers are serialised among themselves, but never
+ * block readers, which merely load the current snapshot. A row's data is never written
+ * once any snapshot includes it; bitmaps are copied on write instead. Segments and
+ * bitmaps are reference-counted by the snapshots, and reclaimed once no snapshot refers
+ * to them - such as the old bitmaps, or segments all of whose rows have been deleted. */
+struct LiveTable {
+	static constexpr size_t kSegmentRows = 64*1024;
+	static constexpr size_t kContainers = kSegmentRows / 32;
+
+	/* Bit r % 32 of container r / 32 for row r of a segment, like Column::validity */
+	using Bitmap = std::vector<uint32_t>;
+
+	struct Segment {
+		kernel_compact_declare
+
+		Segment() {
+#define alloc_column(col) \
+			l_##col = static_cast<decltype(l_##col)>(aligned_alloc(4*1024, kSegmentRows * sizeof(l_##col[0])));
+			alloc_column(shipdate);
+			alloc_column(returnflag);
+			alloc_column(linestatus);
+			alloc_column(discount);
+			alloc_column(tax);
+			alloc_column(extendedprice);
+			alloc_column(quantity);
+#undef alloc_column
+			/* the bitmaps belong to the snapshots */
+			l_shipdate_validity = nullptr;
+			l_extendedprice_validity = nullptr;
+		}
+
+		~Segment() {
+			free(l_shipdate);
+			free(l_returnflag);
+			free(l_linestatus);
+			free(l_discount);
+			free(l_tax);
+			free(l_extendedprice);
+			free(l_quantity);
+		}
+
+		Segment(const Segment&) = delete;
+		Segment& operator=(const Segment&) = delete;
+	};
+
+	/* A segment as of some snapshot. nullptr bitmaps mean all bits are set. */
+	struct SegmentVersion {
+		std::shared_ptr<Segment> segment; /* nullptr once all its rows were deleted */
+		std::shared_ptr<const Bitmap> selectable; /* l_shipdate is non-NULL, and the row isn't deleted */
+		std::shared_ptr<const Bitmap> extendedprice_valid;
+		std::shared_ptr<const Bitmap> deleted; /* nullptr if none is */
+		size_t rows = 0;
+		size_t num_deleted = 0;
+
+		/* The segment's columns, for a kernel's UseColumns(). Deleted rows appear as NULL
+		 * ship dates, which the scan's selection already excludes. */
+		struct Columns {
+			kernel_compact_declare
+
+			Columns(const SegmentVersion& version) {
+				kernel_compact_init_from(*version.segment);
+				l_shipdate_validity = Data(version.selectable);
+				l_extendedprice_validity = Data(version.extendedprice_valid);
+			}
+
+		private:
+			static uint32_t* Data(const std::shared_ptr<const Bitmap>& bits) {
+				return bits ? const_cast<uint32_t*>(bits->data()) : nullptr;
+			}
+		};
+	};
+
+	struct Snapshot {
+		uint64_t epoch = 0;
+		size_t cardinality = 0; /* including deleted rows; row r is in segment r / kSegmentRows */
+		size_t num_deleted = 0;
+		std::vector<SegmentVersion> segments;
+	};
+
+	std::shared_ptr<const Snapshot> GetSnapshot() const {
+		return std::atomic_load(&current);
+	}
+
+	/* Appends rows [first, first+num) of another set of compact columns, e.g. ComprData */
+	template<typename COLUMNS>
+	void Append(const COLUMNS& src, size_t first, size_t num) {
+		std::unique_lock<std::mutex> guard(write_lock);
+		auto next = std::make_shared<Snapshot>(*GetSnapshot());
+		next->epoch++;
+
+		while (num > 0) {
+			const size_t s = next->cardinality / kSegmentRows;
+			if (s == next->segments.size()) {
+				next->segments.emplace_back();
+				next->segments.back().segment = std::make_shared<Segment>();
+			}
+			auto& version = next->segments[s];
+			auto& seg = *version.segment;
+			const size_t pos = next->cardinality % kSegmentRows;
+			const size_t n = std::min(kSegmentRows - pos, num);
+
+#define append_column(col) \
+			memcpy(seg.l_##col + pos, src.l_##col + first, n * sizeof(seg.l_##col[0]));
+			append_column(shipdate);
+			append_column(returnflag);
+			append_column(linestatus);
+			append_column(discount);
+			append_column(tax);
+			append_column(extendedprice);
+			append_column(quantity);
+#undef append_column
+
+			/* bitmaps of other snapshots may share containers with the new rows */
+			std::shared_ptr<Bitmap> selectable, extendedprice_valid;
+			for (size_t i=0; i<n; i++) {
+				if (!IsSet(src.l_shipdate_validity, first + i)) {
+					Clear(Writable(version.selectable, selectable), pos + i);
+				}
+				if (!IsSet(src.l_extendedprice_validity, first + i)) {
+					Clear(Writable(version.extendedprice_valid, extendedprice_valid), pos + i);
+				}
+			}
+
+			version.rows += n;
+			next->cardinality += n;
+			first += n;
+			num -= n;
+		}
+
+		std::atomic_store(&current, std::shared_ptr<const Snapshot>(std::move(next)));
+	}
+
+	/* Deletes rows by position; returns how many of them weren't deleted already */
+	size_t Delete(const std::vector<size_t>& rows) {
+		std::unique_lock<std::mutex> guard(write_lock);
+		auto next = std::make_shared<Snapshot>(*GetSnapshot());
+		next->epoch++;
+
+		std::vector<std::shared_ptr<Bitmap>> selectable(next->segments.size());
+		std::vector<std::shared_ptr<Bitmap>> deleted(next->segments.size());
+		size_t num = 0;
+		for (size_t row : rows) {
+			const size_t s = row / kSegmentRows;
+			const size_t pos = row % kSegmentRows;
+			if (row >= next->cardinality || !next->segments[s].segment) {
+				continue;
+			}
+			auto& version = next->segments[s];
+			if (version.deleted && IsSet(version.deleted->data(), pos)) {
+				continue;
+			}
+			if (!deleted[s]) {
+				/* initially, no row of the segment is deleted: all bits clear */
+				deleted[s] = std::make_shared<Bitmap>(version.deleted ? *version.deleted : Bitmap(kContainers, 0));
+				version.deleted = deleted[s];
+			}
+			(*deleted[s])[pos / 32] |= 1u << (pos % 32);
+			Clear(Writable(version.selectable, selectable[s]), pos);
+			version.num_deleted++;
+			num++;
+		}
+		next->num_deleted += num;
+
+		/* Reclaim the segments left empty, except for the one being appended to */
+		for (size_t s=0; s+1<next->segments.size(); s++) {
+			auto& version = next->segments[s];
+			if (version.segment && version.num_deleted == version.rows) {
+				version.segment = nullptr;
+				version.selectable = version.extendedprice_valid = version.deleted = nullptr;
+			}
+		}
+
+		std::atomic_store(&current, std::shared_ptr<const Snapshot>(std::move(next)));
+		return num;
+	}
+
+	static LiveTable& Get(const lineitem& li) {
+		static std::mutex lock;
+		static LiveTable* table = nullptr;
+
+		std::unique_lock<std::mutex> guard(lock);
+		if (!table) {
+			auto& source = *ComprData::Get(li, 0);
+			source.DecodeFlags();
+			table = new LiveTable();
+			table->Append(source, 0, li.l_extendedprice.cardinality);
+		}
+		return *table;
+	}
+
+private:
+	std::shared_ptr<const Snapshot> current = std::make_shared<Snapshot>();
+	std::mutex write_lock;
+
+	static bool IsSet(const uint32_t* bits, size_t i) {
+		return !bits || ((bits[i / 32] >> (i % 32)) & 1);
+	}
+
+	static void Clear(Bitmap& bits, size_t i) {
+		bits[i / 32] &= ~(1u << (i % 32));
+	}
+
+	/* Replaces a snapshot's bitmap by a private copy - once per change - for modifying */
+	static Bitmap& Writable(std::shared_ptr<const Bitmap>& bits, std::shared_ptr<Bitmap>& copy) {
+		if (!copy) {
+			copy = std::make_shared<Bitmap>(bits ? *bits : Bitmap(kContainers, ~0u));
+			bits = copy;
+		}
+		return *copy;
+	}
+};
+
+/* Runs KERNEL (e.g. KernelX100) on a snapshot of the LiveTable; rows appended or deleted
+ * meanwhile don't affect the query. The segments are the morsels: the pool's workers,
+ * one per CPU of the placement and each with a KERNEL of its own, take them in turn,
+ * and the last to finish adds up their partial results. */
+template<typename KERNEL>
+struct KernelSnapshot : BaseKernel {
+	static_assert(KERNEL::kHonoursValidity, "The snapshots' deleted rows are only cleared in l_shipdate_validity");
+
+	std::vector<KERNEL*> states;
+	Placement placement;
+	WorkerPool::Team team;
+	LiveTable& table;
+
+	struct QueryJob : WorkerPool::Job {
+		KernelSnapshot& scan;
+		QueryJob(KernelSnapshot& scan) : scan(scan) {}
+		void Run(size_t id) override { scan.Query(id); }
+	} query_job { *this };
+
+	/* of the query running */
+	std::shared_ptr<const LiveTable::Snapshot> snapshot;
+	alignas(64) std::atomic<size_t> next_segment;
+	alignas(64) std::atomic<size_t> workers_left;
+
+	/* of the last query */
+	uint64_t epoch = 0;
+	size_t cardinality = 0;
+
+	KernelSnapshot(const lineitem& li, bool wo_core0 = false)
+	 : BaseKernel(li, KERNEL::GroupsOf(li)), table(LiveTable::Get(li)) {
+		tracks_groups = true; /* those AddGroups() touches */
+		placement = Placement::Make(Placement::default_policy, true, wo_core0);
+		team = WorkerPool::Get().GetTeam(placement);
+		states.resize(team.size(), nullptr);
+
+		/* on the workers, so that their states' memory is local to their CPUs */
+		WorkerPool::Get().Run(team, [this] (size_t id) {
+			states[id] = new KERNEL(this->li, placement.cpus[id]);
+		});
+	}
+
+	~KernelSnapshot() {
+		for (auto& s : states) {
+			delete s;
+		}
+	}
+
+	NOINL void operator()() {
+		snapshot = table.GetSnapshot();
+		epoch = snapshot->epoch;
+		cardinality = snapshot->cardinality - snapshot->num_deleted;
+
+		next_segment.store(0, std::memory_order_relaxed);
+		workers_left.store(states.size(), std::memory_order_relaxed);
+		WorkerPool::Get().Submit(query_job, team);
+		WorkerPool::Get().Wait(query_job);
+
+		snapshot = nullptr;
+	}
+
+	NOINL void Query(size_t id) {
+		auto& s = *states[id];
+		const auto& segments = snapshot->segments;
+
+		for (size_t i = next_segment.fetch_add(1); i < segments.size(); i = next_segment.fetch_add(1)) {
+			const auto& version = segments[i];
+			if (version.segment) {
+				s.UseColumns(LiveTable::SegmentVersion::Columns(version));
+				s.task(0, version.rows);
+			}
+		}
+
+		/* Only the last worker writes the global table */
+		if (workers_left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			for (auto& other : states) {
+				AddGroups(*other);
+				other->ClearGroups();
+			}
+		}
+	}
+
+	std::string DescribePlacement() const override {
+		return placement.Describe();
+	}
+
+	void SetThreshold(const monetdb::date_t& threshold) override {
+		BaseKernel::SetThreshold(threshold);
+		for (auto& s : states) {
+			s->SetThreshold(threshold);
+		}
+	}
+
+	void Clear() override {
+		for (auto& s : states) {
+			s->Clear();
+		}
+		BaseKernel::Clear();
+	}
+};
+
+#endif
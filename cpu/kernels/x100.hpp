@@ -2,17 +2,82 @@
 #define H_KERNEL_X100
 
 #include "../common.hpp"
+#include "../../src/util/bit_sliced_column.hpp"
+#include "../../src/util/range_encoded_bitmap_index.hpp"
 #include <cinttypes>
+#include <algorithm>
+#include <initializer_list>
 
 enum AggrFlavour {
-	k1Step, kMultiplePrims, kMagic, kMagicFused, kNoAggr
+	k1Step, kMultiplePrims, kMagic, kMagicFused, kNoAggr,
+	kMicroAdaptive /* kMagic or k1Step, and the select and maps' flavours, chosen per vector */
 };
 
 enum Avx512Flavour {
 	kNoAvx512, kCompare, kPopulationCount
 };
 
-template<AggrFlavour aggr_flavour, bool nsm, Avx512Flavour avx512 = kNoAvx512>
+enum ShipDateFlavour {
+	kShipDateValues, kShipDateBitSliced
+};
+
+/* The arithmetic of the maps and partial sums over a stretch of rows (see KernelX100::ArithFor()) */
+enum X100Arith {
+	kArithNarrow, /* 8-bit factors, 32-bit discounted prices and 64-bit sums, unchecked */
+	kArithChecked, /* the same, checked, any overflowing vector redone as kArithWide */
+	kArithWide, /* 64-bit factors and prices, 128-bit charges and sums */
+	kNumAriths
+};
+
+/* Micro adaptivity, as in Vectorwise: picks one of N flavours of a call site per vector,
+ * by the cycles per tuple each took lately - the median over kWindow calls, which an
+ * interrupt doesn't skew. It mostly exploits the cheapest, but every kExplorePeriod calls
+ * it runs each flavour for a window again, so that it follows the costs as they change,
+ * e.g. with the selectivity. */
+template<size_t N>
+struct MicroAdaptive {
+	static constexpr size_t kWindow = 16;
+	static constexpr size_t kExplorePeriod = 1024;
+
+	double cost[N] = {}; /* cycles per tuple of each flavour's last window */
+	size_t calls[N] = {};
+
+	size_t Choose() const {
+		return current;
+	}
+
+	void Update(uint64_t cycles, size_t tuples) {
+		calls[current]++;
+		window[window_calls++] = (double)cycles / (double)std::max<size_t>(tuples, 1);
+		if (window_calls < kWindow) {
+			return;
+		}
+
+		std::nth_element(window, window + kWindow/2, window + kWindow);
+		cost[current] = window[kWindow/2];
+		window_calls = 0;
+
+		since_exploration += kWindow;
+		if (since_exploration >= kExplorePeriod) {
+			since_exploration = 0;
+			explore = 0;
+		}
+		current = explore < N ? explore++ : Cheapest();
+	}
+
+private:
+	size_t current = 0;
+	size_t explore = 0; /* the next flavour to explore, N if none; at first, after warming up */
+	size_t since_exploration = 0;
+	double window[kWindow];
+	size_t window_calls = 0;
+
+	size_t Cheapest() const {
+		return std::min_element(cost, cost + N) - cost;
+	}
+};
+
+template<AggrFlavour aggr_flavour, bool nsm, Avx512Flavour avx512 = kNoAvx512, ShipDateFlavour shipdate_flavour = kShipDateValues>
 struct KernelX100 : BaseKernel {
 	static constexpr size_t kVectorsize = MAX_VSIZE;
 
@@ -20,7 +85,7 @@ struct KernelX100 : BaseKernel {
 	idx_t* RESTRICT lim;
 	idx_t* RESTRICT grp;
 
-	uint16_t** grppos;
+	uint16_t** grppos; /* two halves, of the group domain each */
 	uint16_t* selbuf;
 
 	int16_t* RESTRICT v_shipdate;
@@ -31,6 +96,8 @@ struct KernelX100 : BaseKernel {
 	int32_t* RESTRICT v_extendedprice;
 	int16_t* RESTRICT v_quantity;
 
+	int32_t* RESTRICT v_extendedprice_nonnull; /* NULLs replaced by 0, for vectors which have any */
+
 	int8_t* RESTRICT v_disc_1;
 	int8_t* RESTRICT v_tax_1;
 
@@ -39,19 +106,30 @@ struct KernelX100 : BaseKernel {
 	int64_t*  RESTRICT v_charge;
 	sel_t* RESTRICT v_sel;
 
+	const bit_sliced_column<uint16_t>* l_shipdate_bit_sliced = nullptr;
+	uint64_t* RESTRICT v_filter;
+
+	/* Of the columns scanned, if ComprData's, whose zones bound their values */
+	const ComprData* stats = nullptr;
+	size_t arith_choices[kNumAriths] = {};
+
 	kernel_compact_declare
 
 	#define scan(name) v_##name = (l_##name);
 	#define scan_epilogue(name) v_##name += chunk_size;
 
-	KernelX100(const lineitem& li, size_t core) : BaseKernel(li) {
-		grppos = new_array<uint16_t*>(kGrpPosSize);
+	static constexpr bool kHonoursValidity = true;
+
+	KernelX100(const lineitem& li, size_t core) : BaseKernel(li, GroupsOf(li)) {
+		tracks_groups = true;
+		grppos = new_array<uint16_t*>(2 * groups.Size());
 		selbuf = new_array<uint16_t>(kSelBufSize);
 		pos = new_array<idx_t>(kVectorsize);
 		lim = new_array<idx_t>(kVectorsize);
 		grp = new_array<idx_t>(kVectorsize);
 
 		kernel_compact_init(core);
+		stats = ComprData::GetCore(li, core);
 
 		v_shipdate = new_array<int16_t>(kVectorsize);
 
@@ -65,6 +143,7 @@ struct KernelX100 : BaseKernel {
 		v_extendedprice = new_array<int32_t>(kVectorsize);
 
 		v_quantity = new_array<int16_t>(kVectorsize);
+		v_extendedprice_nonnull = new_array<int32_t>(kVectorsize);
 
 
 
@@ -76,6 +155,66 @@ struct KernelX100 : BaseKernel {
 		v_charge = new_array<int64_t>(kVectorsize);
 
 		v_sel = new_array<sel_t>(kVectorsize);
+
+		v_filter = new_array<uint64_t>(kVectorsize / 64 + 1);
+		if (shipdate_flavour == kShipDateBitSliced) {
+			l_shipdate_bit_sliced = &ComprData::GetCore(li, core)->GetShipDateBitSliced();
+		}
+	}
+
+	/* Without AVX-512, the group ids are map_gid2_dom_restrict()'s, relative to the flags'
+	 * minima: some 160 for TPC-H's. With the minima unknown, each flag may take 256. */
+	static GroupDomain GroupsOf(const lineitem& li) {
+		if (avx512 != kNoAvx512) {
+			return GroupDomain::Of(li);
+		}
+		const auto& rf = li.l_returnflag.minmax;
+		const auto& ls = li.l_linestatus.minmax;
+		const size_t rf_range = rf.min <= rf.max ? rf.max - rf.min : 255;
+		const size_t ls_range = ls.min <= ls.max ? ls.max - ls.min : 255;
+		const uint8_t d = (int8_t)ls.max - (int8_t)ls.min;
+
+		GroupDomain domain;
+		domain.begin = 0;
+		domain.end = rf_range * d + ls_range + 1;
+		return domain;
+	}
+
+	/* Scan other compact columns than this core's ComprData replica */
+	template<typename COLUMNS>
+	void UseColumns(const COLUMNS& columns) {
+		static_assert(shipdate_flavour == kShipDateValues, "The bit-sliced ship dates belong to the replica");
+		kernel_compact_init_from(columns);
+		stats = nullptr;
+	}
+
+	/* The narrowest arithmetic which the ranges of the values in rows [first, end) prove
+	 * safe: the ranges of the maps' results, and of the sums of a vector of them, by
+	 * interval arithmetic over the ranges of the columns' values in the rows' zones.
+	 * Without zones - e.g. for other columns than ComprData's, or shared ones published
+	 * without them - the maps are checked. */
+	X100Arith ArithFor(size_t first, size_t end) const {
+		if (!stats || !stats->HasZones()) {
+			return kArithChecked;
+		}
+		const ValueRange one(Decimal64::ToValue(1, 0), Decimal64::ToValue(1, 0));
+		const auto discount = ComprData::RangeOf(stats->l_discount_zones, first, end);
+		const auto tax = ComprData::RangeOf(stats->l_tax_zones, first, end);
+		/* NULL prices are zeroed, whatever is stored for them */
+		const auto price = ComprData::RangeOf(stats->l_extendedprice_zones, first, end).Union(ValueRange(0, 0));
+		const auto quantity = ComprData::RangeOf(stats->l_quantity_zones, first, end);
+
+		const auto disc_1 = one - discount;
+		const auto tax_1 = one + tax;
+		const auto disc_price = disc_1 * price;
+		const auto charge = disc_price * tax_1;
+
+		const bool narrow = disc_1.Fits<int8_t>() && tax_1.Fits<int8_t>() &&
+			disc_price.Fits<int32_t>() && charge.Fits<int64_t>() &&
+			quantity.Sum(kVectorsize).Fits<int64_t>() && price.Sum(kVectorsize).Fits<int64_t>() &&
+			disc_price.Sum(kVectorsize).Fits<int64_t>() && charge.Sum(kVectorsize).Fits<int64_t>() &&
+			disc_1.Sum(kVectorsize).Fits<int64_t>();
+		return narrow ? kArithNarrow : kArithWide;
 	}
 
     struct ExprProf {
@@ -95,6 +234,22 @@ struct KernelX100 : BaseKernel {
 	int64_t prof_num_strides = 0;
 #endif
 
+	/* The flavours kMicroAdaptive chooses from */
+	enum SelectFlavour {
+		kSelectBranching, kSelectDataDependent, kNumSelectFlavours
+	};
+	enum MapFlavour {
+		kMapSelective, kMapFull /* all tuples up to the last selected one */,
+		kMapBitmap /* all tuples, the select writing a bitmap without branches */, kNumMapFlavours
+	};
+	enum ShuffleFlavour {
+		kShuffleOrdAggr, kShuffleParOrdAggr, kDirectAggr /* k1Step */, kNumShuffleFlavours
+	};
+
+	MicroAdaptive<kNumSelectFlavours> adaptive_select;
+	MicroAdaptive<kNumMapFlavours> adaptive_map;
+	MicroAdaptive<kNumShuffleFlavours> adaptive_aggr;
+
     template<typename T>
     auto ProfileLambda(ExprProf& prof, size_t tuples, T&& fun) {
 #ifdef PROFILE
@@ -130,6 +285,23 @@ struct KernelX100 : BaseKernel {
 		p(aggr_count);
 
 		printf("aggr on full vector (no tuples filtered) %" PRId64 "/%" PRId64 "\n", prof_num_full_aggr, prof_num_strides);
+		printf("arithmetic chosen: narrow %zu, checked %zu, wide %zu times\n",
+			arith_choices[kArithNarrow], arith_choices[kArithChecked], arith_choices[kArithWide]);
+
+		if (aggr_flavour == kMicroAdaptive) {
+			auto q = [] (const char* name, const auto& choice, std::initializer_list<const char*> flavours) {
+				printf("%s:", name);
+				size_t f = 0;
+				for (auto flavour : flavours) {
+					printf(" %s %zu calls (%.2f cycles/tuple lately)", flavour, choice.calls[f], choice.cost[f]);
+					f++;
+				}
+				printf("\n");
+			};
+			q("select", adaptive_select, {"branching", "data-dependent"});
+			q("maps", adaptive_map, {"selective", "full", "bitmap"});
+			q("aggr", adaptive_aggr, {"shuffle", "shuffle par", "direct"});
+		}
 #endif
 	}
 
@@ -144,13 +316,11 @@ struct KernelX100 : BaseKernel {
 		 * because C++ compilers will produce invalid results together with magic_preaggr (d270d85b8dcef5f295b1c10d4b2336c9be858541)
 		 * Moving allocations to class fixed these issues which will be triggered with O1, O2 and O3 */
 	
-#ifdef GPU
-		const int16_t date = (int32_t)cmp.dte_val - (int32_t)727563;
-#else
-		const int16_t date = cmp.dte_val;
-#endif
+		const int16_t date = CompactThreshold();
 		const int8_t int8_t_one_discount = (int8_t)Decimal64::ToValue(1, 0);
 		const int8_t int8_t_one_tax = (int8_t)Decimal64::ToValue(1, 0);
+		X100Arith arith = kArithChecked;
+		size_t arith_end = offset; /* of the rows arith was chosen for */
 
 		scan(shipdate);
 		v_shipdate += offset;
@@ -181,15 +351,67 @@ struct KernelX100 : BaseKernel {
 
 			size_t n = chunk_size;
 
+			/* Vectors without NULLs take the same path as non-nullable columns do */
+			const size_t first_row = offset + done;
+			const bool shipdate_nonnull = Primitives::all_valid(l_shipdate_validity, first_row, n);
+
+			/* Chosen afresh for each zone or so, so that outliers only widen their own */
+			if (first_row + chunk_size > arith_end) {
+				arith_end = std::min(offset + morsel_num,
+					(first_row + chunk_size + ComprData::kZoneRows - 1) / ComprData::kZoneRows * ComprData::kZoneRows);
+				arith = ArithFor(first_row, arith_end);
+				arith_choices[arith]++;
+			}
+
+			/* Times the flavour kMicroAdaptive chose, per tuple of the vector. Not with ProfileLambda(),
+			 * whose counters are only kept with PROFILE, and which times single primitives: a map or
+			 * aggregation flavour spans several, and a vector may leave them early, on overflow. The
+			 * maps are timed from the select on, as their bitmap flavour does the select itself. */
+			const bool adaptive = aggr_flavour == kMicroAdaptive;
+			const uint64_t vector_start = adaptive ? get_cycles() : 0;
+			uint64_t adaptive_start = vector_start;
+			auto adapted = [&] (auto& choice, uint64_t since) {
+				const uint64_t now = get_cycles();
+				choice.Update(now - since, chunk_size);
+				adaptive_start = now;
+			};
+
+			/* Where the select can't write the bitmap - it's bit-sliced, or the NULLs' bits aren't
+			 * word aligned - the bitmap flavour is the full one */
+			const bool map_bitmap = adaptive && adaptive_map.Choose() == kMapBitmap &&
+				shipdate_flavour == kShipDateValues && (shipdate_nonnull || first_row % 32 == 0);
+			const bool data_dep = !adaptive || adaptive_select.Choose() == kSelectDataDependent;
 			const size_t num = ProfileLambda(prof_select, n,
 				[&] () { 
+					if (map_bitmap) {
+						Primitives::filter_int16_t(v_filter, n, v_shipdate, date);
+						if (!shipdate_nonnull) {
+							Primitives::filter_and_validity(v_filter, n, l_shipdate_validity, first_row);
+						}
+						return Primitives::select_bitmap(sel, n, v_filter);
+					}
+					if (shipdate_flavour == kShipDateBitSliced && date >= 0 &&
+							first_row % bit_sliced_column<uint16_t>::rows_per_block == 0) {
+						l_shipdate_bit_sliced->less_or_equal((uint16_t)date, first_row, n, v_filter);
+						if (!shipdate_nonnull) {
+							Primitives::filter_and_validity(v_filter, n, l_shipdate_validity, first_row);
+						}
+						return Primitives::select_bitmap(sel, n, v_filter);
+					}
+					if (!shipdate_nonnull) {
+						return Primitives::select_int16_t_nullable(sel, nullptr, n, data_dep, v_shipdate, date, l_shipdate_validity, first_row);
+					}
 					if (avx512 == kNoAvx512) {
-						return Primitives::select_int16_t(sel, nullptr, n, false, v_shipdate, date);
+						return Primitives::select_int16_t(sel, nullptr, n, data_dep, v_shipdate, date);
 					} else {
-						return Primitives::select_int16_t_avx512(sel, nullptr, n, false, v_shipdate, date);
+						return Primitives::select_int16_t_avx512(sel, nullptr, n, data_dep, v_shipdate, date);
 					}
 				});
 
+			if (adaptive && !map_bitmap) {
+				adapted(adaptive_select, adaptive_start);
+			}
+
 			if (!num) {
 				scan_epilogue(returnflag);
 				scan_epilogue(linestatus);
@@ -202,7 +424,12 @@ struct KernelX100 : BaseKernel {
 				continue;
 			}
 
-			if (num > kVectorsize / 2) {
+			/* Only choose when there is a choice, i.e. not all tuples were selected - or was made already */
+			const bool choose_map = adaptive && (map_bitmap || num != n);
+			const bool full = choose_map ? adaptive_map.Choose() != kMapSelective : num > kVectorsize / 2;
+			if (map_bitmap) {
+				sel = nullptr;
+			} else if (full) {
 				if (num != n)
 					n = sel[num-1]+1;
 				sel = nullptr;
@@ -227,22 +454,72 @@ struct KernelX100 : BaseKernel {
 				}
 			});
 
-			ProfileLambda(prof_map_disc_1, n, [&] () {
-				return Primitives::map_disc_1(v_disc_1, sel, n, int8_t_one_discount, v_discount);
-			});
+			/* SUMs skip NULLs: zeroing NULL prices zeroes the discounted prices and charges derived from them, too.
+			 * The selected positions range over the whole chunk, whereas n may have become their number. */
+			int32_t* RESTRICT v_price = v_extendedprice;
+			if (!Primitives::all_valid(l_extendedprice_validity, first_row, chunk_size)) {
+				Primitives::map_zero_nulls_int32_t(v_extendedprice_nonnull, sel, n, v_extendedprice, l_extendedprice_validity, first_row);
+				v_price = v_extendedprice_nonnull;
+			}
 
-			ProfileLambda(prof_map_tax_1, n, [&] () {
-				return Primitives::map_tax_1(v_tax_1, sel, n, v_tax, int8_t_one_tax);
-			});
+			/* As ArithFor() proves safe: unchecked, checked - any result which overflowed
+			 * having the vector redone with wider types - or wide right away */
+			bool overflow = arith == kArithWide;
+			if (arith == kArithNarrow) {
+				ProfileLambda(prof_map_disc_1, n, [&] () {
+					return Primitives::map_disc_1_unchecked(v_disc_1, sel, n, int8_t_one_discount, v_discount);
+				});
 
-			ProfileLambda(prof_map_disc_price, n, [&] () {
-				return Primitives::map_disc_price(v_disc_price, sel, n, v_disc_1, v_extendedprice);			
-			});
+				ProfileLambda(prof_map_tax_1, n, [&] () {
+					return Primitives::map_tax_1_unchecked(v_tax_1, sel, n, v_tax, int8_t_one_tax);
+				});
+
+				ProfileLambda(prof_map_disc_price, n, [&] () {
+					return Primitives::map_disc_price_unchecked(v_disc_price, sel, n, v_disc_1, v_price);
+				});
+			} else if (arith == kArithChecked) {
+				overflow = ProfileLambda(prof_map_disc_1, n, [&] () {
+					return Primitives::map_disc_1(v_disc_1, sel, n, int8_t_one_discount, v_discount);
+				});
+
+				overflow |= ProfileLambda(prof_map_tax_1, n, [&] () {
+					return Primitives::map_tax_1(v_tax_1, sel, n, v_tax, int8_t_one_tax);
+				});
+
+				overflow |= ProfileLambda(prof_map_disc_price, n, [&] () {
+					return Primitives::map_disc_price(v_disc_price, sel, n, v_disc_1, v_price);
+				});
+			}
+
+			if (UNLIKELY(overflow)) {
+				sel_t* wide_sel = num == chunk_size ? nullptr : v_sel;
+				if (aggr_flavour != kNoAggr) {
+					aggregate_wide(wide_sel, num, v_price);
+				}
+				if (adaptive) {
+					adaptive_start = get_cycles();
+				}
+				scan_epilogue(returnflag);
+				scan_epilogue(linestatus);
+				scan_epilogue(shipdate);
+				scan_epilogue(discount);
+				scan_epilogue(tax);
+				scan_epilogue(extendedprice);
+				scan_epilogue(quantity);
+				done += chunk_size;
+				continue;
+			}
 
 			ProfileLambda(prof_map_charge, n, [&] () {
 				return Primitives::map_charge(v_charge, v_disc_price, v_tax_1, sel, n);
 			});
 
+			if (choose_map) {
+				adapted(adaptive_map, vector_start);
+			} else if (adaptive) {
+				adaptive_start = get_cycles();
+			}
+
 #ifdef PROFILE
 			const auto prof_ag_start = rdtsc();
 #endif
@@ -252,14 +529,16 @@ struct KernelX100 : BaseKernel {
 			prof_num_full_aggr += num == chunk_size;
 			prof_num_strides++;
 #endif
-			switch (aggr_flavour) {
+			const size_t shuffle = adaptive ? adaptive_aggr.Choose() : (size_t)kShuffleOrdAggr;
+			switch (adaptive ? (shuffle == kDirectAggr ? k1Step : kMagic) : aggr_flavour) {
 			case kNoAggr:
+			case kMicroAdaptive:
 				break;
 
 			case kMagicFused:
 			case kMagic: {
-				auto gp0 = grppos;
-				auto gp1 = grppos + kGrpPosSize/2;
+				auto gp0 = grppos - groups.begin;
+				auto gp1 = grppos + groups.Size() - groups.begin;
 				auto sb0 = selbuf;
 				auto sb1 = selbuf + kSelBufSize/2;
 
@@ -270,7 +549,7 @@ struct KernelX100 : BaseKernel {
 				size_t num_groups;
 				switch (avx512) {
 				case kNoAvx512:
-					num_groups = Primitives::partial_shuffle_scalar(v_idx, aggr_sel, num, pos, lim, grp, gp0, gp1, sb0, sb1);
+					num_groups = Primitives::partial_shuffle_avx2(v_idx, aggr_sel, num, pos, lim, grp, gp0, gp1, sb0, sb1);
 					break;
 				case kCompare:
 					num_groups = Primitives::partial_shuffle_avx512_cmp(v_idx, v_sel, num, pos, lim, grp, gp0, gp1, sb0, sb1);
@@ -283,20 +562,24 @@ struct KernelX100 : BaseKernel {
 #ifdef PROFILE
 				sum_magic_time += rdtsc() - prof_magic_start;
 #endif
+				for (size_t k=0; k<num_groups; k++) {
+					Touch(grp[k]);
+				}
+
 				/* pre-aggregate */
 				if (aggr_flavour == kMagicFused) {
-					Primitives::ordaggr_all_in_one(aggrs0, pos, lim, grp, num_groups, v_quantity, v_extendedprice, v_disc_price, v_charge, v_disc_1);
+					Primitives::ordaggr_all_in_one(aggrs0, pos, lim, grp, num_groups, v_quantity, v_price, v_disc_price, v_charge, v_disc_1);
 				} else {
 					#define aggregate(prof, ag, vec) do { \
 							ProfileLambda(prof_aggr_##prof, n, [&] () { \
-								return avx512 == kNoAvx512 ? \
+								return avx512 == kNoAvx512 && shuffle == kShuffleOrdAggr ? \
 									Primitives::ordaggr_##ag(aggrs0, pos, lim, grp, num_groups, vec) : \
 									Primitives::par_ordaggr_##ag(aggrs0, pos, lim, grp, num_groups, vec); \
 							}); \
 						} while (false)
 
 					aggregate(quantity, quantity, v_quantity);
-					aggregate(base_price, extended_price, v_extendedprice);
+					aggregate(base_price, extended_price, v_price);
 					aggregate(disc_price, disc_price, v_disc_price);
 					aggregate(charge, charge, v_charge);
 					aggregate(disc, disc, v_disc_1);
@@ -314,16 +597,17 @@ struct KernelX100 : BaseKernel {
 			case k1Step:
 				Primitives::for_each(aggr_sel, num, [&] (auto i) {
 					const auto g = v_idx[i];
+					Touch(g);
 					if (nsm) {
 						aggrs0[g].sum_quantity += v_quantity[i];						
-						aggrs0[g].sum_base_price += v_extendedprice[i];
+						aggrs0[g].sum_base_price += v_price[i];
 						aggrs0[g].sum_disc_price = int128_add64(aggrs0[g].sum_disc_price, v_disc_price[i]);
 						aggrs0[g].sum_charge = int128_add64(aggrs0[g].sum_charge, v_charge[i]);
 						aggrs0[g].sum_disc += v_disc_1[i];
 						aggrs0[g].count ++;
 					} else {
 						aggr_dsm0_sum_quantity[g] += v_quantity[i];
-						aggr_dsm0_sum_base_price[g] += v_extendedprice[i];
+						aggr_dsm0_sum_base_price[g] += v_price[i];
 						aggr_dsm0_sum_disc_price[g] = int128_add64(aggr_dsm0_sum_disc_price[g], v_disc_price[i]);
 						aggr_dsm0_sum_charge[g] = int128_add64(aggr_dsm0_sum_charge[g], v_charge[i]);
 						aggr_dsm0_sum_disc[g] += v_disc_1[i];
@@ -347,9 +631,9 @@ struct KernelX100 : BaseKernel {
 				Primitives::for_each(aggr_sel, num, [&] (auto i) {
 					auto g = v_idx[i];
 					if (nsm) {
-						aggrs0[g].sum_base_price += v_extendedprice[i];
+						aggrs0[g].sum_base_price += v_price[i];
 					} else {
-						aggr_dsm0_sum_base_price[g] += v_extendedprice[i];
+						aggr_dsm0_sum_base_price[g] += v_price[i];
 					}
 				});
 				Primitives::for_each(aggr_sel, num, [&] (auto i) {
@@ -378,6 +662,7 @@ struct KernelX100 : BaseKernel {
 				});
 				Primitives::for_each(aggr_sel, num, [&] (auto i) {
 					auto g = v_idx[i];
+					Touch(g);
 					if (nsm) {
 						aggrs0[g].count ++;
 					} else {
@@ -387,6 +672,10 @@ struct KernelX100 : BaseKernel {
 				break;
 			}
 
+			if (adaptive) {
+				adapted(adaptive_aggr, adaptive_start);
+			}
+
 #ifdef PROFILE
 			sum_aggr_time += rdtsc() - prof_ag_start;
 #endif
@@ -401,15 +690,44 @@ struct KernelX100 : BaseKernel {
 		};
 	}
 
+	/* The selected tuples of a vector whose maps overflowed, or may, as k1Step aggregates them but
+	 * computing in 64 bits, and the charge in 128: the products of 32-bit prices and 8-bit
+	 * factors can't overflow those. The sums per group are 128 bits, or, for the others,
+	 * can't exceed 64 before 2^31 vectors. */
+	NOINL void aggregate_wide(sel_t* aggr_sel, size_t num, const int32_t* RESTRICT v_price) {
+		const int64_t one = Decimal64::ToValue(1, 0);
+
+		Primitives::for_each(aggr_sel, num, [&] (auto i) {
+			const auto g = v_idx[i];
+			const int64_t disc_1 = one - v_discount[i];
+			const int64_t disc_price = disc_1 * v_price[i];
+			const int128_t charge = (int128_t)disc_price * (one + v_tax[i]);
+			Touch(g);
+			if (nsm) {
+				aggrs0[g].sum_quantity += v_quantity[i];
+				aggrs0[g].sum_base_price += v_price[i];
+				aggrs0[g].sum_disc_price += disc_price;
+				aggrs0[g].sum_charge += charge;
+				aggrs0[g].sum_disc += disc_1;
+				aggrs0[g].count ++;
+			} else {
+				aggr_dsm0_sum_quantity[g] += v_quantity[i];
+				aggr_dsm0_sum_base_price[g] += v_price[i];
+				aggr_dsm0_sum_disc_price[g] += disc_price;
+				aggr_dsm0_sum_charge[g] += charge;
+				aggr_dsm0_sum_disc[g] += disc_1;
+				aggr_dsm0_count[g] ++;
+			}
+		});
+	}
+
 	#undef scan
 	#undef scan_epilogue
 
 };
 
-#include <thread>
 #include <atomic>
-#include <condition_variable>
-#include <mutex>
+#include "../worker_pool.hpp"
 
 // without stupid typedefs
 void precompute_filter_for_table_chunk(
@@ -422,209 +740,217 @@ void precompute_filter_for_table_chunk(
 template<typename KERNEL, bool full_system = true>
 struct Morsel : BaseKernel {
 
-	std::vector<std::thread> workers;
 	std::vector<KERNEL*> states;
 
-	size_t num_morsels;
-	std::atomic<size_t> morsel_start;
-	std::atomic<size_t> morsel_completed;
+	/* One worker of the process's pool per CPU of the placement (see topology.hpp);
+	 * the "one socket" variant keeps to the first socket whatever the policy */
+	Placement placement;
+	WorkerPool::Team team;
+
+	struct QueryJob : WorkerPool::Job {
+		Morsel& morsel;
+		QueryJob(Morsel& morsel) : morsel(morsel) {}
+		void Run(size_t id) override { morsel.Query(id); }
+	} query_job { *this };
+
+	/* A worker's share of the query's morsels, by index, on a cache line of its own */
+	struct alignas(64) MorselRange {
+		std::atomic<size_t> next;
+		size_t end;
+	};
 
-	std::mutex lock_query;
-	std::condition_variable cond_finished;
-	std::condition_variable cond_start;
+	/* Each worker takes the morsels of its own range first, then steals from the others'
+	 * - those of the workers on its NUMA node first. There is no cache line which all of
+	 * them keep writing, and each mostly scans its own stretch of the table. */
+	MorselRange* ranges;
+	std::vector<std::vector<size_t>> steal_order; /* per worker, starting with itself */
+	size_t morsels_offset; /* of morsel 0 */
 
-	size_t pushdown_cpu_start_offset;
+	/* The compact columns scanned, if partitioned over the nodes (see ComprData), whose
+	 * slices' morsels go to the workers on their nodes; otherwise null */
+	const ComprData* partitioned = nullptr;
+	std::vector<std::vector<size_t>> node_workers;
 
-	enum Stage {
-		UNCLEAR = 0,
-		DONE,
-		QUERY,
-		DTOR,
-	};
+	struct alignas(64) {
+		std::atomic<size_t> count;
+	} workers_left; /* yet to finish the query's morsels */
 
-	Stage stage;
+	size_t pushdown_cpu_start_offset;
 
 	size_t size;
 
 	void FilterPushDownShit(size_t offset, size_t num) {
 		static_assert(sizeof(compr_shipdate[0] ) == sizeof(uint16_t), "Wrong type");
-		precompute_filter_for_table_chunk(compr_shipdate + offset, precomp_filter + offset / 32, num);
+		const uint16_t threshold = (int32_t)cmp.dte_val - (int32_t)727563;
+		if (compr_shipdate_month_index) {
+			compr_shipdate_month_index->less_or_equal(threshold, offset, num, precomp_filter + offset / 32);
+		} else if (compr_shipdate_bit_sliced && offset % bit_sliced_column<uint16_t>::rows_per_block == 0) {
+			compr_shipdate_bit_sliced->less_or_equal(threshold, offset, num, precomp_filter + offset / 32);
+		} else {
+			precompute_filter_for_table_chunk(compr_shipdate + offset, precomp_filter + offset / 32, num);
+		}
 
 		precomp_filter_queue.enqueue(FilterChunk { offset, num});
 	}
 
+	static GroupDomain GroupsOf(const lineitem& li) {
+		return KERNEL::GroupsOf(li);
+	}
+
 	NOINL void Query(size_t id) {
 		assert(size > 0);
 		auto& s = *states[id];
 
-		// process all morsels
-		while (morsel_start < size) {
-			size_t offset = morsel_start.fetch_add(morsel_size);
-			if (offset >= size) {
-				break;
-			}
+		// process all morsels, own ones first
+		for (size_t victim : steal_order[id]) {
+			auto& range = ranges[victim];
 
-			size_t num = min(morsel_size, size - offset);
+			while (range.next.load(std::memory_order_relaxed) < range.end) {
+				const size_t morsel = range.next.fetch_add(1);
+				if (morsel >= range.end) {
+					break;
+				}
 
-			assert(offset < li.l_extendedprice.cardinality);
-			assert(offset + num <= li.l_extendedprice.cardinality);
+				size_t offset = morsels_offset + morsel * morsel_size;
+				size_t num = min(morsel_size, size - offset);
 
-			if (offset < pushdown_cpu_start_offset) {
-				FilterPushDownShit(offset, num);
-			} else {
-				s.task(offset, num);
-			}
+				assert(offset + num <= size);
 
-			if (morsel_completed++ >= num_morsels) {
-				std::unique_lock<std::mutex> lock(lock_query);
-				cond_finished.notify_all();
-				break;
+				if (offset < pushdown_cpu_start_offset) {
+					FilterPushDownShit(offset, num);
+				} else {
+					s.task(offset, num);
+				}
 			}
 		}
 
-		// propagate partial results to global table
-		for (size_t group=0; group<MAX_GROUPS; group++) {
-			if (s.aggrs0[group].count > 0) {
-				#define FADD(NAME) __sync_fetch_and_add(&aggrs0[group].NAME, s.aggrs0[group].NAME)
-				FADD(sum_quantity);
-				FADD(sum_base_price);
-				FADD(sum_disc);
-				FADD(sum_disc_price);
-				FADD(sum_charge);
-				FADD(count);
+		/* The last worker to finish adds all partial results to the global table, over
+		 * the groups each touched, and clears them, so that the next query - e.g. on the
+		 * next segment of a snapshot - starts afresh. Only it writes the global table. */
+		if (workers_left.count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			for (auto& other : states) {
+				AddGroups(*other);
+				other->ClearGroups();
 			}
 		}
-
-		// well ... this worker's job is done
-		stage = DONE;
 	}
 
-	void Work(size_t id) {
-		bool query = false;
-
-		{
-			std::unique_lock<std::mutex> lock(lock_query);
-			assert(!states[id]);
-			states[id] = new KERNEL(li, full_system ? id : id*2);
-			cond_finished.notify_all();
-		}
-
-		while (true) {
-			{
-				std::unique_lock<std::mutex> lock(lock_query);
-
-				while (stage != DTOR && stage != QUERY) {
-					cond_start.wait(lock);
-				}
-
-				query = stage == QUERY;
-				if (stage == DTOR) {
-					return;
+	Morsel(const lineitem& li, bool wo_core0 = false) : BaseKernel(li, KERNEL::GroupsOf(li)) {
+		tracks_groups = true; /* those AddGroups() touches */
+		placement = Placement::Make(Placement::default_policy, full_system, wo_core0);
+		team = WorkerPool::Get().GetTeam(placement);
+		const size_t threadinhos = team.size();
+		states.resize(threadinhos, nullptr);
+
+		ranges = new_array<MorselRange>(threadinhos);
+		steal_order.resize(threadinhos);
+		const size_t numa_nodes = ComprData::GetNumaNodes();
+		node_workers.resize(numa_nodes);
+		for (size_t i=0; i<threadinhos; i++) {
+			node_workers[NumaNode(i)].push_back(i);
+			/* itself, then the others on the same node, then those on the next nodes */
+			for (size_t distance=0; distance<numa_nodes; distance++) {
+				for (size_t k=0; k<threadinhos; k++) {
+					const size_t other = (i + k) % threadinhos;
+					if (NumaNode(other) == (NumaNode(i) + distance) % numa_nodes) {
+						steal_order[i].push_back(other);
+					}
 				}
 			}
-
-			if (query) {
-				Query(id);
-			}
 		}
-		
-		delete states[id];
-		states[id] = nullptr;
-	}
-	
-	Morsel(const lineitem& li, bool wo_core0 = false) : BaseKernel(li) {
-		size_t threadinhos = std::thread::hardware_concurrency();
-		threadinhos/=2;
 
-		if (!full_system) {
-			threadinhos /= 2;
-		}
-		if (wo_core0) {
-			threadinhos--;
-		}
+		/* on the workers, so that their states' memory is local to their CPUs */
+		WorkerPool::Get().Run(team, [this] (size_t id) {
+			states[id] = new KERNEL(this->li, Core(id));
+		});
 
-		if (threadinhos < 1) {
-			threadinhos = 1;
+		auto d = ComprData::Get(li, 0);
+		if (d->Layout() == kPartition) {
+			partitioned = d;
 		}
+	}
 
-		{
-			std::unique_lock<std::mutex> lock(lock_query);
-			stage = DONE;
+	void Profile(size_t total_tuples) override {
+	}
 
-			states.resize(threadinhos);
-			for (size_t i=0; i<threadinhos; i++) {
-				states[i] = nullptr;
-			}
-		}
+	std::string DescribePlacement() const override {
+		return placement.Describe();
+	}
 
-		{
-			std::unique_lock<std::mutex> lock(lock_query);
+	/* The CPU worker id runs on, whose node's ComprData replica it scans */
+	size_t Core(size_t id) const {
+		return placement.cpus[id];
+	}
 
-			for (size_t i=0 ; i<threadinhos; i++) {
-				workers.push_back(std::thread(&Morsel::Work, this, i));
+	size_t NumaNode(size_t id) const {
+		return ComprData::GetNumaNode(Core(id));
+	}
 
-#if 0
-				// set affinity
-				cpu_set_t cpuset;
-				CPU_ZERO(&cpuset);
-				CPU_SET(i + wo_core0 ? 1 : 0, &cpuset);
-				int rc = pthread_setaffinity_np(workers[i].native_handle(), sizeof(cpu_set_t), &cpuset);
-				assert(rc == 0 && "Setting affinity failed");
-#endif
-			}
+	template<typename COLUMNS>
+	void UseColumns(const COLUMNS& columns) {
+		partitioned = nullptr;
+		for (auto& s : states) {
+			s->UseColumns(columns);
 		}
+	}
 
-		{ // wait until all are up and running
-			std::unique_lock<std::mutex> lock(lock_query);
-
-			while (true) {
-				bool all_up = true;
-				for(auto& s : states) {
-					all_up &= !!s;
-				}	
-				if (!all_up) {
-					cond_finished.wait(lock);
-				} else {
-					break;
-				}
-			}
+	void SetThreshold(const monetdb::date_t& threshold) override {
+		BaseKernel::SetThreshold(threshold);
+		for (auto& s : states) {
+			s->SetThreshold(threshold);
 		}
 	}
 
-	void Profile(size_t total_tuples) override {
+	/* Equally many of the morsels starting in each node's slice per worker on the node;
+	 * false, changing nothing, if a slice has morsels but its node no workers */
+	bool split_by_slices(size_t offset, size_t num_morsels) {
+		const size_t numa_nodes = node_workers.size();
+		auto morsel_at = [&] (size_t row) {
+			return row <= offset ? 0 : std::min(num_morsels, (row - offset + morsel_size - 1) / morsel_size);
+		};
+		for (size_t n=0; n<numa_nodes; n++) {
+			size_t first, end;
+			partitioned->Slice(n, first, end);
+			if (morsel_at(end) > morsel_at(first) && node_workers[n].empty()) {
+				return false;
+			}
+		}
+		for (size_t n=0; n<numa_nodes; n++) {
+			size_t first, end;
+			partitioned->Slice(n, first, end);
+			const size_t begin = morsel_at(first), morsels = morsel_at(end) - begin;
+			const size_t workers = node_workers[n].size();
+			for (size_t k=0; k<workers; k++) {
+				auto& range = ranges[node_workers[n][k]];
+				range.next.store(begin + morsels * k / workers, std::memory_order_relaxed);
+				range.end = begin + morsels * (k+1) / workers;
+			}
+		}
+		return true;
 	}
 
 	NOINL void spawn(size_t offset, size_t num, size_t pushdown_cpu_start_offset) {
 		this->pushdown_cpu_start_offset = pushdown_cpu_start_offset;
 		size = offset + num;
-		assert(size <= li.l_extendedprice.cardinality);
-		// start threads
-		{
-			std::unique_lock<std::mutex> lock(lock_query);
-			num_morsels = num / morsel_size;
-			if (num_morsels < 1) {
-				num_morsels = 1;
+
+		/* consecutive, equally many morsels per worker - of its node's slice, if partitioned */
+		const size_t num_morsels = (num + morsel_size - 1) / morsel_size;
+		const size_t num_workers = states.size();
+		if (!partitioned || !split_by_slices(offset, num_morsels)) {
+			for (size_t i=0; i<num_workers; i++) {
+				ranges[i].next.store(num_morsels * i / num_workers, std::memory_order_relaxed);
+				ranges[i].end = num_morsels * (i+1) / num_workers;
 			}
-			morsel_start = offset;
-			morsel_completed = 0;
-			stage = QUERY;
-			cond_start.notify_all();
 		}
-	}
+		morsels_offset = offset;
+		workers_left.count.store(num_workers, std::memory_order_relaxed);
 
-	NOINL void wait(bool active = false) {
-		if (active) {
-			Work(0);
-		}
-		// wait for completion
-		{
-			std::unique_lock<std::mutex> lock(lock_query);
-			while (morsel_completed < num_morsels) {
-				cond_finished.wait(lock);
-			}
+		WorkerPool::Get().Submit(query_job, team);
+	}
 
-			stage = DONE;
-		}
+	/* Returns once all workers have merged their results */
+	NOINL void wait() {
+		WorkerPool::Get().Wait(query_job);
 	}
 
 	NOINL void task(size_t offset, size_t num) {
@@ -648,18 +974,10 @@ struct Morsel : BaseKernel {
 		BaseKernel::Clear();
 	}
 
+	/* The workers stay, for the next kernel */
 	~Morsel() {
-		{
-			std::unique_lock<std::mutex> lock(lock_query);
-			cond_start.notify_all();
-			stage = DTOR;
-		}
-
-		for (auto& w : workers) {
-			if (!w.joinable()) {
-				continue;
-			}
-			w.join();
+		for (auto& s : states) {
+			delete s;
 		}
 	}
 };
@@ -36,7 +36,7 @@ struct KernelOldX100 : BaseKernel {
 	#define scan_epilogue(name) v_##name += chunk_size;
 
 	KernelOldX100(const lineitem& li) : BaseKernel(li) {
-		grppos = new_array<uint16_t*>(kGrpPosSize);
+		grppos = new_array<uint16_t*>(2 * groups.Size());
 		selbuf = new_array<uint16_t>(kSelBufSize);
 		pos = new_array<idx_t>(kVectorsize);
 		lim = new_array<idx_t>(kVectorsize);
@@ -80,6 +80,7 @@ struct KernelOldX100 : BaseKernel {
 		scan(quantity);
 
 		const auto dec_one = Decimal64::ToValue(1, 0);
+		const uint32_t* shipdate_validity = li.l_shipdate.Validity();
 
 		
 		size_t done=0;
@@ -90,7 +91,16 @@ struct KernelOldX100 : BaseKernel {
 			size_t n = chunk_size;
 
 			// select
-			const size_t num = Primitives::select_int32_t(sel, nullptr, n, false, v_shipdate, cmp.dte_val);
+			size_t num = Primitives::select_int32_t(sel, nullptr, n, false, v_shipdate, cmp.dte_val);
+			if (!Primitives::all_valid(shipdate_validity, done, chunk_size)) {
+				/* NULL ship dates are stored as date_nil, which is below any threshold */
+				size_t k = 0;
+				for (size_t j=0; j<num; j++) {
+					sel[k] = sel[j];
+					k += Primitives::is_valid(shipdate_validity, done + sel[j]);
+				}
+				num = k;
+			}
 			if (num > kVectorsize / 2) {
 				if (num != n)
 					n = sel[num-1]+1;
@@ -125,7 +135,7 @@ struct KernelOldX100 : BaseKernel {
 			case kMagic: {
 				const auto prof_magic_start = rdtsc();
 				const size_t num_groups = Primitives::partial_shuffle_scalar(v_idx, aggr_sel, num, pos, lim, grp,
-					grppos, grppos + kGrpPosSize/2, selbuf, selbuf + kSelBufSize/2);
+					grppos - groups.begin, grppos + groups.Size() - groups.begin, selbuf, selbuf + kSelBufSize/2);
 				sum_magic_time += rdtsc() - prof_magic_start;
 
 				/* pre-aggregate */
@@ -1,6 +1,10 @@
 #include <sstream>
 #include <vector>
 #include <time.h>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
 #include "common.hpp"
 #include "vectorized.hpp"
 
@@ -10,6 +14,13 @@
 #include "kernels/hyper_compact.hpp"
 #include "kernels/x100.hpp"
 #include "kernels/x100_old.hpp"
+#include "kernels/cracked.hpp"
+#include "kernels/cube.hpp"
+#include "kernels/factorised.hpp"
+#include "kernels/correlated.hpp"
+#include "kernels/snapshot.hpp"
+#include "kernels/maintained.hpp"
+#include "kernels/pipeline.hpp"
 // Commented-out per Tim's suggests 2018-07-18
 // #include "kernels/avx512.hpp"
 
@@ -21,6 +32,8 @@ size_t morsel_size = 10*1024;
 
 uint32_t* precomp_filter = nullptr;
 uint16_t* compr_shipdate = nullptr;
+const bit_sliced_column<uint16_t>* compr_shipdate_bit_sliced = nullptr;
+const range_encoded_bitmap_index<uint16_t, uint32_t>* compr_shipdate_month_index = nullptr;
 moodycamel::BlockingConcurrentQueue<FilterChunk> precomp_filter_queue;
 
 void precompute_filter_for_table_chunk(
@@ -75,6 +88,11 @@ void run(const lineitem& li, const std::string& name, Args&&... args)
 		(double)fun.sum_magic_time / total_tuples,
 		(double)(total_time - 0 - fun.sum_aggr_time - fun.sum_magic_time) / total_tuples);
 
+	const auto placement = fun.DescribePlacement();
+	if (!placement.empty()) {
+		printf("   \t placement %s\n", placement.c_str());
+	}
+
 	runIdCounter++;
 	// fun.Profile(total_tuples);
 #ifdef PRINT_RESULTS
@@ -100,7 +118,7 @@ void run(const lineitem& li, const std::string& name, Args&&... args)
 		return start;
 	};
 
-	for (size_t group=0; group<MAX_GROUPS; group++) {
+	for (size_t group=fun.groups.begin; group<fun.groups.end; group++) {
 		if (fun.aggrs0[group].count > 0) {
 			char rf = group >> 8;
 			char ls = group & std::numeric_limits<unsigned char>::max();
@@ -115,8 +133,8 @@ void run(const lineitem& li, const std::string& name, Args&&... args)
 			printf("|%ld\n", fun.aggrs0[i].count);
 		}
 	}
-	size_t i=0;
-	for (size_t group=0; group<MAX_GROUPS; group++) {
+	size_t i=fun.groups.begin*8;
+	for (size_t group=fun.groups.begin; group<fun.groups.end; group++) {
 		char rf = group >> 8;
 		char ls = group & std::numeric_limits<unsigned char>::max();
 
@@ -157,7 +175,7 @@ std::pair<string,string> split_once(string delimited, char delimiter) {
 
 int main(int argc, const char** argv) {
     double scale_factor = 1;
-
+    std::string shared_columns_mode;
 
     for(int i = 1; i < argc; i++) {
         auto arg = string(argv[i]);
@@ -174,6 +192,44 @@ int main(int argc, const char** argv) {
             if (scale_factor - 0 < 0.001) {
                 std::invalid_argument("Invalid scale factor");
             }
+        } else if (arg_name == "shared-columns") {
+            /* publish: load the columns into shared memory, for later runs to attach to, and exit
+             * attach:  use the published columns if they're there, otherwise load them as usual
+             * remove:  remove the published columns and exit */
+            if (arg_value != "publish" and arg_value != "attach" and arg_value != "remove") {
+                exit(1);
+            }
+            shared_columns_mode = arg_value;
+        } else if (arg_name == "isa") {
+            /* Force the vectorized primitives' instruction set: sse4.2, avx2 or avx512 */
+            PrimitivesIsa isa;
+            if (!Primitives::isa_by_name(arg_value, isa)) {
+                exit(1);
+            }
+            if (!Primitives::use_isa(isa)) {
+                fprintf(stderr, "This CPU doesn't support %s\n", Primitives::isa_name(isa));
+                exit(1);
+            }
+        } else if (arg_name == "pin") {
+            /* Where the Morsel kernels' workers run: cores, smt, socket or none (see topology.hpp) */
+            PinPolicy policy;
+            if (!Placement::policy_by_name(arg_value, policy)) {
+                exit(1);
+            }
+            Placement::default_policy = policy;
+        } else if (arg_name == "huge-pages") {
+            /* on: back the kernels' arenas with transparent huge pages (see arena.hpp) */
+            if (arg_value != "on" and arg_value != "off") {
+                exit(1);
+            }
+            Arena::huge_pages = arg_value == "on";
+        } else if (arg_name == "data-placement") {
+            /* How the compact columns are laid out over the NUMA nodes: replicate, interleave or partition */
+            DataPlacement placement;
+            if (!ComprData::placement_by_name(arg_value, placement)) {
+                exit(1);
+            }
+            ComprData::placement = placement;
         } else {
             exit(1);
         }
@@ -181,19 +237,67 @@ int main(int argc, const char** argv) {
     std::string tpch_directory = join_path(EXPAND_THEN_QUOTE(DATA_FILES_DIR) , std::to_string(scale_factor));
     std::string input_file = join_path(tpch_directory, "lineitem.tbl");
 
-    if (not file_exists(input_file.c_str())) {
-        throw std::runtime_error("Cannot locate table text file " + input_file);
-        // Not generating it ourselves - that's: 1. Not healthy and 2. Not portable;
-        // setup scripts are intended to do that
+    /* Shared columns are tagged with the table file's identity, as well as with our
+     * (CPU build's) compact encoding, which differs from the GPU build's */
+    std::string shared_columns_name = "q1-sf" + std::to_string(scale_factor);
+    uint64_t shared_columns_version = shared_column_store::file_version(input_file,
+        shared_column_store::hash("q1 lineitem and compact columns v4"));
+
+    if (shared_columns_mode == "remove") {
+        bool removed = shared_column_store::remove(shared_columns_name);
+        printf("%s shared columns %s\n", removed ? "Removed the" : "There are no", shared_columns_name.c_str());
+        return 0;
     }
 
 	/* load data */
 
     lineitem li((size_t)(7000000 * std::max(scale_factor, 1.0)));
-    li.FromFile(input_file.c_str());
+    std::unique_ptr<shared_column_store> shared_columns;
+    struct Unplug {
+        /* Must come after li, so that li's columns are unplugged from the shared ones before it's destroyed */
+        std::vector<std::function<void()>> functions;
+        ~Unplug() { for (auto& f : functions) { f(); } }
+    } unplug;
+
+    if (shared_columns_mode == "attach") {
+        std::string why_not;
+        shared_columns = shared_column_store::attach(shared_columns_name, shared_columns_version, &why_not);
+        if (shared_columns && ComprData::AttachShared(li, *shared_columns, unplug.functions)) {
+            printf("Attached to the shared columns %s\n", shared_columns->describe().c_str());
+        } else {
+            fprintf(stderr, "Not using shared columns: %s\n",
+                shared_columns ? "some columns are missing" : why_not.c_str());
+            shared_columns.reset();
+        }
+    }
+
+    if (!shared_columns) {
+        if (not file_exists(input_file.c_str())) {
+            throw std::runtime_error("Cannot locate table text file " + input_file);
+            // Not generating it ourselves - that's: 1. Not healthy and 2. Not portable;
+            // setup scripts are intended to do that
+        }
+        li.FromFile(input_file.c_str());
+    }
+
+    if (shared_columns_mode == "publish") {
+        std::vector<shared_column_store::column> columns;
+        ComprData::AddSharedColumns(li, columns);
+        auto location = shared_column_store::publish(shared_columns_name, shared_columns_version,
+            "lineitem and compact columns of " + input_file, columns);
+        printf("Published the columns at %s\n", location.c_str());
+        return 0;
+    }
 
 	/* start processing */
 
+	printf("Vectorized primitives for %s (the best this CPU supports: %s)\n",
+		Primitives::isa_name(Primitives::current_isa()), Primitives::isa_name(Primitives::best_isa()));
+	printf("CPUs: %s; workers placed by %s\n", CpuTopology::Get().Describe().c_str(),
+		Placement::policy_name(Placement::default_policy));
+	ComprData::Get(li, 0);
+	printf("Compact columns: %s\n", ComprData::Describe().c_str());
+
 	printf("ID \t %-40s \t timetuple \t millisec \t aggrtuple \t pshuffletuple \t remainingtuple\n",
 		"Configuration");
 
@@ -210,14 +314,98 @@ int main(int argc, const char** argv) {
 	run<KernelX100<k1Step, true>>(li, "$\\text{X100 Compact NSM Standard Fused}$");
 #endif
 	run<KernelX100<kMagic, true>>(li, "$\\text{X100 Compact NSM In-Reg}$", 0);
+	run<KernelX100<kMagic, true, kNoAvx512, kShipDateBitSliced>>(li, "$\\text{X100 Compact NSM In-Reg BitSliced}$", 0);
+	run<KernelX100<kMicroAdaptive, true>>(li, "$\\text{X100 Compact NSM Micro-Adaptive}$", 0);
 
 	run<Morsel<KernelX100<kMagic, true>, true>>(li, "$\\text{Full system Morsel X100 Compact NSM In-Reg}$");
 	run<Morsel<KernelX100<kMagic, true>, false>>(li, "$\\text{One socket Morsel X100 Compact NSM In-Reg}$");
+	run<Morsel<KernelX100<kMagic, true, kNoAvx512, kShipDateBitSliced>, true>>(li, "$\\text{Full system Morsel X100 Compact NSM In-Reg BitSliced}$");
+	run<Morsel<KernelX100<kMicroAdaptive, true>, true>>(li, "$\\text{Full system Morsel X100 Compact NSM Micro-Adaptive}$");
 
 	run<Morsel<KernelX100<kMagic, true, kPopulationCount>, true>>(li, "$\\text{AVX512 opt, Full system Morsel X100 Compact NSM In-Reg}$");
 	run<Morsel<KernelX100<kMagic, true, kPopulationCount>, false>>(li, "$\\text{AVX512 opt, One socket Morsel X100 Compact NSM In-Reg}$");
 	
 
+	run<KernelFactorised>(li, "$\\text{Factorised Compact}$", 0);
+	run<Morsel<KernelFactorised, true>>(li, "$\\text{Full system Morsel Factorised Compact}$");
+
+	run<KernelCorrelatedFlags>(li, "$\\text{Correlated flags Compact}$", 0);
+	run<Morsel<KernelCorrelatedFlags, true>>(li, "$\\text{Full system Morsel Correlated flags Compact}$");
+
+	run<KernelPipelineFused>(li, "$\\text{Pipeline Compact Fused}$", 0);
+	run<KernelPipelineSelect>(li, "$\\text{Pipeline Compact Materialised after Select}$", 0);
+	run<KernelPipelineSelectMaps>(li, "$\\text{Pipeline Compact Materialised after Select and Maps}$", 0);
+	run<Morsel<KernelPipelineSelect, true>>(li, "$\\text{Full system Morsel Pipeline Compact Materialised after Select}$");
+
+	/* The cube is of the compact columns, which the shared columns' version identifies */
+	run<KernelAggregateCube>(li, "$\\text{Prefix-sum aggregate cube}$", join_path(tpch_directory, "cpu_aggregate_cube.bin"),
+		shared_columns_version);
+
+	/* A day's worth of analyst queries with varying DELTA; each cracks the shared copy further */
+	for (int delta : { 90, 60, 120, 75, 105, 90 }) {
+		run<KernelCracked<KernelX100<kMagic, true>>>(li,
+			"$\\text{Cracked X100 Compact NSM In-Reg}$ DELTA=" + std::to_string(delta), delta, 0);
+		run<KernelCracked<Morsel<KernelX100<kMagic, true>, true>>>(li,
+			"$\\text{Cracked Full system Morsel X100 Compact NSM In-Reg}$ DELTA=" + std::to_string(delta), delta);
+	}
+
+	/* Queries on snapshots, while new rows keep arriving and random rows are cancelled */
+	{
+		auto& live = LiveTable::Get(li);
+		std::atomic<bool> stop(false);
+		std::thread feed([&] () {
+			auto& source = *ComprData::Get(li, 0);
+			source.DecodeFlags();
+			const size_t cardinality = li.l_extendedprice.cardinality;
+			std::mt19937_64 random(42);
+			std::vector<size_t> cancelled(1024);
+			size_t next = 0;
+
+			while (!stop) {
+				const size_t num = std::min(cancelled.size(), cardinality - next);
+				live.Append(source, next, num);
+				next = (next + num) % cardinality;
+
+				const size_t live_cardinality = live.GetSnapshot()->cardinality;
+				for (auto& row : cancelled) {
+					row = random() % live_cardinality;
+				}
+				live.Delete(cancelled);
+
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		});
+
+		run<KernelSnapshot<KernelX100<kMagic, true>>>(li, "$\\text{Snapshot Full system Morsel X100 Compact NSM In-Reg}$");
+
+		run<KernelMaintainedQ1>(li, "$\\text{Maintained Per Day Compact}$");
+
+		/* Refreshed repeatedly while the table changes, the maintained result must end up
+		 * the same as a scan of the final table */
+		KernelMaintainedQ1 maintained(li);
+		for (size_t i=0; i<REP_COUNT; i++) {
+			maintained();
+		}
+
+		stop = true;
+		feed.join();
+
+		auto snapshot = live.GetSnapshot();
+		printf("Live table at epoch %" PRIu64 ": %zu rows appended, %zu deleted, in %zu segments\n",
+			snapshot->epoch, snapshot->cardinality, snapshot->num_deleted, snapshot->segments.size());
+
+		KernelSnapshot<KernelX100<kMagic, true>> scan(li);
+		maintained();
+		scan();
+		bool same = maintained.epoch == scan.epoch;
+		same &= maintained.groups.begin == scan.groups.begin && maintained.groups.end == scan.groups.end;
+		for (size_t group=scan.groups.begin; same && group<scan.groups.end; group++) {
+			same &= !memcmp(&maintained.aggrs0[group], &scan.aggrs0[group], sizeof(AggrHashTable));
+		}
+		printf("Maintained result (last refresh: %zu rows added, %zu subtracted) %s the scan's\n",
+			maintained.rows_added, maintained.rows_subtracted, same ? "matches" : "DIFFERS FROM");
+	}
+
 	//run<Morsel<KernelNaiveCompact>>(li, "$\\text{HyPer Compact NoOverflow}$");
 	//run<KernelNaiveCompact>(li, "$\\text{HyPer Compact NoOverflow}$", 0);
 	
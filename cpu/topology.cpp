@@ -0,0 +1,369 @@
+#include "topology.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+#include <thread>
+#include <numa.h>
+#include <pthread.h>
+#include <sched.h>
+
+static bool
+read_file(const std::string& path, std::string& contents)
+{
+	std::ifstream file(path);
+	if (!file) {
+		return false;
+	}
+	std::getline(file, contents, '\0');
+	return true;
+}
+
+static int
+read_int(const std::string& path, int fallback)
+{
+	std::string contents;
+	if (!read_file(path, contents)) {
+		return fallback;
+	}
+	try {
+		return std::stoi(contents);
+	} catch (...) {
+		return fallback;
+	}
+}
+
+/* e.g. "0-3,8-11" */
+static std::vector<int>
+parse_cpu_list(const std::string& list)
+{
+	std::vector<int> cpus;
+	std::istringstream ranges(list);
+	for (std::string range; std::getline(ranges, range, ',');) {
+		int first, last;
+		const int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+		if (n < 1) {
+			continue;
+		}
+		for (int cpu=first; cpu<=(n == 2 ? last : first); cpu++) {
+			cpus.push_back(cpu);
+		}
+	}
+	return cpus;
+}
+
+static std::string
+format_cpu_list(std::vector<int> cpus)
+{
+	std::sort(cpus.begin(), cpus.end());
+	std::string list;
+	for (size_t i=0; i<cpus.size();) {
+		size_t k = i;
+		while (k+1 < cpus.size() && cpus[k+1] == cpus[k] + 1) {
+			k++;
+		}
+		list += (list.empty() ? "" : ",") + std::to_string(cpus[i]);
+		if (k > i) {
+			list += "-" + std::to_string(cpus[k]);
+		}
+		i = k+1;
+	}
+	return list;
+}
+
+static bool
+has_token(const std::string& list, const std::string& token)
+{
+	std::istringstream tokens(list);
+	for (std::string t; std::getline(tokens, t, ',');) {
+		if (t == token) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Lowers quota to the least one of the cgroup at path (in the hierarchy mounted at
+ * mount_point, whose root is the cgroup root) and its ancestors set - they all apply.
+ * A cgroup outside the mount, e.g. of another cgroup namespace, is looked for at the
+ * mount's root. read() gives the quota of a cgroup's directory, 0 for none. */
+template<typename READ>
+static void
+lower_to_cgroup_quota(double& quota, const std::string& mount_point, const std::string& root,
+	const std::string& path, READ&& read)
+{
+	std::string dir;
+	if (path.compare(0, root.size(), root) == 0) {
+		dir = path.substr(root == "/" ? 0 : root.size());
+	}
+	while (true) {
+		const double q = read(mount_point + dir);
+		if (q > 0 && (quota == 0 || q < quota)) {
+			quota = q;
+		}
+		if (dir.empty() || dir == "/") {
+			break;
+		}
+		dir = dir.substr(0, dir.rfind('/'));
+	}
+}
+
+/* cgroup v2's cpu.max, "<quota> <period>" or "max <period>" */
+static double
+read_cpu_max(const std::string& dir)
+{
+	std::string contents;
+	double quota, period;
+	if (!read_file(dir + "/cpu.max", contents) || sscanf(contents.c_str(), "%lf %lf", &quota, &period) != 2) {
+		return 0; /* including "max" */
+	}
+	return period > 0 ? quota / period : 0;
+}
+
+/* cgroup v1's cpu.cfs_quota_us, -1 if unlimited, and cpu.cfs_period_us */
+static double
+read_cfs_quota(const std::string& dir)
+{
+	const int quota = read_int(dir + "/cpu.cfs_quota_us", -1);
+	const int period = read_int(dir + "/cpu.cfs_period_us", 0);
+	return quota > 0 && period > 0 ? (double)quota / period : 0;
+}
+
+static double
+cgroup_cpu_quota()
+{
+	/* The process's cgroup in each hierarchy: "<id>:<controllers>:<path>", with id 0 and
+	 * no controllers for cgroup v2's */
+	std::string v1_path, v2_path;
+	bool v1 = false, v2 = false;
+	std::ifstream cgroups("/proc/self/cgroup");
+	for (std::string line; std::getline(cgroups, line);) {
+		const auto first = line.find(':');
+		const auto second = first == std::string::npos ? first : line.find(':', first + 1);
+		if (second == std::string::npos) {
+			continue;
+		}
+		const auto controllers = line.substr(first + 1, second - first - 1);
+		if (line.compare(0, first, "0") == 0 && controllers.empty()) {
+			v2_path = line.substr(second + 1);
+			v2 = true;
+		} else if (has_token(controllers, "cpu")) {
+			v1_path = line.substr(second + 1);
+			v1 = true;
+		}
+	}
+
+	/* Where the hierarchies are mounted: "<id> <parent> <dev> <root> <mount point>
+	 * <options> [<optional fields>] - <type> <source> <super options>" */
+	double quota = 0;
+	std::ifstream mounts("/proc/self/mountinfo");
+	for (std::string line; std::getline(mounts, line);) {
+		std::istringstream fields(line);
+		std::string id, parent, dev, root, mount_point, field, type, source, options;
+		fields >> id >> parent >> dev >> root >> mount_point;
+		while (fields >> field && field != "-") {
+		}
+		fields >> type >> source >> options;
+
+		if (type == "cgroup2" && v2) {
+			lower_to_cgroup_quota(quota, mount_point, root, v2_path, read_cpu_max);
+		} else if (type == "cgroup" && v1 && has_token(options, "cpu")) {
+			lower_to_cgroup_quota(quota, mount_point, root, v1_path, read_cfs_quota);
+		}
+	}
+	return quota;
+}
+
+CpuTopology::CpuTopology()
+{
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	const bool have_affinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+	std::string online;
+	std::vector<int> ids;
+	if (read_file("/sys/devices/system/cpu/online", online)) {
+		ids = parse_cpu_list(online);
+	}
+	if (ids.empty()) {
+		for (unsigned i=0; i<std::max(1u, std::thread::hardware_concurrency()); i++) {
+			ids.push_back(i);
+		}
+	}
+
+	/* Without sysfs' topology, each CPU counts as a core of its own, on socket 0. Some
+	 * hypervisors report package -1. */
+	for (int id : ids) {
+		if (have_affinity && (id >= CPU_SETSIZE || !CPU_ISSET(id, &allowed))) {
+			continue;
+		}
+		const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+		Cpu cpu;
+		cpu.id = id;
+		cpu.socket = std::max(0, read_int(dir + "physical_package_id", 0));
+		cpu.core = read_int(dir + "core_id", id); /* unique per socket only, until renumbered */
+		cpu.thread = 0;
+		cpu.numa_node = NumaNodeOf(id);
+		cpus.push_back(cpu);
+	}
+	if (cpus.empty()) {
+		cpus.push_back(Cpu { std::max(0, sched_getcpu()), 0, 0, 0, 0 });
+		cpus.back().numa_node = NumaNodeOf(cpus.back().id);
+	}
+
+	std::sort(cpus.begin(), cpus.end(), [] (const Cpu& a, const Cpu& b) {
+		return std::make_tuple(a.socket, a.core, a.id) < std::make_tuple(b.socket, b.core, b.id);
+	});
+	for (size_t i=0; i<cpus.size(); i++) {
+		Cpu& cpu = cpus[i];
+		const Cpu* prev = i ? &cpus[i-1] : nullptr;
+		const bool same_socket = prev && prev->socket == cpu.socket;
+		const bool same_core = same_socket && prev->core == cpu.core;
+		num_sockets += !same_socket;
+		num_cores += !same_core;
+		cpu.thread = same_core ? prev->thread + 1 : 0;
+	}
+	int core = -1;
+	for (size_t i=0; i<cpus.size(); i++) {
+		core += !cpus[i].thread;
+		cpus[i].core = core;
+	}
+
+	cpu_quota = cgroup_cpu_quota();
+}
+
+size_t
+CpuTopology::NumUsable() const
+{
+	if (cpu_quota <= 0) {
+		return cpus.size();
+	}
+	/* a thread beyond the quota's whole CPUs would just get the others throttled */
+	return std::max<size_t>(1, std::min<size_t>(cpus.size(), std::floor(cpu_quota + 1e-6)));
+}
+
+int
+CpuTopology::NumaNodeOf(int cpu)
+{
+	static const bool have_numa = numa_available() != -1;
+	return have_numa ? std::max(0, numa_node_of_cpu(cpu)) : 0;
+}
+
+std::string
+CpuTopology::Describe() const
+{
+	char quota[64] = "";
+	if (cpu_quota > 0) {
+		snprintf(quota, sizeof(quota), ", quota %.1f CPUs", cpu_quota);
+	}
+	return std::to_string(num_sockets) + (num_sockets == 1 ? " socket, " : " sockets, ") +
+		std::to_string(num_cores) + (num_cores == 1 ? " core, " : " cores, ") +
+		std::to_string(cpus.size()) + (cpus.size() == 1 ? " thread" : " threads") + " allowed" + quota;
+}
+
+const CpuTopology&
+CpuTopology::Get()
+{
+	static const CpuTopology topology;
+	return topology;
+}
+
+PinPolicy Placement::default_policy = kPinCores;
+
+static const char* const policy_names[kNumPinPolicies] = {
+	"cores", "smt", "socket", "none"
+};
+
+Placement
+Placement::Make(PinPolicy policy, bool whole_system, bool reserve_feeder)
+{
+	const auto& topology = CpuTopology::Get();
+	Placement placement;
+	placement.policy = policy;
+
+	/* The feeder takes the first allowed CPU, like the main thread used to be pinned to core 0 */
+	auto candidates = topology.cpus;
+	const auto feeder = candidates.front();
+	placement.feeder_cpu = feeder.id;
+
+	size_t budget = topology.NumUsable();
+	if (reserve_feeder && topology.num_cores > 1) {
+		placement.feeder_reserved = true;
+		candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+			[&] (const CpuTopology::Cpu& c) { return c.core == feeder.core; }), candidates.end());
+		budget = std::max<size_t>(1, budget - 1);
+	}
+	if (!whole_system || policy == kPinSocket) {
+		const int socket = candidates.front().socket;
+		candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+			[&] (const CpuTopology::Cpu& c) { return c.socket != socket; }), candidates.end());
+	}
+
+	for (auto& c : candidates) {
+		placement.pool.push_back(c.id);
+		if ((policy == kPinSmt || c.thread == 0) && placement.cpus.size() < budget) {
+			placement.cpus.push_back(c.id);
+		}
+	}
+	return placement;
+}
+
+static bool
+pin_to(const std::vector<int>& cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus) {
+		if (cpu >= 0 && cpu < CPU_SETSIZE) {
+			CPU_SET(cpu, &set);
+		}
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool
+Placement::Pin(size_t worker) const
+{
+	/* Unpinned workers would otherwise inherit e.g. the feeder's affinity */
+	return policy == kPinNone ? pin_to(pool) : pin_to({ cpus[worker % cpus.size()] });
+}
+
+bool
+Placement::PinFeeder()
+{
+	return pin_to({ CpuTopology::Get().cpus.front().id });
+}
+
+std::string
+Placement::Describe() const
+{
+	const auto& where = policy == kPinNone ? pool : cpus;
+	std::string s = std::string(policy_name(policy)) + ": " + std::to_string(cpus.size()) +
+		(cpus.size() == 1 ? " worker" : " workers") + (policy == kPinNone ? " unpinned among" : " on") +
+		(where.size() == 1 ? " CPU " : " CPUs ") + format_cpu_list(where);
+	if (feeder_reserved) {
+		s += "; GPU feeder on CPU " + std::to_string(feeder_cpu) + ", its core reserved";
+	}
+	return s + " (" + CpuTopology::Get().Describe() + ")";
+}
+
+const char*
+Placement::policy_name(PinPolicy policy)
+{
+	return policy >= 0 && policy < kNumPinPolicies ? policy_names[policy] : "unknown";
+}
+
+bool
+Placement::policy_by_name(const std::string& name, PinPolicy& policy)
+{
+	for (int i = 0; i < kNumPinPolicies; i++) {
+		if (name == policy_names[i]) {
+			policy = (PinPolicy)i;
+			return true;
+		}
+	}
+	return false;
+}
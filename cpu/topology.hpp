@@ -0,0 +1,90 @@
+#ifndef H_topology
+#define H_topology
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/* The CPUs this process may run on, and how they share hardware: hardware threads
+ * (SMT siblings) of physical cores, of sockets, on NUMA nodes. Read from sysfs and
+ * libnuma once, restricted to the CPUs sched_getaffinity() allows - as of the first
+ * call, i.e. before any thread pins itself - and accompanied by the cgroup's CPU quota,
+ * which limits how many of them the process can keep busy at once. */
+struct CpuTopology {
+	struct Cpu {
+		int id; /* as the OS numbers it */
+		int socket; /* physical package */
+		int core; /* physical core, numbered across all sockets */
+		int thread; /* rank among the allowed SMT siblings of its core */
+		int numa_node;
+	};
+
+	/* The allowed CPUs, by socket, then core, then thread */
+	std::vector<Cpu> cpus;
+
+	size_t num_sockets = 0; /* with any allowed CPU */
+	size_t num_cores = 0;
+
+	/* CPUs' worth of time per period the cgroups allow us; 0 if unlimited */
+	double cpu_quota = 0;
+
+	/* How many threads can run at once: the allowed CPUs, within the quota */
+	size_t NumUsable() const;
+
+	/* The NUMA node of any CPU, allowed or not; 0 if unknown */
+	static int NumaNodeOf(int cpu);
+
+	/* e.g. "2 sockets, 16 cores, 32 threads allowed, quota 8.0 CPUs" */
+	std::string Describe() const;
+
+	static const CpuTopology& Get();
+
+private:
+	CpuTopology();
+};
+
+/* Which CPUs a parallel kernel's workers run on */
+enum PinPolicy {
+	kPinCores, /* one worker per physical core */
+	kPinSmt, /* one per hardware thread, SMT siblings as consecutive workers */
+	kPinSocket, /* one per physical core, of the first socket only */
+	kPinNone, /* as many as kPinCores, but left to the scheduler */
+	kNumPinPolicies
+};
+
+struct Placement {
+	PinPolicy policy;
+
+	/* per worker: the CPU it's pinned to, or (kPinNone) which it counts as being on */
+	std::vector<int> cpus;
+
+	/* The CPUs the workers were drawn from, which kPinNone leaves them to roam */
+	std::vector<int> pool;
+
+	/* The CPU the GPU feeder - the thread launching the GPU's work - is pinned to, and
+	 * whether its physical core is kept free of workers */
+	int feeder_cpu = -1;
+	bool feeder_reserved = false;
+
+	/* For one thread per element of cpus, of all the allowed CPUs - or those of one
+	 * socket - within the cgroup quota; optionally keeping a core free for the feeder */
+	static Placement Make(PinPolicy policy, bool whole_system = true, bool reserve_feeder = false);
+
+	/* Binds the calling thread to worker's CPU; with kPinNone, to the workers' CPUs.
+	 * Best effort: returns false if the OS refused. */
+	bool Pin(size_t worker) const;
+
+	/* Binds the calling thread to the CPU Make() reserves for the GPU feeder */
+	static bool PinFeeder();
+
+	/* e.g. "cores: 7 workers on CPUs 1-7; GPU feeder on CPU 0, its core reserved (...)" */
+	std::string Describe() const;
+
+	/* The policy of parallel kernels which don't ask for one; kPinCores by default */
+	static PinPolicy default_policy;
+
+	static const char* policy_name(PinPolicy policy);
+	static bool policy_by_name(const std::string& name, PinPolicy& policy);
+};
+
+#endif
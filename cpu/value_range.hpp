@@ -0,0 +1,104 @@
+#ifndef H_value_range
+#define H_value_range
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits>
+
+/* A closed interval of integers which values are proven to lie in: those of a column,
+ * from its statistics, or of an expression over such values, by interval arithmetic
+ * on its operands' ranges. The bounds are 128 bits wide, so that the products and sums
+ * of 64-bit ranges are exact; beyond that they saturate, which only ever widens the
+ * range. Everything is constexpr, so that the same rules prove at compile time what
+ * the types alone imply - e.g. that an int32_t times an int8_t fits into 64 bits - and,
+ * at run time, what the data implies, e.g. per morsel, from its zones' statistics. */
+struct ValueRange {
+	using Bound = __int128;
+
+	static constexpr Bound kMaxBound = (Bound)(~(unsigned __int128)0 >> 2);
+	static constexpr Bound kMinBound = -kMaxBound;
+
+	/* lo > hi for the range of no values at all, e.g. of an empty column */
+	Bound lo;
+	Bound hi;
+
+	constexpr ValueRange(Bound lo, Bound hi) : lo(clamp(lo)), hi(clamp(hi)) {}
+
+	/* Of all values of a type */
+	template<typename T>
+	static constexpr ValueRange Of() {
+		return ValueRange(std::numeric_limits<T>::min(), std::numeric_limits<T>::max());
+	}
+
+	/* Of a detail::MinMax - as Column keeps them - or anything with min and max; all
+	 * values of T if it saw no values, as with columns filled in place */
+	template<typename T, typename MINMAX>
+	static constexpr ValueRange OfMinMax(const MINMAX& minmax) {
+		return minmax.min <= minmax.max ? ValueRange(minmax.min, minmax.max) : Of<T>();
+	}
+
+	static constexpr ValueRange None() {
+		return ValueRange(1, 0);
+	}
+
+	constexpr bool IsEmpty() const {
+		return lo > hi;
+	}
+
+	/* Does every value in the range fit into T? */
+	template<typename T>
+	constexpr bool Fits() const {
+		return IsEmpty() || (lo >= (Bound)std::numeric_limits<T>::min() && hi <= (Bound)std::numeric_limits<T>::max());
+	}
+
+	/* The range of either's values */
+	constexpr ValueRange Union(const ValueRange& o) const {
+		return IsEmpty() ? o : o.IsEmpty() ? *this : ValueRange(lo < o.lo ? lo : o.lo, hi > o.hi ? hi : o.hi);
+	}
+
+	constexpr ValueRange operator+(const ValueRange& o) const {
+		return IsEmpty() || o.IsEmpty() ? None() : ValueRange(lo + o.lo, hi + o.hi);
+	}
+
+	constexpr ValueRange operator-(const ValueRange& o) const {
+		return IsEmpty() || o.IsEmpty() ? None() : ValueRange(lo - o.hi, hi - o.lo);
+	}
+
+	constexpr ValueRange operator*(const ValueRange& o) const {
+		return IsEmpty() || o.IsEmpty() ? None() : ValueRange(
+			min4(mul(lo, o.lo), mul(lo, o.hi), mul(hi, o.lo), mul(hi, o.hi)),
+			max4(mul(lo, o.lo), mul(lo, o.hi), mul(hi, o.lo), mul(hi, o.hi)));
+	}
+
+	/* Of the sum of up to n values of the range - or none */
+	constexpr ValueRange Sum(size_t n) const {
+		return IsEmpty() ? ValueRange(0, 0) : ValueRange(
+			lo < 0 ? mul(lo, (Bound)n) : 0,
+			hi > 0 ? mul(hi, (Bound)n) : 0);
+	}
+
+private:
+	static constexpr Bound clamp(Bound b) {
+		return b < kMinBound ? kMinBound : b > kMaxBound ? kMaxBound : b;
+	}
+
+	/* Saturating, on clamped bounds: the product of two fits iff it's below 2^126 */
+	static constexpr Bound mul(Bound a, Bound b) {
+		return a == 0 || b == 0 ? 0 :
+			abs(a) > kMaxBound / abs(b) ? ((a < 0) != (b < 0) ? kMinBound : kMaxBound) : a * b;
+	}
+
+	static constexpr Bound abs(Bound a) {
+		return a < 0 ? -a : a;
+	}
+
+	static constexpr Bound min4(Bound a, Bound b, Bound c, Bound d) {
+		return (a < b ? a : b) < (c < d ? c : d) ? (a < b ? a : b) : (c < d ? c : d);
+	}
+
+	static constexpr Bound max4(Bound a, Bound b, Bound c, Bound d) {
+		return (a > b ? a : b) > (c > d ? c : d) ? (a > b ? a : b) : (c > d ? c : d);
+	}
+};
+
+#endif
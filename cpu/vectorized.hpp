@@ -10,6 +10,69 @@
 #include <string>
 #include <cstring>
 #include <x86intrin.h>
+#include <utility>
+
+/* Instruction sets for which the dispatched primitives are compiled, in order of preference */
+enum PrimitivesIsa {
+    kIsaSse42, kIsaAvx2, kIsaAvx512, kNumIsas
+};
+
+/* The primitives which aren't templates, i.e. those called from the kernels rather than
+ * inlined into them. Each is compiled once per instruction set (see vectorized_isa.cpp),
+ * and calls go through a table of the variants for the best instruction set the CPU
+ * supports - or the one forced with use_isa() - so that the binary runs, and runs
+ * as fast as it may, regardless of the CPU it was built on. Lists, for each, prim(return
+ * type, name, (parameters)). */
+#define PRIMITIVES_DISPATCHED(prim) \
+    prim(int, partial_shuffle_scalar, (idx_t* RESTRICT gids, sel_t* RESTRICT aggr_sel, int num, idx_t* RESTRICT sel, idx_t* RESTRICT lim, idx_t* RESTRICT grp, uint16_t** RESTRICT grppos0, uint16_t** RESTRICT grppos1, uint16_t* RESTRICT selbuf0, uint16_t* RESTRICT selbuf1)) \
+    prim(int, partial_shuffle_avx512_cmp, (idx_t* RESTRICT gids, sel_t* RESTRICT aggr_sel, int num, idx_t* RESTRICT sel, idx_t* RESTRICT lim, idx_t* RESTRICT grp, uint16_t** RESTRICT grppos0, uint16_t** RESTRICT grppos1, uint16_t* RESTRICT selbuf0, uint16_t* RESTRICT selbuf1)) \
+    /** Improved version using a in-register lookup table and population counts */ \
+    prim(int, partial_shuffle_avx512, (idx_t* RESTRICT gids, sel_t* RESTRICT aggr_sel, int num, idx_t* RESTRICT sel, idx_t* RESTRICT lim, idx_t* RESTRICT grp, uint16_t** RESTRICT grppos0, uint16_t** RESTRICT grppos1, uint16_t* RESTRICT selbuf0, uint16_t* RESTRICT selbuf1)) \
+    /** Compares 8 group ids at a time with those of the groups seen so far, with AVX2 */ \
+    prim(int, partial_shuffle_avx2, (idx_t* RESTRICT gids, sel_t* RESTRICT aggr_sel, int num, idx_t* RESTRICT sel, idx_t* RESTRICT lim, idx_t* RESTRICT grp, uint16_t** RESTRICT grppos0, uint16_t** RESTRICT grppos1, uint16_t* RESTRICT selbuf0, uint16_t* RESTRICT selbuf1)) \
+    prim(uint64_t, map_charge, (int64_t* RESTRICT res, int32_t*RESTRICT col1, int8_t*RESTRICT col2, sel_t*RESTRICT sel, int n)) \
+    prim(int, select_int32_t, (sel_t* RESTRICT out, sel_t* RESTRICT sel, int n, bool data_dep, int* RESTRICT a, int b)) \
+    prim(int, select_int16_t, (sel_t* RESTRICT out, sel_t* RESTRICT sel, int n, bool data_dep, int16_t* RESTRICT a, int16_t b)) \
+    /* Converts a bitmap, bit j of word k for row 64*k+j, into a selection vector */ \
+    prim(int, select_bitmap, (sel_t* RESTRICT out, int n, const uint64_t* RESTRICT bits)) \
+    /* The bitmap, as select_bitmap takes it, of the rows for which a[i] <= b; without branches */ \
+    prim(void, filter_int16_t, (uint64_t* RESTRICT bits, int n, int16_t* RESTRICT a, int16_t b)) \
+    prim(int, select_int16_t_avx512, (sel_t* RESTRICT out, sel_t* RESTRICT sel, int n, bool data_dep, int16_t* RESTRICT a, int16_t b)) \
+    /* Are rows [first_row, first_row+n) all non-NULL? A nullptr bitmap means there are no NULLs */ \
+    prim(bool, all_valid, (const uint32_t* RESTRICT validity, size_t first_row, size_t n)) \
+    /* As select_int16_t, where NULLs (i.e. comparing to NULL) never qualify */ \
+    prim(int, select_int16_t_nullable, (sel_t* RESTRICT out, sel_t* RESTRICT sel, int n, bool data_dep, int16_t* RESTRICT a, int16_t b, const uint32_t* RESTRICT validity, size_t first_row)) \
+    /* Clears the bits of NULLs in a bitmap as passed to select_bitmap; first_row must be a multiple of 32 */ \
+    prim(void, filter_and_validity, (uint64_t* RESTRICT bits, int n, const uint32_t* RESTRICT validity, size_t first_row)) \
+    /* Replaces NULLs with 0, so that sums over the result - and over values derived from it - skip them */ \
+    prim(int, map_zero_nulls_int32_t, (int32_t* RESTRICT out, sel_t* RESTRICT sel, int n, int32_t* RESTRICT a, const uint32_t* RESTRICT validity, size_t first_row)) \
+    prim(int, map_gid2_dom_restrict, (idx_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t min_a, int8_t max_a, int8_t* RESTRICT b, int8_t min_b, int8_t max_b)) \
+    prim(int, map_gid, (idx_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t* RESTRICT b)) \
+    /* The checked maps return whether any result overflowed - and wrapped around - checking once per vector */ \
+    prim(bool, map_disc_1, (int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t RESTRICT b, int8_t* RESTRICT a)) \
+    prim(bool, map_tax_1, (int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t RESTRICT b)) \
+    prim(bool, map_disc_price, (int32_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int32_t* RESTRICT b)) \
+    /* The same maps unchecked, for operands whose ranges prove no result overflows (see ValueRange) */ \
+    prim(int, map_disc_1_unchecked, (int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t RESTRICT b, int8_t* RESTRICT a)) \
+    prim(int, map_tax_1_unchecked, (int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t RESTRICT b)) \
+    prim(int, map_disc_price_unchecked, (int32_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int32_t* RESTRICT b)) \
+    prim(int, ordaggr_quantity, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int16_t* RESTRICT quantity)) \
+    prim(int, ordaggr_extended_price, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT quantity)) \
+    prim(int, ordaggr_disc_price, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT quantity)) \
+    prim(int, ordaggr_charge, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int64_t* RESTRICT charge)) \
+    prim(int, ordaggr_disc, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int8_t* RESTRICT charge)) \
+    prim(int, ordaggr_count, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups)) \
+    prim(int, par_ordaggr_quantity, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int16_t* RESTRICT quantity)) \
+    prim(int, par_ordaggr_extended_price, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT quantity)) \
+    prim(int, par_ordaggr_disc_price, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT quantity)) \
+    prim(int, par_ordaggr_charge, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int64_t* RESTRICT charge)) \
+    prim(int, par_ordaggr_disc, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int8_t* RESTRICT charge)) \
+    prim(int, ordaggr_all_in_one, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int16_t* RESTRICT quantity, int32_t* RESTRICT price, int32_t* RESTRICT disc_price, int64_t* RESTRICT charge, int8_t* RESTRICT disc)) \
+    prim(int, old_map_gid, (idx_t* RESTRICT out, sel_t* RESTRICT sel, int n, char* RESTRICT v_returnflag, char* RESTRICT v_linestatus)) \
+    prim(int, old_map_disc_1, (int64_t* RESTRICT v_disc_1, sel_t* RESTRICT sel, int n, int64_t dec_one, int64_t* RESTRICT v_discount)) \
+    prim(int, old_map_tax_1, (int64_t* RESTRICT v_disc_1, sel_t* RESTRICT sel, int n, int64_t dec_one, int64_t* RESTRICT v_tax)) \
+    prim(int, old_map_mul, (int64_t* RESTRICT v_disc_price, sel_t* RESTRICT sel, int n, int64_t* RESTRICT v_disc_1, int64_t* RESTRICT v_extendedprice)) \
+    prim(int, old_ordaggr_all_in_one, (AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int64_t* RESTRICT quantity, int64_t* RESTRICT extendedprice, int64_t* RESTRICT disc_price, int64_t* RESTRICT charge, int64_t* RESTRICT disc_1))
 
 struct Primitives {
     template<typename F>
@@ -163,61 +226,36 @@ struct Primitives {
     }
 
 public:
-    static int NOINL partial_shuffle_scalar(idx_t* RESTRICT gids, sel_t* RESTRICT aggr_sel, int num, idx_t* RESTRICT sel,
-        idx_t* RESTRICT lim, idx_t* RESTRICT grp, uint16_t** RESTRICT grppos0, uint16_t** RESTRICT grppos1,
-        uint16_t* RESTRICT selbuf0, uint16_t* RESTRICT selbuf1);
-
-    static int NOINL partial_shuffle_avx512_cmp(idx_t* RESTRICT gids, sel_t* RESTRICT aggr_sel, int num, idx_t* RESTRICT sel,
-        idx_t* RESTRICT lim, idx_t* RESTRICT grp, uint16_t** RESTRICT grppos0, uint16_t** RESTRICT grppos1,
-        uint16_t* RESTRICT selbuf0, uint16_t* RESTRICT selbuf1);
-
-    /** Improved version using a in-register lookup table and population counts */
-    static int NOINL partial_shuffle_avx512(idx_t* RESTRICT gids, sel_t* RESTRICT aggr_sel, int num, idx_t* RESTRICT sel,
-        idx_t* RESTRICT lim, idx_t* RESTRICT grp, uint16_t** RESTRICT grppos0, uint16_t** RESTRICT grppos1, 
-        uint16_t* RESTRICT selbuf0, uint16_t* RESTRICT selbuf1);
-
-
-    static uint64_t NOINL map_charge(int64_t* RESTRICT res, int32_t*RESTRICT col1, int8_t*RESTRICT col2, sel_t*RESTRICT sel, int n);
-
-    static int NOINL select_int32_t(sel_t* RESTRICT out, sel_t* RESTRICT sel, int n, bool data_dep, int* RESTRICT a, int b);
-    static int NOINL select_int16_t(sel_t* RESTRICT out, sel_t* RESTRICT sel, int n, bool data_dep, int16_t* RESTRICT a, int16_t b);
-    static int NOINL select_int16_t_avx512(sel_t* RESTRICT out, sel_t* RESTRICT sel, int n, bool data_dep, int16_t* RESTRICT a, int16_t b);
-
-
-    static int NOINL map_gid2_dom_restrict(idx_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t min_a, int8_t max_a, int8_t* RESTRICT b, int8_t min_b, int8_t max_b);
-    static int NOINL map_gid(idx_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t* RESTRICT b);
-
-    static int NOINL map_disc_1(int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t RESTRICT b, int8_t* RESTRICT a);
-
-    static int NOINL map_tax_1(int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t RESTRICT b);
-
-
-    static int NOINL map_disc_price(int32_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int32_t* RESTRICT b);
-
-    static int NOINL ordaggr_quantity(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int16_t* RESTRICT quantity);
-    static int NOINL ordaggr_extended_price(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT quantity);
-    static int NOINL ordaggr_disc_price(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT quantity);
-    static int NOINL ordaggr_charge(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int64_t* RESTRICT charge);
-    static int NOINL ordaggr_disc(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int8_t* RESTRICT charge);
-    static int NOINL ordaggr_count(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups);
-
-    static int NOINL par_ordaggr_quantity(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int16_t* RESTRICT quantity);
-    static int NOINL par_ordaggr_extended_price(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT quantity);
-    static int NOINL par_ordaggr_disc_price(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT quantity);
-    static int NOINL par_ordaggr_charge(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int64_t* RESTRICT charge);
-    static int NOINL par_ordaggr_disc(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int8_t* RESTRICT charge);
-
-    static int NOINL ordaggr_all_in_one(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int16_t* RESTRICT quantity, int32_t* RESTRICT price, int32_t* RESTRICT disc_price, int64_t* RESTRICT charge, int8_t* RESTRICT disc);
-
-
-
-    static int NOINL old_map_gid(idx_t* RESTRICT out, sel_t* RESTRICT sel, int n, char* RESTRICT v_returnflag, char* RESTRICT v_linestatus);
-    static int NOINL old_map_disc_1(int64_t* RESTRICT v_disc_1, sel_t* RESTRICT sel, int n, int64_t dec_one, int64_t* RESTRICT v_discount);
-
-    static int NOINL old_map_tax_1(int64_t* RESTRICT v_disc_1, sel_t* RESTRICT sel, int n, int64_t dec_one, int64_t* RESTRICT v_tax);
-    static int NOINL old_map_mul(int64_t* RESTRICT v_disc_price, sel_t* RESTRICT sel, int n, int64_t* RESTRICT v_disc_1, int64_t* RESTRICT v_extendedprice);
+    /* A variant of the dispatched primitives */
+    struct Table {
+#define entry(ret, name, params) ret (*name) params;
+        PRIMITIVES_DISPATCHED(entry)
+#undef entry
+    };
+
+    /* The variant in use */
+    static const Table* table;
+
+#define dispatch(ret, name, params) \
+    template<typename... Args> static ret name(Args&&... args) { return table->name(std::forward<Args>(args)...); }
+    PRIMITIVES_DISPATCHED(dispatch)
+#undef dispatch
+
+    /* Validity bitmaps (see Column::validity) of the rows first_row, first_row+1, ... of a vector */
+    static uint32_t is_valid(const uint32_t* RESTRICT validity, size_t row) {
+        return (validity[row / 32] >> (row % 32)) & 1;
+    }
 
-    static int NOINL old_ordaggr_all_in_one(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int64_t* RESTRICT quantity, int64_t* RESTRICT extendedprice, int64_t* RESTRICT disc_price, int64_t* RESTRICT charge, int64_t* RESTRICT disc_1);
+    /* Does the CPU (and OS) support the instruction set? */
+    static bool isa_supported(PrimitivesIsa isa);
+    /* The instruction set of the variant used unless overridden, detected at startup */
+    static PrimitivesIsa best_isa();
+    static PrimitivesIsa current_isa();
+    /* Overrides the variant in use, e.g. for benchmarking; false if the CPU lacks that instruction set */
+    static bool use_isa(PrimitivesIsa isa);
+    static const char* isa_name(PrimitivesIsa isa);
+    /* By isa_name(); false if there's no such instruction set */
+    static bool isa_by_name(const std::string& name, PrimitivesIsa& isa);
 };
 
 #endif
\ No newline at end of file
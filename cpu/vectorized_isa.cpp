@@ -0,0 +1,1544 @@
+#include "vectorized.hpp"
+
+/* The dispatched primitives, for one instruction set: the build compiles this file once
+ * per PrimitivesIsa, with that instruction set enabled and PRIMITIVES_ISA naming the
+ * namespace to place that variant in, and vectorized.cpp picks one at runtime. Code
+ * which needs a particular extension (e.g. AVX-512) is still chosen with #ifdef, and
+ * falls back to the portable code in the variants for the other instruction sets. */
+#ifndef PRIMITIVES_ISA
+#error "PRIMITIVES_ISA must be defined, e.g. as primitives_avx2 when compiling for AVX2"
+#endif
+
+namespace PRIMITIVES_ISA {
+
+struct Impl : Primitives {
+#define declare(ret, name, params) static ret NOINL name params;
+	PRIMITIVES_DISPATCHED(declare)
+#undef declare
+};
+
+#ifdef __AVX2__
+/* For each 8-bit mask, the lanes whose bits are set, in order: compresses the result
+ * of comparing 8 lanes into (the positions of) the selected ones. Also as the bytes to
+ * _mm_shuffle_epi8 8 lanes of 16 bits by. */
+struct CompressLut {
+	uint8_t pos[256][8];
+	uint8_t shuffle16[256][16];
+
+	constexpr CompressLut() : pos(), shuffle16() {
+		for (int mask = 0; mask < 256; mask++) {
+			int k = 0;
+			for (int lane = 0; lane < 8; lane++) {
+				if (mask & (1 << lane)) {
+					pos[mask][k] = lane;
+					shuffle16[mask][2*k] = 2*lane;
+					shuffle16[mask][2*k + 1] = 2*lane + 1;
+					k++;
+				}
+			}
+		}
+	}
+};
+
+static constexpr CompressLut compress_lut;
+
+/* Dense map, STRIDE tuples at a time by 'vec', the remainder one at a time by 'fun' */
+template<int STRIDE, typename T, typename V, typename F>
+static int map_avx2(T* RESTRICT out, int n, V&& vec, F&& fun) {
+	int i = 0;
+	for (; i + STRIDE <= n; i += STRIDE) {
+		vec(out + i, i);
+	}
+	for (; i < n; i++) {
+		out[i] = fun(i);
+	}
+	return n;
+}
+#endif
+
+#ifdef __AVX512F__
+#define HAND_OPT_CODE false
+#else
+#define HAND_OPT_CODE false
+#endif
+
+int
+Impl::partial_shuffle_scalar(idx_t* RESTRICT gids, sel_t* RESTRICT aggr_sel, int num, idx_t* RESTRICT sel,
+	idx_t* RESTRICT lim, idx_t* RESTRICT grp, uint16_t** RESTRICT grppos0, uint16_t** RESTRICT grppos1, 
+	uint16_t* RESTRICT selbuf0, uint16_t* RESTRICT selbuf1)
+{
+	#define declare(n) \
+		uint16_t* RESTRICT buf_ins##n=selbuf##n; \
+		const uint16_t* RESTRICT buf_end##n = selbuf##n + GROUP_BUF_SIZE; \
+		uint16_t buf##n[MAX_ACTIVE_GROUPS]; \
+		uint16_t* RESTRICT max_gid##n = buf##n;
+
+	declare(0);
+	declare(1);
+
+	/* Reduce TLB thrashing by removing positional access on vector 'gids' */
+	gids = Primitives::desel(sel, aggr_sel, gids, num);
+
+	#define new_group(n, dstpos) \
+		do { \
+			if (UNLIKELY(buf_ins##n >= buf_end##n)) { \
+				printf("gid %lld -> %d, %lld\n", (long long int) gid, (unsigned) (gid & 0xFF), (long long int) (gid >> 8)); \
+				assert(false && "bail out"); /* Never happens in Q1 */ \
+			} \
+			*dstpos = buf_ins##n; \
+			buf_ins##n += MAX_VSIZE; \
+			*max_gid##n = gid; \
+			max_gid##n++; \
+		} while (0)
+
+
+	#define insert(n, idx, org) \
+		do { \
+			const auto gid = gids[org]; \
+			auto dstpos = &grppos##n[gid]; \
+			if (UNLIKELY(!(*dstpos))) { \
+				new_group(n, dstpos); \
+			} \
+			**dstpos = idx; \
+			(*dstpos)++; \
+		} while (0)
+
+#if 0
+	/* One iterator */
+	if (aggr_sel) {
+		for (int i=0; i<num; i++) {
+			auto k = aggr_sel[i];
+			insert(0, k, i);
+		}
+	} else {
+		for (int i=0; i<num; i++) {
+			insert(0, i, i);
+		}
+	}
+#else
+	/* Two iterators. Improves CPU utilization but risks TLB thrashing */
+	Primitives::for_each_2(aggr_sel, num,
+		[&] (auto i0, auto i1, auto org0, auto org1) { insert(0, i0, org0); insert(1, i1, org1); },
+		[&] (auto i0, auto org0) { insert(0, i0, org0); });
+#endif
+
+	int64_t num_groups = 0, num_tuples = 0;
+
+	#define copy(nr, gid) do { \
+			const auto pos = grppos##nr[gid]; \
+			const auto num = (pos - selbuf##nr) % MAX_VSIZE; /* Optimized into bit-wise operations */ \
+			const uint16_t* RESTRICT start = pos - num; \
+			for (size_t i=0; i<num; i++) { \
+				sel[i] = start[i]; \
+			} \
+			grppos##nr[gid] = NULL; \
+			sel += num; \
+			num_tuples += num; \
+		} while (0)
+
+
+	{ /* Build selection vector */
+		for (auto curr=buf0; curr < max_gid0; curr++) {
+			const auto gid = *curr;
+
+			copy(0, gid);
+			if (grppos1[gid]) { copy(1, gid); }
+
+			lim[num_groups] = num_tuples;
+			grp[num_groups] = gid;
+			num_groups++;
+		}
+
+		for (auto curr=buf1; curr < max_gid1; curr++) {
+			const auto gid = *curr;
+			if (!grppos1[gid]) {
+				continue;
+			}
+
+			copy(1, gid);
+			lim[num_groups] = num_tuples;
+			grp[num_groups] = gid;
+			num_groups++;
+		}
+	}
+
+	// assert(i <= 4);
+	return num_groups;
+
+	#undef insert
+	#undef assert_pos
+	#undef copy
+	#undef declare
+	#undef new_group
+}
+
+#ifdef __AVX512F__
+static int32_t* group_sel_curr[MAX_ACTIVE_GROUPS]; /* selection vector of each group */
+static int32_t* group_sel_start[MAX_ACTIVE_GROUPS];
+static int32_t group_sel_buf[GROUP_BUF_SIZE];
+static int32_t group_gids[16];
+#endif
+
+int Impl::partial_shuffle_avx512_cmp(idx_t* RESTRICT group_ids, sel_t* RESTRICT aggr_sel, int num, idx_t* RESTRICT out_sel,
+	idx_t* RESTRICT lim, idx_t* RESTRICT grp,  uint16_t** RESTRICT grppos0, uint16_t** RESTRICT grppos1,
+	uint16_t* RESTRICT selbuf0, uint16_t* RESTRICT selbuf1)
+{
+#ifdef __AVX512F__
+	// assert(aggr_sel);
+
+#define new_group(gid) do { \
+		group_sel_curr[gid] = &group_sel_buf[group_sel_buf_idx]; \
+		group_sel_start[gid] = group_sel_curr[gid]; \
+		group_sel_buf_idx += MAX_VSIZE; \
+		group_gids[group_gids_idx++] = gid; \
+		if (group_sel_buf_idx > GROUP_BUF_SIZE) { \
+			assert(false && "bail out"); return -1; /* Too much groups */ \
+		} \
+	} while (false)
+
+
+	int32_t group_buf[16];
+	int i = 0;
+	int group_idx;
+	int64_t group_sel_buf_idx = 0;
+	int64_t group_gids_idx = 0;
+
+	const auto zero = _mm512_setzero_epi32();
+
+	while (i + 16 < num) {
+		// cast our selection vector down to have a more efficient SIMD ops
+		const auto sel1 = _mm512_cvtepi64_epi32(_mm512_load_epi64(aggr_sel + i));
+		const auto sel2 = _mm512_cvtepi64_epi32(_mm512_load_epi64(aggr_sel + i + 8));
+
+		auto sel = _mm512_inserti64x4(_mm512_inserti64x4(zero, sel1, 0), sel2, 1);
+
+		// gather and cast down
+		const auto gids = _mm512_i32gather_epi32(sel, (int*)(group_ids), 8);
+
+		auto cflct = _mm512_conflict_epi32(gids);
+		auto uniq_mask = _mm512_cmpeq_epi32_mask(cflct, zero);
+		_mm512_mask_compressstoreu_epi32(&group_buf[0], uniq_mask, gids);
+
+		auto num_groups = _mm_popcnt_u32(uniq_mask);
+
+		for (group_idx=0; group_idx<num_groups; group_idx++) {
+			const auto gid = group_buf[group_idx];
+
+			if (UNLIKELY(!group_sel_start[gid])) { /* This one actually almost never changes */
+				new_group(gid);
+			}
+
+			auto matches = _mm512_cmpeq_epi32_mask(gids, _mm512_set1_epi32(gid));
+			_mm512_mask_compressstoreu_epi32(group_sel_curr[gid], matches, sel);
+			/* Advance selection vector of this group */
+			group_sel_curr[gid] += _mm_popcnt_u32(matches);
+		}
+
+		i += 16;
+	}
+
+	// remaining items
+	while (i < num) {
+		const auto idx = aggr_sel[i];
+		const auto gid = group_ids[idx];
+		if (!group_sel_start[gid]) {
+			new_group(gid);
+		}
+		*group_sel_curr[gid] = idx;
+		group_sel_curr[gid]++;
+		i++;
+	}
+
+	// go through gids and concat selection vectors
+
+	for (i=0; i<group_gids_idx; i++) {
+		auto gid = group_gids[i];
+
+		int32_t* sel = group_sel_start[gid];
+		int32_t* end = group_sel_curr[gid];
+
+		while (sel + 8 < end) {
+			auto tmp = _mm256_loadu_si256((__m256i*)sel);
+			_mm512_storeu_si512((__m512i*)out_sel, _mm512_cvtepi32_epi64(tmp));
+			sel += 8;
+			out_sel += 8;
+		}
+
+		while (sel != end) {
+			*out_sel = *sel;
+			out_sel++;
+			sel++;
+		}
+	}
+
+	int64_t num_groups = 0;
+	int64_t num_tuples = 0;
+	for (i=0; i<group_gids_idx; i++) {
+		auto gid = group_gids[i];
+
+		int32_t* sel = group_sel_start[gid];
+		int32_t* end = group_sel_curr[gid];
+
+		size_t n = end - sel;
+
+		num_tuples += n;
+		lim[num_groups] = num_tuples;
+		grp[num_groups] = gid;
+
+		num_groups++;
+
+		// reset
+		group_sel_curr[gid] = nullptr;
+		group_sel_start[gid] = nullptr;
+	}
+
+	return num_groups;
+#else
+	return partial_shuffle_scalar(group_ids, aggr_sel, num, out_sel, lim, grp, grppos0, grppos1, selbuf0, selbuf1);
+#endif
+}
+
+#undef new_group
+
+/** Quick heler for accessing register internals */
+union m512_epi32 {
+	__m512i v;
+	int32_t a[16];
+};
+
+int Impl::partial_shuffle_avx512(idx_t* RESTRICT groups, sel_t* RESTRICT aggr_sel, int num, idx_t* RESTRICT out_sel,
+	idx_t* RESTRICT lim, idx_t* RESTRICT grp, uint16_t** RESTRICT grppos0, uint16_t** RESTRICT grppos1,
+	uint16_t* RESTRICT selbuf0, uint16_t* RESTRICT selbuf1)
+{
+#ifdef __AVX512F__
+	assert(aggr_sel);
+
+	constexpr int kCommonOffset = sizeof(int64_t);
+
+	int i = 0;
+	const auto zero = _mm512_setzero_epi32();
+	const auto min_offsets = _mm512_set1_epi32(kCommonOffset);
+	const auto one = _mm512_set1_epi32(1);
+
+	__m512i popcnt_table = popcount_up_to_16_epi32_table;
+
+	/** Large array indexed by GID which provides the current index into 'group_sel' */
+	static int32_t group_base[65536]; // TODO: maybe even int16_t as we limit ourselves tyo 64 groups * 1024 items
+	/** Buffer for all the selecion lists */
+	static int32_t group_sel[kCommonOffset + GROUP_BUF_SIZE];
+	/** Pointer into 'group_sel'
+	 * Can be used for fast iteration over groups or counting the total amount of tuples in a group */
+	static int32_t group_sel_start[MAX_ACTIVE_GROUPS];
+
+	int total_groups = 0;
+
+#define sequential(gid, sel_idx) do { \
+		auto idx = group_base[gid]; \
+		if (idx < kCommonOffset) { \
+			/* Allocate new index in group_sel */ \
+			group_base[gid] = kCommonOffset + total_groups * MAX_VSIZE; \
+			group_sel_start[total_groups] = group_base[gid]; \
+			/* printf("new group gid=%d group_base[gid]=%d idx=%d sel_start[idx]=%d\n", gid, group_base[gid], total_groups, group_sel_start[total_groups]); */ \
+			total_groups++; \
+			if (UNLIKELY(total_groups > MAX_ACTIVE_GROUPS)) { \
+				assert(false && "bail out"); \
+			} \
+		} \
+		group_sel[group_base[gid]] = sel_idx; \
+		group_base[gid]++; \
+	} while (false)
+
+	while (i + 16 < num) {
+		// cast our selection vector down to have a more efficient SIMD ops
+		const auto sel1 = _mm512_cvtepi64_epi32(_mm512_load_epi64(aggr_sel + i));
+		const auto sel2 = _mm512_cvtepi64_epi32(_mm512_load_epi64(aggr_sel + i + 8));
+
+		auto sel = _mm512_inserti64x4(_mm512_inserti64x4(zero, sel1, 0), sel2, 1);
+		
+		// gather and cast down
+		const auto gids = _mm512_i32gather_epi32(sel, (int*)(groups), 8);
+		
+		auto cflct = _mm512_conflict_epi32(gids);
+		
+		// population count gives us the indices inside each group
+		auto pop = popcount_up_to_16_bitw_epi32(cflct);
+		
+		// generate index for each group
+		auto idx = _mm512_i32gather_epi32(gids, group_base, 4);
+		
+		/* We always add kCommonOffset to the offsets, so 0 means uninitialized */
+		auto new_groups_mask = _mm512_cmplt_epi32_mask(idx, min_offsets);
+
+		// find new groups <=> idx <= 0
+		int num_new_groups = _mm_popcnt_u32(new_groups_mask);
+
+		// get absolute indices
+		idx = _mm512_add_epi32(pop, idx);
+		// increment by one to prepare for the next round
+		auto new_idx = _mm512_add_epi32(idx, one);
+
+		if (num_new_groups == 0) {
+			_mm512_i32scatter_epi32(group_sel, idx, sel, 4);
+
+			// increment by scattering back / last write wins (according to intel manual)
+			_mm512_i32scatter_epi32(group_base, gids, new_idx, 4);
+		} else {
+			m512_epi32 gid_vec;
+			m512_epi32 sel_vec;
+
+			gid_vec.v = gids;
+			sel_vec.v = sel;
+
+			/* Get rid of existing groups by flushing them into buffers, before we start to sequntially
+			 * resolve the problematic cases. */
+			auto existing_groups_mask = _mm512_knot(new_groups_mask);
+			_mm512_mask_i32scatter_epi32(group_sel, existing_groups_mask, idx, sel, 4);
+
+			// increment by scattering back / last write wins (according to intel manual)
+			_mm512_mask_i32scatter_epi32(group_base, existing_groups_mask, gids, new_idx, 4);
+
+			/* Two cases: 1. A completely new group or 2. a conflicting new group.
+			 * This should be a cold path anyway, so we just resolve this by trying again
+			 * in sequential fashion */
+			// assert(num_new_groups > 0);
+			int group_counter = 0;
+			
+			for (int j=0; j<16; j++) {
+				if ((1 << j) & new_groups_mask) {
+					const auto k = sel_vec.a[j];
+					const auto gid = gid_vec.a[j];
+					sequential(gid, k);
+					group_counter++;
+				}
+			}
+			// assert(group_counter == num_new_groups);
+		}
+
+		i += 16;
+	}
+
+	/* Cold path, sequentially process remainder */
+	while (i < num) {
+		const auto k = aggr_sel[i];
+		const auto gid = groups[k];
+		sequential(gid, k);
+		i++;
+	}
+
+	int num_groups = 0;
+	int acc_num = 0;
+	/* Build selection vector from lists */
+	for (int i=0; i<MAX_ACTIVE_GROUPS; i++) {
+		int32_t first = group_sel_start[i];
+		if (!first) {
+			break;
+		}
+		
+		const int32_t* sel16 = &group_sel[first];
+		const auto gid = groups[*sel16];
+
+		// assert(first < group_base[gid]);
+
+		const int32_t* sel16_end = &group_sel[group_base[gid]];
+		const size_t sel_num = sel16_end - sel16;
+
+		while (sel16 + 8 < sel16_end) {
+			auto tmp = _mm256_loadu_si256((__m256i*)sel16);
+			_mm512_storeu_si512((__m512i*)out_sel, _mm512_cvtepi32_epi64(tmp));
+			sel16 += 8;
+			out_sel += 8;
+		}
+
+		
+		while (sel16 != sel16_end) {
+			*out_sel = *sel16;
+			sel16++;
+			out_sel++;
+		}
+
+		acc_num += sel_num;
+		lim[num_groups] = acc_num;
+		grp[num_groups] = gid;
+		num_groups++;
+
+		/* Clean up */
+		group_sel_start[i] = 0;
+		group_base[gid] = 0;
+	}
+
+	assert(num_groups == total_groups);
+
+	#undef sequential
+
+	return total_groups;
+#else
+	return partial_shuffle_scalar(groups, aggr_sel, num, out_sel, lim, grp, grppos0, grppos1, selbuf0, selbuf1);
+#endif
+}
+
+int Impl::partial_shuffle_avx2(idx_t* RESTRICT gids, sel_t* RESTRICT aggr_sel, int num, idx_t* RESTRICT sel,
+	idx_t* RESTRICT lim, idx_t* RESTRICT grp, uint16_t** RESTRICT grppos0, uint16_t** RESTRICT grppos1,
+	uint16_t* RESTRICT selbuf0, uint16_t* RESTRICT selbuf1)
+{
+#ifdef __AVX2__
+	/* Q1 has but a few groups per vector: each group of 8 tuples is compared with the
+	 * first kCompared groups, and their positions compressed into those groups' buffers,
+	 * a MAX_VSIZE slice of selbuf0 each. Whatever tuples are left take the scalar path,
+	 * which adds new groups. Storing 8 positions stays within a slice, as at most i
+	 * tuples were added before tuple i. */
+	constexpr int kCompared = 8;
+	constexpr int kMaxGroups = GROUP_BUF_SIZE / MAX_VSIZE;
+
+	int32_t group_gid[kMaxGroups];
+	uint16_t* group_end[kMaxGroups];
+	int num_groups = 0;
+
+	auto insert = [&] (int32_t gid, uint16_t position) {
+		int g = 0;
+		while (g < num_groups && group_gid[g] != gid) {
+			g++;
+		}
+		if (g == num_groups) {
+			if (UNLIKELY(num_groups == kMaxGroups)) {
+				return false;
+			}
+			group_gid[g] = gid;
+			group_end[g] = selbuf0 + g * MAX_VSIZE;
+			num_groups++;
+		}
+		*group_end[g]++ = position;
+		return true;
+	};
+
+	/* Packs the lower halves of two vectors of 4 x 64 bits */
+	const __m256i lower_halves = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	auto narrow = [&] (__m256i lo, __m256i hi) {
+		return _mm256_permute2x128_si256(_mm256_permutevar8x32_epi32(lo, lower_halves),
+			_mm256_permutevar8x32_epi32(hi, lower_halves), 0x20);
+	};
+	const __m128i lanes = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+
+	int i = 0;
+	for (; i + 8 <= num; i += 8) {
+		/* The group ids as 32 bits, to compare, and the positions as 16 bits, to compress */
+		__m256i group_ids;
+		__m128i positions;
+		if (aggr_sel) {
+			const __m256i s0 = _mm256_loadu_si256((const __m256i*)(aggr_sel + i));
+			const __m256i s1 = _mm256_loadu_si256((const __m256i*)(aggr_sel + i + 4));
+			const __m256i s = narrow(s0, s1);
+			positions = _mm_packus_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+			group_ids = narrow(_mm256_i64gather_epi64((const long long int*)gids, s0, 8),
+				_mm256_i64gather_epi64((const long long int*)gids, s1, 8));
+		} else {
+			positions = _mm_add_epi16(_mm_set1_epi16(i), lanes);
+			group_ids = narrow(_mm256_loadu_si256((const __m256i*)(gids + i)),
+				_mm256_loadu_si256((const __m256i*)(gids + i + 4)));
+		}
+
+		/* Without branching on the masks, which are hardly predictable */
+		uint32_t left = 0xFF;
+		const int compared = std::min(num_groups, kCompared);
+		for (int g = 0; g < compared; g++) {
+			const __m256i eq = _mm256_cmpeq_epi32(group_ids, _mm256_set1_epi32(group_gid[g]));
+			const uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+			const __m128i shuffle = _mm_loadu_si128((const __m128i*)compress_lut.shuffle16[mask]);
+			_mm_storeu_si128((__m128i*)group_end[g], _mm_shuffle_epi8(positions, shuffle));
+			group_end[g] += _mm_popcnt_u32(mask);
+			left &= ~mask;
+		}
+
+		if (left) {
+			uint16_t p[8];
+			int32_t q[8];
+			_mm_storeu_si128((__m128i*)p, positions);
+			_mm256_storeu_si256((__m256i*)q, group_ids);
+			for (; left; left &= left - 1) {
+				const int lane = __builtin_ctz(left);
+				if (!insert(q[lane], p[lane])) {
+					return partial_shuffle_scalar(gids, aggr_sel, num, sel, lim, grp, grppos0, grppos1, selbuf0, selbuf1);
+				}
+			}
+		}
+	}
+
+	for (; i < num; i++) {
+		const auto position = aggr_sel ? aggr_sel[i] : i;
+		if (!insert(gids[position], position)) {
+			return partial_shuffle_scalar(gids, aggr_sel, num, sel, lim, grp, grppos0, grppos1, selbuf0, selbuf1);
+		}
+	}
+
+	/* Build selection vector */
+	int64_t num_tuples = 0;
+	for (int g = 0; g < num_groups; g++) {
+		const uint16_t* RESTRICT start = selbuf0 + g * MAX_VSIZE;
+		const int64_t n = group_end[g] - start;
+		int64_t k = 0;
+		for (; k + 4 <= n; k += 4) {
+			const __m256i positions = _mm256_cvtepu16_epi64(_mm_loadl_epi64((const __m128i*)(start + k)));
+			_mm256_storeu_si256((__m256i*)(sel + num_tuples + k), positions);
+		}
+		for (; k < n; k++) {
+			sel[num_tuples + k] = start[k];
+		}
+		num_tuples += n;
+		lim[g] = num_tuples;
+		grp[g] = group_gid[g];
+	}
+	return num_groups;
+#else
+	return partial_shuffle_scalar(gids, aggr_sel, num, sel, lim, grp, grppos0, grppos1, selbuf0, selbuf1);
+#endif
+}
+
+inline static void
+cast_int32_t_int64_t(const __m128i& inp, __m128i& r1, __m128i& r2)
+{
+	r1 = _mm_cvtepi32_epi64(inp);
+	r2 = _mm_cvtepi32_epi64(_mm_shuffle_epi32(inp, 14));
+}
+
+
+template<bool GET_LO>
+inline static void
+cast_int8_t_int64_t(const __m128i& inp, __m128i& r1, __m128i& r2, __m128i& r3, __m128i& r4)
+{
+	auto split = [] (const auto& a, auto& lo, auto& hi) {
+		lo = _mm_cvtepi8_epi64(a);
+		hi = _mm_cvtepi8_epi64(_mm_srli_epi32(a, 16));
+	};
+
+	if (GET_LO) {
+		split(inp, r1, r2);
+		split(_mm_shuffle_epi32(inp, 1), r3, r4);
+	} else {
+		split(_mm_shuffle_epi32(inp, 2), r1, r2);
+		split(_mm_shuffle_epi32(inp, 3), r3, r4);
+	}
+}
+
+/* Unchecked, as it can't overflow */
+static_assert((ValueRange::Of<int32_t>() * ValueRange::Of<int8_t>()).Fits<int64_t>(),
+	"An int32_t times an int8_t doesn't fit into 64 bits");
+
+uint64_t
+Impl::map_charge(int64_t*RESTRICT res, int32_t*RESTRICT col1, int8_t*RESTRICT col2, sel_t*RESTRICT sel, int n)
+{
+	if (HAND_OPT_CODE && !sel) {
+		n = (n-1) >> 4;
+
+		for(int i=0; i<=n; i++) {
+			const auto c1 = (__m128i*)col1 + i*4;
+			const auto c2 = (__m128i*)col2 + i;
+			auto out = (__m128i*) res + i * 8;
+
+			const __m128i l_16 = _mm_loadu_si128(c2);
+
+			/* Multiplies and stores the result */
+			auto mul_store = [&] (const auto& a, const auto& b, const int off) {
+				_mm_storeu_si128(out + off, _mm_mul_epi32(a, b));
+			};
+
+			auto load_cast_int32_t = [&] (const int off, auto& lo, auto& hi) {
+				cast_int32_t_int64_t(_mm_loadu_si128(c1 + off), lo, hi);
+			};
+
+			__m128i l1, l2, l3, l4;
+			__m128i r1, r2, r3, r4;
+
+			/* Process first 8 multiplcations */
+			cast_int8_t_int64_t<true>(l_16, r1, r2, r3, r4);
+			load_cast_int32_t(0, l1, l2);
+			load_cast_int32_t(1, l3, l4);
+
+			mul_store(l1, r1, 0);
+			mul_store(l2, r2, 1);
+			mul_store(l3, r3, 2);
+			mul_store(l4, r4, 3);
+
+			/* Process next 8 multiplcations */
+			cast_int8_t_int64_t<false>(l_16, r1, r2, r3, r4);
+			load_cast_int32_t(2, l1, l2);
+			load_cast_int32_t(3, l3, l4);
+
+          	mul_store(l1, r1, 4);
+			mul_store(l2, r2, 5);
+			mul_store(l3, r3, 6);
+			mul_store(l4, r4, 7);
+		}
+		return n;
+	}
+
+	auto charge = [&] (auto i) {
+		return ((int64_t) col1[i])*col2[i];
+	};
+#ifdef __AVX2__
+	if (!sel) {
+		return map_avx2<4>(res, n, [&] (int64_t* RESTRICT out, int i) {
+			/* _mm256_mul_epi32 multiplies the (sign-extended) lower halves into 64 bits */
+			const __m256i price = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)(col1 + i)));
+			const __m256i tax = _mm256_cvtepi8_epi64(_mm_loadu_si32(col2 + i));
+			_mm256_storeu_si256((__m256i*)out, _mm256_mul_epi32(price, tax));
+		}, charge);
+	}
+#endif
+	return map(res, sel, n, charge);
+}
+
+int Impl::select_int32_t(sel_t* RESTRICT out, sel_t* RESTRICT sel, int n, bool data_dep, int* RESTRICT a, int b) {
+	return select(out, sel, n, data_dep, [&] (size_t i) { return a[i] <= b; });
+}
+
+int Impl::select_int16_t(sel_t* RESTRICT out, sel_t* RESTRICT sel, int n, bool data_dep, int16_t* RESTRICT a, int16_t b) {
+#ifdef __AVX2__
+	if (data_dep && !sel) {
+		/* Without branches, like select(): 16 comparisons at a time, compressed 8 lanes
+		 * at a time. Storing all 8 positions stays within 'out', as at most i tuples were
+		 * selected before tuple i. */
+		const __m256i bound = _mm256_set1_epi16(b);
+		auto compress = [&] (uint32_t mask, int i, int num) {
+			const __m128i lanes = _mm_loadl_epi64((const __m128i*)compress_lut.pos[mask]);
+			const __m256i base = _mm256_set1_epi64x(i);
+			_mm256_storeu_si256((__m256i*)(out + num), _mm256_add_epi64(base, _mm256_cvtepu8_epi64(lanes)));
+			_mm256_storeu_si256((__m256i*)(out + num + 4), _mm256_add_epi64(base, _mm256_cvtepu8_epi64(_mm_srli_si128(lanes, 4))));
+			return num + _mm_popcnt_u32(mask);
+		};
+
+		int i = 0, num = 0;
+		for (; i + 16 <= n; i += 16) {
+			const __m256i gt = _mm256_cmpgt_epi16(_mm256_loadu_si256((const __m256i*)(a + i)), bound);
+			const uint32_t mask = ~_mm_movemask_epi8(_mm_packs_epi16(_mm256_castsi256_si128(gt), _mm256_extracti128_si256(gt, 1))) & 0xFFFF;
+			num = compress(mask & 0xFF, i, num);
+			num = compress(mask >> 8, i + 8, num);
+		}
+		for (; i < n; i++) {
+			out[num] = i;
+			num += a[i] <= b;
+		}
+		return num;
+	}
+#endif
+    return select(out, sel, n, data_dep, [&] (size_t i) { return a[i] <= b; });
+}
+
+int Impl::select_bitmap(sel_t* RESTRICT out, int n, const uint64_t* RESTRICT bits) {
+	int res = 0;
+	for (int k = 0; k*64 < n; k++) {
+		uint64_t word = bits[k];
+		while (word) {
+			out[res++] = k*64 + __builtin_ctzll(word);
+			word &= word - 1;
+		}
+	}
+	return res;
+}
+
+void Impl::filter_int16_t(uint64_t* RESTRICT bits, int n, int16_t* RESTRICT a, int16_t b) {
+	int i = 0;
+#ifdef __AVX2__
+	/* As select_int16_t's: 16 comparisons at a time, 64 to a word */
+	const __m256i bound = _mm256_set1_epi16(b);
+	auto le = [&] (int i) -> uint64_t {
+		const __m256i gt = _mm256_cmpgt_epi16(_mm256_loadu_si256((const __m256i*)(a + i)), bound);
+		return ~_mm_movemask_epi8(_mm_packs_epi16(_mm256_castsi256_si128(gt), _mm256_extracti128_si256(gt, 1))) & 0xFFFF;
+	};
+	for (; i + 64 <= n; i += 64) {
+		bits[i / 64] = le(i) | le(i + 16) << 16 | le(i + 32) << 32 | le(i + 48) << 48;
+	}
+#endif
+	for (; i < n; i += 64) {
+		const int num = std::min(64, n - i);
+		uint64_t word = 0;
+		for (int j = 0; j < num; j++) {
+			word |= (uint64_t)(a[i + j] <= b) << j;
+		}
+		bits[i / 64] = word;
+	}
+}
+
+bool Impl::all_valid(const uint32_t* RESTRICT validity, size_t first_row, size_t n) {
+	if (!validity) {
+		return true;
+	}
+	const size_t end = first_row + n;
+	for (size_t row = first_row; row < end; ) {
+		const size_t bit = row % 32;
+		const size_t len = std::min(32 - bit, end - row);
+		const uint32_t mask = (uint32_t)(((uint64_t)1 << len) - 1) << bit;
+		if ((validity[row / 32] & mask) != mask) {
+			return false;
+		}
+		row += len;
+	}
+	return true;
+}
+
+int Impl::select_int16_t_nullable(sel_t* RESTRICT out, sel_t* RESTRICT sel, int n, bool data_dep, int16_t* RESTRICT a, int16_t b,
+	const uint32_t* RESTRICT validity, size_t first_row) {
+	return select(out, sel, n, data_dep, [&] (size_t i) { return (a[i] <= b) & is_valid(validity, first_row + i); });
+}
+
+void Impl::filter_and_validity(uint64_t* RESTRICT bits, int n, const uint32_t* RESTRICT validity, size_t first_row) {
+	assert(first_row % 32 == 0);
+	validity += first_row / 32;
+	for (int c = 0; c*32 < n; c++) {
+		bits[c / 2] &= ~((uint64_t)~validity[c] << (32 * (c % 2)));
+	}
+}
+
+int Impl::map_zero_nulls_int32_t(int32_t* RESTRICT out, sel_t* RESTRICT sel, int n, int32_t* RESTRICT a,
+	const uint32_t* RESTRICT validity, size_t first_row) {
+	return map(out, sel, n, [&] (size_t i) {
+		return a[i] & -(int32_t)is_valid(validity, first_row + i);
+	});
+}
+
+int Impl::select_int16_t_avx512(sel_t* RESTRICT out, sel_t* RESTRICT sel, int n, bool data_dep, int16_t* RESTRICT a, int16_t b) {
+	return select_int16_t(out, sel, n, data_dep, a, b);
+}
+
+int Impl::map_gid2_dom_restrict(idx_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t min_a, int8_t max_a, int8_t* RESTRICT b, int8_t min_b, int8_t max_b) {
+	uint8_t d = max_b - min_b;
+#ifdef __AVX2__
+	if (!sel) {
+		/* As below: relative to a non-zero minimum modulo 256, otherwise as is */
+		auto rel = [] (const int8_t* RESTRICT col, int8_t min) {
+			const __m256i v = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)col));
+			return min ? _mm256_and_si256(_mm256_sub_epi32(v, _mm256_set1_epi32(min)), _mm256_set1_epi32(0xFF)) : v;
+		};
+		return map_avx2<8>(out, n, [&] (idx_t* RESTRICT res, int i) {
+			const __m256i gid = _mm256_add_epi32(_mm256_mullo_epi32(rel(a + i, min_a), _mm256_set1_epi32(d)), rel(b + i, min_b));
+			_mm256_storeu_si256((__m256i*)res, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(gid)));
+			_mm256_storeu_si256((__m256i*)(res + 4), _mm256_cvtepi32_epi64(_mm256_extracti128_si256(gid, 1)));
+		}, [&] (size_t i) {
+			const int ra = min_a ? (uint8_t) (a[i] - (uint8_t) min_a) : a[i];
+			const int rb = min_b ? (uint8_t) (b[i] - (uint8_t) min_b) : b[i];
+			return ra * d + rb;
+		});
+	}
+#endif
+	if (min_a) {
+		if (min_b) {
+			return map(out, sel, n, [&] (size_t i) {
+		        return ((uint8_t) (a[i] - (uint8_t) min_a)) * d + ((uint8_t) (b[i] - (uint8_t) min_b));
+		    });
+		} else {
+			return map(out, sel, n, [&] (size_t i) {
+		        return ((uint8_t) (a[i] - (uint8_t) min_a)) * d + (uint8_t)b[i];
+		    });
+		}
+	} else {
+		if (min_b) {
+			return map(out, sel, n, [&] (size_t i) {
+				return a[i] * d + (uint8_t) (b[i] - (uint8_t) min_b);
+		    });
+		} else {
+			return map(out, sel, n, [&] (size_t i) {
+				return (a[i]) * d + (b[i]);
+		    });
+		}
+	}
+}
+
+int Impl::map_gid(idx_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t* RESTRICT b) {
+    auto gid = [&] (size_t i) {
+        uint16_t idx =  a[i] << 8 | b[i];
+        return idx;
+    };
+#ifdef __AVX2__
+	if (!sel) {
+		return map_avx2<8>(out, n, [&] (idx_t* RESTRICT res, int i) {
+			const __m256i hi = _mm256_slli_epi32(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(a + i))), 8);
+			const __m256i lo = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(b + i)));
+			const __m256i idx = _mm256_and_si256(_mm256_or_si256(hi, lo), _mm256_set1_epi32(0xFFFF));
+			_mm256_storeu_si256((__m256i*)res, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(idx)));
+			_mm256_storeu_si256((__m256i*)(res + 4), _mm256_cvtepu32_epi64(_mm256_extracti128_si256(idx, 1)));
+		}, gid);
+	}
+#endif
+    return map(out, sel, n, gid);
+}
+
+/* The maps which may overflow come checked - returning whether any result did - and
+ * unchecked, for vectors whose operands' ranges prove they can't (see ValueRange) */
+template<bool CHECKED>
+static bool map_disc_1_flavour(int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t RESTRICT b, int8_t* RESTRICT a) {
+    bool overflow = false;
+    auto disc_1 = [&] (size_t i) -> int8_t {
+        if (!CHECKED) {
+            return b - (int8_t)a[i];
+        }
+        int8_t r;
+        overflow |= __builtin_sub_overflow(b, a[i], &r);
+        return r;
+    };
+#ifdef __AVX2__
+	if (!sel) {
+		/* lanes where the saturating difference differs from the wrapping one overflowed */
+		__m256i lanes = _mm256_setzero_si256();
+		map_avx2<32>(out, n, [&] (int8_t* RESTRICT res, int i) {
+			const __m256i disc = _mm256_loadu_si256((const __m256i*)(a + i));
+			const __m256i r = _mm256_sub_epi8(_mm256_set1_epi8(b), disc);
+			if (CHECKED) {
+				lanes = _mm256_or_si256(lanes, _mm256_xor_si256(r, _mm256_subs_epi8(_mm256_set1_epi8(b), disc)));
+			}
+			_mm256_storeu_si256((__m256i*)res, r);
+		}, disc_1);
+		return overflow || !_mm256_testz_si256(lanes, lanes);
+	}
+#endif
+    Primitives::map(out, sel, n, disc_1);
+    return overflow;
+}
+
+template<bool CHECKED>
+static bool map_tax_1_flavour(int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t RESTRICT b) {
+    bool overflow = false;
+    auto tax_1 = [&] (size_t i) -> int8_t {
+        if (!CHECKED) {
+            return b + a[i];
+        }
+        int8_t r;
+        overflow |= __builtin_add_overflow(b, a[i], &r);
+        return r;
+    };
+#ifdef __AVX2__
+	if (!sel) {
+		__m256i lanes = _mm256_setzero_si256();
+		map_avx2<32>(out, n, [&] (int8_t* RESTRICT res, int i) {
+			const __m256i tax = _mm256_loadu_si256((const __m256i*)(a + i));
+			const __m256i r = _mm256_add_epi8(tax, _mm256_set1_epi8(b));
+			if (CHECKED) {
+				lanes = _mm256_or_si256(lanes, _mm256_xor_si256(r, _mm256_adds_epi8(tax, _mm256_set1_epi8(b))));
+			}
+			_mm256_storeu_si256((__m256i*)res, r);
+		}, tax_1);
+		return overflow || !_mm256_testz_si256(lanes, lanes);
+	}
+#endif
+    Primitives::map(out, sel, n, tax_1);
+    return overflow;
+}
+
+/* An int8_t times any price within this bound fits into 32 bits */
+static constexpr int32_t kDiscPriceSafeBound = std::numeric_limits<int32_t>::max() / 128;
+static_assert((ValueRange::Of<int8_t>() * ValueRange(-kDiscPriceSafeBound, kDiscPriceSafeBound)).Fits<int32_t>(),
+	"The bound on prices doesn't keep discounted prices within 32 bits");
+
+template<bool CHECKED>
+static bool map_disc_price_flavour(int32_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int32_t* RESTRICT b) {
+    bool overflow = false;
+    auto disc_price = [&] (size_t i) -> int32_t {
+        if (!CHECKED) {
+            return (int32_t)a[i] * b[i];
+        }
+        int32_t z;
+        overflow |= __builtin_mul_overflow((int32_t)a[i], b[i], &z);
+        return z;
+    };
+#ifdef __AVX2__
+	if (!sel) {
+		/* Checking 32-bit products takes 64-bit ones; rather, bound the prices, and only
+		 * check the products exactly if any is out of bounds */
+		__m256i hi = _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+		__m256i lo = _mm256_set1_epi32(std::numeric_limits<int32_t>::max());
+		map_avx2<8>(out, n, [&] (int32_t* RESTRICT res, int i) {
+			const __m256i disc_1 = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(a + i)));
+			const __m256i price = _mm256_loadu_si256((const __m256i*)(b + i));
+			if (CHECKED) {
+				hi = _mm256_max_epi32(hi, price);
+				lo = _mm256_min_epi32(lo, price);
+			}
+			_mm256_storeu_si256((__m256i*)res, _mm256_mullo_epi32(disc_1, price));
+		}, disc_price);
+		if (!CHECKED) {
+			return false;
+		}
+		const __m256i out_of_bounds = _mm256_or_si256(
+			_mm256_cmpgt_epi32(hi, _mm256_set1_epi32(kDiscPriceSafeBound)),
+			_mm256_cmpgt_epi32(_mm256_set1_epi32(-kDiscPriceSafeBound), lo));
+		if (!_mm256_testz_si256(out_of_bounds, out_of_bounds)) {
+			for (int i=0; i<n; i++) {
+				disc_price(i);
+			}
+		}
+		return overflow;
+	}
+#endif
+    Primitives::map(out, sel, n, disc_price);
+    return overflow;
+}
+
+bool Impl::map_disc_1(int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t RESTRICT b, int8_t* RESTRICT a) {
+	return map_disc_1_flavour<true>(out, sel, n, b, a);
+}
+
+int Impl::map_disc_1_unchecked(int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t RESTRICT b, int8_t* RESTRICT a) {
+	map_disc_1_flavour<false>(out, sel, n, b, a);
+	return n;
+}
+
+bool Impl::map_tax_1(int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t RESTRICT b) {
+	return map_tax_1_flavour<true>(out, sel, n, a, b);
+}
+
+int Impl::map_tax_1_unchecked(int8_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int8_t RESTRICT b) {
+	map_tax_1_flavour<false>(out, sel, n, a, b);
+	return n;
+}
+
+bool Impl::map_disc_price(int32_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int32_t* RESTRICT b) {
+	return map_disc_price_flavour<true>(out, sel, n, a, b);
+}
+
+int Impl::map_disc_price_unchecked(int32_t* RESTRICT out, sel_t* RESTRICT sel, int n, int8_t* RESTRICT a, int32_t* RESTRICT b) {
+	map_disc_price_flavour<false>(out, sel, n, a, b);
+	return n;
+}
+
+int Impl::ordaggr_quantity(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int16_t* RESTRICT quantity) {
+    int64_t ag_sum_quantity;
+    return Primitives::ordaggr(pos, lim, grp, num_groups,
+        [&] (auto g) { /* Init aggregate */
+            ag_sum_quantity = 0;
+        },
+        [&] (auto g, auto i) { /* Update aggregate */
+            ag_sum_quantity += quantity[i]; 
+        },
+        [&] (auto group_idx) { /* Finalize aggregate*/
+            auto g = grp[group_idx];
+            aggr0[g].sum_quantity += ag_sum_quantity;
+        });
+};
+
+int Impl::ordaggr_extended_price(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT price)
+{
+	int64_t ag_sum_base_price;
+
+	return Primitives::ordaggr(pos, lim, grp, num_groups,
+		[&] (auto g) { /* Init aggregate */
+			ag_sum_base_price = 0;
+		},
+		[&] (auto g, auto i) { /* Update aggregate */
+			ag_sum_base_price += price[i];
+		},
+		[&] (auto group_idx) { /* Finalize aggregate*/
+			auto g = grp[group_idx];
+			aggr0[g].sum_base_price += ag_sum_base_price;
+		});	
+}
+
+int Impl::ordaggr_disc_price(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT v_disc_price)
+{
+	int64_t ag_sum_disc_price;
+
+	return Primitives::ordaggr(pos, lim, grp, num_groups,
+		[&] (auto g) { /* Init aggregate */
+			ag_sum_disc_price = 0;
+		},
+		[&] (auto g, auto i) { /* Update aggregate */
+			ag_sum_disc_price += v_disc_price[i];
+		},
+		[&] (auto group_idx) { /* Finalize aggregate*/
+			auto g = grp[group_idx];
+			aggr0[g].sum_disc_price = int128_add64(aggr0[g].sum_disc_price, ag_sum_disc_price);
+		});	
+}
+
+int Impl::ordaggr_charge(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int64_t* RESTRICT v_charge)
+{
+	int64_t ag_sum_charge;
+
+	return Primitives::ordaggr(pos, lim, grp, num_groups,
+		[&] (auto g) { /* Init aggregate */
+			ag_sum_charge = 0;
+		},
+		[&] (auto g, auto i) { /* Update aggregate */
+			ag_sum_charge += v_charge[i];
+		},
+		[&] (auto group_idx) { /* Finalize aggregate*/
+			auto g = grp[group_idx];
+			aggr0[g].sum_charge = int128_add64(aggr0[g].sum_charge, ag_sum_charge);
+		});	
+}
+
+int Impl::ordaggr_disc(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int8_t* RESTRICT v_disc_1)
+{
+	int64_t ag_sum_disc;
+
+	return Primitives::ordaggr(pos, lim, grp, num_groups,
+		[&] (auto g) { /* Init aggregate */
+			ag_sum_disc = 0;
+		},
+		[&] (auto g, auto i) { /* Update aggregate */
+			ag_sum_disc += v_disc_1[i];
+		},
+		[&] (auto group_idx) { /* Finalize aggregate*/
+			auto g = grp[group_idx];
+			aggr0[g].sum_disc += ag_sum_disc;
+		});	
+}
+
+int Impl::ordaggr_count(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups)
+{
+	size_t i = 0;
+	for (int g=0; g<num_groups; g++) {
+		aggr0[grp[g]].count += lim[g] - i;
+		i = lim[g];
+	}
+	return 0;
+}
+
+
+template<typename T, typename AccT, int DOP, bool FixAlign, typename VecInit,
+	typename SelLoad, typename ValGather, typename ValLoad,
+	typename VecAdd, typename VecReduce, typename FinalizeFun>
+int ordaggr_sum(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, T* RESTRICT v_charge,
+	VecInit&& init_vec, SelLoad&& sel_load, ValGather&& val_gather, ValLoad&& val_load,
+	VecAdd&& add, VecReduce&& reduce, FinalizeFun&& finalize)
+{
+	AccT ag_sum_charge;
+	int64_t k = 0;
+
+	const size_t ALIGNMENT = 64;
+
+	if (pos) {
+		for (idx_t g=0; g<num_groups; g++) {
+			ag_sum_charge = 0;
+			// prologue thanks to alignment when we switch to next group
+			if (FixAlign && (size_t)(pos + k) % ALIGNMENT) {
+				while ((size_t)(pos + k) % ALIGNMENT && k < lim[g]) {
+		            ag_sum_charge += v_charge[pos[k]];
+		            k++;
+		        }
+			}
+
+			if (k + DOP < lim[g]) {
+				auto sum = init_vec();
+				do {
+		        	auto v_sel = sel_load(pos + k);
+		        	sum = add(sum, val_gather(v_sel, v_charge));
+		        	k += DOP;
+		        } while (k + DOP < lim[g]);
+		        ag_sum_charge += reduce(sum);
+			}
+
+			while (k < lim[g]) {
+	            ag_sum_charge += v_charge[pos[k]];
+	            k++;
+	        }
+
+	        finalize(g, ag_sum_charge);
+	    }
+	} else {
+		for (idx_t g=0; g<num_groups; g++) {
+			ag_sum_charge = 0;
+			if (FixAlign && (size_t)(v_charge + k) % ALIGNMENT) {
+				while ((size_t)(v_charge + k) % ALIGNMENT && k < lim[g]) {
+		            ag_sum_charge += v_charge[k];
+		            k++;
+		        }
+			}
+
+			if (k + DOP < lim[g]) {
+				auto sum = init_vec();
+				do {
+		        	sum = add(sum, val_load(v_charge + k));
+		        	k += DOP;
+		        } while (k + DOP < lim[g]);
+		        ag_sum_charge += reduce(sum);
+			}
+
+			while (k < lim[g]) {
+	            ag_sum_charge += v_charge[k];
+	            k++;
+	        }
+
+	        finalize(g, ag_sum_charge);
+	    }
+	}
+
+	return 0;
+}
+
+
+template<typename T, typename ValGather, typename ValLoad, typename FinalizeFun>
+int ordaggr_sum_32(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, T* RESTRICT data, ValGather&& val_gather, ValLoad&& val_load, FinalizeFun&& finalize)
+{
+	return ordaggr_sum<T, int64_t, 16, true>(pos, lim, grp, num_groups, data,
+		[] () { return _mm512_set1_epi32(0); },
+		[] (auto sel) {
+			/* load part of selection vector and convert to 32 bit indices in order to fit more */
+			auto lo = _mm512_cvtepi64_epi32(_mm512_load_epi64(sel));
+			auto hi = _mm512_cvtepi64_epi32(_mm512_load_epi64(sel + 8));
+
+			auto r = _mm512_set1_epi32(0);
+
+			r = _mm512_inserti64x4(r, lo, 0);
+			r = _mm512_inserti64x4(r, hi, 1);
+			return r;
+		},
+		[&] (auto sel, auto val) { return val_gather(sel, val); },
+		[&] (auto val) { return val_load(val); },
+		[] (auto old, auto next) { return _mm512_add_epi32(old, next); },
+		[] (auto acc) { return m512_hsum_epi32(acc); },
+		[&] (auto a, auto b) { finalize(a, b); }
+	); 
+}
+
+template<typename T, typename ValGather, typename ValLoad, typename FinalizeFun>
+int ordaggr_sum_64(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, T* RESTRICT data, ValGather&& val_gather, ValLoad&& val_load, FinalizeFun&& finalize)
+{
+	return ordaggr_sum<T, int64_t, 8, true>(pos, lim, grp, num_groups, data,
+		[] () { return _mm512_set1_epi64(0); },
+		[] (auto sel) { return _mm512_load_epi64(sel); },
+		[&] (auto sel, auto val) { return val_gather(sel, val); },
+		[&] (auto val) { return val_load(val); },
+		[] (auto old, auto next) { return _mm512_add_epi64(old, next); },
+		[] (auto acc) { return m512_hsum_epi64(acc); },
+		[&] (auto a, auto b) { finalize(a, b); }
+	); 
+}
+
+template<typename FinalizeFun>
+int ordaggr_int64_t_sum(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int64_t* RESTRICT data, FinalizeFun&& finalize)
+{
+	return ordaggr_sum_64<int64_t>(pos, lim, grp, num_groups, data,
+		[] (auto sel, auto val) { return  _mm512_i64gather_epi64(sel, (const long long int*)val, 8); },
+		[] (auto val) { return _mm512_loadu_si512(val); },
+		[&] (auto a, auto b) { finalize(a, b); });
+}
+
+template<typename FinalizeFun>
+int ordaggr_int32_t_sum(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT data, FinalizeFun&& finalize)
+{
+	return ordaggr_sum_32<int32_t>(pos, lim, grp, num_groups, data,
+		[] (auto sel, auto val) { return  _mm512_i32gather_epi32(sel, (const int*)val, 4); },
+		[] (auto val) { return _mm512_load_epi32(val); },
+		[&] (auto a, auto b) { finalize(a, b); }
+	);
+}
+
+template<typename FinalizeFun>
+int ordaggr_int32_t_sum64(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT data, FinalizeFun&& finalize)
+{
+	return ordaggr_sum_64<int32_t>(pos, lim, grp, num_groups, data,
+		[] (auto sel, auto val) { return  _mm512_and_epi64(_mm512_set1_epi64(0xFFFFFFFF), _mm512_i64gather_epi64(sel, (const long long int*)val, 4)); },
+		[] (auto val) { return _mm512_cvtepi32_epi64(_mm256_load_si256((__m256i*)val)); },
+		[&] (auto a, auto b) { finalize(a, b); }
+	);
+}
+
+template<typename FinalizeFun>
+int ordaggr_int16_t_sum(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int16_t* RESTRICT data, FinalizeFun&& finalize)
+{
+	return ordaggr_sum_32<int16_t>(pos, lim, grp, num_groups, data,
+		[] (auto sel, auto val) { return  _mm512_and_epi32(_mm512_set1_epi32(0xFFFF), _mm512_i32gather_epi32(sel, (int*)val, 2)); }, // gather 2-bytes and mask the use-less bits
+		[] (auto val) { return _mm512_cvtepi16_epi32(_mm256_load_si256((__m256i*)val)); }, // load subsequent 2-bytes values and cast them up to 32 bit
+		[&] (auto a, auto b) { finalize(a, b); }
+	);
+}
+
+template<typename FinalizeFun>
+int ordaggr_int8_t_sum(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int8_t* RESTRICT data, FinalizeFun&& finalize)
+{
+	return ordaggr_sum_32<int8_t>(pos, lim, grp, num_groups, data,
+		[] (auto sel, auto val) { return  _mm512_and_epi32(_mm512_set1_epi32(0xFF), _mm512_i32gather_epi32(sel, (int*)val, 1)); }, // gather 1-bytes and mask the use-less bits
+		[] (auto val) { return _mm512_cvtepi8_epi32(_mm_load_si128((__m128i*)val)); }, // load subsequent 1-bytes values and cast them up to 32 bit
+		[&] (auto a, auto b) { finalize(a, b); }
+	);
+}
+
+
+/* The 1- or 2-byte values at 4 positions, in the low bits of 32-bit lanes, the rest
+ * garbage. Gathering 4 bytes starting at each value could read past the end of the data,
+ * and the page; gathering the aligned 4 bytes holding it can't, as those never cross a
+ * page. Each lane is then shifted to its value's offset in its word. */
+template<typename T>
+static inline __m128i gather_narrow_avx2(const T* data, __m256i sel)
+{
+	static_assert(sizeof(T) == 1 || sizeof(T) == 2, "Wider values are gathered as they are");
+	const uintptr_t base = (uintptr_t)data;
+	const __m256i offsets = _mm256_add_epi64(_mm256_slli_epi64(sel, sizeof(T) - 1), _mm256_set1_epi64x(base & 3));
+	const __m128i words = _mm256_i64gather_epi32((const int*)(base & ~(uintptr_t)3),
+		_mm256_andnot_si256(_mm256_set1_epi64x(3), offsets), 1);
+	const __m256i shifts = _mm256_slli_epi64(_mm256_and_si256(offsets, _mm256_set1_epi64x(3)), 3);
+	return _mm_srlv_epi32(words, _mm256_castsi256_si128(
+		_mm256_permutevar8x32_epi32(shifts, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6))));
+}
+
+/* AVX2 sums in 4 lanes of 64 bits, which none of the sums over a vector overflow */
+template<typename T, typename ValGather, typename ValLoad, typename FinalizeFun>
+int ordaggr_sum_avx2(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, T* RESTRICT data, ValGather&& val_gather, ValLoad&& val_load, FinalizeFun&& finalize)
+{
+	return ordaggr_sum<T, int64_t, 4, false>(pos, lim, grp, num_groups, data,
+		[] () { return _mm256_setzero_si256(); },
+		[] (auto sel) { return _mm256_loadu_si256((const __m256i*)sel); },
+		[&] (auto sel, auto val) { return val_gather(sel, val); },
+		[&] (auto val) { return val_load(val); },
+		[] (auto old, auto next) { return _mm256_add_epi64(old, next); },
+		[] (auto acc) { return m256_hsum_epi64(acc); },
+		[&] (auto a, auto b) { finalize(a, b); }
+	);
+}
+
+template<typename FinalizeFun>
+int ordaggr_int64_t_sum_avx2(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int64_t* RESTRICT data, FinalizeFun&& finalize)
+{
+	return ordaggr_sum_avx2<int64_t>(pos, lim, grp, num_groups, data,
+		[] (auto sel, auto val) { return _mm256_i64gather_epi64((const long long int*)val, sel, 8); },
+		[] (auto val) { return _mm256_loadu_si256((const __m256i*)val); },
+		[&] (auto a, auto b) { finalize(a, b); }
+	);
+}
+
+template<typename FinalizeFun>
+int ordaggr_int32_t_sum_avx2(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT data, FinalizeFun&& finalize)
+{
+	return ordaggr_sum_avx2<int32_t>(pos, lim, grp, num_groups, data,
+		[] (auto sel, auto val) { return _mm256_cvtepi32_epi64(_mm256_i64gather_epi32((const int*)val, sel, 4)); },
+		[] (auto val) { return _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i*)val)); },
+		[&] (auto a, auto b) { finalize(a, b); }
+	);
+}
+
+template<typename FinalizeFun>
+int ordaggr_int16_t_sum_avx2(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int16_t* RESTRICT data, FinalizeFun&& finalize)
+{
+	return ordaggr_sum_avx2<int16_t>(pos, lim, grp, num_groups, data,
+		[] (auto sel, auto val) {
+			/* sign-extend the lower 2 bytes */
+			const __m128i v = gather_narrow_avx2(val, sel);
+			return _mm256_cvtepi32_epi64(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16));
+		},
+		[] (auto val) { return _mm256_cvtepi16_epi64(_mm_loadl_epi64((const __m128i*)val)); },
+		[&] (auto a, auto b) { finalize(a, b); }
+	);
+}
+
+template<typename FinalizeFun>
+int ordaggr_int8_t_sum_avx2(idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int8_t* RESTRICT data, FinalizeFun&& finalize)
+{
+	return ordaggr_sum_avx2<int8_t>(pos, lim, grp, num_groups, data,
+		[] (auto sel, auto val) {
+			const __m128i v = gather_narrow_avx2(val, sel);
+			return _mm256_cvtepi32_epi64(_mm_srai_epi32(_mm_slli_epi32(v, 24), 24));
+		},
+		[] (auto val) { return _mm256_cvtepi8_epi64(_mm_loadu_si32(val)); },
+		[&] (auto a, auto b) { finalize(a, b); }
+	);
+}
+
+int Impl::par_ordaggr_quantity(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int16_t* RESTRICT quantity) {
+#ifdef __AVX512F__
+	return ordaggr_int16_t_sum(pos, lim, grp, num_groups, quantity,
+		[&] (auto group_idx, int64_t val) {
+			auto g = grp[group_idx];
+			aggr0[g].sum_quantity += val;
+		}
+	);
+#elif defined(__AVX2__)
+	return ordaggr_int16_t_sum_avx2(pos, lim, grp, num_groups, quantity,
+		[&] (auto group_idx, int64_t val) {
+			auto g = grp[group_idx];
+			aggr0[g].sum_quantity += val;
+		}
+	);
+#else
+	return ordaggr_quantity(aggr0, pos, lim, grp, num_groups, quantity);
+#endif
+};
+
+int Impl::par_ordaggr_extended_price(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT price)
+{
+#ifdef __AVX512F__
+	return ordaggr_int32_t_sum(pos, lim, grp, num_groups, price,
+		[&] (auto group_idx, int64_t val) {
+			auto g = grp[group_idx];
+			aggr0[g].sum_base_price += val;
+		}
+	);
+#elif defined(__AVX2__)
+	return ordaggr_int32_t_sum_avx2(pos, lim, grp, num_groups, price,
+		[&] (auto group_idx, int64_t val) {
+			auto g = grp[group_idx];
+			aggr0[g].sum_base_price += val;
+		}
+	);
+#else
+	return ordaggr_extended_price(aggr0, pos, lim, grp, num_groups, price);
+#endif
+}
+
+int Impl::par_ordaggr_disc_price(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int32_t* RESTRICT v_disc_price)
+{
+#ifdef __AVX512F__
+	return ordaggr_int32_t_sum64(pos, lim, grp, num_groups, v_disc_price,
+		[&] (auto group_idx, int64_t val) {
+			auto g = grp[group_idx];
+			aggr0[g].sum_disc_price = int128_add64(aggr0[g].sum_disc_price, val);
+		}
+	);
+#elif defined(__AVX2__)
+	return ordaggr_int32_t_sum_avx2(pos, lim, grp, num_groups, v_disc_price,
+		[&] (auto group_idx, int64_t val) {
+			auto g = grp[group_idx];
+			aggr0[g].sum_disc_price = int128_add64(aggr0[g].sum_disc_price, val);
+		}
+	);
+#else
+	return ordaggr_disc_price(aggr0, pos, lim, grp, num_groups, v_disc_price);
+#endif
+}
+
+int Impl::par_ordaggr_charge(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int64_t* RESTRICT v_charge)
+{
+#ifdef __AVX512F__
+	return ordaggr_int64_t_sum(pos, lim, grp, num_groups, v_charge,
+		[&] (auto group_idx, int64_t val) {
+			auto g = grp[group_idx];
+			aggr0[g].sum_charge = int128_add64(aggr0[g].sum_charge, val);
+		}
+	);
+#elif defined(__AVX2__)
+	return ordaggr_int64_t_sum_avx2(pos, lim, grp, num_groups, v_charge,
+		[&] (auto group_idx, int64_t val) {
+			auto g = grp[group_idx];
+			aggr0[g].sum_charge = int128_add64(aggr0[g].sum_charge, val);
+		}
+	);
+#else
+	return ordaggr_charge(aggr0, pos, lim, grp, num_groups, v_charge);
+#endif
+}
+
+int Impl::par_ordaggr_disc(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int8_t* RESTRICT v_disc_1)
+{
+#ifdef __AVX512F__
+	return ordaggr_int8_t_sum(pos, lim, grp, num_groups, v_disc_1,
+		[&] (auto group_idx, int64_t val) {
+			auto g = grp[group_idx];
+			aggr0[g].sum_disc += val;
+		}
+	);
+#elif defined(__AVX2__)
+	return ordaggr_int8_t_sum_avx2(pos, lim, grp, num_groups, v_disc_1,
+		[&] (auto group_idx, int64_t val) {
+			auto g = grp[group_idx];
+			aggr0[g].sum_disc += val;
+		}
+	);
+#else
+	return ordaggr_disc(aggr0, pos, lim, grp, num_groups, v_disc_1);
+#endif
+}
+
+int Impl::ordaggr_all_in_one(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int16_t* RESTRICT quantity,
+	int32_t* RESTRICT extendedprice, int32_t* RESTRICT disc_price, int64_t* RESTRICT charge, int8_t* RESTRICT disc_1)
+{
+	int64_t ag_sum_quantity;
+	int64_t ag_sum_base_price;
+	int64_t ag_sum_disc_price;
+	int64_t ag_sum_charge;
+	int64_t ag_sum_disc;
+
+	return Primitives::ordaggr_fst(pos, lim, grp, num_groups,
+		[&] (auto g) { /* Init aggregate */
+			ag_sum_quantity = 0;
+			ag_sum_base_price = 0;
+			ag_sum_disc_price = 0;
+			ag_sum_charge = 0;
+			ag_sum_disc = 0;
+		},
+		[&] (auto g, auto i) { /* Update aggregate */
+			ag_sum_quantity += quantity[i];	
+			ag_sum_base_price += extendedprice[i];
+			ag_sum_disc_price += disc_price[i];
+			ag_sum_charge += charge[i];
+			ag_sum_disc += disc_1[i];
+		},
+		[&] (auto group_idx, auto first) { /* Finalize aggregate*/
+			auto g = grp[group_idx]; /* Figure out the real group */
+
+			aggr0[g].sum_quantity += ag_sum_quantity;
+			aggr0[g].sum_base_price += ag_sum_base_price;
+			aggr0[g].sum_disc_price = int128_add64(aggr0[g].sum_disc_price, ag_sum_disc_price);
+			aggr0[g].sum_charge = int128_add64(aggr0[g].sum_charge, ag_sum_charge);
+			aggr0[g].sum_disc += ag_sum_disc;
+			aggr0[g].count += lim[group_idx] - first;
+		});	
+}
+
+int Impl::old_ordaggr_all_in_one(AggrHashTable* RESTRICT aggr0, idx_t* RESTRICT pos, idx_t* RESTRICT lim, idx_t* RESTRICT grp, idx_t num_groups, int64_t* RESTRICT quantity,
+	int64_t* RESTRICT extendedprice, int64_t* RESTRICT disc_price, int64_t* RESTRICT charge, int64_t* RESTRICT disc_1)
+{
+	int64_t ag_sum_quantity;
+	int64_t ag_sum_base_price;
+	int128_t ag_sum_disc_price; /* TODO: actually 128 bits long, but we can make it shorter due to partial aggr, see ordaggr_all_in_one() */
+	int128_t ag_sum_charge; /* TODO: actually 128 bits long, but we can make it shorter due to partial aggr, see ordaggr_all_in_one() */
+	int64_t ag_sum_disc;
+
+	return Primitives::ordaggr_fst(pos, lim, grp, num_groups,
+		[&] (auto g) { /* Init aggregate */
+			ag_sum_quantity = 0;
+			ag_sum_base_price = 0;
+			ag_sum_disc_price = 0;
+			ag_sum_charge = 0;
+			ag_sum_disc = 0;
+		},
+		[&] (auto g, auto i) { /* Update aggregate */
+			ag_sum_quantity += quantity[i];	
+			ag_sum_base_price += extendedprice[i];
+			ag_sum_disc_price += disc_price[i];
+			ag_sum_charge += charge[i];
+			ag_sum_disc += disc_1[i];
+		},
+		[&] (auto group_idx, auto first) { /* Finalize aggregate*/
+			auto g = grp[group_idx]; /* Figure out the real group */
+
+			aggr0[g].sum_quantity += ag_sum_quantity;
+			aggr0[g].sum_base_price += ag_sum_base_price;
+			aggr0[g].sum_disc_price = int128_add64(aggr0[g].sum_disc_price, ag_sum_disc_price);
+			aggr0[g].sum_charge = int128_add64(aggr0[g].sum_charge, ag_sum_charge);
+			aggr0[g].sum_disc += ag_sum_disc;
+			aggr0[g].count += lim[group_idx] - first;
+		});	
+}
+
+int Impl::old_map_gid(idx_t* RESTRICT out, sel_t* RESTRICT sel, int n, char* RESTRICT v_returnflag, char* RESTRICT v_linestatus)
+{
+	return Primitives::map(out, sel, n, [&] (size_t i) {
+			return v_returnflag[i] << 8 | v_linestatus[i];
+		});	
+}
+
+int Impl::old_map_disc_1(int64_t* RESTRICT v_disc_1, sel_t* RESTRICT sel, int n, int64_t dec_one, int64_t* RESTRICT v_discount)
+{
+	return Primitives::map(v_disc_1, sel, n, [&] (size_t i) {
+			return dec_one - v_discount[i];
+		});
+}
+
+int Impl::old_map_tax_1(int64_t* RESTRICT v_disc_1, sel_t* RESTRICT sel, int n, int64_t dec_one, int64_t* RESTRICT v_tax)
+{
+	return Primitives::map(v_disc_1, sel, n, [&] (size_t i) {
+			return v_tax[i] + dec_one;
+		});
+}
+
+int Impl::old_map_mul(int64_t* RESTRICT v_disc_price, sel_t* RESTRICT sel, int n, int64_t* RESTRICT v_disc_1, int64_t* RESTRICT v_extendedprice)
+{
+	return Primitives::map(v_disc_price, sel, n, [&] (size_t i) {
+			return Decimal64::Mul(v_disc_1[i], v_extendedprice[i]);
+		});
+}
+
+extern const Primitives::Table table;
+const Primitives::Table table = {
+#define entry(ret, name, params) &Impl::name,
+	PRIMITIVES_DISPATCHED(entry)
+#undef entry
+};
+
+} /* namespace PRIMITIVES_ISA */
@@ -0,0 +1,144 @@
+#include "worker_pool.hpp"
+
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+/* The futex words hold a count, shifted left by one, and whether a thread sleeps on
+ * them, in bit 0: whoever advances the count only makes a system call if one does. */
+static constexpr uint32_t kCountMask = UINT_MAX >> 1;
+
+struct alignas(64) WorkerPool::Worker : CacheLineAligned {
+	/* written when posting a job */
+	std::atomic<uint32_t> posted { 0 }; /* futex word of jobs posted */
+	Job* job = nullptr;
+	size_t index = 0;
+
+	/* written by the worker */
+	alignas(64) std::atomic<uint32_t> finished { 0 }; /* jobs run */
+};
+
+/* About as long as a Morsel query takes to be submitted again, e.g. by a snapshot's
+ * next segment; a few dozen microseconds */
+static constexpr uint64_t kSpinCycles = 100*1000;
+
+/* Returns the count once it isn't old any more. Only one thread awaits each word. */
+static uint32_t
+await_change(std::atomic<uint32_t>& word, uint32_t old, bool spin)
+{
+	uint32_t value = word.load(std::memory_order_acquire);
+	if (spin) {
+		const uint64_t start = __rdtsc();
+		while (value >> 1 == old && __rdtsc() - start < kSpinCycles) {
+			_mm_pause();
+			value = word.load(std::memory_order_acquire);
+		}
+	}
+
+	while (value >> 1 == old) {
+		if (!(value & 1) && !word.compare_exchange_weak(value, value | 1, std::memory_order_acquire)) {
+			continue;
+		}
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, value | 1, nullptr, nullptr, 0);
+		value = word.load(std::memory_order_acquire);
+	}
+	return value >> 1;
+}
+
+/* The word is only passed to the system call after the count changed, i.e. when the
+ * waiter may have returned already: like any futex wake, that's harmless if the word's
+ * memory was freed meanwhile */
+static void
+advance(std::atomic<uint32_t>& word, uint32_t count)
+{
+	if (word.exchange((count & kCountMask) << 1, std::memory_order_acq_rel) & 1) {
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+	}
+}
+
+/* Spinning only pays off with a CPU to spare; on a single one, the waiting side would
+ * just keep the thread it waits for from running */
+WorkerPool::WorkerPool() : spin(CpuTopology::Get().NumUsable() > 1)
+{
+}
+
+WorkerPool&
+WorkerPool::Get()
+{
+	static WorkerPool* pool = new WorkerPool(); /* its workers run until the process exits */
+	return *pool;
+}
+
+WorkerPool::Team
+WorkerPool::GetTeam(const Placement& placement)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	Team team;
+	const bool pinned = placement.policy != kPinNone;
+	for (size_t i=0; i<placement.cpus.size(); i++) {
+		auto& worker = workers[std::make_pair(placement.cpus[i], pinned)];
+		if (!worker) {
+			worker = new Worker();
+			Worker& w = *worker;
+			std::thread([this, &w, placement, i] () {
+				placement.Pin(i);
+				Loop(w);
+			}).detach();
+		}
+		team.push_back(worker);
+	}
+	return team;
+}
+
+void
+WorkerPool::Loop(Worker& w)
+{
+	uint32_t seen = 0;
+	while (true) {
+		seen = await_change(w.posted, seen, spin);
+		Job& job = *w.job;
+		job.Run(w.index);
+
+		/* From here on, the worker may be posted its next job; and once all have
+		 * finished, this one may be destroyed */
+		w.finished.store(seen, std::memory_order_release);
+		if (job.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			advance(job.completed, job.submitted);
+		}
+	}
+}
+
+void
+WorkerPool::Submit(Job& job, const Team& team)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	job.submitted = (job.submitted + 1) & kCountMask;
+	job.remaining.store(team.size(), std::memory_order_relaxed);
+	if (team.empty()) {
+		advance(job.completed, job.submitted);
+	}
+
+	for (size_t i=0; i<team.size(); i++) {
+		Worker& w = *team[i];
+		uint32_t posted = w.posted.load(std::memory_order_relaxed) >> 1;
+		/* still running another kernel's job, however briefly: which its submitter, or
+		 * others' for other workers, needn't wait for */
+		while (w.finished.load(std::memory_order_acquire) != posted) {
+			guard.unlock();
+			std::this_thread::yield();
+			guard.lock();
+			posted = w.posted.load(std::memory_order_relaxed) >> 1;
+		}
+		w.job = &job;
+		w.index = i;
+		advance(w.posted, posted + 1);
+	}
+}
+
+void
+WorkerPool::Wait(Job& job)
+{
+	await_change(job.completed, (job.submitted - 1) & kCountMask, spin);
+}
@@ -0,0 +1,73 @@
+#ifndef H_worker_pool
+#define H_worker_pool
+
+#include "arena.hpp"
+#include "topology.hpp"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/* The process's worker threads, shared by all parallel kernels - e.g. the Morsel ones
+ * of q1 and the GPU build's CoProc - which run their queries on them as jobs, back to
+ * back, without starting or stopping any thread. A worker is started for each CPU the
+ * first placement asking for it names, pinned to it, and kept for later ones. Waking a
+ * worker, and waiting for a job's completion, take a store and a load of a word on a
+ * cache line of the worker's or job's own; the waiting side spins for a while, then
+ * sleeps on a futex, so that a job posted soon after the last one finds its workers
+ * still awake. */
+struct WorkerPool {
+	/* Work for a team of workers: Run(i) is called once on the team's i-th worker.
+	 * A job is submitted again only after Wait() returned, and lives until then. */
+	struct Job : CacheLineAligned {
+		virtual ~Job() {}
+		virtual void Run(size_t index) = 0;
+
+	private:
+		friend struct WorkerPool;
+		alignas(64) std::atomic<uint32_t> remaining { 0 }; /* workers yet to finish */
+		alignas(64) std::atomic<uint32_t> completed { 0 }; /* futex word of submissions completed */
+		uint32_t submitted = 0;
+	};
+
+	template<typename F>
+	struct FunctionJob : Job {
+		F f;
+		FunctionJob(F f) : f(std::move(f)) {}
+		void Run(size_t index) override { f(index); }
+	};
+
+	struct Worker;
+	using Team = std::vector<Worker*>;
+
+	/* One worker per CPU of placement, in its order; started unless they were already */
+	Team GetTeam(const Placement& placement);
+
+	/* Starts job on team; waits for its workers to be done with their previous jobs */
+	void Submit(Job& job, const Team& team);
+
+	/* The completion barrier: returns once each of the team has run the job */
+	void Wait(Job& job);
+
+	template<typename F>
+	void Run(const Team& team, F&& f) {
+		FunctionJob<typename std::decay<F>::type> job(std::forward<F>(f));
+		Submit(job, team);
+		Wait(job);
+	}
+
+	static WorkerPool& Get();
+
+private:
+	std::mutex lock; /* for starting workers, and posting jobs */
+	std::map<std::pair<int, bool>, Worker*> workers; /* by CPU, and whether pinned */
+	const bool spin;
+
+	WorkerPool();
+	void Loop(Worker& worker);
+};
+
+#endif
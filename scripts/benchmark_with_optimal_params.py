@@ -101,6 +101,7 @@ def run_test(raw_results_file = None, mean_results_file = None, sf = None, strea
 		args.append('--use-filter-pushdown')
 	if data_parallel_coprocessing:
 		args.append('--use-coprocessing')
+	args.append('--shared-columns=attach') # published once, below, rather than loaded by every run
 	args.extend([
 		'--streams=1'                             , # serialize everything for testing the kernels proper,
 		'--runs=%u'                     % runs    , # Do we need multiple runs at all? probably not
@@ -153,6 +154,7 @@ mean_fn = os.path.join(results_dir, '%s_mean.csv' % results_basename)
 raw_fn = os.path.join(results_dir, '%s_raw.csv' % results_basename)
 init_results_file(raw_fn)
 init_results_file(mean_fn)
+syscall('%s --scale-factor=%f --shared-columns=publish' % (binary, default_sf))
 
 for opt in options:
 	for p in placements:
@@ -166,4 +168,4 @@ for opt in options:
 			vals = params['tuples_per_thread'],
 			threads = params['threads_per_block'],
 			placement = p, options = opt, runs = default_num_runs)
-
+syscall('%s --scale-factor=%f --shared-columns=remove' % (binary, default_sf))
@@ -95,6 +95,7 @@ def run_test(results_file = None, sf = None, streams = None, tpls = None, vals =
 		args.append('--use-filter-pushdown')
 	if data_parallel_coprocessing:
 		args.append('--use-coprocessing')
+	args.append('--shared-columns=attach') # published once, below, rather than loaded by every run
 
 	total_time_of_launches, num_launches, average_execution_time, min_execution_time, max_execution_time = ('', '', '', '', '')
 	if not data_parallel_coprocessing:
@@ -153,8 +154,10 @@ os.system('make $binary')
 gp_basename='grid_params'
 results_fn = os.path.join(results_dir, '%s.csv' % gp_basename)
 init_results_file(results_fn)
+syscall('%s --scale-factor=%f --shared-columns=publish' % (binary, default_sf))
 for opt in options:
 	for p in placements:
 		for vals in tuples_per_thread:
 			for threads in threads_per_block:
 					run_test(results_file = results_fn, vals = vals, threads = threads, placement = p, options = opt)
+syscall('%s --scale-factor=%f --shared-columns=remove' % (binary, default_sf))
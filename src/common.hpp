@@ -17,7 +17,28 @@ struct q1_params_t {
     std::string kernel_variant           { defaults::kernel_variant };
     bool should_print_results            { defaults::should_print_results };
     bool use_filter_pushdown             { false };
+    bool use_bit_sliced_filter           { false };
+        // Evaluate the pushed-down filter using a bit-sliced copy of the ship date column
+    bool use_bitmap_index                { false };
+        // Evaluate the pushed-down filter using a range-encoded monthly bitmap index on the ship date
+    bool compress_bitmap_index           { false };
+    bool use_aggregate_cube              { false };
+        // Answer the query from a prefix-sum aggregate cube over the ship dates, rather than scanning
     bool apply_compression               { defaults::apply_compression };
+    bool verify_compression              { false };
+        // Check that compressing the columns loses no information (it doesn't, for TPC-H data)
+    std::string arrow_input_file         { };
+        // Take the lineitem columns from this Arrow IPC file rather than the cache or the table file
+    std::string arrow_output_file        { };
+        // Write the (uncompressed) lineitem columns to this Arrow IPC file
+    std::string shared_columns           { };
+        // "publish", "attach" or "remove": the loaded columns in shared memory, for reuse by later processes
+    std::string cpu_isa                  { };
+        // Force the instruction set of the CPU's vectorized primitives; empty for the best one the CPU supports
+    std::string cpu_placement            { "cores" };
+        // Where the CPU's co-processing workers run: cores, smt, socket or none (see cpu/topology.hpp)
+    std::string cpu_data_placement       { "replicate" };
+        // How the CPU's compact columns are laid out over the NUMA nodes: replicate, interleave or partition
     int num_gpu_streams                  { defaults::num_gpu_streams };
     cuda::grid_block_dimension_t num_threads_per_block
                                          { defaults::num_threads_per_block };
@@ -43,7 +64,9 @@ inline std::ostream& operator<<(std::ostream& os, const q1_params_t& p)
 {
     os << "SF = " << p.scale_factor << " | "
        << "kernel = " << p.kernel_variant << " | "
-       << (p.use_filter_pushdown ? "filter precomp" : "") << " | "
+       << (p.use_filter_pushdown ? (
+              p.use_bitmap_index ? "filter precomp (bitmap index)" :
+              p.use_bit_sliced_filter ? "filter precomp (bit-sliced)" : "filter precomp") : "") << " | "
        << (p.apply_compression ? "compressed" : "uncompressed" ) << " | "
        << "streams = " << p.num_gpu_streams << " | "
        << "block size = " << p.num_threads_per_block << " | "
@@ -5,11 +5,13 @@
 
 uint32_t* precomp_filter = nullptr;
 uint16_t* compr_shipdate = nullptr;
+const bit_sliced_column<uint16_t>* compr_shipdate_bit_sliced = nullptr;
+const range_encoded_bitmap_index<uint16_t, uint32_t>* compr_shipdate_month_index = nullptr;
 moodycamel::BlockingConcurrentQueue<FilterChunk> precomp_filter_queue;
 size_t morsel_size = 10*1024;
 
-// Wrapper like Eminem
-struct CPUKernel {
+// Wrapper like Eminem; holds the Morsel, with its cache line aligned members, by value
+struct CPUKernel : CacheLineAligned {
 	Morsel<KernelX100<kMagic, true,
 #ifdef __AVX512F__
 	kPopulationCount
@@ -23,7 +25,7 @@ struct CPUKernel {
 
 	void spawn(size_t offset, size_t num, size_t pushdown_cpu_start_offset) { m.spawn(offset, num, pushdown_cpu_start_offset); }
 
-	void wait(bool active) { m.wait(active); }
+	void wait() { m.wait(); }
 };
 
 CoProc::CoProc(const lineitem& li, bool wo_core0)
@@ -47,20 +49,33 @@ CoProc::operator()(size_t offset, size_t num, size_t pushdown_cpu_start_offset)
 void
 CoProc::wait()
 {
-	kernel->wait(false);
+	kernel->wait();
 }
 
 size_t
 CoProc::numExtantGroups() const
 {
 	unsigned long long num_extant_groups { 0 };
-    for (size_t i = 0; i < MAX_GROUPS; i++) {
+    const auto& groups = kernel->m.groups;
+    for (size_t i = groups.begin; i < groups.end; i++) {
         if (table[i].count > 0) { num_extant_groups++; }
     }
     return num_extant_groups;
 }
 
 
+const AggrHashTable*
+CoProc::groupAggregates(size_t group) const
+{
+	return kernel->m.groups.Contains(group) ? &table[group] : nullptr;
+}
+
+std::string
+CoProc::describePlacement() const
+{
+	return kernel->m.DescribePlacement();
+}
+
 void
 CoProc::Clear()
 {
@@ -8,6 +8,8 @@ struct lineitem;
 
 struct CPUKernel;
 struct AggrHashTable;
+template <typename T> class bit_sliced_column;
+template <typename T, typename BitContainer> class range_encoded_bitmap_index;
 
 struct FilterChunk {
 	size_t offset;
@@ -16,6 +18,8 @@ struct FilterChunk {
 
 extern uint32_t* precomp_filter;
 extern uint16_t* compr_shipdate;
+extern const bit_sliced_column<uint16_t>* compr_shipdate_bit_sliced; // optional; used for filter pushdown if set
+extern const range_encoded_bitmap_index<uint16_t, uint32_t>* compr_shipdate_month_index; // optional; preferred for filter pushdown if set
 extern moodycamel::BlockingConcurrentQueue<FilterChunk> precomp_filter_queue;
 
 extern size_t morsel_size;
@@ -33,6 +37,8 @@ struct CoProc {
 	void wait();
 	void Clear();
 	size_t numExtantGroups() const;
+	const AggrHashTable* groupAggregates(size_t group) const; // nullptr if the kernel can't have the group
+	std::string describePlacement() const;
 		// Avoiding inclusion of anything else.
 
 };
@@ -38,6 +38,16 @@ using line_status_t          = uint8_t; // Don't use this!
 using bit_container_t             = uint32_t;
 // static_assert(std::is_same<bit_container_t,uint32_t>{}, "Expecting the bit container to hold 32 bits");
 
+/**
+ * A row whose flags differ from those predicted by its ship date (see
+ * predicted_flags_set), with its actual flags, encoded
+ */
+struct flag_exception_t {
+    cardinality_t  row;
+    uint8_t        return_flag;
+    uint8_t        line_status;
+};
+
 // Used to distinguish between uncompressed and compressed types,
 // which is why this anonymous enum has been moved here
 enum : bool { is_compressed = true, is_not_compressed = false};
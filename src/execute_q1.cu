@@ -8,6 +8,7 @@
 #include "kernels/ht_in_shared_mem_per_thread.cuh"
 #include "kernels/ht_in_shared_mem_per_bank.cuh"
 #include "kernels/ht_in_shared_mem_per_block.cuh"
+#include "kernels/predicted_flags.cuh"
 #include "cpu/common.hpp"
 #include "cpu.hpp"
 
@@ -20,6 +21,7 @@
 #include <unordered_map>
 #include <numeric>
 #include <sstream>
+#include <algorithm>
 
 #ifndef GPU
 #error The GPU preprocessor directive must be defined (ask Tim for the reason)
@@ -91,7 +93,8 @@ void execute_query_1_once(
     input_buffer_set<plain_ptr, is_not_compressed>&
                                     __restrict__  uncompressed, // on host
     input_buffer_set<cuda::memory::host::unique_ptr, is_compressed>&
-                                    __restrict__  compressed // on host
+                                    __restrict__  compressed, // on host
+    const predicted_flags_set&      __restrict__  predicted_flags // on host
 )
 {
     if (params.use_coprocessing || params.use_filter_pushdown) {
@@ -188,14 +191,56 @@ void execute_query_1_once(
             stream.enqueue.copy(stream_input_buffer_set.extended_price.get(), compressed.extended_price.get() + offset_in_table, num_tuples_for_this_launch * sizeof(compressed::extended_price_t));
             stream.enqueue.copy(stream_input_buffer_set.tax.get()           , compressed.tax.get()            + offset_in_table, num_tuples_for_this_launch * sizeof(compressed::tax_t));
             stream.enqueue.copy(stream_input_buffer_set.quantity.get()      , compressed.quantity.get()       + offset_in_table, num_tuples_for_this_launch * sizeof(compressed::quantity_t));
-            stream.enqueue.copy(stream_input_buffer_set.return_flag.get()   , compressed.return_flag.get()    + offset_in_table / return_flag_values_per_container, num_return_flag_bit_containers_for_this_launch * sizeof(bit_container_t));
-            stream.enqueue.copy(stream_input_buffer_set.line_status.get()   , compressed.line_status.get()    + offset_in_table / line_status_values_per_container, num_line_status_bit_containers_for_this_launch * sizeof(bit_container_t));
+            // With filter pushdown the ship dates aren't uploaded, so the host expands the prediction instead
+            bool expand_flags_on_gpu = predicted_flags.fits and not params.use_filter_pushdown;
+            if (not expand_flags_on_gpu) {
+                stream.enqueue.copy(stream_input_buffer_set.return_flag.get()   , compressed.return_flag.get()    + offset_in_table / return_flag_values_per_container, num_return_flag_bit_containers_for_this_launch * sizeof(bit_container_t));
+                stream.enqueue.copy(stream_input_buffer_set.line_status.get()   , compressed.line_status.get()    + offset_in_table / line_status_values_per_container, num_line_status_bit_containers_for_this_launch * sizeof(bit_container_t));
+            }
             if (not params.use_filter_pushdown) {
                 stream.enqueue.copy(stream_input_buffer_set.ship_date.get(), compressed.ship_date.get() + offset_in_table, num_tuples_for_this_launch * sizeof(compressed::ship_date_t));
             } else {
                 auto num_bit_containers_for_this_launch = div_rounding_up(num_tuples_for_this_launch, bits_per_container);
                 stream.enqueue.copy(stream_input_buffer_set.precomputed_filter.get(), compressed.precomputed_filter.get() + offset_in_table / bits_per_container, num_bit_containers_for_this_launch * sizeof(bit_container_t));
             }
+            if (expand_flags_on_gpu) {
+                // A bit per tuple and the launch's exceptions, rather than the flag containers - which
+                // are then expanded from them, on the same stream, before the query kernel reads them
+                auto& returned = stream_input_buffer_sets.returned[stream_index];
+                auto& exceptions = stream_input_buffer_sets.flag_exceptions[stream_index];
+                auto exceptions_end = predicted_flags.exceptions.get() + predicted_flags.num_exceptions;
+                auto first_exception = std::lower_bound(predicted_flags.exceptions.get(), exceptions_end, offset_in_table,
+                    [](const flag_exception_t& e, size_t row) { return e.row < row; });
+                auto end_exception = std::lower_bound(first_exception, exceptions_end, offset_in_table + num_tuples_for_this_launch,
+                    [](const flag_exception_t& e, size_t row) { return e.row < row; });
+                cardinality_t num_exceptions_for_this_launch = end_exception - first_exception;
+                assert(num_exceptions_for_this_launch <= predicted_flags.max_exceptions_per_launch);
+
+                stream.enqueue.copy(returned.get(), predicted_flags.returned.get() + offset_in_table / line_status_values_per_container, num_line_status_bit_containers_for_this_launch * sizeof(bit_container_t));
+                if (num_exceptions_for_this_launch > 0) {
+                    stream.enqueue.copy(exceptions.get(), first_exception, num_exceptions_for_this_launch * sizeof(flag_exception_t));
+                }
+                enum { num_threads_per_block_for_flags = 256 };
+                stream.enqueue.kernel_launch(
+                    kernels::predicted_flags::expand,
+                    cuda::make_launch_config(div_rounding_up(num_line_status_bit_containers_for_this_launch, num_threads_per_block_for_flags), num_threads_per_block_for_flags),
+                    stream_input_buffer_set.return_flag.get(),
+                    stream_input_buffer_set.line_status.get(),
+                    stream_input_buffer_set.ship_date.get(),
+                    returned.get(),
+                    predicted_flags.last_final_day,
+                    num_tuples_for_this_launch);
+                if (num_exceptions_for_this_launch > 0) {
+                    stream.enqueue.kernel_launch(
+                        kernels::predicted_flags::patch_exceptions,
+                        cuda::make_launch_config(div_rounding_up(num_exceptions_for_this_launch, num_threads_per_block_for_flags), num_threads_per_block_for_flags),
+                        stream_input_buffer_set.return_flag.get(),
+                        stream_input_buffer_set.line_status.get(),
+                        exceptions.get(),
+                        num_exceptions_for_this_launch,
+                        (cardinality_t) offset_in_table);
+                }
+            }
         }
         else {
             auto& stream_input_buffer_set = stream_input_buffer_sets.uncompressed[stream_index];
@@ -37,10 +37,35 @@ struct input_buffer_set<Ptr, is_not_compressed> {
 };
 
 
+/**
+ * The return flag and line status as predicted from the ship date, as for the CPU's
+ * compact columns (see ComprData::flags_predicted): an item is Open, and Not returned,
+ * iff it shipped after the last ship date of a final item; of the final items, one
+ * bit tells Returned from Accepted. The rows which don't fit are listed as exceptions.
+ * When the data fits, a launch uploads a bit per row, plus its exceptions, instead of
+ * the three bits of the compressed flag containers, and expands them on the GPU.
+ *
+ * The prediction is derived and validated when the compressed columns are built, and
+ * cached (and shared) in place of their flag containers; those are only kept when the
+ * data doesn't fit it.
+ */
+struct predicted_flags_set {
+    bool                                                  fits { false };
+    compressed::ship_date_t                               last_final_day;
+    cuda::memory::host::unique_ptr< bit_container_t[]  >  returned;
+    cuda::memory::host::unique_ptr< flag_exception_t[] >  exceptions; // by row
+    cardinality_t                                         num_exceptions { 0 };
+    cardinality_t                                         max_exceptions_per_launch { 0 };
+};
+
 // Note: This should be a variant; or we could just templatize more.
 struct stream_input_buffer_sets {
     std::vector<input_buffer_set<cuda::memory::device::unique_ptr, is_not_compressed > > uncompressed;
     std::vector<input_buffer_set<cuda::memory::device::unique_ptr, is_compressed     > > compressed;
+
+    // With predicted flags only
+    std::vector<cuda::memory::device::unique_ptr< bit_container_t[]  > > returned;
+    std::vector<cuda::memory::device::unique_ptr< flag_exception_t[] > > flag_exceptions;
 };
 
 template <template <typename> class UniquePtr>
@@ -68,7 +93,8 @@ void execute_query_1_once(
     input_buffer_set<plain_ptr, is_not_compressed>&
                                     __restrict__  uncompressed, // on host
     input_buffer_set<cuda::memory::host::unique_ptr, is_compressed>&
-                                    __restrict__  compressed // on host
+                                    __restrict__  compressed, // on host
+    const predicted_flags_set&      __restrict__  predicted_flags // on host
 );
 
 extern CoProc* cpu_coprocessor;
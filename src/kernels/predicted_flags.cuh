@@ -0,0 +1,86 @@
+#pragma once
+
+#include "util/preprocessor_shorthands.hpp"
+#include "constants.hpp"
+#include "data_types.hpp"
+#include "util/bit_operations.hpp"
+
+namespace kernels {
+namespace predicted_flags {
+
+enum : cardinality_t {
+    return_flag_containers_per_line_status_container =
+        line_status_values_per_container / return_flag_values_per_container,
+};
+
+static_assert(line_status_values_per_container == bits_per_bit_container,
+    "The returned bits are expected to be laid out like the line stati");
+
+/**
+ * Fills the compressed flag containers of a launch's tuples with the flags predicted
+ * from their ship dates (see predicted_flags_set); one thread per line status container
+ */
+__global__
+void expand(
+    bit_container_t*                __restrict__ return_flag,
+    bit_container_t*                __restrict__ line_status,
+    const compressed::ship_date_t*  __restrict__ ship_date,
+    const bit_container_t*          __restrict__ returned,
+    compressed::ship_date_t                      last_final_day,
+    cardinality_t                                num_tuples)
+{
+    cardinality_t container_index = blockIdx.x * blockDim.x + threadIdx.x;
+    cardinality_t first_tuple = container_index * line_status_values_per_container;
+    if (first_tuple >= num_tuples) { return; }
+
+    auto returned_bits = returned[container_index];
+    bit_container_t line_status_container { 0 };
+    bit_container_t return_flag_containers[return_flag_containers_per_line_status_container] = { 0 };
+    for(cardinality_t j = 0; j < line_status_values_per_container and first_tuple + j < num_tuples; j++) {
+        bool is_final = ship_date[first_tuple + j] <= last_final_day;
+        bool is_returned = (returned_bits >> j) & 0x1;
+        line_status_container |= bit_container_t { encode_line_status(is_final ? 'F' : 'O') } << j;
+        return_flag_containers[j / return_flag_values_per_container] |=
+            bit_container_t { encode_return_flag(is_final ? (is_returned ? 'R' : 'A') : 'N') }
+                << ((j % return_flag_values_per_container) * return_flag_bits);
+    }
+    line_status[container_index] = line_status_container;
+    for(cardinality_t k = 0; k < return_flag_containers_per_line_status_container and
+        first_tuple + k * return_flag_values_per_container < num_tuples; k++)
+    {
+        return_flag[container_index * return_flag_containers_per_line_status_container + k] = return_flag_containers[k];
+    }
+}
+
+/**
+ * Overwrites the expanded flags of the exceptions among a launch's tuples, which start
+ * at @p first_row of the table; one thread per exception. Exceptions sharing a container
+ * change disjoint bits of it, hence in any order.
+ */
+__global__
+void patch_exceptions(
+    bit_container_t*         __restrict__ return_flag,
+    bit_container_t*         __restrict__ line_status,
+    const flag_exception_t*  __restrict__ exceptions,
+    cardinality_t                         num_exceptions,
+    cardinality_t                         first_row)
+{
+    cardinality_t exception_index = blockIdx.x * blockDim.x + threadIdx.x;
+    if (exception_index >= num_exceptions) { return; }
+
+    auto exception = exceptions[exception_index];
+    auto i = exception.row - first_row;
+
+    auto return_flag_shift = (i % return_flag_values_per_container) * return_flag_bits;
+    auto& return_flag_container = return_flag[i / return_flag_values_per_container];
+    atomicAnd(&return_flag_container, ~(bit_container_t { (1 << return_flag_bits) - 1 } << return_flag_shift));
+    atomicOr (&return_flag_container, bit_container_t { exception.return_flag } << return_flag_shift);
+
+    auto line_status_shift = (i % line_status_values_per_container) * line_status_bits;
+    auto& line_status_container = line_status[i / line_status_values_per_container];
+    atomicAnd(&line_status_container, ~(bit_container_t { (1 << line_status_bits) - 1 } << line_status_shift));
+    atomicOr (&line_status_container, bit_container_t { exception.line_status } << line_status_shift);
+}
+
+} // namespace predicted_flags
+} // namespace kernels
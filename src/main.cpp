@@ -5,11 +5,16 @@
 #include "monetdb_tpch_kit/tpch_kit.hpp"
 #include "cpu/common.hpp"
 #include "cpu.hpp"
+#include "cpu/aggregate_cube.hpp"
 
 #include "util/helper.hpp"
 #include "util/extra_pointer_traits.hpp"
 #include "util/bit_operations.hpp"
 #include "util/file_access.hpp"
+#include "util/bit_sliced_column.hpp"
+#include "util/range_encoded_bitmap_index.hpp"
+#include "util/arrow_ipc.hpp"
+#include "util/shared_column_store.hpp"
 
 #include <iostream>
 #include <cuda/api_wrappers.h>
@@ -18,7 +23,14 @@
 #include <chrono>
 #include <unordered_map>
 #include <numeric>
+#include <algorithm>
 #include <sstream>
+#include <thread>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <map>
 
 #ifndef GPU
 #error The GPU preprocessor directive must be defined (ask Tim for the reason)
@@ -84,8 +96,8 @@ void print_results(const T& aggregates_on_host, cardinality_t cardinality) {
                 continue;
             }
 
-            if (cpu_coprocessor) {
-                auto t = &cpu_coprocessor->table[idx];
+            auto t = cpu_coprocessor ? cpu_coprocessor->groupAggregates(idx) : nullptr;
+            if (t) {
                 auto& a = aggregates_on_host;
 
                 a.sum_quantity[group] += t->sum_quantity;
@@ -155,10 +167,12 @@ bool columns_are_cached(
     // TODO: We could check that _all_ cache files are present instead of just an arbirary one.
 }
 
+// Without @p with_flags, leaves the flag columns empty - for compressed columns whose flags are predicted
 template <template <typename> class UniquePtr, bool Compressed>
 cardinality_t load_cached_columns(
     const q1_params_t&                         params,
-    input_buffer_set<UniquePtr, Compressed>&   buffer_set)
+    input_buffer_set<UniquePtr, Compressed>&   buffer_set,
+    bool                                       with_flags = true)
 {
     auto data_files_directory =
         filesystem::path(defaults::tpch_data_subdirectory) / std::to_string(params.scale_factor);
@@ -184,15 +198,17 @@ cardinality_t load_cached_columns(
     buffer_set.discount       = extra_pointer_traits<decltype(buffer_set.discount)       >::make(cardinality);
     buffer_set.quantity       = extra_pointer_traits<decltype(buffer_set.quantity)       >::make(cardinality);
     buffer_set.extended_price = extra_pointer_traits<decltype(buffer_set.extended_price) >::make(cardinality);
-    buffer_set.return_flag    = extra_pointer_traits<decltype(buffer_set.return_flag)    >::make(return_flag_container_count);
-    buffer_set.line_status    = extra_pointer_traits<decltype(buffer_set.line_status)    >::make(line_status_container_count);
     load_column_from_binary_file(buffer_set.ship_date.get(),      cardinality, data_files_directory, filename_prefix + "shipdate"      + ".bin");
     load_column_from_binary_file(buffer_set.discount.get(),       cardinality, data_files_directory, filename_prefix + "discount"      + ".bin");
     load_column_from_binary_file(buffer_set.tax.get(),            cardinality, data_files_directory, filename_prefix + "tax"           + ".bin");
     load_column_from_binary_file(buffer_set.quantity.get(),       cardinality, data_files_directory, filename_prefix + "quantity"      + ".bin");
     load_column_from_binary_file(buffer_set.extended_price.get(), cardinality, data_files_directory, filename_prefix + "extendedprice" + ".bin");
-    load_column_from_binary_file(buffer_set.return_flag.get(),    return_flag_container_count, data_files_directory, filename_prefix + "returnflag"    + ".bin");
-    load_column_from_binary_file(buffer_set.line_status.get(),    line_status_container_count, data_files_directory, filename_prefix + "linestatus"    + ".bin");
+    if (with_flags) {
+        buffer_set.return_flag = extra_pointer_traits<decltype(buffer_set.return_flag)>::make(return_flag_container_count);
+        buffer_set.line_status = extra_pointer_traits<decltype(buffer_set.line_status)>::make(line_status_container_count);
+        load_column_from_binary_file(buffer_set.return_flag.get(), return_flag_container_count, data_files_directory, filename_prefix + "returnflag" + ".bin");
+        load_column_from_binary_file(buffer_set.line_status.get(), line_status_container_count, data_files_directory, filename_prefix + "linestatus" + ".bin");
+    }
 
 
 
@@ -236,8 +252,11 @@ void write_columns_to_cache(
     write_column_to_binary_file(&buffer_set.tax[0],            cardinality, data_files_directory, filename_prefix + "tax" + ".bin");
     write_column_to_binary_file(&buffer_set.quantity[0],       cardinality, data_files_directory, filename_prefix + "quantity" + ".bin");
     write_column_to_binary_file(&buffer_set.extended_price[0], cardinality, data_files_directory, filename_prefix + "extendedprice" + ".bin");
-    write_column_to_binary_file(&buffer_set.return_flag[0],    return_flag_container_count, data_files_directory, filename_prefix + "returnflag" + ".bin");
-    write_column_to_binary_file(&buffer_set.line_status[0],    line_status_container_count, data_files_directory, filename_prefix + "linestatus" + ".bin");
+    if (buffer_set.return_flag != nullptr) {
+        // Compressed columns' flags are cached in their prediction's place, if they fit it (see write_flag_prediction_to_cache())
+        write_column_to_binary_file(&buffer_set.return_flag[0], return_flag_container_count, data_files_directory, filename_prefix + "returnflag" + ".bin");
+        write_column_to_binary_file(&buffer_set.line_status[0], line_status_container_count, data_files_directory, filename_prefix + "linestatus" + ".bin");
+    }
 
 /*    for_each_argument(
         [&](auto tup){
@@ -280,6 +299,10 @@ cardinality_t parse_table_file_into_columns(
         // setup scripts are intended to do that
     }
     li.FromFile(table_file_path.c_str());
+    if (li.l_shipdate.Validity() != nullptr) {
+        // They're stored as date_nil, which the GPU kernels (and the cached columns) would take for an early date
+        throw std::runtime_error("The lineitem table has NULL ship dates, which the GPU kernels don't support");
+    }
     cardinality = li.l_extendedprice.cardinality;
     if (cardinality == cardinality_of_scale_factor_1) {
         cardinality = ((double) cardinality) * params.scale_factor;
@@ -291,6 +314,73 @@ cardinality_t parse_table_file_into_columns(
     return cardinality;
 }
 
+/*
+ * Runs f(first_row, num_rows) on consecutive ranges of rows, one per hardware thread;
+ * ranges start at multiples of whole compressed flag bit containers, so they can be
+ * written independently. Rethrows the first exception thrown by any of the ranges.
+ */
+template <typename F>
+void for_row_ranges_in_parallel(cardinality_t cardinality, F f)
+{
+    enum : cardinality_t { granularity = 64 * 1024 };
+    static_assert(granularity % return_flag_values_per_container == 0 and granularity % line_status_values_per_container == 0,
+        "Ranges must not share flag bit containers");
+    size_t num_threads = CpuTopology::Get().NumUsable();
+    size_t rows_per_range = ((cardinality + num_threads - 1) / num_threads + granularity - 1) / granularity * granularity;
+
+    std::vector<std::thread> threads;
+    std::vector<std::exception_ptr> exceptions;
+    exceptions.reserve(num_threads);
+    for(size_t first_row = 0; first_row < cardinality; first_row += rows_per_range) {
+        exceptions.emplace_back();
+        auto& exception = exceptions.back();
+        threads.emplace_back([&f, &exception, first_row, num_rows = std::min<size_t>(rows_per_range, cardinality - first_row)]() {
+            try { f(first_row, num_rows); }
+            catch(...) { exception = std::current_exception(); }
+        });
+    }
+    for(auto& thread : threads) { thread.join(); }
+    for(auto& exception : exceptions) {
+        if (exception) { std::rethrow_exception(exception); }
+    }
+}
+
+/*
+ * Packs flags into whole bit containers, each built in a register and stored once,
+ * rather than or'ing every element into memory separately; @p first_flag must be
+ * the first flag of a container
+ */
+template <unsigned LogBitsPerValue, typename Encode>
+void pack_flags(
+    bit_container_t*    __restrict__  containers,
+    const char*         __restrict__  flags,
+    cardinality_t                     first_flag,
+    cardinality_t                     num_flags,
+    Encode                            encode)
+{
+    enum : cardinality_t {
+        bits_per_value = 1 << LogBitsPerValue,
+        values_per_container = bits_per_bit_container / bits_per_value
+    };
+    containers += first_flag / values_per_container;
+    flags += first_flag;
+    cardinality_t num_full_containers = num_flags / values_per_container;
+    for(cardinality_t c = 0; c < num_full_containers; c++) {
+        bit_container_t container { 0 };
+        for(cardinality_t j = 0; j < values_per_container; j++) {
+            container |= bit_container_t { encode(flags[c * values_per_container + j]) } << (j * bits_per_value);
+        }
+        containers[c] = container;
+    }
+    if (num_flags % values_per_container != 0) {
+        bit_container_t container { 0 };
+        for(cardinality_t j = 0; j < num_flags % values_per_container; j++) {
+            container |= bit_container_t { encode(flags[num_full_containers * values_per_container + j]) } << (j * bits_per_value);
+        }
+        containers[num_full_containers] = container;
+    }
+}
+
 input_buffer_set<cuda::memory::host::unique_ptr, is_compressed> compress_columns(
     input_buffer_set<plain_ptr, is_not_compressed>  uncompressed,
     cardinality_t                                   cardinality)
@@ -308,36 +398,254 @@ input_buffer_set<cuda::memory::host::unique_ptr, is_compressed> compress_columns
 
     cout << "Compressing column data... " << flush;
 
-    // Man, we really need to have a sub-byte-length-value container class
-    std::memset(compressed.return_flag.get(), 0, div_rounding_up(cardinality, return_flag_values_per_container));
-    std::memset(compressed.line_status.get(), 0, div_rounding_up(cardinality, line_status_values_per_container));
-    for(cardinality_t i = 0; i < cardinality; i++) {
-        compressed.ship_date[i]      = uncompressed.ship_date[i] - ship_date_frame_of_reference;
-        compressed.discount[i]       = uncompressed.discount[i]; // we're keeping the factor 100 scaling
-        compressed.extended_price[i] = uncompressed.extended_price[i];
-        compressed.quantity[i]       = uncompressed.quantity[i] / 100;
-        compressed.tax[i]            = uncompressed.tax[i]; // we're keeping the factor 100 scaling
-        set_bit_resolution_element<log_return_flag_bits, cardinality_t>(
-            compressed.return_flag.get(), i, encode_return_flag(uncompressed.return_flag[i]));
-        set_bit_resolution_element<log_line_status_bits, cardinality_t>(
-            compressed.line_status.get(), i, encode_line_status(uncompressed.line_status[i]));
-        assert( (ship_date_t)      compressed.ship_date[i]      == uncompressed.ship_date[i] - ship_date_frame_of_reference);
-        assert( (discount_t)       compressed.discount[i]       == uncompressed.discount[i]);
-        assert( (extended_price_t) compressed.extended_price[i] == uncompressed.extended_price[i]);
-        assert( (quantity_t)       compressed.quantity[i]       == uncompressed.quantity[i] / 100);
+    // Each range of rows is narrowed one column at a time, in simple loops the compiler vectorizes
+    for_row_ranges_in_parallel(cardinality, [&](cardinality_t first_row, cardinality_t num_rows) {
+        auto narrow = [=](const auto* __restrict__ in, auto* __restrict__ out, auto f) {
+            for(auto i = first_row; i < first_row + num_rows; i++) { out[i] = f(in[i]); }
+        };
+        narrow(uncompressed.ship_date,      compressed.ship_date.get(),      [](ship_date_t d)      { return d - ship_date_frame_of_reference; });
+        narrow(uncompressed.discount,       compressed.discount.get(),       [](discount_t d)       { return d; }); // we're keeping the factor 100 scaling
+        narrow(uncompressed.extended_price, compressed.extended_price.get(), [](extended_price_t p) { return p; });
+        narrow(uncompressed.tax,            compressed.tax.get(),            [](tax_t t)            { return t; }); // we're keeping the factor 100 scaling
+        narrow(uncompressed.quantity,       compressed.quantity.get(),       [](quantity_t q)       { return q / 100; });
             // not keeping the scaling here since we know the data is all integral; you could call this a form
             // of compression
-        assert( (tax_t)            compressed.tax[i]            == uncompressed.tax[i]);
-    }
-    for(cardinality_t i = 0; i < cardinality; i++) {
-        assert(decode_return_flag(get_bit_resolution_element<log_return_flag_bits, cardinality_t>(compressed.return_flag.get(), i)) == uncompressed.return_flag[i]);
-        assert(decode_line_status(get_bit_resolution_element<log_line_status_bits, cardinality_t>(compressed.line_status.get(), i)) == uncompressed.line_status[i]);
-    }
+        pack_flags<log_return_flag_bits>(compressed.return_flag.get(), uncompressed.return_flag, first_row, num_rows,
+            [](char return_flag) { return encode_return_flag(return_flag); });
+        pack_flags<log_line_status_bits>(compressed.line_status.get(), uncompressed.line_status, first_row, num_rows,
+            [](char line_status) { return encode_line_status(line_status); });
+    });
 
     cout << "done." << endl;
     return compressed;
 }
 
+/*
+ * Checks, in parallel, that the compressed columns decompress back into the uncompressed
+ * ones - i.e. that the data fits the compressed representation; throws otherwise
+ */
+void verify_compressed_columns(
+    const input_buffer_set<plain_ptr, is_not_compressed>&                   uncompressed,
+    const input_buffer_set<cuda::memory::host::unique_ptr, is_compressed>&  compressed,
+    cardinality_t                                                           cardinality)
+{
+    cout << "Verifying the compressed columns... " << flush;
+    for_row_ranges_in_parallel(cardinality, [&](cardinality_t first_row, cardinality_t num_rows) {
+        for(auto i = first_row; i < first_row + num_rows; i++) {
+            if ( (ship_date_t)      compressed.ship_date[i] + ship_date_frame_of_reference != uncompressed.ship_date[i]      or
+                 (discount_t)       compressed.discount[i]                                 != uncompressed.discount[i]       or
+                 (extended_price_t) compressed.extended_price[i]                           != uncompressed.extended_price[i] or
+                 (quantity_t)       compressed.quantity[i] * 100                           != uncompressed.quantity[i]       or
+                 (tax_t)            compressed.tax[i]                                      != uncompressed.tax[i]            or
+                 decode_return_flag(get_bit_resolution_element<log_return_flag_bits, cardinality_t>(
+                     compressed.return_flag.get(), i)) != uncompressed.return_flag[i] or
+                 decode_line_status(get_bit_resolution_element<log_line_status_bits, cardinality_t>(
+                     compressed.line_status.get(), i)) != uncompressed.line_status[i])
+            {
+                throw std::runtime_error("The data does not fit the compressed representation, at row " + std::to_string(i));
+            }
+        }
+    });
+    cout << "done." << endl;
+}
+
+/*
+ * Derives the flags' prediction from the ship dates (see predicted_flags_set), in
+ * parallel, and validates it against the compressed flags; it doesn't fit if more than
+ * one row in ComprData::kMaxFlagExceptionsFraction is an exception, as for the CPU's
+ * columns. If it fits, the flag containers are released - the prediction replaces them.
+ */
+predicted_flags_set predict_flags(
+    input_buffer_set<cuda::memory::host::unique_ptr, is_compressed>&  compressed,
+    cardinality_t                                                     cardinality)
+{
+    auto return_flag_of = [&](cardinality_t i) {
+        return (uint8_t) get_bit_resolution_element<log_return_flag_bits, cardinality_t>(
+            compressed.return_flag[i / return_flag_values_per_container], i % return_flag_values_per_container);
+    };
+    auto line_status_of = [&](cardinality_t i) {
+        return (uint8_t) get_bit_resolution_element<log_line_status_bits, cardinality_t>(
+            compressed.line_status[i / line_status_values_per_container], i % line_status_values_per_container);
+    };
+
+    predicted_flags_set predicted;
+    if (cardinality == 0) { return predicted; }
+
+    cout << "Predicting the flags from the ship dates... " << flush;
+    std::mutex mutex;
+
+    // CURRENTDATE is the last ship date of a final item
+    compressed::ship_date_t last_final_day { 0 };
+    for_row_ranges_in_parallel(cardinality, [&](cardinality_t first_row, cardinality_t num_rows) {
+        compressed::ship_date_t range_last_final_day { 0 };
+        for(auto i = first_row; i < first_row + num_rows; i++) {
+            if (line_status_of(i) == encode_line_status('F')) {
+                range_last_final_day = std::max(range_last_final_day, compressed.ship_date[i]);
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        last_final_day = std::max(last_final_day, range_last_final_day);
+    });
+
+    // Ranges stop early once there are too many exceptions overall; each range's are kept by its first row
+    auto max_exceptions = cardinality / ComprData::kMaxFlagExceptionsFraction;
+    std::atomic<cardinality_t> num_exceptions { 0 };
+    std::map<cardinality_t, std::vector<flag_exception_t>> exceptions_by_range;
+    auto num_returned_containers = div_rounding_up(cardinality, line_status_values_per_container);
+    auto returned = cuda::memory::host::make_unique< bit_container_t[] >(num_returned_containers);
+    for_row_ranges_in_parallel(cardinality, [&](cardinality_t first_row, cardinality_t num_rows) {
+        std::fill_n(returned.get() + first_row / line_status_values_per_container,
+            div_rounding_up(num_rows, line_status_values_per_container), 0);
+        std::vector<flag_exception_t> exceptions;
+        for(auto i = first_row; i < first_row + num_rows and num_exceptions <= max_exceptions; i++) {
+            auto return_flag = return_flag_of(i);
+            auto line_status = line_status_of(i);
+            bool fits;
+            if (compressed.ship_date[i] <= last_final_day) {
+                fits = line_status == encode_line_status('F') and
+                    (return_flag == encode_return_flag('A') or return_flag == encode_return_flag('R'));
+                if (fits and return_flag == encode_return_flag('R')) {
+                    set_bit(returned[i / line_status_values_per_container], i % line_status_values_per_container);
+                }
+            }
+            else {
+                fits = line_status == encode_line_status('O') and return_flag == encode_return_flag('N');
+            }
+            if (not fits) {
+                exceptions.push_back({ i, return_flag, line_status });
+                num_exceptions++;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        exceptions_by_range[first_row] = std::move(exceptions);
+    });
+    if (num_exceptions > max_exceptions) {
+        cout << "the data doesn't fit; keeping the flags as they are." << endl;
+        return predicted;
+    }
+
+    predicted.fits = true;
+    predicted.last_final_day = last_final_day;
+    predicted.returned = std::move(returned);
+    predicted.num_exceptions = num_exceptions;
+    predicted.exceptions = cuda::memory::host::make_unique< flag_exception_t[] >(std::max<size_t>(num_exceptions, 1));
+    auto next_exception = predicted.exceptions.get();
+    for(const auto& range : exceptions_by_range) {
+        next_exception = std::copy(range.second.begin(), range.second.end(), next_exception);
+    }
+    compressed.return_flag.reset();
+    compressed.line_status.reset();
+    cout << "done; " << predicted.num_exceptions << " exceptions ("
+         << 100.0 * predicted.num_exceptions / cardinality << "% of the rows)." << endl;
+    return predicted;
+}
+
+/*
+ * Rebuilds the compressed flag containers from the prediction, in parallel, for uses
+ * which need them on the host; does nothing if the containers were kept
+ */
+void expand_predicted_flags(
+    const predicted_flags_set&                                        predicted,
+    input_buffer_set<cuda::memory::host::unique_ptr, is_compressed>&  compressed,
+    cardinality_t                                                     cardinality)
+{
+    if (not predicted.fits or compressed.return_flag != nullptr) { return; }
+
+    compressed.return_flag = cuda::memory::host::make_unique< bit_container_t[] >(div_rounding_up(cardinality, return_flag_values_per_container));
+    compressed.line_status = cuda::memory::host::make_unique< bit_container_t[] >(div_rounding_up(cardinality, line_status_values_per_container));
+    auto exceptions_end = predicted.exceptions.get() + predicted.num_exceptions;
+    for_row_ranges_in_parallel(cardinality, [&](cardinality_t first_row, cardinality_t num_rows) {
+        std::fill_n(compressed.return_flag.get() + first_row / return_flag_values_per_container,
+            div_rounding_up(num_rows, return_flag_values_per_container), 0);
+        std::fill_n(compressed.line_status.get() + first_row / line_status_values_per_container,
+            div_rounding_up(num_rows, line_status_values_per_container), 0);
+        auto exception = std::lower_bound(predicted.exceptions.get(), exceptions_end, first_row,
+            [](const flag_exception_t& e, cardinality_t row) { return e.row < row; });
+        for(auto i = first_row; i < first_row + num_rows; i++) {
+            bit_container_t return_flag, line_status;
+            if (exception != exceptions_end and exception->row == i) {
+                return_flag = exception->return_flag;
+                line_status = exception->line_status;
+                exception++;
+            }
+            else if (compressed.ship_date[i] <= predicted.last_final_day) {
+                return_flag = get_bit(predicted.returned.get(), i) ? encode_return_flag('R') : encode_return_flag('A');
+                line_status = encode_line_status('F');
+            }
+            else {
+                return_flag = encode_return_flag('N');
+                line_status = encode_line_status('O');
+            }
+            set_bit_resolution_element<log_return_flag_bits, cardinality_t>(compressed.return_flag.get(), i, return_flag);
+            set_bit_resolution_element<log_line_status_bits, cardinality_t>(compressed.line_status.get(), i, line_status);
+        }
+    });
+}
+
+/*
+ * The flags' prediction is cached along with the compressed columns: whether the data
+ * fits it, and if so its encoding, in place of the flag containers
+ */
+void write_flag_prediction_to_cache(
+    const q1_params_t&          params,
+    const predicted_flags_set&  predicted,
+    cardinality_t               cardinality)
+{
+    auto data_files_directory =
+        filesystem::path(defaults::tpch_data_subdirectory) / std::to_string(params.scale_factor);
+    if (predicted.fits) {
+        write_column_to_binary_file(predicted.returned.get(), div_rounding_up(cardinality, line_status_values_per_container),
+            data_files_directory, "compressed_returned.bin");
+        write_column_to_binary_file(predicted.exceptions.get(), predicted.num_exceptions,
+            data_files_directory, "compressed_flag_exceptions.bin");
+        filesystem::remove(data_files_directory / "compressed_returnflag.bin");
+        filesystem::remove(data_files_directory / "compressed_linestatus.bin");
+    }
+    int32_t prediction[] = { predicted.fits, predicted.fits ? predicted.last_final_day : 0 };
+    write_column_to_binary_file(prediction, 2, data_files_directory, "compressed_flag_prediction.bin");
+        // last, so that it's only there if the encoding is
+}
+
+/*
+ * Loads the cached compressed columns, with the flags' prediction in place of the flag
+ * containers if the data fits it; for columns cached without a prediction, it's
+ * derived (and cached) here
+ */
+cardinality_t load_cached_compressed_columns(
+    const q1_params_t&                                                params,
+    input_buffer_set<cuda::memory::host::unique_ptr, is_compressed>&  compressed,
+    predicted_flags_set&                                              predicted)
+{
+    auto data_files_directory =
+        filesystem::path(defaults::tpch_data_subdirectory) / std::to_string(params.scale_factor);
+    bool prediction_is_cached = filesystem::exists(data_files_directory / "compressed_flag_prediction.bin");
+    int32_t prediction[] = { false, 0 };
+    if (prediction_is_cached) {
+        load_column_from_binary_file(prediction, 2, data_files_directory, "compressed_flag_prediction.bin");
+    }
+    auto cardinality = load_cached_columns(params, compressed, not prediction[0]);
+    if (not prediction_is_cached) {
+        predicted = predict_flags(compressed, cardinality);
+        write_flag_prediction_to_cache(params, predicted, cardinality);
+        return cardinality;
+    }
+    if (not prediction[0]) { return cardinality; }
+
+    predicted.fits = true;
+    predicted.last_final_day = prediction[1];
+    auto num_returned_containers = div_rounding_up(cardinality, line_status_values_per_container);
+    predicted.returned = cuda::memory::host::make_unique< bit_container_t[] >(num_returned_containers);
+    load_column_from_binary_file(predicted.returned.get(), num_returned_containers, data_files_directory, "compressed_returned.bin");
+    auto exceptions_file = data_files_directory / "compressed_flag_exceptions.bin";
+    cardinality_t num_cached_exceptions = filesystem::file_size(exceptions_file) / sizeof(flag_exception_t);
+    predicted.exceptions = cuda::memory::host::make_unique< flag_exception_t[] >(std::max<size_t>(num_cached_exceptions, 1));
+    load_column_from_binary_file(predicted.exceptions.get(), num_cached_exceptions, data_files_directory, "compressed_flag_exceptions.bin");
+    // The cached columns may be longer, for sub-scale-factor-1 arguments
+    predicted.num_exceptions = std::lower_bound(predicted.exceptions.get(), predicted.exceptions.get() + num_cached_exceptions, cardinality,
+        [](const flag_exception_t& e, cardinality_t row) { return e.row < row; }) - predicted.exceptions.get();
+    return cardinality;
+}
+
 input_buffer_set<plain_ptr, is_not_compressed>
 get_buffers_inside(lineitem& li)
 {
@@ -389,13 +697,427 @@ void set_lineitem_cardinalities(
     li.l_linestatus.cardinality = cardinality;
 }
 
+// Arrow dates count days since the Unix epoch; ours are MonetDB dates
+ship_date_t ship_date_of_arrow_date(int64_t days_since_epoch)
+{
+    static const ship_date_t unix_epoch = monetdb::date_t(1970, 1, 1).dte_val;
+    return unix_epoch + days_since_epoch;
+}
+
+// Indices of the fields of an Arrow lineitem file which Q1 uses
+struct arrow_lineitem_fields {
+    int ship_date, discount, extended_price, tax, quantity, return_flag, line_status;
+};
+
+arrow_lineitem_fields find_arrow_lineitem_fields(const arrow_ipc::file_reader& file)
+{
+    using arrow_ipc::type_id;
+    auto find = [&](const std::string& name, std::initializer_list<type_id> acceptable_types) {
+        auto index = file.field_index(name);
+        if (index < 0) {
+            throw std::runtime_error("The Arrow file has no " + name + " column");
+        }
+        const auto& field = file.fields()[index];
+        if (std::find(acceptable_types.begin(), acceptable_types.end(), field.type.id) == acceptable_types.end() or
+            field.dictionary_encoded)
+        {
+            throw std::runtime_error("Unsupported type for the Arrow file's " + name + " column");
+        }
+        if (field.type.id == type_id::decimal and field.type.scale != 2) {
+            throw std::runtime_error("The Arrow file's " + name + " column must have 2 decimal digits");
+        }
+        if (field.type.id == type_id::fixed_size_binary and field.type.byte_width != 1) {
+            throw std::runtime_error("The Arrow file's " + name + " column must have single-character values");
+        }
+        if (file.null_count(index) > 0) {
+            throw std::runtime_error("The Arrow file's " + name + " column has nulls");
+        }
+        return index;
+    };
+    return {
+        find("l_shipdate",      { type_id::date }),
+        find("l_discount",      { type_id::decimal }),
+        find("l_extendedprice", { type_id::decimal }),
+        find("l_tax",           { type_id::decimal }),
+        find("l_quantity",      { type_id::decimal }),
+        find("l_returnflag",    { type_id::fixed_size_binary, type_id::utf8, type_id::binary }),
+        find("l_linestatus",    { type_id::fixed_size_binary, type_id::utf8, type_id::binary })
+    };
+}
+
+/*
+ * Columns may use buffers they don't own - those of a memory-mapped Arrow file, or of
+ * a shared column store; this keeps the owners mapped, and unplugs those columns
+ * before the lineitem object and the compressed columns are destroyed (so it must be
+ * declared after them)
+ */
+struct borrowed_buffers {
+    std::unique_ptr<arrow_ipc::file_reader>  arrow_file;
+    std::unique_ptr<shared_column_store>     shared_columns;
+    std::vector<std::function<void()>>       unplug;
+
+    ~borrowed_buffers() { for(auto& f : unplug) { f(); } }
+};
+
+cardinality_t load_arrow_file_into_lineitem(
+    borrowed_buffers&  borrowed,
+    lineitem&          li)
+{
+    const auto& file = *borrowed.arrow_file;
+    auto fields = find_arrow_lineitem_fields(file);
+    if (file.num_rows() > std::numeric_limits<cardinality_t>::max()) {
+        throw std::runtime_error("The Arrow file has too many rows");
+    }
+    cardinality_t cardinality = file.num_rows();
+
+    // Use the file's buffers in place if we can, otherwise convert into the column's own buffer
+    auto load = [&](auto& column, int field_index, bool in_place_representation_matches, auto convert) {
+        using T = std::remove_reference_t<decltype(column.get()[0])>;
+        auto in_place = in_place_representation_matches ? file.template contiguous_values<T>(field_index) : nullptr;
+        if (in_place != nullptr and reinterpret_cast<uintptr_t>(in_place) % 64 == 0) {
+                // Columns' buffers are assumed to be 64-byte-aligned
+            ::free(column.m_ptr);
+            column.m_ptr = const_cast<T*>(in_place);
+            column.m_capacity = cardinality;
+            borrowed.unplug.emplace_back([&column]() { column.m_ptr = nullptr; });
+            return;
+        }
+        if (column.capacity() < cardinality) {
+            column.resize(cardinality);
+        }
+        auto values = column.get();
+        for_row_ranges_in_parallel(cardinality, [&](size_t first_row, size_t num_rows) {
+            file.for_each_value(field_index, first_row, num_rows, [&](size_t i, int64_t value) { values[i] = convert(value); });
+        });
+    };
+    auto is_decimal64 = [&](int field_index) { return file.fields()[field_index].type.value_width() == sizeof(int64_t); };
+    auto is_single_byte = [&](int field_index) { return file.fields()[field_index].type.value_width() == sizeof(char); };
+    auto as_is = [](int64_t value) { return value; };
+
+    load(li.l_shipdate,      fields.ship_date,      false, ship_date_of_arrow_date);
+    load(li.l_discount,      fields.discount,       is_decimal64(fields.discount),       as_is);
+    load(li.l_extendedprice, fields.extended_price, is_decimal64(fields.extended_price), as_is);
+    load(li.l_tax,           fields.tax,            is_decimal64(fields.tax),            as_is);
+    load(li.l_quantity,      fields.quantity,       is_decimal64(fields.quantity),       as_is);
+    load(li.l_returnflag,    fields.return_flag,    is_single_byte(fields.return_flag),  as_is);
+    load(li.l_linestatus,    fields.line_status,    is_single_byte(fields.line_status),  as_is);
+    set_lineitem_cardinalities(li, cardinality);
+    return cardinality;
+}
+
+/*
+ * Narrows the columns of an Arrow lineitem file directly into the compressed
+ * representation (see compress_columns()), in parallel
+ */
+input_buffer_set<cuda::memory::host::unique_ptr, is_compressed> load_arrow_file_into_compressed_columns(
+    const arrow_ipc::file_reader&  file,
+    cardinality_t&                 cardinality)
+{
+    auto fields = find_arrow_lineitem_fields(file);
+    if (file.num_rows() > std::numeric_limits<cardinality_t>::max()) {
+        throw std::runtime_error("The Arrow file has too many rows");
+    }
+    cardinality = file.num_rows();
+    auto num_return_flag_containers = (cardinality + return_flag_values_per_container - 1) / return_flag_values_per_container;
+    auto num_line_status_containers = (cardinality + line_status_values_per_container - 1) / line_status_values_per_container;
+
+    input_buffer_set<cuda::memory::host::unique_ptr, is_compressed> compressed = {
+        cuda::memory::host::make_unique< compressed::ship_date_t[]      >(cardinality),
+        cuda::memory::host::make_unique< compressed::discount_t[]       >(cardinality),
+        cuda::memory::host::make_unique< compressed::extended_price_t[] >(cardinality),
+        cuda::memory::host::make_unique< compressed::tax_t[]            >(cardinality),
+        cuda::memory::host::make_unique< compressed::quantity_t[]       >(cardinality),
+        cuda::memory::host::make_unique< bit_container_t[] >(num_return_flag_containers),
+        cuda::memory::host::make_unique< bit_container_t[] >(num_line_status_containers),
+        nullptr // precomputed filter - we don't create this here.
+    };
+
+    cout << "Narrowing the Arrow file's columns... " << flush;
+    for_row_ranges_in_parallel(cardinality, [&](size_t first_row, size_t num_rows) {
+        std::fill_n(compressed.return_flag.get() + first_row / return_flag_values_per_container,
+            (num_rows + return_flag_values_per_container - 1) / return_flag_values_per_container, 0);
+        std::fill_n(compressed.line_status.get() + first_row / line_status_values_per_container,
+            (num_rows + line_status_values_per_container - 1) / line_status_values_per_container, 0);
+        file.for_each_value(fields.ship_date, first_row, num_rows, [&](size_t i, int64_t days) {
+            compressed.ship_date[i] = ship_date_of_arrow_date(days) - ship_date_frame_of_reference;
+        });
+        file.for_each_value(fields.discount, first_row, num_rows, [&](size_t i, int64_t discount) {
+            compressed.discount[i] = discount; // we're keeping the factor 100 scaling
+        });
+        file.for_each_value(fields.extended_price, first_row, num_rows, [&](size_t i, int64_t extended_price) {
+            compressed.extended_price[i] = extended_price;
+        });
+        file.for_each_value(fields.tax, first_row, num_rows, [&](size_t i, int64_t tax) {
+            compressed.tax[i] = tax; // we're keeping the factor 100 scaling
+        });
+        file.for_each_value(fields.quantity, first_row, num_rows, [&](size_t i, int64_t quantity) {
+            compressed.quantity[i] = quantity / 100;
+        });
+        file.for_each_value(fields.return_flag, first_row, num_rows, [&](size_t i, int64_t return_flag) {
+            set_bit_resolution_element<log_return_flag_bits, cardinality_t>(
+                compressed.return_flag.get(), i, encode_return_flag(return_flag));
+        });
+        file.for_each_value(fields.line_status, first_row, num_rows, [&](size_t i, int64_t line_status) {
+            set_bit_resolution_element<log_line_status_bits, cardinality_t>(
+                compressed.line_status.get(), i, encode_line_status(line_status));
+        });
+    });
+    cout << "done." << endl;
+    return compressed;
+}
+
+/*
+ * Writes the uncompressed columns as an Arrow IPC file, with the decimals as
+ * 64-bit Arrow decimals and the flags as single-byte binaries - so that reading
+ * the file back uses those in place
+ */
+void write_columns_to_arrow_file(
+    const std::string&                                     path,
+    const input_buffer_set<plain_ptr, is_not_compressed>&  uncompressed,
+    cardinality_t                                          cardinality)
+{
+    using arrow_ipc::field_type;
+    if (uncompressed.ship_date == nullptr) {
+        throw std::runtime_error("Writing an Arrow file requires the uncompressed columns; "
+            "invoke without \"--apply-compression\", or without compressed columns cached");
+    }
+    cout << "Writing the columns to the Arrow file " << path << " ... " << flush;
+    std::vector<int32_t> ship_date_as_days_since_epoch(cardinality);
+    auto unix_epoch = ship_date_of_arrow_date(0);
+    for_row_ranges_in_parallel(cardinality, [&](size_t first_row, size_t num_rows) {
+        for(auto i = first_row; i < first_row + num_rows; i++) {
+            ship_date_as_days_since_epoch[i] = uncompressed.ship_date[i] - unix_epoch;
+        }
+    });
+    static_assert(sizeof(return_flag_t) == 1 and sizeof(line_status_t) == 1, "Flags are expected to be single bytes");
+    auto decimal = field_type::decimal(15, 2, sizeof(int64_t) * CHAR_BIT);
+    arrow_ipc::write_file(path, {
+        { "l_quantity",      decimal,                               uncompressed.quantity       },
+        { "l_extendedprice", decimal,                               uncompressed.extended_price },
+        { "l_discount",      decimal,                               uncompressed.discount       },
+        { "l_tax",           decimal,                               uncompressed.tax            },
+        { "l_returnflag",    field_type::fixed_size_binary(1),      uncompressed.return_flag    },
+        { "l_linestatus",    field_type::fixed_size_binary(1),      uncompressed.line_status    },
+        { "l_shipdate",      field_type::date(arrow_ipc::date_unit::day), ship_date_as_days_since_epoch.data() },
+    }, cardinality);
+    cout << "done." << endl;
+}
+
+/*
+ * Loads the columns the query is to process - or, with @p load_both_representations,
+ * the uncompressed and the compressed columns both - from the Arrow file, if one was
+ * specified, otherwise from the cache, parsing the table file if necessary. Compressed
+ * columns come with their flags' prediction, which replaces their flag containers if
+ * the data fits it.
+ */
+cardinality_t load_columns(
+    const q1_params_t&                                                 params,
+    bool                                                               load_both_representations,
+    lineitem&                                                          li,
+    input_buffer_set<plain_ptr, is_not_compressed>&                    uncompressed,
+    input_buffer_set<cuda::memory::host::unique_ptr, is_compressed>&  compressed,
+    predicted_flags_set&                                               predicted_flags,
+    borrowed_buffers&                                                  borrowed)
+{
+    cardinality_t cardinality;
+    bool need_uncompressed = load_both_representations or not params.apply_compression;
+    bool need_compressed   = load_both_representations or params.apply_compression;
+    input_buffer_set<plugged_unique_ptr, is_not_compressed> uncompressed_outside_li;
+        // If we parse, we have to go through an "lineitem" object which holds its
+        // own pointers, while we need this class, which is the same template for
+        // the compressed as uncompressed case. For this reason we have these two
+        // objects, using the first, moving it into li, then using the second as
+        // a sort of a facade for li.
+
+    if (not params.arrow_input_file.empty()) {
+        cout << "Memory-mapping the Arrow file " << params.arrow_input_file << " ... " << flush;
+        borrowed.arrow_file = std::make_unique<arrow_ipc::file_reader>(params.arrow_input_file);
+        cout << "done." << endl;
+        if (need_compressed) {
+            compressed = load_arrow_file_into_compressed_columns(*borrowed.arrow_file, cardinality);
+            predicted_flags = predict_flags(compressed, cardinality);
+            set_lineitem_cardinalities(li, cardinality);
+        }
+        if (need_uncompressed) {
+            cardinality = load_arrow_file_into_lineitem(borrowed, li);
+            uncompressed = get_buffers_inside(li);
+        }
+    }
+    else if (not need_uncompressed and columns_are_cached(params, is_compressed)) {
+        cardinality = load_cached_compressed_columns(params, compressed, predicted_flags);
+        set_lineitem_cardinalities(li, cardinality);
+    }
+    else {
+        if (columns_are_cached(params, is_not_compressed)) {
+            cardinality = load_cached_columns(params, uncompressed_outside_li);
+            move_buffers_into_lineitem_object(uncompressed_outside_li, li, cardinality);
+            uncompressed = get_buffers_inside(li);
+        }
+        else {
+            cardinality = parse_table_file_into_columns(params, li);
+            uncompressed = get_buffers_inside(li);
+            write_columns_to_cache(params, uncompressed, cardinality);
+                // We write the uncompressed columns to cache files
+                // even if our interest is in the compressed ones
+        }
+
+        if (need_compressed and columns_are_cached(params, is_compressed)) {
+            load_cached_compressed_columns(params, compressed, predicted_flags);
+        }
+        else if (need_compressed) {
+            compressed = compress_columns(uncompressed, cardinality);
+            if (params.verify_compression) {
+                verify_compressed_columns(uncompressed, compressed, cardinality);
+            }
+            predicted_flags = predict_flags(compressed, cardinality);
+            write_columns_to_cache(params, compressed, cardinality);
+            write_flag_prediction_to_cache(params, predicted_flags, cardinality);
+        }
+    }
+    return cardinality;
+}
+
+/*
+ * Applies f(column, name, length) to each of the compressed columns, with its name in
+ * shared column stores - for the flags, to their prediction's columns if the data fits
+ * it, otherwise to the flag containers
+ */
+template <typename F>
+void for_each_compressed_column(
+    input_buffer_set<cuda::memory::host::unique_ptr, is_compressed>&  compressed,
+    predicted_flags_set&                                              predicted_flags,
+    cardinality_t                                                     cardinality,
+    F                                                                 f)
+{
+    f(compressed.ship_date,      "compressed_ship_date",      cardinality);
+    f(compressed.discount,       "compressed_discount",       cardinality);
+    f(compressed.extended_price, "compressed_extended_price", cardinality);
+    f(compressed.tax,            "compressed_tax",            cardinality);
+    f(compressed.quantity,       "compressed_quantity",       cardinality);
+    if (predicted_flags.fits) {
+        f(predicted_flags.returned,   "compressed_returned",        div_rounding_up(cardinality, line_status_values_per_container));
+        f(predicted_flags.exceptions, "compressed_flag_exceptions", predicted_flags.num_exceptions);
+    }
+    else {
+        f(compressed.return_flag,    "compressed_return_flag",    div_rounding_up(cardinality, return_flag_values_per_container));
+        f(compressed.line_status,    "compressed_line_status",    div_rounding_up(cardinality, line_status_values_per_container));
+    }
+}
+
+std::string shared_columns_name(const q1_params_t& params)
+{
+    return "tpch_q1-sf" + std::to_string(params.scale_factor);
+}
+
+/*
+ * Identifies both the data which shared columns were loaded from - by the source
+ * file's path, size and modification time - and their representation
+ */
+uint64_t shared_columns_data_version(const q1_params_t& params)
+{
+    auto data_files_directory =
+        filesystem::path(defaults::tpch_data_subdirectory) / std::to_string(params.scale_factor);
+    auto source = params.arrow_input_file.empty() ?
+        data_files_directory / lineitem_table_file_name : filesystem::path(params.arrow_input_file);
+    if (not filesystem::exists(source)) {
+        source = data_files_directory / "shipdate.bin"; // we only have the cached columns
+    }
+    std::stringstream representation;
+    representation
+        << "tpch_q1 lineitem, compressed and compact columns v4; ship date frame of reference "
+        << ship_date_frame_of_reference << "; scale factor " << params.scale_factor;
+    return shared_column_store::file_version(source.string(), shared_column_store::hash(representation.str()));
+}
+
+/*
+ * Places the uncompressed, compressed and compact (CPU co-processing) columns in
+ * shared memory, replacing any previously-published ones
+ */
+void publish_shared_columns(
+    const q1_params_t&                                                 params,
+    lineitem&                                                          li,
+    input_buffer_set<cuda::memory::host::unique_ptr, is_compressed>&  compressed,
+    predicted_flags_set&                                               predicted_flags,
+    cardinality_t                                                      cardinality)
+{
+    std::vector<shared_column_store::column> columns;
+    set_lineitem_cardinalities(li, cardinality);
+        // which is fewer than were parsed for sub-scale-factor-1 arguments
+    ComprData::AddSharedColumns(li, columns);
+    for_each_compressed_column(compressed, predicted_flags, cardinality, [&](auto& column, const char* name, cardinality_t length) {
+        columns.push_back({ name, column.get(), length * sizeof(column[0]) });
+    });
+    if (predicted_flags.fits) {
+        // its presence is what tells attaching processes the flags are predicted
+        columns.push_back({ "compressed_last_final_day", &predicted_flags.last_final_day, sizeof(predicted_flags.last_final_day) });
+    }
+    cout << "Publishing the columns in shared memory... " << flush;
+    auto location = shared_column_store::publish(shared_columns_name(params), shared_columns_data_version(params),
+        "scale factor " + std::to_string(params.scale_factor) +
+        (params.arrow_input_file.empty() ? "" : ", from " + params.arrow_input_file), columns);
+    cout << "done; they're at " << location << endl;
+}
+
+/*
+ * Uses previously-published columns in place - for the lineitem object, the
+ * compressed columns and the compact ones
+ *
+ * @return false (having changed nothing) if there are no such columns, or they were
+ * loaded from different data
+ */
+bool attach_shared_columns(
+    const q1_params_t&                                                 params,
+    lineitem&                                                          li,
+    input_buffer_set<plain_ptr, is_not_compressed>&                    uncompressed,
+    input_buffer_set<cuda::memory::host::unique_ptr, is_compressed>&  compressed,
+    predicted_flags_set&                                               predicted_flags,
+    cardinality_t&                                                     cardinality,
+    borrowed_buffers&                                                  borrowed)
+{
+    std::string why_not;
+    auto store = shared_column_store::attach(shared_columns_name(params), shared_columns_data_version(params), &why_not);
+    if (store) {
+        cardinality = store->size_of("l_extendedprice") / sizeof(extended_price_t);
+        auto last_final_day = static_cast<const compressed::ship_date_t*>(
+            store->find("compressed_last_final_day", sizeof(compressed::ship_date_t)));
+        predicted_flags.fits = last_final_day != nullptr;
+        if (predicted_flags.fits) {
+            predicted_flags.last_final_day = *last_final_day;
+            predicted_flags.num_exceptions = store->size_of("compressed_flag_exceptions") / sizeof(flag_exception_t);
+        }
+        bool complete { cardinality > 0 };
+        for_each_compressed_column(compressed, predicted_flags, cardinality, [&](auto& column, const char* name, cardinality_t length) {
+            complete = complete and store->find(name, length * sizeof(column[0])) != nullptr;
+        });
+        if (not complete or not ComprData::AttachShared(li, *store, borrowed.unplug)) {
+            why_not = store->describe() + " lacks some of the columns";
+            predicted_flags = predicted_flags_set{};
+            store.reset();
+        }
+    }
+    if (not store) {
+        cerr << "Not using shared columns: " << why_not << endl;
+        return false;
+    }
+    for_each_compressed_column(compressed, predicted_flags, cardinality, [&](auto& column, const char* name, cardinality_t length) {
+        using element_type = std::remove_reference_t<decltype(column[0])>;
+        column.reset(static_cast<element_type*>(const_cast<void*>(store->find(name, length * sizeof(element_type)))));
+        borrowed.unplug.emplace_back([&column]() { column.release(); });
+    });
+    uncompressed = get_buffers_inside(li);
+    cout << "Attached to the shared columns " << store->describe() << endl;
+    borrowed.shared_columns = std::move(store);
+    return true;
+}
+
 void allocate_non_input_resources(
     q1_params_t                     params,
     cuda::device_t<>                cuda_device,
     cardinality_t                   cardinality,
     device_aggregates_t&            aggregates_on_device,
     host_aggregates_t&              aggregates_on_host,
-    stream_input_buffer_sets&       stream_input_buffer_sets
+    stream_input_buffer_sets&       stream_input_buffer_sets,
+    const predicted_flags_set&      predicted_flags
 )
 {
     aggregates_on_host = {
@@ -435,6 +1157,12 @@ void allocate_non_input_resources(
                 cuda::memory::device::make_unique< bit_container_t[]              >(cuda_device, div_rounding_up(params.num_tuples_per_kernel_launch, bits_per_container))
             };
             stream_input_buffer_sets.compressed.emplace_back(std::move(stream_input_buffer_set));
+            if (predicted_flags.fits and not params.use_filter_pushdown) {
+                stream_input_buffer_sets.returned.emplace_back(
+                    cuda::memory::device::make_unique< bit_container_t[]  >(cuda_device, div_rounding_up(params.num_tuples_per_kernel_launch, line_status_values_per_container)));
+                stream_input_buffer_sets.flag_exceptions.emplace_back(
+                    cuda::memory::device::make_unique< flag_exception_t[] >(cuda_device, std::max<cardinality_t>(predicted_flags.max_exceptions_per_launch, 1)));
+            }
         }
         else {
             auto stream_input_buffer_set = input_buffer_set<cuda::memory::device::unique_ptr, is_not_compressed>{
@@ -451,9 +1179,79 @@ void allocate_non_input_resources(
     }
 }
 
-int main(int argc, char** argv) {
-    make_sure_we_are_on_cpu_core_0();
+// The most exceptions to the flags' prediction any one launch has to upload
+cardinality_t max_flag_exceptions_per_launch(
+    const predicted_flags_set&  predicted,
+    cardinality_t               cardinality,
+    cardinality_t               num_tuples_per_kernel_launch)
+{
+    cardinality_t max_exceptions { 0 };
+    for(cardinality_t first = 0, launch_start = 0; launch_start < cardinality; launch_start += num_tuples_per_kernel_launch) {
+        auto end = first;
+        while (end < predicted.num_exceptions and predicted.exceptions[end].row < launch_start + num_tuples_per_kernel_launch) { end++; }
+        max_exceptions = std::max(max_exceptions, end - first);
+        first = end;
+    }
+    return max_exceptions;
+}
+
+AggregateCube build_aggregate_cube(
+    const input_buffer_set<cuda::memory::host::unique_ptr, is_compressed>&  compressed,
+    cardinality_t                                                          cardinality)
+{
+    auto ship_dates = compressed.ship_date.get();
+    auto ship_date_range = std::minmax_element(ship_dates, ship_dates + cardinality);
+    std::vector<uint32_t> group_indices(num_potential_groups);
+    std::iota(group_indices.begin(), group_indices.end(), 0);
+    return AggregateCube::Build(cardinality, group_indices, *ship_date_range.first, *ship_date_range.second,
+        [&](size_t i) {
+            auto return_flag = get_bit_resolution_element<log_return_flag_bits, cardinality_t>(
+                compressed.return_flag[i / return_flag_values_per_container], i % return_flag_values_per_container);
+            auto line_status = get_bit_resolution_element<log_line_status_bits, cardinality_t>(
+                compressed.line_status[i / line_status_values_per_container], i % line_status_values_per_container);
+            return AggregateCube::Row {
+                ship_dates[i],
+                (return_flag << line_status_bits) + line_status,
+                compressed.quantity[i],
+                compressed.extended_price[i],
+                compressed.discount[i],
+                compressed.tax[i]
+            };
+        });
+}
 
+void get_aggregates_from_cube(
+    const AggregateCube&  cube,
+    host_aggregates_t&    aggregates_on_host)
+{
+    for(int group = 0; group < num_potential_groups; group++) {
+        auto cell = cube.Range(cube.first_day, compressed_threshold_ship_date, group);
+        aggregates_on_host.sum_quantity[group]         = cell.sum_quantity;
+        aggregates_on_host.sum_base_price[group]       = cell.sum_base_price;
+        aggregates_on_host.sum_discounted_price[group] = cell.sum_disc_price;
+        aggregates_on_host.sum_charge[group]           = cell.sum_charge;
+        aggregates_on_host.sum_discount[group]         = cell.sum_disc;
+        aggregates_on_host.record_count[group]         = cell.count;
+    }
+}
+
+// Upper bounds, in the compressed representation, of the months in which the ship dates fall
+std::vector<compressed::ship_date_t> month_ends_for_compressed_ship_dates(
+    const compressed::ship_date_t*  __restrict__  compressed_ship_date,
+    cardinality_t                                 cardinality)
+{
+    auto max_ship_date = *std::max_element(compressed_ship_date, compressed_ship_date + cardinality);
+    std::vector<compressed::ship_date_t> month_ends;
+    for(int year = 1992; month_ends.empty() or month_ends.back() < max_ship_date; year++) {
+        for(int month = 1; month <= 12; month++) {
+            monetdb::date_t first_day_of_next_month(month == 12 ? year + 1 : year, month % 12 + 1, 1);
+            month_ends.push_back(first_day_of_next_month.dte_val - 1 - ship_date_frame_of_reference);
+        }
+    }
+    return month_ends;
+}
+
+int main(int argc, char** argv) {
     auto params = parse_command_line(argc, argv);
     morsel_size = params.num_tuples_per_kernel_launch;
     cardinality_t cardinality;
@@ -462,58 +1260,102 @@ int main(int argc, char** argv) {
         // Note: lineitem should really not need this cap, it should just adjust
         // allocated space as the need arises (and start with an estimate based on
         // the file size
-    input_buffer_set<plugged_unique_ptr, is_not_compressed> uncompressed_outside_li;
     input_buffer_set<plain_ptr, is_not_compressed> uncompressed;
-        // If we parse, we have to go through an "lineitem" object which holds its
-        // own pointers, while we need this class, which is the same template for
-        // the compressed as uncompressed case. For this reason we have these two
-        // objects, using the first, moving it into li, then using the second as
-        // a sort of a facade for li.
+        // A facade for li's columns (see load_columns())
 
     input_buffer_set<cuda::memory::host::unique_ptr, is_compressed> compressed;
-        // Compressed columns are handled entirely independently of lineitem objects,
-        // so we don't need the two input_buffer_set objects
+        // Compressed columns are handled entirely independently of lineitem objects
+    predicted_flags_set predicted_flags;
+        // If the data fits it, this replaces compressed's flag containers (see load_columns())
 
-    auto columns_to_process_are_cached = columns_are_cached(params, params.apply_compression);
+    borrowed_buffers borrowed;
+        // Must come after li, compressed and predicted_flags - see borrowed_buffers
 
-    if (columns_to_process_are_cached) {
-        if (params.apply_compression) {
-            cardinality = load_cached_columns(params, compressed);
-            set_lineitem_cardinalities(li, cardinality);
-        }
-        else {
-            cardinality = load_cached_columns(params, uncompressed_outside_li);
-            move_buffers_into_lineitem_object(uncompressed_outside_li, li, cardinality);
-            uncompressed = get_buffers_inside(li);
-        }
+    if (params.shared_columns == "remove") {
+        auto removed = shared_column_store::remove(shared_columns_name(params));
+        cout << (removed ? "Removed the" : "There are no") << " shared columns " << shared_columns_name(params) << endl;
+        return EXIT_SUCCESS;
+    }
+    bool attached = (params.shared_columns == "attach") and
+        attach_shared_columns(params, li, uncompressed, compressed, predicted_flags, cardinality, borrowed);
+    if (not attached) {
+        cardinality = load_columns(params, params.shared_columns == "publish", li, uncompressed, compressed, predicted_flags, borrowed);
     }
-    else {
-        if (columns_are_cached(params, is_not_compressed)) {
-            cardinality = load_cached_columns(params, uncompressed_outside_li);
-            move_buffers_into_lineitem_object(uncompressed_outside_li, li, cardinality);
-            uncompressed = get_buffers_inside(li);
-        }
-        else {
-            cardinality = parse_table_file_into_columns(params, li);
-            uncompressed = get_buffers_inside(li);
-            write_columns_to_cache(params, uncompressed, cardinality);
-                // We write the uncompressed columns to cache files
-                // even if our interest is in the compressed ones
-        }
 
-        if (params.apply_compression) {
-            compressed = compress_columns(uncompressed, cardinality);
-            write_columns_to_cache(params, compressed, cardinality);
+    if (not params.arrow_output_file.empty()) {
+        write_columns_to_arrow_file(params.arrow_output_file, uncompressed, cardinality);
+    }
+
+    if (params.shared_columns == "publish") {
+        publish_shared_columns(params, li, compressed, predicted_flags, cardinality);
+        return EXIT_SUCCESS;
+    }
+
+    // The cube is cached along with the compressed columns, but (re)built if it's missing or stale
+    AggregateCube aggregate_cube;
+    bool use_aggregate_cube { false };
+    if (params.use_aggregate_cube) {
+        auto cube_file_path =
+            filesystem::path(defaults::tpch_data_subdirectory) / std::to_string(params.scale_factor) / "compressed_aggregate_cube.bin";
+        // Of the compressed columns, of the source data and representation the shared columns' version identifies
+        auto cube_data_version = shared_columns_data_version(params);
+        use_aggregate_cube =
+            AggregateCube::Read(cube_file_path.string(), cube_data_version, aggregate_cube) and
+            aggregate_cube.cardinality == cardinality;
+        if (not use_aggregate_cube) {
+            expand_predicted_flags(predicted_flags, compressed, cardinality);
+            cout << "Building the aggregate cube... " << flush;
+            aggregate_cube = build_aggregate_cube(compressed, cardinality);
+            use_aggregate_cube = true;
+            cout << "done." << endl;
+            try {
+                aggregate_cube.Write(cube_file_path.string(), cube_data_version);
+            } catch(std::exception& e) {
+                cerr << "Failed caching the aggregate cube: " << e.what() << endl;
+            }
         }
     }
 
     if (params.use_filter_pushdown) {
         assert(params.apply_compression);
+        // Its launches leave the ship dates on the host, so they upload the flag containers rather than the prediction
+        expand_predicted_flags(predicted_flags, compressed, cardinality);
         compressed.precomputed_filter =
             cuda::memory::host::make_unique< bit_container_t[] >(div_rounding_up(cardinality, bits_per_container));
     }
 
+    std::unique_ptr<bit_sliced_column<compressed::ship_date_t>> bit_sliced_ship_date;
+    if (params.use_bit_sliced_filter) {
+        bit_sliced_ship_date = std::make_unique<bit_sliced_column<compressed::ship_date_t>>(compressed.ship_date.get(), cardinality);
+        compr_shipdate_bit_sliced = bit_sliced_ship_date.get();
+    }
+
+    std::unique_ptr<range_encoded_bitmap_index<compressed::ship_date_t, bit_container_t>> ship_date_month_index;
+    if (params.use_bitmap_index) {
+        ship_date_month_index = std::make_unique<range_encoded_bitmap_index<compressed::ship_date_t, bit_container_t>>(
+            compressed.ship_date.get(), cardinality,
+            month_ends_for_compressed_ship_dates(compressed.ship_date.get(), cardinality),
+            params.compress_bitmap_index);
+        compr_shipdate_month_index = ship_date_month_index.get();
+    }
+
+    if (params.apply_compression and predicted_flags.fits) {
+        predicted_flags.max_exceptions_per_launch =
+            max_flag_exceptions_per_launch(predicted_flags, cardinality, params.num_tuples_per_kernel_launch);
+        cout << "The flags are predicted from the ship dates, with " << predicted_flags.num_exceptions << " exceptions ("
+             << 100.0 * predicted_flags.num_exceptions / cardinality << "% of the rows)." << endl;
+    }
+
+    // Loading is over, and with it the use of all CPUs by this thread's children; from here on it
+    // feeds the GPU, from a core which the CPU's co-processing workers keep clear of
+    if (not Placement::PinFeeder()) {
+        cerr << "Could not pin the GPU feeder thread to its CPU" << endl;
+    }
     cpu_coprocessor = (params.use_coprocessing or params.use_filter_pushdown) ?  new CoProc(li, true) : nullptr;
+    if (cpu_coprocessor) {
+        cout << "CPU co-processing placement: " << cpu_coprocessor->describePlacement() << endl;
+        cout << "CPU compact columns: " << ComprData::Describe() << endl;
+    }
 
     // We don't need li beyond this point. Actually, we should need it at all except dfor parsing perhaps
 
@@ -550,7 +1392,8 @@ int main(int argc, char** argv) {
         cardinality,
         aggregates_on_device,
         aggregates_on_host,
-        stream_input_buffer_sets);
+        stream_input_buffer_sets,
+        predicted_flags);
 
     std::ofstream results_file;
     results_file.open("results.csv", std::ios::out);
@@ -562,15 +1405,23 @@ int main(int argc, char** argv) {
        << "Time: " << timestamp() << " | "
        << "Hostname: " << host_name() << " | "
        << "Parameters: " << params;
+    if (cpu_coprocessor) {
+        ss << " | CPU placement: " << cpu_coprocessor->describePlacement();
+    }
     cuda::profiling::mark::point(ss.str());
 
     for(int run_index = 0; run_index < params.num_query_execution_runs; run_index++) {
         cout << "Executing TPC-H Query 1, run " << run_index + 1 << " of " << params.num_query_execution_runs << "... " << flush;
         auto start = timer::now();
-        execute_query_1_once(
-            params, cuda_device, run_index, cardinality, streams,
-            aggregates_on_host, aggregates_on_device, stream_input_buffer_sets,
-            uncompressed, compressed);
+        if (use_aggregate_cube) {
+            get_aggregates_from_cube(aggregate_cube, aggregates_on_host);
+        }
+        else {
+            execute_query_1_once(
+                params, cuda_device, run_index, cardinality, streams,
+                aggregates_on_host, aggregates_on_device, stream_input_buffer_sets,
+                uncompressed, compressed, predicted_flags);
+        }
 
         auto end = timer::now();
 
@@ -4,6 +4,19 @@
 #include <cassert>
 #include <tuple>
 #include <ctime>
+#include <boost/optional.hpp>
+
+/* A field which may be empty, i.e. NULL */
+template<typename T>
+struct Nullable {
+	boost::optional<T> val;
+
+	Nullable(const char* v, int64_t len) {
+		if (len > 0) {
+			val.emplace(v, len);
+		}
+	}
+};
 
 template<typename ...Types>
 class TableReader {
@@ -100,18 +113,28 @@ void
 lineitem::FromFile(const std::string& file)
 {
 	const clock_t begin = clock();
-	TableReader<SkipCol, SkipCol, SkipCol, SkipCol, monetdb::decimal64_t, monetdb::decimal64_t, monetdb::decimal64_t, monetdb::decimal64_t, Char, Char, monetdb::date_t> reader;
+	TableReader<SkipCol, SkipCol, SkipCol, SkipCol, monetdb::decimal64_t, Nullable<monetdb::decimal64_t>, monetdb::decimal64_t, monetdb::decimal64_t, Char, Char, Nullable<monetdb::date_t>> reader;
 	reader.DoFile(file, [&] (auto t) {
 		assert(std::get<8>(t).chr_val);
 		assert(std::get<9>(t).chr_val);
 
 		l_quantity.Push(std::get<4>(t).dec_val);
-		l_extendedprice.Push(std::get<5>(t).dec_val);
+		const auto& extendedprice = std::get<5>(t).val;
+		if (extendedprice) {
+			l_extendedprice.Push(extendedprice->dec_val);
+		} else {
+			l_extendedprice.PushNull(0);
+		}
 		l_discount.Push(std::get<6>(t).dec_val);
 		l_tax.Push(std::get<7>(t).dec_val);
 		l_returnflag.Push(std::get<8>(t).chr_val);
 		l_linestatus.Push(std::get<9>(t).chr_val);
-		l_shipdate.Push(std::get<10>(t).dte_val);
+		const auto& shipdate = std::get<10>(t).val;
+		if (shipdate) {
+			l_shipdate.Push(shipdate->dte_val);
+		} else {
+			l_shipdate.PushNull(monetdb::date_t::date_nil);
+		}
 
 	});
 
@@ -6,6 +6,8 @@
 #include <cassert>
 #include <cmath>
 #include <limits>
+#include <vector>
+#include <algorithm>
 #include "buffer.hpp"
 #include "date.hpp"
 #include "decimal.hpp" // Not actually used in this header, but necessary
@@ -47,6 +49,10 @@ struct Column : Buffer<T> {
 
 	detail::MinMax<T> minmax;
 
+	/* Validity of the values: bit i % 32 of container i / 32 is set iff value i is not
+	 * NULL (the bit container format of the filters). Empty as long as there are no NULLs. */
+	std::vector<uint32_t> validity;
+
 	Column(size_t init_cap)
 	 : Buffer<T>(init_cap), cardinality(0) {
 	}
@@ -61,9 +67,44 @@ struct Column : Buffer<T> {
 		}
 		assert(HasSpaceFor(1));
 		auto data = Buffer<T>::get();
+		if (!validity.empty()) {
+			SetValid(cardinality, true);
+		}
 		data[cardinality++] = val;
 		minmax(val);
 	}
+
+	/* Appends a NULL, stored as @p placeholder - which doesn't count towards minmax */
+	void PushNull(const T& placeholder) {
+		if (!HasSpaceFor(1)) {
+			Buffer<T>::resizeByFactor(1.5);
+		}
+		assert(HasSpaceFor(1));
+		if (validity.empty()) {
+			validity.assign(cardinality / 32 + 1, 0);
+			std::fill(validity.begin(), validity.begin() + cardinality / 32, ~0u);
+			validity[cardinality / 32] = (1u << (cardinality % 32)) - 1;
+		}
+		SetValid(cardinality, false);
+		Buffer<T>::get()[cardinality++] = placeholder;
+	}
+
+	/* nullptr if there are no NULLs */
+	const uint32_t* Validity() const {
+		return validity.empty() ? nullptr : validity.data();
+	}
+
+	bool IsValid(size_t i) const {
+		return validity.empty() || ((validity[i / 32] >> (i % 32)) & 1);
+	}
+
+private:
+	void SetValid(size_t i, bool valid) {
+		if (validity.size() <= i / 32) {
+			validity.resize(i / 32 + 1, 0);
+		}
+		validity[i / 32] = (validity[i / 32] & ~(1u << (i % 32))) | ((uint32_t)valid << (i % 32));
+	}
 };
 
 // starting from 1
@@ -71,10 +112,10 @@ struct lineitem {
 	Column<char> l_returnflag; // 9
 	Column<char> l_linestatus; // 10
 	Column<int64_t> l_quantity; // 5, DECIMAL(15,2)
-	Column<int64_t> l_extendedprice; // 6, DECIMAL(15,2)
+	Column<int64_t> l_extendedprice; // 6, DECIMAL(15,2), nullable
 	Column<int64_t> l_discount; // 7, DECIMAL(15,2)
 	Column<int64_t> l_tax; // 8, DECIMAL(15,2)
-	Column<int> l_shipdate; // 11
+	Column<int> l_shipdate; // 11, nullable (NULLs stored as date_nil)
 public:
 	lineitem(size_t init_cap)
 	 : l_returnflag(init_cap), l_linestatus(init_cap), l_quantity(init_cap), l_extendedprice(init_cap), l_discount(init_cap), l_tax(init_cap), l_shipdate(init_cap) {
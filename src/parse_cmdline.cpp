@@ -4,6 +4,7 @@
 #include "util/helper.hpp"
 #include "constants.hpp"
 #include "cpu/common.hpp"
+#include "cpu/vectorized.hpp"
 
 #include <boost/program_options.hpp>
 
@@ -42,9 +43,53 @@ q1_params_t make_params(const boost::program_options::variables_map& vm)
 
     params.use_coprocessing     = (vm.find("use-coprocessing"   ) != vm.end());
     params.apply_compression    = (vm.find("apply-compression"  ) != vm.end());
+    params.verify_compression   = (vm.find("verify-compression" ) != vm.end());
     params.use_filter_pushdown  = (vm.find("use-filter-pushdown") != vm.end());
+    params.use_bit_sliced_filter = (vm.find("use-bit-sliced-filter") != vm.end());
+    params.use_bitmap_index      = (vm.find("use-bitmap-index"     ) != vm.end());
+    params.compress_bitmap_index = (vm.find("compress-bitmap-index") != vm.end());
+    params.use_aggregate_cube    = (vm.find("use-aggregate-cube"   ) != vm.end());
     params.should_print_results = (vm.find("print-results"      ) != vm.end());
 
+    update_with(params.arrow_input_file, "arrow-file", vm);
+    update_with(params.arrow_output_file, "write-arrow-file", vm);
+    update_with(params.shared_columns, "shared-columns", vm);
+    if (not params.shared_columns.empty() and params.shared_columns != "publish" and
+        params.shared_columns != "attach" and params.shared_columns != "remove")
+    {
+        cerr << "Invalid shared columns action \"" + params.shared_columns + "\"" << endl;
+        exit(EXIT_FAILURE);
+    }
+    update_with(params.cpu_isa, "cpu-isa", vm);
+    if (not params.cpu_isa.empty()) {
+        PrimitivesIsa isa;
+        if (not Primitives::isa_by_name(params.cpu_isa, isa)) {
+            cerr << "No instruction set named \"" + params.cpu_isa + "\" is available" << endl;
+            exit(EXIT_FAILURE);
+        }
+        if (not Primitives::use_isa(isa)) {
+            cerr << "This CPU doesn't support the " + params.cpu_isa + " instruction set" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    update_with(params.cpu_placement, "cpu-placement", vm);
+    {
+        PinPolicy policy;
+        if (not Placement::policy_by_name(params.cpu_placement, policy)) {
+            cerr << "No CPU placement policy named \"" + params.cpu_placement + "\" is available" << endl;
+            exit(EXIT_FAILURE);
+        }
+        Placement::default_policy = policy;
+    }
+    update_with(params.cpu_data_placement, "cpu-data-placement", vm);
+    {
+        DataPlacement placement;
+        if (not ComprData::placement_by_name(params.cpu_data_placement, placement)) {
+            cerr << "No CPU data placement policy named \"" + params.cpu_data_placement + "\" is available" << endl;
+            exit(EXIT_FAILURE);
+        }
+        ComprData::placement = placement;
+    }
     update_with(params.scale_factor, "scale-factor", vm);
     if (params.scale_factor - 0 < 0.001) {
         cerr << "Invalid scale factor " + std::to_string(params.scale_factor) << endl;
@@ -85,6 +130,30 @@ q1_params_t make_params(const boost::program_options::variables_map& vm)
                 "invoke with \"--apply-compression\"." << endl;
         exit(EXIT_FAILURE);
     }
+    if (params.use_bit_sliced_filter and not params.use_filter_pushdown) {
+        cerr << "A bit-sliced ship date column is only used for filter precomputation; "
+                "invoke with \"--use-filter-pushdown\"." << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (params.use_bitmap_index and not params.use_filter_pushdown) {
+        cerr << "The ship date bitmap index is only used for filter precomputation; "
+                "invoke with \"--use-filter-pushdown\"." << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (params.compress_bitmap_index and not params.use_bitmap_index) {
+        cerr << "Compressing the ship date bitmap index requires \"--use-bitmap-index\"." << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (params.use_aggregate_cube and not params.apply_compression) {
+        cerr << "The aggregate cube is built over the compressed columns; "
+                "invoke with \"--apply-compression\"." << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (params.use_aggregate_cube and (params.use_coprocessing or params.use_filter_pushdown)) {
+        cerr << "The aggregate cube replaces scanning altogether; it can't be combined with "
+                "co-processing or filter pushdown." << endl;
+        exit(EXIT_FAILURE);
+    }
     auto user_set_num_threads_per_block = (vm.find("threads-per-block") != vm.end());
     if (fixed_threads_per_block.find(params.kernel_variant) != fixed_threads_per_block.end()) {
         auto required_num_thread_per_block = fixed_threads_per_block.at(params.kernel_variant);
@@ -140,7 +209,18 @@ q1_params_t parse_command_line(int argc, char** argv)
         ("list-devices",                                                                                                "List CUDA devices on this system")
         ("use-coprocessing",                                                                                            "Use the both a CPU socket and a GPU to process Q1")
         ("apply-compression",                                                                                           "Use compressed input columns")
+        ("verify-compression",                                                                                          "Check that the columns decompress back into the original ones, when compressing them")
         ("use-filter-pushdown",                                                                                         "Precompute the Q1 WHERE clause on the CPU")
+        ("use-bit-sliced-filter",                                                                                       "Precompute the Q1 WHERE clause using a bit-sliced copy of the ship date column")
+        ("use-bitmap-index",                                                                                            "Precompute the Q1 WHERE clause using a range-encoded monthly bitmap index on the ship date")
+        ("compress-bitmap-index",                                                                                       "Run-length-encode the ship date bitmap index")
+        ("use-aggregate-cube",                                                                                          "Answer the query from a cached prefix-sum aggregate cube over the ship dates")
+        ("arrow-file",               po::value<string       >(),                                                        "Read the lineitem columns from this Arrow IPC file (using its buffers in place where possible)")
+        ("write-arrow-file",         po::value<string       >(),                                                        "Write the uncompressed lineitem columns to this Arrow IPC file")
+        ("shared-columns",           po::value<string       >(),                                                        "Share loaded columns between processes: publish (load, place in shared memory and exit), attach (use the published columns if available) or remove")
+        ("cpu-isa",                  po::value<string       >(),                                                        "Instruction set for the CPU's vectorized primitives: sse4.2, avx2 or avx512 (default: the best the CPU supports)")
+        ("cpu-placement",            po::value<string       >()->default_value("cores"),                                "Where the CPU's co-processing workers run: cores (one per physical core), smt (one per hardware thread), socket (one per core of one socket) or none (unpinned); a core is kept free for the GPU feeder")
+        ("cpu-data-placement",       po::value<string       >()->default_value("replicate"),                            "How the CPU's compact columns are laid out over the NUMA nodes: replicate (a copy per node), interleave (one copy, pages spread over the nodes) or partition (one copy, a slice per node, scanned by that node's workers)")
         ("cpu-fraction",             po::value<double       >()->default_value(defaults::cpu_coprocessing_fraction),    "Fraction of data to be processed by the CPU, when co-processing")
         ("hash-table-placement",     po::value<string       >()->default_value(defaults::kernel_variant),               kernel_variant_names_argument.c_str())
         ("tuples-per-thread",        po::value<cardinality_t>()->default_value(defaults::num_tuples_per_thread),        "Process this many LINEITEM tuples with each GPU kernel thread")
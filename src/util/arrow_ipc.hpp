@@ -0,0 +1,936 @@
+/**
+ * @file arrow_ipc.hpp
+ *
+ * A minimal, dependency-free reader and writer for Apache Arrow IPC files
+ * ("Feather V2"), covering what we need for getting table columns in and out.
+ *
+ * The reader memory-maps the file and exposes each top-level field's record batch
+ * buffers in place, so that a column whose physical type matches ours can be used
+ * without copying anything; other columns can be decoded value-by-value (see
+ * file_reader::for_each_value). Compressed bodies, big-endian files and view types
+ * are not supported. The writer emits a single record batch of non-nullable,
+ * fixed-width columns.
+ *
+ * The IPC metadata is FlatBuffers-encoded; rather than depend on the FlatBuffers
+ * library and Arrow's generated schema code, we access the few tables we need by
+ * field slot, following the Arrow format's Schema.fbs, Message.fbs and File.fbs.
+ */
+#pragma once
+#ifndef ARROW_IPC_HPP_
+#define ARROW_IPC_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <initializer_list>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace arrow_ipc {
+
+enum class type_id : uint8_t {
+    none              = 0,
+    null              = 1,
+    int_              = 2,
+    floating_point    = 3,
+    binary            = 4,
+    utf8              = 5,
+    bool_             = 6,
+    decimal           = 7,
+    date              = 8,
+    time              = 9,
+    timestamp         = 10,
+    interval          = 11,
+    list              = 12,
+    struct_           = 13,
+    union_            = 14,
+    fixed_size_binary = 15,
+    fixed_size_list   = 16,
+    map               = 17,
+    duration          = 18,
+    large_binary      = 19,
+    large_utf8        = 20,
+    large_list        = 21,
+    run_end_encoded   = 22,
+};
+
+enum class date_unit : int16_t { day = 0, millisecond = 1 };
+
+struct field_type {
+    type_id   id          { type_id::none };
+    int       bit_width   { 0 };     // Int, Decimal
+    bool      is_signed   { false }; // Int
+    int       precision   { 0 };     // Decimal
+    int       scale       { 0 };     // Decimal
+    date_unit unit        { date_unit::millisecond }; // Date
+    int       byte_width  { 0 };     // FixedSizeBinary
+
+    static field_type integer(int bit_width, bool is_signed)
+    {
+        field_type t; t.id = type_id::int_; t.bit_width = bit_width; t.is_signed = is_signed; return t;
+    }
+    static field_type decimal(int precision, int scale, int bit_width)
+    {
+        field_type t; t.id = type_id::decimal; t.precision = precision; t.scale = scale; t.bit_width = bit_width; return t;
+    }
+    static field_type date(date_unit unit)
+    {
+        field_type t; t.id = type_id::date; t.unit = unit; return t;
+    }
+    static field_type fixed_size_binary(int byte_width)
+    {
+        field_type t; t.id = type_id::fixed_size_binary; t.byte_width = byte_width; return t;
+    }
+
+    /**
+     * Width in bytes of each value in the data buffer, or 0 for types which
+     * are not simple fixed-width ones
+     */
+    size_t value_width() const noexcept
+    {
+        switch(id) {
+        case type_id::int_:              return bit_width / 8;
+        case type_id::decimal:           return bit_width / 8;
+        case type_id::date:              return unit == date_unit::day ? 4 : 8;
+        case type_id::fixed_size_binary: return byte_width;
+        default:                         return 0;
+        }
+    }
+};
+
+struct field {
+    std::string name;
+    bool        nullable           { true };
+    bool        dictionary_encoded { false };
+    field_type  type;
+};
+
+/**
+ * One record batch's worth of a top-level field's data, in place
+ */
+struct array_chunk {
+    size_t          length     { 0 };
+    size_t          null_count { 0 };
+    const uint8_t*  validity   { nullptr }; // may be null if there are no nulls
+    const uint8_t*  offsets    { nullptr }; // variable-width types only
+    const uint8_t*  data       { nullptr };
+    size_t          data_size  { 0 };
+};
+
+namespace detail {
+
+[[noreturn]] inline void fail(const std::string& what)
+{
+    throw std::runtime_error("Invalid or unsupported Arrow IPC file: " + what);
+}
+
+template <typename T>
+T read(const uint8_t* buffer, size_t size, size_t position)
+{
+    if (position > size or size - position < sizeof(T)) { fail("metadata access out of bounds"); }
+    T value;
+    std::memcpy(&value, buffer + position, sizeof(T));
+    return value;
+}
+
+struct flatbuffer_vector {
+    size_t position { 0 }; // of the first element
+    size_t length   { 0 };
+};
+
+/**
+ * Read access to a FlatBuffers table, by field slot, with bounds checking
+ */
+class flatbuffer_table {
+public:
+    flatbuffer_table(const uint8_t* buffer, size_t size, size_t position)
+        : buffer_(buffer), size_(size), position_(position)
+    {
+        auto vtable = (int64_t) position - read<int32_t>(buffer, size, position);
+        if (vtable < 0) { fail("bad vtable offset"); }
+        vtable_ = vtable;
+        vtable_size_ = read<uint16_t>(buffer, size, vtable_);
+    }
+
+    static flatbuffer_table root(const uint8_t* buffer, size_t size)
+    {
+        return { buffer, size, read<uint32_t>(buffer, size, 0) };
+    }
+
+    bool has(unsigned slot) const { return field_offset(slot) != 0; }
+
+    template <typename T>
+    T scalar(unsigned slot, T default_value) const
+    {
+        auto offset = field_offset(slot);
+        return offset == 0 ? default_value : read<T>(buffer_, size_, position_ + offset);
+    }
+
+    flatbuffer_table table(unsigned slot) const
+    {
+        return { buffer_, size_, referenced(slot) };
+    }
+
+    std::string string(unsigned slot) const
+    {
+        if (not has(slot)) { return {}; }
+        auto position = referenced(slot);
+        auto length = read<uint32_t>(buffer_, size_, position);
+        if (size_ - position - sizeof(uint32_t) < length) { fail("string out of bounds"); }
+        return { reinterpret_cast<const char*>(buffer_) + position + sizeof(uint32_t), length };
+    }
+
+    flatbuffer_vector vector(unsigned slot, size_t element_size) const
+    {
+        if (not has(slot)) { return {}; }
+        auto position = referenced(slot);
+        flatbuffer_vector v { position + sizeof(uint32_t), read<uint32_t>(buffer_, size_, position) };
+        if ((size_ - v.position) / element_size < v.length) { fail("vector out of bounds"); }
+        return v;
+    }
+
+    flatbuffer_table table_in_vector(const flatbuffer_vector& v, size_t index) const
+    {
+        auto element_position = v.position + index * sizeof(uint32_t);
+        return { buffer_, size_, element_position + read<uint32_t>(buffer_, size_, element_position) };
+    }
+
+    template <typename T>
+    T struct_member_in_vector(const flatbuffer_vector& v, size_t struct_size, size_t index, size_t member_offset) const
+    {
+        return read<T>(buffer_, size_, v.position + index * struct_size + member_offset);
+    }
+
+private:
+    uint16_t field_offset(unsigned slot) const
+    {
+        auto entry = 2 * sizeof(uint16_t) + slot * sizeof(uint16_t);
+        return entry + sizeof(uint16_t) > vtable_size_ ? 0 : read<uint16_t>(buffer_, size_, vtable_ + entry);
+    }
+
+    size_t referenced(unsigned slot) const
+    {
+        auto offset = field_offset(slot);
+        if (offset == 0) { fail("missing required metadata field"); }
+        auto field_position = position_ + offset;
+        return field_position + read<uint32_t>(buffer_, size_, field_position);
+    }
+
+    const uint8_t*  buffer_;
+    size_t          size_;
+    size_t          position_;
+    size_t          vtable_;
+    uint16_t        vtable_size_;
+};
+
+/**
+ * Builds a FlatBuffers buffer front-to-back: a table is laid out before the objects
+ * it references, whose (forward) offsets are patched in once they've been added.
+ */
+class flatbuffer_builder {
+public:
+    struct scalar_field {
+        unsigned  slot;
+        unsigned  size; // 1, 2, 4 or 8 bytes; or 0 for a reference to be set later
+        uint64_t  value;
+    };
+
+    enum : unsigned { reference = 0, max_slots = 8 };
+
+    flatbuffer_builder() : buffer_(sizeof(uint32_t), 0) { }
+
+    /**
+     * @return the table's position, and the positions of its reference fields by slot
+     */
+    std::pair<size_t, std::vector<size_t>> add_table(std::initializer_list<scalar_field> fields)
+    {
+        unsigned num_slots { 0 };
+        for(const auto& f : fields) {
+            if (f.slot >= max_slots) { fail("field slot out of range"); }
+            num_slots = std::max(num_slots, f.slot + 1);
+        }
+        std::vector<uint16_t> vtable(2 + num_slots, 0);
+
+        // Fields are laid out widest first, right after the table's 4-byte vtable offset,
+        // with the table starting at 4 mod 8 so that 8-byte fields are aligned
+        std::vector<size_t> field_positions(max_slots, 0);
+        uint16_t table_size = sizeof(int32_t);
+        for(unsigned width : { 8u, 4u, 2u, 1u }) {
+            for(const auto& f : fields) {
+                auto field_width = f.size == reference ? sizeof(uint32_t) : f.size;
+                if (field_width != width) { continue; }
+                vtable[2 + f.slot] = table_size;
+                table_size += width;
+            }
+        }
+        table_size = (table_size + 3) / 4 * 4;
+        vtable[0] = vtable.size() * sizeof(uint16_t);
+        vtable[1] = table_size;
+
+        align(2);
+        auto vtable_position = buffer_.size();
+        append(vtable.data(), vtable[0]);
+        while (buffer_.size() % 8 != 4) { buffer_.push_back(0); }
+        auto table_position = buffer_.size();
+        buffer_.resize(table_position + table_size, 0);
+        put<int32_t>(table_position, (int32_t) (table_position - vtable_position));
+        for(const auto& f : fields) {
+            auto position = table_position + vtable[2 + f.slot];
+            switch(f.size) {
+            case reference: field_positions[f.slot] = position; break;
+            case 1: put<uint8_t> (position, (uint8_t)  f.value); break;
+            case 2: put<uint16_t>(position, (uint16_t) f.value); break;
+            case 4: put<uint32_t>(position, (uint32_t) f.value); break;
+            case 8: put<uint64_t>(position, (uint64_t) f.value); break;
+            default: fail("bad field size");
+            }
+        }
+        return { table_position, field_positions };
+    }
+
+    size_t add_string(const std::string& s)
+    {
+        align(4);
+        auto position = buffer_.size();
+        auto length = (uint32_t) s.size();
+        append(&length, sizeof(length));
+        append(s.data(), s.size());
+        buffer_.push_back(0);
+        return position;
+    }
+
+    /**
+     * A vector of inline structs, or of scalars
+     */
+    size_t add_vector(const void* elements, size_t length, size_t element_size, size_t alignment)
+    {
+        align(4);
+        while ((buffer_.size() + sizeof(uint32_t)) % alignment != 0) { buffer_.push_back(0); }
+        auto position = buffer_.size();
+        auto length_ = (uint32_t) length;
+        append(&length_, sizeof(length_));
+        append(elements, length * element_size);
+        return position;
+    }
+
+    /**
+     * A vector of references, each to be set with set_reference_in_vector()
+     */
+    size_t add_reference_vector(size_t length)
+    {
+        align(4);
+        auto position = buffer_.size();
+        auto length_ = (uint32_t) length;
+        append(&length_, sizeof(length_));
+        buffer_.resize(buffer_.size() + length * sizeof(uint32_t), 0);
+        return position;
+    }
+
+    void set_reference(size_t field_position, size_t target)
+    {
+        put<uint32_t>(field_position, (uint32_t) (target - field_position));
+    }
+
+    void set_reference_in_vector(size_t vector_position, size_t index, size_t target)
+    {
+        set_reference(vector_position + sizeof(uint32_t) * (index + 1), target);
+    }
+
+    /**
+     * @return the finished buffer, padded to a multiple of 8 bytes
+     */
+    std::vector<uint8_t> finish(size_t root_table_position)
+    {
+        put<uint32_t>(0, (uint32_t) root_table_position);
+        align(8);
+        return std::move(buffer_);
+    }
+
+private:
+    void align(size_t alignment) { while (buffer_.size() % alignment != 0) { buffer_.push_back(0); } }
+
+    void append(const void* data, size_t size)
+    {
+        auto bytes = static_cast<const uint8_t*>(data);
+        buffer_.insert(buffer_.end(), bytes, bytes + size);
+    }
+
+    template <typename T>
+    void put(size_t position, T value) { std::memcpy(buffer_.data() + position, &value, sizeof(T)); }
+
+    std::vector<uint8_t> buffer_;
+};
+
+// Slots and constants of the Arrow format's FlatBuffers schemata
+enum : unsigned {
+    footer_schema = 1, footer_record_batches = 3,
+    schema_endianness = 0, schema_fields = 1,
+    field_name = 0, field_nullable = 1, field_type_type = 2, field_type_value = 3, field_dictionary = 4, field_children = 5,
+    int_bit_width = 0, int_is_signed = 1,
+    decimal_precision = 0, decimal_scale = 1, decimal_bit_width = 2,
+    date_unit_slot = 0,
+    fixed_size_binary_byte_width = 0,
+    message_version = 0, message_header_type = 1, message_header = 2, message_body_length = 3,
+    record_batch_length = 0, record_batch_nodes = 1, record_batch_buffers = 2, record_batch_compression = 3,
+};
+enum : uint8_t { message_header_schema = 1, message_header_record_batch = 3 };
+enum : int16_t { metadata_version_v5 = 4 };
+enum : size_t { block_size = 24, field_node_size = 16, buffer_descriptor_size = 16, body_alignment = 64 };
+constexpr const char magic[] = "ARROW1";
+enum : size_t { magic_length = sizeof(magic) - 1, padded_magic_length = 8 };
+
+} // namespace detail
+
+/**
+ * A read-only memory mapping of a whole file
+ */
+class mapped_file {
+public:
+    explicit mapped_file(const std::string& path)
+    {
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) { throw std::runtime_error("Failed opening file " + path + ": " + strerror(errno)); }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed obtaining the size of " + path + ": " + strerror(errno));
+        }
+        size_ = st.st_size;
+        if (size_ > 0) {
+            auto address = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Failed memory-mapping " + path + ": " + strerror(errno));
+            }
+            data_ = static_cast<const uint8_t*>(address);
+        }
+        ::close(fd);
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file(mapped_file&& other) noexcept : data_(other.data_), size_(other.size_) { other.data_ = nullptr; other.size_ = 0; }
+
+    ~mapped_file()
+    {
+        if (data_ != nullptr) { munmap(const_cast<uint8_t*>(data_), size_); }
+    }
+
+    const uint8_t* data() const noexcept { return data_; }
+    size_t size() const noexcept { return size_; }
+
+protected:
+    const uint8_t*  data_ { nullptr };
+    size_t          size_ { 0 };
+};
+
+/**
+ * Memory-maps an Arrow IPC file and validates its footer, schema and record batch
+ * metadata; the data pointers in the chunks it exposes remain valid for as long as
+ * the reader object is alive.
+ */
+class file_reader {
+public:
+    explicit file_reader(const std::string& path) : file_(path)
+    {
+        using namespace detail;
+        auto data = file_.data();
+        auto size = file_.size();
+        if (size < padded_magic_length + sizeof(int32_t) + magic_length or
+            std::memcmp(data, magic, magic_length) != 0 or
+            std::memcmp(data + size - magic_length, magic, magic_length) != 0)
+        {
+            fail("bad magic in " + path);
+        }
+        auto footer_length = read<int32_t>(data, size, size - magic_length - sizeof(int32_t));
+        if (footer_length <= 0 or (size_t) footer_length > size - padded_magic_length - sizeof(int32_t) - magic_length) {
+            fail("bad footer length");
+        }
+        auto footer_start = size - magic_length - sizeof(int32_t) - footer_length;
+        auto footer = flatbuffer_table::root(data + footer_start, footer_length);
+
+        auto schema = footer.table(footer_schema);
+        if (schema.scalar<int16_t>(schema_endianness, 0) != 0) { fail("big-endian files are not supported"); }
+        auto fields = schema.vector(schema_fields, sizeof(uint32_t));
+        std::vector<unsigned> num_buffers;
+        std::vector<unsigned> num_nodes;
+        for(size_t i = 0; i < fields.length; i++) {
+            auto f = schema.table_in_vector(fields, i);
+            fields_.push_back(parse_field(f));
+            num_buffers.push_back(0);
+            num_nodes.push_back(0);
+            count_buffers_and_nodes(f, num_buffers.back(), num_nodes.back());
+        }
+        chunks_.resize(fields_.size());
+
+        auto blocks = footer.vector(footer_record_batches, block_size);
+        for(size_t b = 0; b < blocks.length; b++) {
+            auto offset          = footer.struct_member_in_vector<int64_t>(blocks, block_size, b, 0);
+            auto metadata_length = footer.struct_member_in_vector<int32_t>(blocks, block_size, b, 8);
+            auto body_length     = footer.struct_member_in_vector<int64_t>(blocks, block_size, b, 16);
+            if (offset < 0 or metadata_length < 8 or body_length < 0 or
+                (size_t) offset > footer_start or footer_start - offset < (size_t) metadata_length + body_length)
+            {
+                fail("record batch block out of bounds");
+            }
+            add_record_batch(data + offset, metadata_length, data + offset + metadata_length, body_length, num_buffers, num_nodes);
+        }
+    }
+
+    const std::vector<field>& fields() const noexcept { return fields_; }
+    size_t num_rows() const noexcept { return num_rows_; }
+
+    /**
+     * @return the index of the top-level field with the given name, or -1 if there is none
+     */
+    int field_index(const std::string& name) const noexcept
+    {
+        for(size_t i = 0; i < fields_.size(); i++) {
+            if (fields_[i].name == name) { return i; }
+        }
+        return -1;
+    }
+
+    const std::vector<array_chunk>& chunks(size_t field_index) const { return chunks_.at(field_index); }
+
+    size_t null_count(size_t field_index) const
+    {
+        size_t total { 0 };
+        for(const auto& c : chunks(field_index)) { total += c.null_count; }
+        return total;
+    }
+
+    /**
+     * The values of a fixed-width field as a single in-place array - if they are
+     * stored contiguously as T's, i.e. in a single record batch, aligned and without nulls
+     *
+     * @return the array, or nullptr if the values cannot be used in place
+     */
+    template <typename T>
+    const T* contiguous_values(size_t field_index) const
+    {
+        const auto& f = fields_.at(field_index);
+        const auto& cs = chunks(field_index);
+        if (f.dictionary_encoded or f.type.value_width() != sizeof(T) or cs.size() != 1 or cs[0].null_count != 0 or
+            reinterpret_cast<uintptr_t>(cs[0].data) % alignof(T) != 0)
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<const T*>(cs[0].data);
+    }
+
+    /**
+     * Decodes the values of rows [first_row, first_row + num_rows) of a field, as
+     * integers, passing each to @p f along with its row index. Supported: Int, Date
+     * (as days), Decimal (as the unscaled integer, which must fit 64 bits) and
+     * single-byte values of FixedSizeBinary, Binary or Utf8 fields. Nulls are not
+     * supported.
+     */
+    template <typename F>
+    void for_each_value(size_t field_index, size_t first_row, size_t num_rows, F&& f) const
+    {
+        const auto& fld = fields_.at(field_index);
+        if (fld.dictionary_encoded) { detail::fail("dictionary-encoded field " + fld.name); }
+        size_t chunk_start { 0 };
+        auto end_row = first_row + num_rows;
+        for(const auto& c : chunks(field_index)) {
+            auto chunk_end = chunk_start + c.length;
+            if (chunk_end > first_row and chunk_start < end_row) {
+                if (c.null_count != 0) { detail::fail("field " + fld.name + " has nulls"); }
+                auto begin = std::max(first_row, chunk_start);
+                auto end = std::min(end_row, chunk_end);
+                decode(fld, c, begin - chunk_start, end - begin, [&](size_t i, int64_t value) { f(chunk_start + i, value); });
+            }
+            chunk_start = chunk_end;
+        }
+    }
+
+protected:
+    static field parse_field(const detail::flatbuffer_table& f)
+    {
+        using namespace detail;
+        field result;
+        result.name = f.string(field_name);
+        result.nullable = f.scalar<uint8_t>(field_nullable, 0);
+        result.dictionary_encoded = f.has(field_dictionary);
+        result.type.id = static_cast<type_id>(f.scalar<uint8_t>(field_type_type, 0));
+        if (not f.has(field_type_value)) { return result; }
+        auto t = f.table(field_type_value);
+        switch(result.type.id) {
+        case type_id::int_:
+            result.type.bit_width = t.scalar<int32_t>(int_bit_width, 0);
+            result.type.is_signed = t.scalar<uint8_t>(int_is_signed, 0);
+            break;
+        case type_id::decimal:
+            result.type.precision = t.scalar<int32_t>(decimal_precision, 0);
+            result.type.scale = t.scalar<int32_t>(decimal_scale, 0);
+            result.type.bit_width = t.scalar<int32_t>(decimal_bit_width, 128);
+            break;
+        case type_id::date:
+            result.type.unit = static_cast<date_unit>(t.scalar<int16_t>(date_unit_slot, (int16_t) date_unit::millisecond));
+            break;
+        case type_id::fixed_size_binary:
+            result.type.byte_width = t.scalar<int32_t>(fixed_size_binary_byte_width, 0);
+            break;
+        default:
+            break;
+        }
+        return result;
+    }
+
+    // The number of record batch buffers and field nodes which a field and its descendants take up
+    static void count_buffers_and_nodes(const detail::flatbuffer_table& f, unsigned& num_buffers, unsigned& num_nodes)
+    {
+        using namespace detail;
+        num_nodes++;
+        if (f.has(field_dictionary)) {
+            num_buffers += 2; // validity and indices
+            return;
+        }
+        switch(static_cast<type_id>(f.scalar<uint8_t>(field_type_type, 0))) {
+        case type_id::null:
+        case type_id::run_end_encoded:
+            break;
+        case type_id::struct_:
+        case type_id::fixed_size_list:
+            num_buffers += 1; break;
+        case type_id::binary:
+        case type_id::utf8:
+        case type_id::large_binary:
+        case type_id::large_utf8:
+            num_buffers += 3; break;
+        case type_id::union_:
+            fail("union fields are not supported");
+        case type_id::int_:
+        case type_id::floating_point:
+        case type_id::bool_:
+        case type_id::decimal:
+        case type_id::date:
+        case type_id::time:
+        case type_id::timestamp:
+        case type_id::interval:
+        case type_id::list:
+        case type_id::fixed_size_binary:
+        case type_id::map:
+        case type_id::duration:
+        case type_id::large_list:
+            num_buffers += 2; break;
+        default:
+            fail("unsupported field type " + std::to_string(f.scalar<uint8_t>(field_type_type, 0)));
+        }
+        auto children = f.vector(field_children, sizeof(uint32_t));
+        for(size_t i = 0; i < children.length; i++) {
+            count_buffers_and_nodes(f.table_in_vector(children, i), num_buffers, num_nodes);
+        }
+    }
+
+    void add_record_batch(
+        const uint8_t*                message,
+        size_t                        block_metadata_length,
+        const uint8_t*                body,
+        size_t                        body_length,
+        const std::vector<unsigned>&  num_buffers,
+        const std::vector<unsigned>&  num_nodes)
+    {
+        using namespace detail;
+        // The encapsulated message starts with a continuation marker (except in pre-1.0 files)
+        size_t prefix_length = sizeof(int32_t);
+        auto metadata_length = read<int32_t>(message, block_metadata_length, 0);
+        if (metadata_length == -1) {
+            prefix_length += sizeof(int32_t);
+            metadata_length = read<int32_t>(message, block_metadata_length, sizeof(int32_t));
+        }
+        if (metadata_length <= 0 or (size_t) metadata_length > block_metadata_length - prefix_length) {
+            fail("bad message metadata length");
+        }
+        auto m = flatbuffer_table::root(message + prefix_length, metadata_length);
+        if (m.scalar<uint8_t>(message_header_type, 0) != message_header_record_batch) {
+            fail("a footer block is not a record batch");
+        }
+        auto batch = m.table(message_header);
+        if (batch.has(record_batch_compression)) { fail("compressed record batches are not supported"); }
+        auto length = batch.scalar<int64_t>(record_batch_length, 0);
+        auto nodes = batch.vector(record_batch_nodes, field_node_size);
+        auto buffers = batch.vector(record_batch_buffers, buffer_descriptor_size);
+
+        size_t node_index { 0 };
+        size_t buffer_index { 0 };
+        for(size_t i = 0; i < fields_.size(); i++) {
+            if (node_index >= nodes.length or buffer_index + num_buffers[i] > buffers.length) {
+                fail("record batch has too few field nodes or buffers");
+            }
+            array_chunk c;
+            c.length     = batch.struct_member_in_vector<int64_t>(nodes, field_node_size, node_index, 0);
+            c.null_count = batch.struct_member_in_vector<int64_t>(nodes, field_node_size, node_index, 8);
+            if ((int64_t) c.length != length) { fail("field length differs from the record batch length"); }
+
+            auto buffer = [&](size_t index, size_t& buffer_length) -> const uint8_t* {
+                auto offset = batch.struct_member_in_vector<int64_t>(buffers, buffer_descriptor_size, index, 0);
+                auto blength = batch.struct_member_in_vector<int64_t>(buffers, buffer_descriptor_size, index, 8);
+                if (offset < 0 or blength < 0 or (size_t) offset > body_length or body_length - offset < (size_t) blength) {
+                    fail("buffer out of bounds");
+                }
+                buffer_length = blength;
+                return blength == 0 ? nullptr : body + offset;
+            };
+            size_t validity_length { 0 };
+            size_t offsets_length { 0 };
+            if (num_buffers[i] >= 2) {
+                c.validity = buffer(buffer_index, validity_length);
+                auto is_variable_width = num_buffers[i] == 3 and not fields_[i].dictionary_encoded;
+                if (is_variable_width) {
+                    c.offsets = buffer(buffer_index + 1, offsets_length);
+                }
+                c.data = buffer(buffer_index + (is_variable_width ? 2 : 1), c.data_size);
+            }
+            check_chunk(fields_[i], c, validity_length, offsets_length);
+            chunks_[i].push_back(c);
+            node_index += num_nodes[i];
+            buffer_index += num_buffers[i];
+        }
+        num_rows_ += length;
+    }
+
+    static void check_chunk(const field& f, const array_chunk& c, size_t validity_length, size_t offsets_length)
+    {
+        if (c.null_count > 0 and validity_length * 8 < c.length) { detail::fail("validity buffer too short for " + f.name); }
+        if (f.dictionary_encoded) { return; }
+        auto width = f.type.value_width();
+        if (width > 0 and c.data_size / width < c.length) { detail::fail("data buffer too short for " + f.name); }
+        auto offset_width = (f.type.id == type_id::large_binary or f.type.id == type_id::large_utf8) ? 8 : 4;
+        if (c.offsets != nullptr and c.length > 0 and offsets_length / offset_width < c.length + 1) {
+            detail::fail("offsets buffer too short for " + f.name);
+        }
+    }
+
+    template <typename F>
+    static void decode(const field& fld, const array_chunk& c, size_t first, size_t count, F&& f)
+    {
+        auto values = [&](auto dummy, auto&& transform) {
+            using T = decltype(dummy);
+            for(size_t i = first; i < first + count; i++) {
+                T value;
+                std::memcpy(&value, c.data + i * sizeof(T), sizeof(T));
+                f(i, transform(value));
+            }
+        };
+        auto as_is = [](auto x) { return (int64_t) x; };
+        const auto& t = fld.type;
+        switch(t.id) {
+        case type_id::int_:
+            switch(t.bit_width) {
+            case 8:  t.is_signed ? values(int8_t{},  as_is) : values(uint8_t{},  as_is); return;
+            case 16: t.is_signed ? values(int16_t{}, as_is) : values(uint16_t{}, as_is); return;
+            case 32: t.is_signed ? values(int32_t{}, as_is) : values(uint32_t{}, as_is); return;
+            case 64: t.is_signed ? values(int64_t{}, as_is) : values(uint64_t{}, as_is); return;
+            }
+            break;
+        case type_id::date:
+            if (t.unit == date_unit::day) { values(int32_t{}, as_is); }
+            else { values(int64_t{}, [](int64_t ms) { return ms / (24 * 60 * 60 * 1000); }); }
+            return;
+        case type_id::decimal:
+            if (t.bit_width == 64) { values(int64_t{}, as_is); return; }
+            if (t.bit_width == 128) {
+                for(size_t i = first; i < first + count; i++) {
+                    int64_t halves[2]; // little-endian: low, high
+                    std::memcpy(halves, c.data + i * sizeof(halves), sizeof(halves));
+                    if (halves[1] != (halves[0] < 0 ? -1 : 0)) { detail::fail("a " + fld.name + " value exceeds 64 bits"); }
+                    f(i, halves[0]);
+                }
+                return;
+            }
+            break;
+        case type_id::fixed_size_binary:
+            if (t.byte_width == 1) { values(uint8_t{}, as_is); return; }
+            break;
+        case type_id::binary:
+        case type_id::utf8:
+            for(size_t i = first; i < first + count; i++) {
+                int32_t offsets[2];
+                std::memcpy(offsets, c.offsets + i * sizeof(int32_t), sizeof(offsets));
+                if (offsets[1] - offsets[0] != 1 or offsets[0] < 0 or (size_t) offsets[0] >= c.data_size) {
+                    detail::fail("a " + fld.name + " value is not a single byte");
+                }
+                f(i, (int64_t) c.data[offsets[0]]);
+            }
+            return;
+        default:
+            break;
+        }
+        detail::fail("can't decode field " + fld.name + " as integers");
+    }
+
+    mapped_file                            file_;
+    std::vector<field>                     fields_;
+    std::vector<std::vector<array_chunk>>  chunks_; // per top-level field, per record batch
+    size_t                                 num_rows_ { 0 };
+};
+
+/**
+ * A column to be written; its values must be stored exactly as the Arrow type
+ * prescribes (e.g. days since the Unix epoch as int32_t's, for a date field of unit day)
+ */
+struct column_to_write {
+    std::string  name;
+    field_type   type;
+    const void*  values;
+};
+
+/**
+ * Writes non-nullable fixed-width columns as an Arrow IPC file with a single record batch
+ *
+ * @note throws on failure
+ */
+inline void write_file(const std::string& path, const std::vector<column_to_write>& columns, size_t num_rows)
+{
+    using namespace detail;
+    using builder = flatbuffer_builder;
+
+    auto add_schema = [&](builder& b) {
+        auto schema = b.add_table({ { schema_endianness, 2, 0 }, { schema_fields, builder::reference, 0 } });
+        auto fields = b.add_reference_vector(columns.size());
+        b.set_reference(schema.second[schema_fields], fields);
+        for(size_t i = 0; i < columns.size(); i++) {
+            const auto& t = columns[i].type;
+            auto f = b.add_table({
+                { field_name,      builder::reference, 0 },
+                { field_nullable,  1, 0 },
+                { field_type_type, 1, (uint64_t) t.id },
+                { field_type_value, builder::reference, 0 },
+                { field_children,  builder::reference, 0 } });
+            b.set_reference_in_vector(fields, i, f.first);
+            b.set_reference(f.second[field_name], b.add_string(columns[i].name));
+            size_t type_table;
+            switch(t.id) {
+            case type_id::int_:
+                type_table = b.add_table({ { int_bit_width, 4, (uint64_t) t.bit_width }, { int_is_signed, 1, t.is_signed } }).first;
+                break;
+            case type_id::decimal:
+                type_table = b.add_table({ { decimal_precision, 4, (uint64_t) t.precision },
+                    { decimal_scale, 4, (uint64_t) t.scale }, { decimal_bit_width, 4, (uint64_t) t.bit_width } }).first;
+                break;
+            case type_id::date:
+                type_table = b.add_table({ { date_unit_slot, 2, (uint64_t) t.unit } }).first;
+                break;
+            case type_id::fixed_size_binary:
+                type_table = b.add_table({ { fixed_size_binary_byte_width, 4, (uint64_t) t.byte_width } }).first;
+                break;
+            default:
+                throw std::invalid_argument("Unsupported type for Arrow column " + columns[i].name);
+            }
+            b.set_reference(f.second[field_type_value], type_table);
+            b.set_reference(f.second[field_children], b.add_vector(nullptr, 0, sizeof(uint32_t), 4));
+        }
+        return schema.first;
+    };
+
+    auto body_buffer_length = [&](const column_to_write& c) { return c.type.value_width() * num_rows; };
+    auto padded = [](size_t length) { return (length + body_alignment - 1) / body_alignment * body_alignment; };
+
+    // The record batch message
+    std::vector<uint64_t> field_nodes;
+    std::vector<uint64_t> buffer_descriptors;
+    size_t body_length { 0 };
+    for(const auto& c : columns) {
+        if (c.type.value_width() == 0) { throw std::invalid_argument("Arrow column " + c.name + " is not fixed-width"); }
+        field_nodes.insert(field_nodes.end(), { num_rows, 0 });
+        buffer_descriptors.insert(buffer_descriptors.end(), { body_length, 0 }); // no validity bitmap
+        buffer_descriptors.insert(buffer_descriptors.end(), { body_length, body_buffer_length(c) });
+        body_length += padded(body_buffer_length(c));
+    }
+    builder batch_builder;
+    auto batch_message = batch_builder.add_table({ { message_version, 2, metadata_version_v5 },
+        { message_header_type, 1, message_header_record_batch }, { message_header, builder::reference, 0 },
+        { message_body_length, 8, body_length } });
+    auto batch = batch_builder.add_table({ { record_batch_length, 8, num_rows },
+        { record_batch_nodes, builder::reference, 0 }, { record_batch_buffers, builder::reference, 0 } });
+    batch_builder.set_reference(batch_message.second[message_header], batch.first);
+    batch_builder.set_reference(batch.second[record_batch_nodes],
+        batch_builder.add_vector(field_nodes.data(), columns.size(), field_node_size, 8));
+    batch_builder.set_reference(batch.second[record_batch_buffers],
+        batch_builder.add_vector(buffer_descriptors.data(), 2 * columns.size(), buffer_descriptor_size, 8));
+    auto batch_metadata = batch_builder.finish(batch_message.first);
+
+    // The footer
+    builder footer_builder;
+    auto footer = footer_builder.add_table({ { 0, 2, metadata_version_v5 },
+        { footer_schema, builder::reference, 0 }, { footer_record_batches, builder::reference, 0 } });
+    footer_builder.set_reference(footer.second[footer_schema], add_schema(footer_builder));
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) { throw std::runtime_error("Failed opening file " + path + ": " + strerror(errno)); }
+    size_t position { 0 };
+    bool ok { true };
+    auto write = [&](const void* data, size_t size) {
+        ok = ok and (size == 0 or fwrite(data, 1, size, file) == size);
+        position += size;
+    };
+    // Pads to a multiple of alignment bytes past origin
+    auto pad_to = [&](size_t alignment, size_t origin) {
+        static const uint8_t zeros[body_alignment] = { 0 };
+        write(zeros, (alignment - (position - origin) % alignment) % alignment);
+    };
+    // Metadata is padded so that the message body starts body_alignment-aligned in the file
+    auto write_message = [&](const std::vector<uint8_t>& metadata) {
+        auto padding = (body_alignment - (position + 2 * sizeof(int32_t) + metadata.size()) % body_alignment) % body_alignment;
+        const int32_t prefix[] = { -1, (int32_t) (metadata.size() + padding) };
+        write(prefix, sizeof(prefix));
+        write(metadata.data(), metadata.size());
+        pad_to(body_alignment, 0);
+    };
+
+    write(magic, magic_length);
+    pad_to(padded_magic_length, 0);
+    {
+        builder b;
+        auto m = b.add_table({ { message_version, 2, metadata_version_v5 },
+            { message_header_type, 1, message_header_schema }, { message_header, builder::reference, 0 },
+            { message_body_length, 8, 0 } });
+        b.set_reference(m.second[message_header], add_schema(b));
+        write_message(b.finish(m.first));
+    }
+    auto batch_start = position;
+    write_message(batch_metadata);
+    auto body_start = position;
+    int64_t block[3] = { (int64_t) batch_start, (int64_t) (body_start - batch_start), (int64_t) body_length };
+    for(const auto& c : columns) {
+        write(c.values, body_buffer_length(c));
+        pad_to(body_alignment, body_start);
+    }
+    const int32_t end_of_stream[] = { -1, 0 };
+    write(end_of_stream, sizeof(end_of_stream));
+
+    // Block is { offset: long, metaDataLength: int, (padding), bodyLength: long }
+    uint8_t block_struct[block_size] = { 0 };
+    auto metadata_length = (int32_t) block[1];
+    std::memcpy(block_struct, &block[0], sizeof(int64_t));
+    std::memcpy(block_struct + 8, &metadata_length, sizeof(int32_t));
+    std::memcpy(block_struct + 16, &block[2], sizeof(int64_t));
+    footer_builder.set_reference(footer.second[footer_record_batches],
+        footer_builder.add_vector(block_struct, 1, block_size, 8));
+    auto footer_buffer = footer_builder.finish(footer.first);
+    write(footer_buffer.data(), footer_buffer.size());
+    auto footer_length = (int32_t) footer_buffer.size();
+    write(&footer_length, sizeof(footer_length));
+    write(magic, magic_length);
+
+    ok = (fclose(file) == 0) and ok;
+    if (not ok) {
+        remove(path.c_str());
+        throw std::runtime_error("Failed writing the Arrow file " + path + ": " + strerror(errno));
+    }
+}
+
+} // namespace arrow_ipc
+
+#endif // ARROW_IPC_HPP_
@@ -0,0 +1,135 @@
+/**
+ * @file bit_sliced_column.hpp
+ *
+ * A vertically bit-sliced (BitWeaving/V-style) copy of an unsigned integer column.
+ *
+ * Rows are grouped into blocks of 64; each block holds one 64-bit word per bit position
+ * ("bit-plane") of the values, most significant plane first, with bit j of each word
+ * belonging to row j of the block. Comparing the column to a constant then takes a few
+ * word operations per bit-plane for 64 rows at once, and can stop as soon as all rows
+ * of a block have been decided.
+ */
+#pragma once
+#ifndef BIT_SLICED_COLUMN_HPP_
+#define BIT_SLICED_COLUMN_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <climits>
+#include <cassert>
+#include <memory>
+#include <type_traits>
+
+template <typename T>
+class bit_sliced_column {
+    static_assert(std::is_unsigned<T>::value, "Only unsigned integer columns can be bit-sliced");
+
+public:
+    using value_type = T;
+    using word_type  = uint64_t;
+    enum : unsigned { rows_per_block = sizeof(word_type) * CHAR_BIT };
+
+    bit_sliced_column(const T* __restrict__ values, size_t num_rows)
+        : num_rows_(num_rows), num_bit_planes_(0)
+    {
+        T max_value { 0 };
+        for(size_t i = 0; i < num_rows; i++) {
+            max_value = values[i] > max_value ? values[i] : max_value;
+        }
+        while (num_bit_planes_ < sizeof(T) * CHAR_BIT and (max_value >> num_bit_planes_) != 0) {
+            num_bit_planes_++;
+        }
+        // Even an all-zeros column gets one plane, so that blocks are never empty
+        num_bit_planes_ = num_bit_planes_ == 0 ? 1 : num_bit_planes_;
+
+        planes_ = std::make_unique<word_type[]>(num_blocks() * num_bit_planes_);
+        for(size_t block = 0; block < num_blocks(); block++) {
+            auto block_values = values + block * rows_per_block;
+            auto num_block_rows = block + 1 < num_blocks() ? size_t{rows_per_block} : num_rows - block * rows_per_block;
+            auto block_planes = planes_.get() + block * num_bit_planes_;
+            for(unsigned plane = 0; plane < num_bit_planes_; plane++) {
+                auto bit = num_bit_planes_ - 1 - plane;
+                word_type word { 0 };
+                for(size_t j = 0; j < num_block_rows; j++) {
+                    word |= word_type{(block_values[j] >> bit) & 0x1u} << j;
+                }
+                block_planes[plane] = word;
+            }
+        }
+    }
+
+    size_t   num_rows()       const noexcept { return num_rows_; }
+    unsigned num_bit_planes() const noexcept { return num_bit_planes_; }
+    size_t   num_blocks()     const noexcept { return (num_rows_ + rows_per_block - 1) / rows_per_block; }
+
+    /**
+     * Evaluates `value <= threshold` for all rows of a single block
+     *
+     * @note bits of rows past the end of the column are always 0
+     */
+    word_type less_or_equal(size_t block_index, T threshold) const noexcept
+    {
+        assert(block_index < num_blocks());
+        auto num_block_rows = num_rows_ - block_index * rows_per_block;
+        word_type valid_rows = num_block_rows >= rows_per_block ?
+            ~word_type{0} : (word_type{1} << num_block_rows) - 1;
+        if (num_bit_planes_ < sizeof(T) * CHAR_BIT and (threshold >> num_bit_planes_) != 0) {
+            return valid_rows; // the threshold exceeds every representable value
+        }
+        auto block_planes = planes_.get() + block_index * num_bit_planes_;
+        word_type less  { 0 };
+        word_type equal { valid_rows };
+        for(unsigned plane = 0; plane < num_bit_planes_ and equal != 0; plane++) {
+            auto bit = num_bit_planes_ - 1 - plane;
+            word_type threshold_bit = ((threshold >> bit) & 0x1u) ? ~word_type{0} : word_type{0};
+            less  |= equal & threshold_bit & ~block_planes[plane];
+            equal &= ~(block_planes[plane] ^ threshold_bit);
+        }
+        return less | equal;
+    }
+
+    /**
+     * Evaluates `value <= threshold` for a range of rows, writing the result in the
+     * precomputed filter format: bit j of container k corresponds to row
+     * first_row + k * (bits per container) + j.
+     *
+     * @note @p first_row must be block-aligned; the number of containers written is
+     * the number needed to hold @p num_rows bits.
+     */
+    template <typename BitContainer>
+    void less_or_equal(
+        T                             threshold,
+        size_t                        first_row,
+        size_t                        num_rows,
+        BitContainer* __restrict__    result) const noexcept
+    {
+        static_assert(std::is_unsigned<BitContainer>::value and sizeof(BitContainer) <= sizeof(word_type),
+            "Unsupported bit container type");
+        enum : unsigned {
+            bits_per_container   = sizeof(BitContainer) * CHAR_BIT,
+            containers_per_block = rows_per_block / bits_per_container,
+        };
+        assert(first_row % rows_per_block == 0);
+        assert(first_row + num_rows <= num_rows_);
+
+        auto first_block = first_row / rows_per_block;
+        auto num_containers = (num_rows + bits_per_container - 1) / bits_per_container;
+        for(size_t block = first_block; num_containers > 0; block++) {
+            auto word = less_or_equal(block, threshold);
+            auto rows_left = first_row + num_rows - block * rows_per_block;
+            if (rows_left < rows_per_block) {
+                word &= (word_type{1} << rows_left) - 1;
+            }
+            for(unsigned c = 0; c < containers_per_block and num_containers > 0; c++, num_containers--) {
+                *(result++) = static_cast<BitContainer>(word >> (c * bits_per_container));
+            }
+        }
+    }
+
+protected:
+    size_t                       num_rows_;
+    unsigned                     num_bit_planes_;
+    std::unique_ptr<word_type[]> planes_; // block-major: all planes of block 0, then of block 1 etc.
+};
+
+#endif // BIT_SLICED_COLUMN_HPP_
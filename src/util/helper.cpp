@@ -43,20 +43,6 @@ void list_device_properties(){
     }
 }
 
-void make_sure_we_are_on_cpu_core_0()
-{
-#if 0
-    // CPU affinities are devil's work
-    // Make sure we are on core 0
-    // TODO: Why not in a function?
-    cpu_set_t cpuset;
-
-    CPU_ZERO(&cpuset);
-    CPU_SET(0, &cpuset);
-    sched_setaffinity(0, sizeof(cpuset), &cpuset);
-#endif
-}
-
 std::pair<std::string,std::string> split_once(std::string delimited, char delimiter) {
     auto pos = delimited.find_first_of(delimiter);
     return { delimited.substr(0, pos), delimited.substr(pos+1) };
@@ -79,7 +79,6 @@ constexpr inline int div_rounding_up(const int& dividend, const int& divisor)
 }
 
 
-void make_sure_we_are_on_cpu_core_0();
 std::string host_name();
 std::string timestamp();
 std::pair<std::string,std::string> split_once(std::string delimited, char delimiter);
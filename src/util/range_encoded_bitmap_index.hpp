@@ -0,0 +1,259 @@
+/**
+ * @file range_encoded_bitmap_index.hpp
+ *
+ * A range-encoded bitmap index over an integer column: for a (sorted) sequence of
+ * bin upper bounds u_0 < u_1 < ... , bitmap B_i marks the rows whose value is
+ * at most u_i. The rows satisfying `value <= t` are then B_{i-1} plus those rows
+ * of bin i - i.e. set in B_i but not in B_{i-1} - which pass a residual check,
+ * where bin i is the one containing t.
+ *
+ * Bitmaps are kept in the precomputed filter format (bit j of container k
+ * corresponds to row k * bits_per_container + j), either plainly or with a simple
+ * word-aligned run-length encoding, which suits the mostly-ones (or mostly-zeros)
+ * bitmaps of bins far from the middle of the value range.
+ */
+#pragma once
+#ifndef RANGE_ENCODED_BITMAP_INDEX_HPP_
+#define RANGE_ENCODED_BITMAP_INDEX_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <climits>
+#include <cassert>
+#include <algorithm>
+#include <vector>
+#include <type_traits>
+
+template <typename T, typename BitContainer = uint32_t>
+class range_encoded_bitmap_index {
+    static_assert(std::is_unsigned<BitContainer>::value, "Bit containers must be unsigned");
+
+public:
+    using value_type         = T;
+    using bit_container_type = BitContainer;
+    enum : unsigned { bits_per_container = sizeof(BitContainer) * CHAR_BIT };
+
+protected:
+    enum : BitContainer { all_ones = ~BitContainer{0} };
+
+    /**
+     * Run-length encoded bitmaps are a sequence of marker containers, each followed
+     * by literal containers: the marker's top bit is the fill value, the next
+     * fill_length_bits bits are the number of fill containers, and the remaining
+     * low bits are the number of literals following the fill.
+     *
+     * @note to allow decoding from the middle of a bitmap, every segment of
+     * containers_per_segment containers is encoded separately.
+     */
+    enum : unsigned {
+        fill_length_bits       = bits_per_container / 2 - 1,
+        literal_count_bits     = bits_per_container / 2,
+        containers_per_segment = 1024,
+    };
+    static_assert(containers_per_segment < (size_t{1} << literal_count_bits), "Segments too long for markers");
+
+    struct bitmap {
+        std::vector<BitContainer> containers;
+        std::vector<size_t>       segment_starts; // empty if the bitmap is not run-length-encoded
+    };
+
+public:
+    /**
+     * @param values the column; it must outlive the index, which uses it for residual checks
+     * @param bin_upper_bounds strictly increasing
+     * @param run_length_encode compress the bitmaps
+     */
+    range_encoded_bitmap_index(
+        const T* __restrict__  values,
+        size_t                 num_rows,
+        std::vector<T>         bin_upper_bounds,
+        bool                   run_length_encode = false)
+        : values_(values), num_rows_(num_rows), bin_upper_bounds_(std::move(bin_upper_bounds))
+    {
+        assert(std::is_sorted(bin_upper_bounds_.begin(), bin_upper_bounds_.end()));
+        auto num_containers = num_containers_for(num_rows);
+        std::vector<BitContainer> plain(num_containers);
+        bitmaps_.reserve(bin_upper_bounds_.size());
+        for(auto upper_bound : bin_upper_bounds_) {
+            for(size_t k = 0; k < num_containers; k++) {
+                BitContainer container { 0 };
+                auto num_container_rows = std::min<size_t>(bits_per_container, num_rows - k * bits_per_container);
+                for(size_t j = 0; j < num_container_rows; j++) {
+                    container |= BitContainer{values[k * bits_per_container + j] <= upper_bound} << j;
+                }
+                plain[k] = container;
+            }
+            bitmaps_.emplace_back(run_length_encode ? encode(plain) : bitmap { plain, {} });
+        }
+    }
+
+    size_t num_rows() const noexcept { return num_rows_; }
+    size_t num_bins() const noexcept { return bin_upper_bounds_.size(); }
+    const std::vector<T>& bin_upper_bounds() const noexcept { return bin_upper_bounds_; }
+
+    size_t size_in_bytes() const noexcept
+    {
+        size_t total { 0 };
+        for(const auto& b : bitmaps_) {
+            total += b.containers.size() * sizeof(BitContainer) + b.segment_starts.size() * sizeof(size_t);
+        }
+        return total;
+    }
+
+    /**
+     * Evaluates `value <= threshold` for a range of rows, writing the result in the
+     * precomputed filter format, i.e. container k of @p result covers rows
+     * first_row + k * bits_per_container onwards.
+     *
+     * @note @p first_row must be a multiple of bits_per_container
+     */
+    void less_or_equal(
+        T                             threshold,
+        size_t                        first_row,
+        size_t                        num_rows,
+        BitContainer* __restrict__    result) const
+    {
+        assert(first_row % bits_per_container == 0);
+        assert(first_row + num_rows <= num_rows_);
+        auto first_container = first_row / bits_per_container;
+        auto num_containers = num_containers_for(num_rows);
+        auto bin = std::lower_bound(bin_upper_bounds_.begin(), bin_upper_bounds_.end(), threshold)
+            - bin_upper_bounds_.begin();
+
+        // Bins beyond the last upper bound, if any values lie there, form one implicit all-ones bitmap
+        if (bin == (ptrdiff_t) num_bins()) {
+            std::fill_n(result, num_containers, all_ones);
+        }
+        else {
+            decode(bitmaps_[bin], first_container, num_containers, result);
+        }
+        auto num_trailing_rows = num_rows % bits_per_container;
+        if (num_trailing_rows != 0) {
+            result[num_containers - 1] &= (BitContainer{1} << num_trailing_rows) - 1;
+        }
+        if (bin < (ptrdiff_t) num_bins() and bin_upper_bounds_[bin] == threshold) {
+            return;
+        }
+
+        // Only some rows of the boundary bin qualify; keep the rows of the
+        // bins below it, and check the rest of the boundary bin one by one
+        enum : size_t { batch_size = 256 };
+        BitContainer lower[batch_size];
+        for(size_t batch_start = 0; batch_start < num_containers; batch_start += batch_size) {
+            auto batch_length = std::min<size_t>(batch_size, num_containers - batch_start);
+            if (bin > 0) {
+                decode(bitmaps_[bin - 1], first_container + batch_start, batch_length, lower);
+            }
+            else {
+                std::fill_n(lower, batch_length, BitContainer{0});
+            }
+            for(size_t k = 0; k < batch_length; k++) {
+                auto container = result[batch_start + k] & lower[k];
+                auto boundary_bin_rows = result[batch_start + k] & ~lower[k];
+                auto container_values = values_ + (first_container + batch_start + k) * bits_per_container;
+                while (boundary_bin_rows != 0) {
+                    auto j = count_trailing_zeros(boundary_bin_rows);
+                    container |= BitContainer{container_values[j] <= threshold} << j;
+                    boundary_bin_rows &= boundary_bin_rows - 1;
+                }
+                result[batch_start + k] = container;
+            }
+        }
+    }
+
+protected:
+    static size_t num_containers_for(size_t num_rows) noexcept
+    {
+        return (num_rows + bits_per_container - 1) / bits_per_container;
+    }
+
+    static unsigned count_trailing_zeros(BitContainer x) noexcept
+    {
+        return sizeof(BitContainer) <= sizeof(unsigned) ? __builtin_ctz(x) : __builtin_ctzll(x);
+    }
+
+    static BitContainer make_marker(bool fill_value, size_t fill_length, size_t num_literals) noexcept
+    {
+        return (BitContainer{fill_value} << (bits_per_container - 1))
+            | (static_cast<BitContainer>(fill_length) << literal_count_bits)
+            | static_cast<BitContainer>(num_literals);
+    }
+
+    static bitmap encode(const std::vector<BitContainer>& plain)
+    {
+        bitmap encoded;
+        const size_t max_fill_length = (size_t{1} << fill_length_bits) - 1;
+        for(size_t segment_start = 0; segment_start < plain.size(); segment_start += containers_per_segment) {
+            encoded.segment_starts.push_back(encoded.containers.size());
+            auto segment_end = std::min<size_t>(segment_start + containers_per_segment, plain.size());
+            size_t k = segment_start;
+            while (k < segment_end) {
+                bool fill_value = plain[k] == all_ones;
+                size_t fill_length = 0;
+                while (k < segment_end and fill_length < max_fill_length and
+                       (plain[k] == 0 or plain[k] == all_ones) and (plain[k] == all_ones) == fill_value)
+                {
+                    k++; fill_length++;
+                }
+                auto literals_start = k;
+                while (k < segment_end and plain[k] != 0 and plain[k] != all_ones) { k++; }
+                encoded.containers.push_back(make_marker(fill_value, fill_length, k - literals_start));
+                encoded.containers.insert(encoded.containers.end(), plain.begin() + literals_start, plain.begin() + k);
+            }
+        }
+        if (encoded.containers.size() + encoded.segment_starts.size() * sizeof(size_t) / sizeof(BitContainer)
+            >= plain.size())
+        {
+            return bitmap { plain, {} }; // Not worth it
+        }
+        encoded.containers.shrink_to_fit();
+        return encoded;
+    }
+
+    static void decode(
+        const bitmap&               b,
+        size_t                      first_container,
+        size_t                      num_containers,
+        BitContainer* __restrict__  out)
+    {
+        if (b.segment_starts.empty()) {
+            std::copy_n(b.containers.data() + first_container, num_containers, out);
+            return;
+        }
+        auto segment = first_container / containers_per_segment;
+        auto pos = b.segment_starts[segment];
+        size_t k = segment * containers_per_segment; // index of the next decoded container
+        auto end = first_container + num_containers;
+        const BitContainer fill_length_mask = (BitContainer{1} << fill_length_bits) - 1;
+        const BitContainer literal_count_mask = (BitContainer{1} << literal_count_bits) - 1;
+        while (k < end) {
+            auto marker = b.containers[pos++];
+            BitContainer fill = (marker >> (bits_per_container - 1)) ? all_ones : BitContainer{0};
+            size_t fill_length = (marker >> literal_count_bits) & fill_length_mask;
+            size_t num_literals = marker & literal_count_mask;
+
+            auto fill_begin = std::max(k, first_container);
+            auto fill_end = std::min(k + fill_length, end);
+            if (fill_begin < fill_end) {
+                std::fill(out + (fill_begin - first_container), out + (fill_end - first_container), fill);
+            }
+            k += fill_length;
+
+            auto literals_begin = std::max(k, first_container);
+            auto literals_end = std::min(k + num_literals, end);
+            if (literals_begin < literals_end) {
+                std::copy(b.containers.data() + pos + (literals_begin - k), b.containers.data() + pos + (literals_end - k),
+                    out + (literals_begin - first_container));
+            }
+            k += num_literals;
+            pos += num_literals;
+        }
+    }
+
+    const T*               values_;
+    size_t                 num_rows_;
+    std::vector<T>         bin_upper_bounds_;
+    std::vector<bitmap>    bitmaps_;
+};
+
+#endif // RANGE_ENCODED_BITMAP_INDEX_HPP_
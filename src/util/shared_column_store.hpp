@@ -0,0 +1,343 @@
+/**
+ * @file shared_column_store.hpp
+ *
+ * Named sets of read-only columns in shared memory, so that a process which has
+ * loaded (and preprocessed) columns can publish them, and later processes can
+ * attach to them instead of loading them again.
+ *
+ * A segment begins with a manifest - a header and a table of named columns -
+ * followed by the column data, each column page-aligned. Segments are placed on
+ * a hugetlbfs mount if one is available and has enough free huge pages, otherwise
+ * in POSIX shared memory (/dev/shm).
+ *
+ * Lifetime and versioning are explicit: a segment outlives its publisher, and
+ * remains until it's removed (or replaced by publishing anew under the same name);
+ * processes still attached to a removed or replaced segment keep their mapping of
+ * it. Publishers tag a segment with a data version, e.g. a hash of the source
+ * data's identity, and attaching fails unless it matches the version expected.
+ */
+#pragma once
+#ifndef SHARED_COLUMN_STORE_HPP_
+#define SHARED_COLUMN_STORE_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+class shared_column_store {
+public:
+    struct column {
+        std::string  name;
+        const void*  data;
+        size_t       size_in_bytes;
+    };
+
+protected:
+    enum : uint32_t { format_version = 1, state_incomplete = 0, state_ready = 1 };
+    enum : size_t { column_alignment = 4096, max_name_length = 55, max_description_length = 127 };
+    enum : size_t { magic_length = 8 };
+    static const char* magic() { return "Q1COLSHM"; }
+
+    struct manifest_header {
+        char      magic[magic_length];
+        uint32_t  format_version;
+        uint32_t  state;          // set to state_ready only once everything else has been written
+        uint64_t  data_version;
+        uint64_t  segment_size;
+        uint64_t  num_columns;
+        int64_t   creation_time;  // seconds since the Unix epoch
+        int64_t   creator_pid;
+        char      description[max_description_length + 1];
+    };
+
+    struct column_entry {
+        char      name[max_name_length + 1];
+        uint64_t  offset;         // from the beginning of the segment
+        uint64_t  size_in_bytes;
+    };
+
+public:
+    /**
+     * Publishes a set of columns under the given name, replacing any existing segment
+     * by that name. Throws on failure.
+     *
+     * @param description free text, for reporting (e.g. what the columns were loaded from)
+     * @return where the segment was placed
+     */
+    static std::string publish(
+        const std::string&          name,
+        uint64_t                    data_version,
+        const std::string&          description,
+        const std::vector<column>&  columns)
+    {
+        remove(name);
+
+        size_t data_start = round_up(sizeof(manifest_header) + columns.size() * sizeof(column_entry), column_alignment);
+        size_t segment_size = data_start;
+        for(const auto& c : columns) {
+            if (c.name.size() > max_name_length) { throw std::invalid_argument("Column name too long: " + c.name); }
+            segment_size += round_up(c.size_in_bytes, column_alignment);
+        }
+
+        segment s;
+        auto huge_pages_directory = hugetlbfs_mount();
+        if (not huge_pages_directory.empty()) {
+            s = create_segment(huge_pages_directory + "/" + name, false,
+                round_up(segment_size, hugetlbfs_page_size(huge_pages_directory)));
+        }
+        if (s.address == nullptr) {
+            s = create_segment("/" + name, true, segment_size);
+        }
+        if (s.address == nullptr) {
+            throw std::runtime_error("Failed creating the shared memory segment " + name + ": " + strerror(errno));
+        }
+
+        auto header = static_cast<manifest_header*>(s.address);
+        std::memcpy(header->magic, magic(), magic_length);
+        header->format_version = format_version;
+        header->state          = state_incomplete;
+        header->data_version   = data_version;
+        header->segment_size   = s.size;
+        header->num_columns    = columns.size();
+        header->creation_time  = time(nullptr);
+        header->creator_pid    = getpid();
+        std::strncpy(header->description, description.c_str(), max_description_length);
+
+        auto entries = reinterpret_cast<column_entry*>(header + 1);
+        size_t offset = data_start;
+        for(size_t i = 0; i < columns.size(); i++) {
+            std::strncpy(entries[i].name, columns[i].name.c_str(), max_name_length);
+            entries[i].offset = offset;
+            entries[i].size_in_bytes = columns[i].size_in_bytes;
+            std::memcpy(static_cast<char*>(s.address) + offset, columns[i].data, columns[i].size_in_bytes);
+            offset += round_up(columns[i].size_in_bytes, column_alignment);
+        }
+        __atomic_store_n(&header->state, (uint32_t) state_ready, __ATOMIC_RELEASE);
+        munmap(s.address, s.size);
+        return s.location;
+    }
+
+    /**
+     * Attaches, read-only, to a published set of columns
+     *
+     * @param why_not if non-null, set to the reason for failing to attach
+     * @return nullptr if there's no complete segment by that name with the expected
+     * data version
+     */
+    static std::unique_ptr<shared_column_store> attach(
+        const std::string&  name,
+        uint64_t            data_version,
+        std::string*        why_not = nullptr)
+    {
+        auto fail = [&](const std::string& reason) {
+            if (why_not != nullptr) { *why_not = reason; }
+            return std::unique_ptr<shared_column_store>();
+        };
+        auto s = open_segment(name);
+        if (s.address == nullptr) { return fail("no segment named " + name); }
+        std::unique_ptr<shared_column_store> store { new shared_column_store(s) };
+
+        const auto& h = store->header();
+        if (s.size < sizeof(manifest_header) or std::memcmp(h.magic, magic(), magic_length) != 0 or
+            h.format_version != format_version)
+        {
+            return fail(s.location + " is not a shared column store segment of a supported format");
+        }
+        if (__atomic_load_n(&h.state, __ATOMIC_ACQUIRE) != state_ready) {
+            return fail(s.location + " is incomplete (perhaps its publisher failed)");
+        }
+        if (h.data_version != data_version) {
+            return fail(s.location + " holds a different version of the data");
+        }
+        if (h.segment_size > s.size or h.num_columns > (s.size - sizeof(manifest_header)) / sizeof(column_entry)) {
+            return fail(s.location + " is corrupt");
+        }
+        for(size_t i = 0; i < h.num_columns; i++) {
+            const auto& e = store->entries()[i];
+            if (e.offset > s.size or s.size - e.offset < e.size_in_bytes) {
+                return fail(s.location + " is corrupt");
+            }
+        }
+        return store;
+    }
+
+    /**
+     * @return true if a segment by that name existed (and has now been removed)
+     */
+    static bool remove(const std::string& name)
+    {
+        bool removed { false };
+        auto huge_pages_directory = hugetlbfs_mount();
+        if (not huge_pages_directory.empty()) {
+            removed = unlink((huge_pages_directory + "/" + name).c_str()) == 0;
+        }
+        return (shm_unlink(("/" + name).c_str()) == 0) or removed;
+    }
+
+    /**
+     * A hash of a file's path, size and modification time - for use as (part of) a data version
+     */
+    static uint64_t file_version(const std::string& path, uint64_t seed = 14695981039346656037ull)
+    {
+        struct stat st;
+        std::stringstream ss;
+        ss << path;
+        if (stat(path.c_str(), &st) == 0) {
+            ss << ':' << st.st_size << ':' << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec;
+        }
+        return hash(ss.str(), seed);
+    }
+
+    static uint64_t hash(const std::string& s, uint64_t seed = 14695981039346656037ull)
+    {
+        // FNV-1a
+        uint64_t h { seed };
+        for(unsigned char c : s) { h = (h ^ c) * 1099511628211ull; }
+        return h;
+    }
+
+    ~shared_column_store() { munmap(segment_.address, segment_.size); }
+
+    /**
+     * @return the column's data, or nullptr if there's no such column (or its size
+     * is different than expected)
+     */
+    const void* find(const std::string& column_name, size_t expected_size_in_bytes) const
+    {
+        auto e = entry(column_name);
+        return (e != nullptr and e->size_in_bytes == expected_size_in_bytes) ?
+            static_cast<const char*>(segment_.address) + e->offset : nullptr;
+    }
+
+    /**
+     * @return the size of a column, or 0 if there's no such column
+     */
+    size_t size_of(const std::string& column_name) const
+    {
+        auto e = entry(column_name);
+        return e != nullptr ? e->size_in_bytes : 0;
+    }
+
+    /**
+     * A one-line summary of the segment: where it is, when and by whom it was
+     * published, and its description
+     */
+    std::string describe() const
+    {
+        char created[32];
+        time_t creation_time = header().creation_time;
+        strftime(created, sizeof(created), "%Y-%m-%d %H:%M:%S", localtime(&creation_time));
+        std::stringstream ss;
+        ss << segment_.location << " (" << segment_.size / (1024 * 1024) << " MiB, "
+           << header().num_columns << " columns, published " << created << " by process "
+           << header().creator_pid << ": " << std::string(header().description, strnlen(header().description, max_description_length + 1)) << ")";
+        return ss.str();
+    }
+
+protected:
+    struct segment {
+        void*        address { nullptr };
+        size_t       size    { 0 };
+        std::string  location;
+    };
+
+    explicit shared_column_store(segment s) : segment_(s) { }
+
+    const manifest_header& header() const { return *static_cast<const manifest_header*>(segment_.address); }
+    const column_entry* entries() const { return reinterpret_cast<const column_entry*>(&header() + 1); }
+
+    const column_entry* entry(const std::string& column_name) const
+    {
+        for(size_t i = 0; i < header().num_columns; i++) {
+            const auto& e = entries()[i];
+            if (column_name == std::string(e.name, strnlen(e.name, sizeof(e.name)))) { return &e; }
+        }
+        return nullptr;
+    }
+
+    static size_t round_up(size_t x, size_t multiple) { return (x + multiple - 1) / multiple * multiple; }
+
+    // The first hugetlbfs mount point we can write to, if any
+    static std::string hugetlbfs_mount()
+    {
+        std::ifstream mounts("/proc/mounts");
+        std::string device, mount_point, type, rest;
+        while (mounts >> device >> mount_point >> type and std::getline(mounts, rest)) {
+            if (type == "hugetlbfs" and access(mount_point.c_str(), W_OK) == 0) { return mount_point; }
+        }
+        return {};
+    }
+
+    static size_t hugetlbfs_page_size(const std::string& mount_point)
+    {
+        struct statfs st;
+        return statfs(mount_point.c_str(), &st) == 0 ? st.f_bsize : 2 * 1024 * 1024;
+    }
+
+    // Leaves the segment's address null on failure
+    static segment create_segment(const std::string& path, bool posix_shm, size_t size)
+    {
+        segment s;
+        s.size = size;
+        s.location = posix_shm ? "/dev/shm" + path : path;
+        int fd = posix_shm ?
+            shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644) :
+            open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) { return s; }
+        void* address = MAP_FAILED;
+        if (ftruncate(fd, size) == 0) {
+            // Huge pages are reserved when mapping, so a shortage of them fails here rather than later
+            address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | (posix_shm ? 0 : MAP_POPULATE), fd, 0);
+        }
+        close(fd);
+        if (address == MAP_FAILED) {
+            posix_shm ? shm_unlink(path.c_str()) : unlink(path.c_str());
+            return s;
+        }
+        s.address = address;
+        return s;
+    }
+
+    static segment open_segment(const std::string& name)
+    {
+        segment s;
+        auto huge_pages_directory = hugetlbfs_mount();
+        int fd = -1;
+        if (not huge_pages_directory.empty()) {
+            s.location = huge_pages_directory + "/" + name;
+            fd = open(s.location.c_str(), O_RDONLY);
+        }
+        if (fd < 0) {
+            s.location = "/dev/shm/" + name;
+            fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+        }
+        if (fd < 0) { return s; }
+        struct stat st;
+        if (fstat(fd, &st) == 0 and st.st_size > 0) {
+            auto address = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (address != MAP_FAILED) {
+                s.address = address;
+                s.size = st.st_size;
+            }
+        }
+        close(fd);
+        return s;
+    }
+
+    segment segment_;
+};
+
+#endif // SHARED_COLUMN_STORE_HPP_